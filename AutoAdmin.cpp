@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoAdmin.cpp
+    Size class allocation
+ */
+
+#include "AutoAdmin.h"
+#include "AutoRecorder.h"
+#include "AutoZone.h"
+
+#include <stdio.h>
+
+namespace Auto {
+
+    void Admin::initialize(Zone *zone, usword_t size_class) {
+        _zone = zone;
+        _size_class = size_class;
+        _block_size = size_class_size(size_class);
+        _lock.value = 0;
+        _free_list = NULL;
+        _subzones = NULL;
+        _sweep_cursor = NULL;
+        _blocks_in_use = 0;
+    }
+
+
+    usword_t Admin::claim(void **results, usword_t n) {
+        usword_t count = 0;
+        while (count < n) {
+            // garbage is reused before more memory is.
+            if (!_free_list) sweep_until_free();
+            Subzone *subzone = _free_list;
+            if (!subzone) {
+                subzone = _zone->allocate_subzone();
+                if (!subzone) break;
+                subzone->initialize(this, _block_size, _zone->sweep_epoch());
+                subzone->set_admin_next(_subzones);
+                _subzones = subzone;
+                subzone->set_on_free_list(true);
+                _free_list = subzone;
+            } else if (_zone->needs_sweep(subzone)) {
+                sweep(subzone);
+            }
+            count += subzone->claim_blocks(results + count, n - count);
+            if (subzone->is_full()) {
+                _free_list = subzone->next();
+                subzone->set_next(NULL);
+                subzone->set_on_free_list(false);
+            }
+        }
+        return count;
+    }
+
+
+    void *Admin::allocate(auto_memory_type_t layout, usword_t refcount, bool clear) {
+        void *block;
+        {
+            SpinLock lock(&_lock);
+            if (!claim(&block, 1)) return NULL;
+            _blocks_in_use++;
+        }
+        _zone->report_growth();
+        Subzone *subzone = Subzone::subzone(block);
+        usword_t index = subzone->block_index(block);
+        // the mark must be visible before the block looks allocated to a sweep.
+        if (_zone->allocates_marked(subzone)) {
+            subzone->test_set_mark(index);
+            if (__builtin_expect(_zone->is_noting_candidates(), 0)) subzone->set_uncounted();
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+        }
+        subzone->allocate_block(index, layout, refcount);
+        if (clear) bzero(block, _block_size);
+        return block;
+    }
+
+
+    void Admin::unclaim(Subzone *subzone, usword_t index) {
+        subzone->unclaim_block(index);
+        if (subzone->is_empty()) subzone->set_empty_since(auto_date_now());
+        if (!subzone->on_free_list()) {
+            subzone->set_next(_free_list);
+            subzone->set_on_free_list(true);
+            _free_list = subzone;
+        }
+    }
+
+
+    void Admin::deallocate(void *block) {
+        Subzone *subzone = Subzone::subzone(block);
+        usword_t index = subzone->block_index(block);
+        subzone->deallocate_block(index);
+        SpinLock lock(&_lock);
+        unclaim(subzone, index);
+        _blocks_in_use--;
+    }
+
+
+    usword_t Admin::claim_blocks(void **results, usword_t n) {
+        usword_t count;
+        {
+            SpinLock lock(&_lock);
+            count = claim(results, n);
+        }
+        _zone->report_growth();
+        return count;
+    }
+
+
+    void Admin::unclaim_blocks(void *list) {
+        SpinLock lock(&_lock);
+        while (list) {
+            void *next = *(void **)list;
+            Subzone *subzone = Subzone::subzone(list);
+            unclaim(subzone, subzone->block_index(list));
+            list = next;
+        }
+    }
+
+
+    void Admin::sweep(Subzone *subzone) {
+        bool generational = _zone->sweep_generational();
+        Bitmap &allocated = subzone->allocated_bitmap();
+        Bitmap &marks = subzone->mark_bitmap();
+        usword_t freed = 0;
+        for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+            usword_t live = allocated.word(w);
+            // blocks allocated or published since the collection are marked first.
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            usword_t survivors = live & marks.word(w);
+            usword_t garbage = live & ~survivors;
+            while (survivors) {
+                subzone->mature((w << bits_per_word_log2) + __builtin_ctzl(survivors));
+                survivors &= survivors - 1;
+            }
+            while (garbage) {
+                usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(garbage);
+                garbage &= garbage - 1;
+                if (generational && !subzone->is_young(index)) continue;
+                if (subzone->is_local(index)) continue;
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (subzone->is_marked(index)) continue;
+                subzone->deallocate_block(index);
+                unclaim(subzone, index);
+                freed++;
+            }
+        }
+        // allocations that still saw the subzone pending marked their blocks, so they survive.
+        subzone->set_swept_epoch(_zone->sweep_epoch());
+        _blocks_in_use -= freed;
+        _zone->note_swept(freed, freed * _block_size);
+    }
+
+
+    void Admin::sweep_until_free() {
+        while (_sweep_cursor && !_free_list) {
+            Subzone *subzone = _sweep_cursor;
+            _sweep_cursor = subzone->admin_next();
+            if (_zone->needs_sweep(subzone)) sweep(subzone);
+        }
+    }
+
+
+    void Admin::reset_sweep_cursor() {
+        SpinLock lock(&_lock);
+        _sweep_cursor = _subzones;
+    }
+
+
+    bool Admin::sweep_next() {
+        SpinLock lock(&_lock);
+        while (_sweep_cursor) {
+            Subzone *subzone = _sweep_cursor;
+            _sweep_cursor = subzone->admin_next();
+            if (_zone->needs_sweep(subzone)) {
+                sweep(subzone);
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    void *Admin::move_block(void *block) {
+        void *copy = NULL;
+        for (Subzone *subzone = _free_list; subzone && !copy; subzone = subzone->next()) {
+            if (!subzone->forwarding()) subzone->claim_blocks(&copy, 1);
+        }
+        if (!copy) return NULL;
+        Subzone *from = Subzone::subzone(block), *to = Subzone::subzone(copy);
+        usword_t index = from->block_index(block), to_index = to->block_index(copy);
+        memcpy(copy, block, _block_size);
+        // age, finalization state and layout travel with the block.
+        to->allocate_block(to_index, from->layout(index), 0);
+        to->set_side_data(to_index, from->side_data(index));
+        if (from->has_weak_locations(index)) to->set_weak_locations(to_index);
+        to->mark_cards(copy, _block_size);
+        from->deallocate_block(index);
+        unclaim(from, index);
+        if (is_recording(_zone)) record_move(block, copy);
+        return copy;
+    }
+
+
+    usword_t Admin::purge_empty(uint64_t now, uint64_t decay, uint64_t &next) {
+        usword_t purged = 0;
+        // subzones are never removed from the list, so it can be walked a lock hold at a time.
+        for (Subzone *subzone = _subzones; subzone; subzone = subzone->admin_next()) {
+            // the header and side tables stay; block contents of an empty subzone are dead.
+            usword_t start = align_up((usword_t)subzone->first_block(), page_size), end = align_down((usword_t)subzone->limit(), page_size);
+            {
+                SpinLock lock(&_lock);
+                uint64_t since = subzone->empty_since();
+                if (!since || !decay_due(since, now, decay, next)) continue;
+                uncommit_memory((void *)start, end - start);
+                subzone->set_empty_since(0);
+            }
+            purged += end - start;
+            if (_zone->control()->log & AUTO_LOG_REGIONS) _zone->log_regions("purged subzone", subzone, subzone_quantum);
+        }
+        return purged;
+    }
+
+
+    bool Admin::check() {
+        SpinLock lock(&_lock);
+        usword_t on_free_list = 0, free_list_length = 0;
+        for (Subzone *subzone = _subzones; subzone; subzone = subzone->admin_next()) {
+            const char *problem = NULL;
+            Bitmap &claimed = subzone->claimed_bitmap(), &allocated = subzone->allocated_bitmap();
+            usword_t claimed_count = 0;
+            for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words && !problem; w++) {
+                // allocated bits are set outside the lock, but only on claimed blocks.
+                usword_t live = allocated.word(w);
+                if (live & ~claimed.word(w)) problem = "allocated blocks that are not claimed";
+                claimed_count += __builtin_popcountl(claimed.word(w));
+            }
+            if (subzone->admin() != this || subzone->block_size() != _block_size) problem = "belongs to another size class";
+            else if (!problem && claimed_count != subzone->claimed_count()) problem = "claimed count disagrees with its bitmap";
+            else if (!problem && !subzone->is_full() && !subzone->on_free_list()) problem = "has unclaimed blocks but is not on the free list";
+            if (problem) {
+                fprintf(stderr, "auto zone %s: subzone %p of size %lu %s\n", _zone->name(), subzone, (unsigned long)_block_size, problem);
+                return false;
+            }
+            if (subzone->on_free_list()) on_free_list++;
+        }
+        for (Subzone *subzone = _free_list; subzone && free_list_length <= on_free_list; subzone = subzone->next()) free_list_length++;
+        if (free_list_length != on_free_list) {
+            fprintf(stderr, "auto zone %s: free list of size %lu holds %lu subzones, %lu are marked on it\n", _zone->name(), (unsigned long)_block_size,
+                    (unsigned long)free_list_length, (unsigned long)on_free_list);
+            return false;
+        }
+        return true;
+    }
+
+};
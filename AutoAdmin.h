@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoAdmin.h
+    Size class allocation
+ */
+
+#ifndef __AUTO_ADMIN__
+#define __AUTO_ADMIN__
+
+#include "AutoDefs.h"
+#include "AutoSubzone.h"
+
+namespace Auto {
+
+    class Zone;
+
+    //
+    // Size classes
+    //
+    // Blocks up to 256 bytes are rounded to the allocation quantum.  Above that each power of two is
+    // split into four classes, up to maximum_small_size, which keeps internal fragmentation under 25%.
+    //
+    enum {
+        linear_size_class_limit = 256,
+        linear_size_class_count = linear_size_class_limit >> allocate_quantum_log2,
+        size_class_count        = linear_size_class_count + 4 * (15 - 8),   // 256 < size <= 32768
+    };
+
+    inline usword_t size_class(usword_t size) {
+        if (size <= linear_size_class_limit) return size ? (size - 1) >> allocate_quantum_log2 : 0;
+        usword_t lg = ilog2(size - 1);
+        return linear_size_class_count + ((lg - 8) << 2) + (((size - 1) >> (lg - 2)) & 3);
+    }
+
+    inline usword_t size_class_size(usword_t sc) {
+        if (sc < linear_size_class_count) return (sc + 1) << allocate_quantum_log2;
+        usword_t j = sc - linear_size_class_count, lg = 8 + (j >> 2);
+        return ((usword_t)1 << lg) + ((j & 3) + 1) * ((usword_t)1 << (lg - 2));
+    }
+
+
+    //
+    // Admin
+    //
+    // Allocator for one size class.  Owns the subzones of that class which still have unclaimed blocks.
+    //
+    class Admin {
+
+      private:
+        Zone            *_zone;
+        usword_t        _size_class;
+        usword_t        _block_size;
+        spin_lock_t     _lock;                              // protects claiming and the free list
+        Subzone         *_free_list;                        // subzones with unclaimed blocks
+        Subzone         *_subzones;                         // every subzone of the class, newest first
+        Subzone         *_sweep_cursor;                     // next subzone to look at for sweeping
+        usword_t        _blocks_in_use;                     // statistics, protected by _lock; excludes thread cache allocations
+
+        //
+        // claim
+        //
+        // Claims up to n blocks, adding subzones as needed.  Caller holds _lock.
+        //
+        usword_t claim(void **results, usword_t n);
+
+        //
+        // unclaim
+        //
+        // Return a claimed block, putting its subzone back on the free list.  Caller holds _lock.
+        //
+        void unclaim(Subzone *subzone, usword_t index);
+
+        //
+        // sweep
+        //
+        // Free the garbage the last collection left in a subzone and age its survivors.  Caller holds
+        // _lock.
+        //
+        void sweep(Subzone *subzone);
+
+        //
+        // sweep_until_free
+        //
+        // Sweep subzones from the cursor on until one has unclaimed blocks.  Caller holds _lock.
+        //
+        void sweep_until_free();
+
+      public:
+
+        void initialize(Zone *zone, usword_t size_class);
+
+        //
+        // Accessors
+        //
+        inline Zone *zone() const { return _zone; }
+        inline usword_t size_class() const { return _size_class; }
+        inline usword_t block_size() const { return _block_size; }
+        inline spin_lock_t *lock() { return &_lock; }
+        inline usword_t blocks_in_use() const { return _blocks_in_use; }
+
+        //
+        // allocate
+        //
+        // Allocate a single block with the given layout and refcount.  Returns NULL if out of memory.
+        //
+        void *allocate(auto_memory_type_t layout, usword_t refcount, bool clear);
+
+        //
+        // deallocate
+        //
+        // Immediately return a live block to the free pool.
+        //
+        void deallocate(void *block);
+
+        //
+        // claim_blocks
+        //
+        // Claim up to n blocks for an allocation cache.  Returns the number claimed.
+        //
+        usword_t claim_blocks(void **results, usword_t n);
+
+        //
+        // unclaim_blocks
+        //
+        // Return a list of claimed, unallocated blocks threaded through their first word.
+        //
+        void unclaim_blocks(void *list);
+
+        //
+        // Lazy sweeping
+        //
+        // Garbage in subzones is freed when the admin next needs blocks, by the background sweeper,
+        // or at the latest before the next collection.  reset_sweep_cursor() starts a new pass once
+        // the zone enables sweeping; sweep_next() sweeps one subzone, returning false when the pass is
+        // over.
+        //
+        void reset_sweep_cursor();
+        bool sweep_next();
+
+        //
+        // Compaction
+        //
+        // The compactor holds every admin's lock while the world is stopped.  move_block() copies a
+        // block into an unclaimed block of a subzone not being evacuated and frees the original,
+        // returning the copy, or NULL if no other subzone has room.
+        //
+        inline Subzone *subzones() const { return _subzones; }
+        void *move_block(void *block);
+
+        //
+        // purge_empty
+        //
+        // Return the block pages of subzones empty for at least decay microseconds to the system; they
+        // stay with this admin to be claimed again.  Lowers next to when the next empty subzone decays.
+        // Returns the number of bytes purged.
+        //
+        usword_t purge_empty(uint64_t now, uint64_t decay, uint64_t &next);
+
+        //
+        // check
+        //
+        // Verify the claimed and allocated bitmaps and the free list of every subzone, reporting the
+        // first inconsistency found to stderr.  Returns false if there was one.
+        //
+        bool check();
+    };
+
+};
+
+#endif // __AUTO_ADMIN__
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoAssociations.cpp
+    Associative references
+ */
+
+#include "AutoAssociations.h"
+#include "AutoCollector.h"
+#include "AutoCompactor.h"
+#include "AutoZone.h"
+
+namespace Auto {
+
+    //----- ObjectAssociations -----//
+
+    void ObjectAssociations::destroy() {
+        if (spilled) {
+            table->~PointerHashMap<void *>();
+            aux_free(table);
+        }
+    }
+
+
+    void *ObjectAssociations::get(const void *key) const {
+        if (spilled) {
+            void **value = table->find(key);
+            return value ? *value : NULL;
+        }
+        for (usword_t i = 0; i < count; i++) {
+            if (inline_associations[i].key == key) return inline_associations[i].value;
+        }
+        return NULL;
+    }
+
+
+    int ObjectAssociations::set(const void *key, void *value) {
+        if (spilled) {
+            if (!value) {
+                if (!table->remove(key)) return 0;
+                count--;
+                return -1;
+            }
+            bool added = table->find(key) == NULL;
+            table->insert(key, value);
+            if (!added) return 0;
+            count++;
+            return 1;
+        }
+
+        for (usword_t i = 0; i < count; i++) {
+            if (inline_associations[i].key != key) continue;
+            if (value) {
+                inline_associations[i].value = value;
+                return 0;
+            }
+            inline_associations[i] = inline_associations[--count];
+            return -1;
+        }
+        if (!value) return 0;
+        if (count < inline_capacity) {
+            inline_associations[count].key = key;
+            inline_associations[count].value = value;
+            count++;
+            return 1;
+        }
+
+        // full; move everything to a table.
+        PointerHashMap<void *> *spill = new (aux_malloc(sizeof(PointerHashMap<void *>))) PointerHashMap<void *>();
+        for (usword_t i = 0; i < count; i++) spill->insert(inline_associations[i].key, inline_associations[i].value);
+        spill->insert(key, value);
+        table = spill;
+        spilled = true;
+        count++;
+        return 1;
+    }
+
+
+    void ObjectAssociations::visit(visitor_t visitor, void *context) const {
+        if (spilled) {
+            for (usword_t i = 0; i < table->capacity(); i++) {
+                PointerHashMap<void *>::Entry &entry = table->entries()[i];
+                if (entry.key) visitor(entry.key, entry.value, context);
+            }
+            return;
+        }
+        for (usword_t i = 0; i < count; i++) visitor(inline_associations[i].key, inline_associations[i].value, context);
+    }
+
+
+    //----- AssociationTable -----//
+
+    AssociationTable::AssociationTable() : _object_count(0) {
+        for (usword_t i = 0; i < stripe_count; i++) _stripes[i].lock.value = 0;
+        for (usword_t i = 0; i < key_shard_count; i++) _key_shards[i].lock.value = 0;
+    }
+
+
+    void AssociationTable::add_key(const void *key, void *object) {
+        KeyShard &shard = _key_shards[key_shard_index(key)];
+        SpinLock lock(&shard.lock);
+        PointerHashMap<bool> **objects = shard.keys.find(key);
+        if (!objects) {
+            shard.keys.insert(key, new (aux_malloc(sizeof(PointerHashMap<bool>))) PointerHashMap<bool>());
+            objects = shard.keys.find(key);
+        }
+        (*objects)->insert(object, true);
+    }
+
+
+    void AssociationTable::remove_key(const void *key, void *object) {
+        KeyShard &shard = _key_shards[key_shard_index(key)];
+        SpinLock lock(&shard.lock);
+        PointerHashMap<bool> **objects = shard.keys.find(key);
+        if (!objects) return;
+        (*objects)->remove(object);
+        if ((*objects)->count()) return;
+        PointerHashMap<bool> *empty = *objects;
+        shard.keys.remove(key);
+        empty->~PointerHashMap<bool>();
+        aux_free(empty);
+    }
+
+
+    void AssociationTable::remove_object(Stripe &stripe, void *object) {
+        ObjectAssociations *associations = stripe.objects.find(object);
+        associations->destroy();
+        stripe.objects.remove(object);
+        __atomic_sub_fetch(&_object_count, 1, __ATOMIC_RELAXED);
+    }
+
+
+    void AssociationTable::set(Zone *zone, void *object, const void *key, void *value) {
+        // thread local collections know nothing of associations.
+        zone->publish(object);
+        zone->publish(value);
+
+        Stripe &stripe = _stripes[stripe_index(object)];
+        SpinLock lock(&stripe.lock);
+        ObjectAssociations *associations = stripe.objects.find(object);
+        if (!associations) {
+            if (!value) return;
+            ObjectAssociations empty;
+            bzero(&empty, sizeof(empty));
+            stripe.objects.insert(object, empty);
+            associations = stripe.objects.find(object);
+            __atomic_add_fetch(&_object_count, 1, __ATOMIC_RELAXED);
+        }
+        int change = associations->set(key, value);
+        if (change > 0) {
+            add_key(key, object);
+        } else if (change < 0) {
+            remove_key(key, object);
+            if (!associations->count && !associations->hash) remove_object(stripe, object);
+        }
+    }
+
+
+    void *AssociationTable::get(void *object, const void *key) {
+        Stripe &stripe = _stripes[stripe_index(object)];
+        SpinLock lock(&stripe.lock);
+        ObjectAssociations *associations = stripe.objects.find(object);
+        return associations ? associations->get(key) : NULL;
+    }
+
+
+    void AssociationTable::erase(void *object) {
+        Stripe &stripe = _stripes[stripe_index(object)];
+        SpinLock lock(&stripe.lock);
+        ObjectAssociations *associations = stripe.objects.find(object);
+        if (!associations) return;
+        if (associations->spilled) {
+            PointerHashMap<void *> *table = associations->table;
+            for (usword_t i = 0; i < table->capacity(); i++) {
+                const void *key = table->entries()[i].key;
+                if (key) remove_key(key, object);
+            }
+        } else {
+            for (usword_t i = 0; i < associations->count; i++) remove_key(associations->inline_associations[i].key, object);
+        }
+        remove_object(stripe, object);
+    }
+
+
+    usword_t AssociationTable::hash(void *object) {
+        Stripe &stripe = _stripes[stripe_index(object)];
+        SpinLock lock(&stripe.lock);
+        ObjectAssociations *associations = stripe.objects.find(object);
+        if (!associations) {
+            ObjectAssociations empty;
+            bzero(&empty, sizeof(empty));
+            stripe.objects.insert(object, empty);
+            associations = stripe.objects.find(object);
+            __atomic_add_fetch(&_object_count, 1, __ATOMIC_RELAXED);
+        }
+        // the address the object had when first asked, kept should it move.
+        if (!associations->hash) associations->hash = (usword_t)object;
+        return associations->hash;
+    }
+
+
+#ifdef __BLOCKS__
+    void AssociationTable::enumerate(const void *key, boolean_t (^block) (void *object, void *value)) {
+        // snapshot the objects having key; the block runs with no locks held.
+        VMArray<void *> objects;
+        {
+            KeyShard &shard = _key_shards[key_shard_index(key)];
+            SpinLock lock(&shard.lock);
+            PointerHashMap<bool> **having = shard.keys.find(key);
+            if (!having) return;
+            for (usword_t i = 0; i < (*having)->capacity(); i++) {
+                const void *object = (*having)->entries()[i].key;
+                if (object) objects.push((void *)object);
+            }
+        }
+        for (usword_t i = 0; i < objects.count(); i++) {
+            void *value = get(objects[i], key);
+            if (value && !block(objects[i], value)) break;
+        }
+    }
+#endif
+
+
+    void AssociationTable::lock_all() {
+        for (usword_t i = 0; i < stripe_count; i++) spin_lock(&_stripes[i].lock);
+    }
+
+
+    void AssociationTable::unlock_all() {
+        for (usword_t i = stripe_count; i--; ) spin_unlock(&_stripes[i].lock);
+    }
+
+
+    struct GatherContext {
+        Collector           *collector;
+        VMArray<void *>     *values;
+    };
+
+
+    static void gather_value(const void *key, void *value, void *context) {
+        GatherContext *gather = (GatherContext *)context;
+        if (gather->collector->is_garbage(value)) gather->values->push(value);
+    }
+
+
+    void AssociationTable::gather_values(Collector &collector, VMArray<void *> &values) {
+        GatherContext context = { &collector, &values };
+        for (usword_t s = 0; s < stripe_count; s++) {
+            PointerHashMap<ObjectAssociations> &objects = _stripes[s].objects;
+            for (usword_t i = 0; i < objects.capacity(); i++) {
+                PointerHashMap<ObjectAssociations>::Entry &entry = objects.entries()[i];
+                if (entry.key && !collector.is_garbage((void *)entry.key)) entry.value.visit(gather_value, &context);
+            }
+        }
+    }
+
+
+    void AssociationTable::erase_dying(Zone *zone, bool generational) {
+        if (is_empty()) return;
+        for (usword_t s = 0; s < stripe_count; s++) {
+            Stripe &stripe = _stripes[s];
+            SpinLock lock(&stripe.lock);
+            PointerHashMap<ObjectAssociations> &objects = stripe.objects;
+            for (usword_t i = 0; i < objects.capacity(); ) {
+                const void *object = objects.entries()[i].key;
+                if (object && zone->is_dying(object, generational)) {
+                    // removal shifts a later entry into slot i; look at it again.
+                    remove_object(stripe, (void *)object);
+                    continue;
+                }
+                i++;
+            }
+        }
+
+        // then the dead objects' entries in the key index, a shard at a time.
+        for (usword_t s = 0; s < key_shard_count; s++) {
+            KeyShard &shard = _key_shards[s];
+            SpinLock lock(&shard.lock);
+            PointerHashMap<PointerHashMap<bool> *> &keys = shard.keys;
+            for (usword_t k = 0; k < keys.capacity(); ) {
+                PointerHashMap<PointerHashMap<bool> *>::Entry &entry = keys.entries()[k];
+                if (!entry.key) {
+                    k++;
+                    continue;
+                }
+                PointerHashMap<bool> *having = entry.value;
+                for (usword_t i = 0; i < having->capacity(); ) {
+                    const void *object = having->entries()[i].key;
+                    if (object && zone->is_dying(object, generational)) {
+                        having->remove(object);
+                        continue;
+                    }
+                    i++;
+                }
+                if (having->count()) {
+                    k++;
+                    continue;
+                }
+                keys.remove(entry.key);
+                having->~PointerHashMap<bool>();
+                aux_free(having);
+            }
+        }
+    }
+
+
+
+    void AssociationTable::relocate(Compactor &compactor) {
+        if (is_empty()) return;
+
+        // gather the moved objects first; inserting while iterating could grow the map being walked.
+        PointerHashMap<ObjectAssociations> moved;
+        for (usword_t s = 0; s < stripe_count; s++) {
+            PointerHashMap<ObjectAssociations> &objects = _stripes[s].objects;
+            for (usword_t i = 0; i < objects.capacity(); ) {
+                PointerHashMap<ObjectAssociations>::Entry &entry = objects.entries()[i];
+                if (!entry.key) {
+                    i++;
+                    continue;
+                }
+                ObjectAssociations &associations = entry.value;
+                if (associations.spilled) {
+                    PointerHashMap<void *> *table = associations.table;
+                    for (usword_t j = 0; j < table->capacity(); j++) {
+                        if (table->entries()[j].key) table->entries()[j].value = compactor.relocated(table->entries()[j].value);
+                    }
+                } else {
+                    for (usword_t j = 0; j < associations.count; j++) {
+                        associations.inline_associations[j].value = compactor.relocated(associations.inline_associations[j].value);
+                    }
+                }
+                void *object = compactor.relocated(entry.key);
+                if (object == entry.key) {
+                    i++;
+                    continue;
+                }
+                // the hash stays what it was.
+                moved.insert(object, associations);
+                objects.remove(entry.key);
+            }
+        }
+        for (usword_t i = 0; i < moved.capacity(); i++) {
+            PointerHashMap<ObjectAssociations>::Entry &entry = moved.entries()[i];
+            if (entry.key) _stripes[stripe_index(entry.key)].objects.insert(entry.key, entry.value);
+        }
+        if (!moved.count()) return;
+
+        // then the objects listed in the key index.
+        PointerHashMap<bool> renamed;
+        for (usword_t s = 0; s < key_shard_count; s++) {
+            KeyShard &shard = _key_shards[s];
+            SpinLock lock(&shard.lock);
+            PointerHashMap<PointerHashMap<bool> *> &keys = shard.keys;
+            for (usword_t k = 0; k < keys.capacity(); k++) {
+                PointerHashMap<bool> *having = keys.entries()[k].value;
+                if (!keys.entries()[k].key) continue;
+                renamed.clear();
+                for (usword_t i = 0; i < having->capacity(); ) {
+                    const void *object = having->entries()[i].key;
+                    void *relocated = object ? compactor.relocated(object) : NULL;
+                    if (relocated == object) {
+                        i++;
+                        continue;
+                    }
+                    renamed.insert(relocated, true);
+                    having->remove(object);
+                }
+                for (usword_t i = 0; i < renamed.capacity(); i++) {
+                    const void *object = renamed.entries()[i].key;
+                    if (object) having->insert(object, true);
+                }
+            }
+        }
+    }
+
+
+    struct VisitContext {
+        AssociationTable::visitor_t visitor;
+        const void          *object;
+        void                *context;
+    };
+
+
+    static void visit_association(const void *key, void *value, void *context) {
+        VisitContext *visit = (VisitContext *)context;
+        visit->visitor(visit->object, key, value, visit->context);
+    }
+
+
+    void AssociationTable::visit(visitor_t visitor, void *context) {
+        VisitContext visit = { visitor, NULL, context };
+        for (usword_t s = 0; s < stripe_count; s++) {
+            PointerHashMap<ObjectAssociations> &objects = _stripes[s].objects;
+            for (usword_t i = 0; i < objects.capacity(); i++) {
+                PointerHashMap<ObjectAssociations>::Entry &entry = objects.entries()[i];
+                if (!entry.key) continue;
+                visit.object = entry.key;
+                entry.value.visit(visit_association, &visit);
+            }
+        }
+    }
+
+};
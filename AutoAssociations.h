@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoAssociations.h
+    Associative references
+ */
+
+#ifndef __AUTO_ASSOCIATIONS__
+#define __AUTO_ASSOCIATIONS__
+
+#include "AutoDefs.h"
+#include "AutoHashTable.h"
+#include "auto_zone.h"
+
+namespace Auto {
+
+    class Collector;
+    class Compactor;
+    class Zone;
+    template <typename T> class VMArray;
+
+    //
+    // Association
+    //
+    struct Association {
+        const void      *key;
+        void            *value;
+    };
+
+
+    //
+    // ObjectAssociations
+    //
+    // The associations of one object: a few kept inline, more in a hash table of their own.  Copied by
+    // value when its table rehashes.
+    //
+    struct ObjectAssociations {
+        enum { inline_capacity = 4 };
+
+        usword_t        count;
+        usword_t        hash;                               // associative hash once asked for, else 0
+        bool            spilled;                            // associations live in table
+        union {
+            Association inline_associations[inline_capacity];
+            PointerHashMap<void *> *table;
+        };
+
+        void destroy();
+
+        //
+        // get
+        //
+        // Returns the value for key, or NULL.
+        //
+        void *get(const void *key) const;
+
+        //
+        // set
+        //
+        // Set or, with a NULL value, remove the value for key.  Returns +1 if key was added, -1 if it
+        // was removed and 0 otherwise.
+        //
+        int set(const void *key, void *value);
+
+        //
+        // Iteration
+        //
+        // Calls visitor(key, value, context) for each association.
+        //
+        typedef void (*visitor_t)(const void *key, void *value, void *context);
+        void visit(visitor_t visitor, void *context) const;
+    };
+
+
+    //
+    // AssociationTable
+    //
+    // Object -> associations, striped by object address, plus key -> objects so that the objects with
+    // a given key are found without looking at every object.  A stripe lock is taken before a key
+    // shard lock.
+    //
+    class AssociationTable {
+        enum {
+            stripe_count_log2 = 5,
+            stripe_count = 1 << stripe_count_log2,
+            key_shard_count_log2 = 4,
+            key_shard_count = 1 << key_shard_count_log2,
+        };
+
+        struct Stripe {
+            spin_lock_t                         lock;
+            PointerHashMap<ObjectAssociations>  objects;
+            char                                padding[64];
+        };
+
+        struct KeyShard {
+            spin_lock_t                         lock;
+            PointerHashMap<PointerHashMap<bool> *> keys;    // key -> objects having it
+            char                                padding[64];
+        };
+
+        Stripe          _stripes[stripe_count];
+        KeyShard        _key_shards[key_shard_count];
+        usword_t        _object_count;                      // objects with associations or a hash
+
+        static inline usword_t stripe_index(const void *object) { return pointer_hash(object) >> (bits_per_word - stripe_count_log2); }
+        static inline usword_t key_shard_index(const void *key) { return pointer_hash(key) >> (bits_per_word - key_shard_count_log2); }
+
+        void add_key(const void *key, void *object);
+        void remove_key(const void *key, void *object);
+        void remove_object(Stripe &stripe, void *object);
+
+      public:
+
+        AssociationTable();
+
+        inline bool is_empty() const { return __atomic_load_n(&_object_count, __ATOMIC_RELAXED) == 0; }
+
+        //
+        // Associative references
+        //
+        void set(Zone *zone, void *object, const void *key, void *value);
+        void *get(void *object, const void *key);
+        void erase(void *object);
+        usword_t hash(void *object);
+#ifdef __BLOCKS__
+        void enumerate(const void *key, boolean_t (^block) (void *object, void *value));
+#endif
+
+        //
+        // Collector access
+        //
+        // lock_all() and unlock_all() bracket the world being stopped.  With the locks held,
+        // gather_values() collects the unmarked values of objects the collection keeps.  Once the world
+        // runs again, erase_dying() drops the associations of all the garbage at once.
+        //
+        void lock_all();
+        void unlock_all();
+        void gather_values(Collector &collector, VMArray<void *> &values);
+        void erase_dying(Zone *zone, bool generational);
+
+        //
+        // relocate
+        //
+        // After compaction, with the stripe locks still held, rekey moved objects and repoint values
+        // that moved.  Keys are opaque and stay as they are.
+        //
+        void relocate(Compactor &compactor);
+
+        //
+        // visit
+        //
+        // Calls visitor(object, key, value, context) for each association.  Called with the stripe locks
+        // held.
+        //
+        typedef void (*visitor_t)(const void *object, const void *key, void *value, void *context);
+        void visit(visitor_t visitor, void *context);
+    };
+
+};
+
+#endif // __AUTO_ASSOCIATIONS__
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoBitmap.h
+    Word array bit operations
+ */
+
+#ifndef __AUTO_BITMAP__
+#define __AUTO_BITMAP__
+
+#include "AutoDefs.h"
+
+namespace Auto {
+
+    //
+    // Bitmap
+    //
+    // Thin wrapper over an externally owned array of words, one bit per element.  The plain
+    // operations are for use under a lock; the atomic ones may race with each other.
+    //
+    class Bitmap {
+        usword_t *_bits;
+
+      public:
+        Bitmap() : _bits(NULL) {}
+        Bitmap(usword_t *bits) : _bits(bits) {}
+
+        static inline usword_t words_for_bits(usword_t n) { return (n + bits_per_word - 1) >> bits_per_word_log2; }
+        static inline usword_t word_index(usword_t i) { return i >> bits_per_word_log2; }
+        static inline usword_t bit_mask(usword_t i) { return (usword_t)1 << (i & (bits_per_word - 1)); }
+
+        inline usword_t *address() const { return _bits; }
+        inline usword_t word(usword_t w) const { return _bits[w]; }
+
+        inline bool test(usword_t i) const { return (_bits[word_index(i)] & bit_mask(i)) != 0; }
+        inline void set(usword_t i) { _bits[word_index(i)] |= bit_mask(i); }
+        inline void clear(usword_t i) { _bits[word_index(i)] &= ~bit_mask(i); }
+
+        //
+        // test_set_atomic
+        //
+        // Sets bit i, returning true if this call changed it.  test_clear_atomic() is the converse.
+        //
+        inline bool test_set_atomic(usword_t i) {
+            usword_t mask = bit_mask(i);
+            usword_t *word = _bits + word_index(i);
+            if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) return false;
+            return (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) == 0;
+        }
+        inline bool test_clear_atomic(usword_t i) {
+            usword_t mask = bit_mask(i);
+            usword_t *word = _bits + word_index(i);
+            if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & mask)) return false;
+            return (__atomic_fetch_and(word, ~mask, __ATOMIC_RELAXED) & mask) != 0;
+        }
+        inline void set_atomic(usword_t i) { __atomic_fetch_or(_bits + word_index(i), bit_mask(i), __ATOMIC_RELAXED); }
+        inline void clear_atomic(usword_t i) { __atomic_fetch_and(_bits + word_index(i), ~bit_mask(i), __ATOMIC_RELAXED); }
+
+        //
+        // set_range_atomic
+        //
+        // Sets bits [i, i + n) a word at a time.
+        //
+        inline void set_range_atomic(usword_t i, usword_t n) {
+            while (n) {
+                usword_t shift = i & (bits_per_word - 1);
+                usword_t span = bits_per_word - shift < n ? bits_per_word - shift : n;
+                usword_t mask = (span == bits_per_word ? ~(usword_t)0 : (((usword_t)1 << span) - 1)) << shift;
+                __atomic_fetch_or(_bits + word_index(i), mask, __ATOMIC_RELAXED);
+                i += span;
+                n -= span;
+            }
+        }
+
+        inline void clear_all(usword_t n) { bzero(_bits, words_for_bits(n) * sizeof(usword_t)); }
+
+        //
+        // find_clear
+        //
+        // Returns the index of the first clear bit at or after 'from' and below 'n', or n if none.
+        //
+        inline usword_t find_clear(usword_t from, usword_t n) const {
+            usword_t nwords = words_for_bits(n);
+            for (usword_t w = word_index(from); w < nwords; w++) {
+                usword_t bits = ~_bits[w];
+                if (w == word_index(from)) bits &= ~(bit_mask(from) - 1);
+                if (bits) {
+                    usword_t i = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                    return i < n ? i : n;
+                }
+            }
+            return n;
+        }
+
+        //
+        // find_set
+        //
+        // Returns the index of the first set bit at or after 'from' and below 'n', or n if none.
+        //
+        inline usword_t find_set(usword_t from, usword_t n) const {
+            usword_t nwords = words_for_bits(n);
+            for (usword_t w = word_index(from); w < nwords; w++) {
+                usword_t bits = _bits[w];
+                if (w == word_index(from)) bits &= ~(bit_mask(from) - 1);
+                if (bits) {
+                    usword_t i = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                    return i < n ? i : n;
+                }
+            }
+            return n;
+        }
+    };
+
+};
+
+#endif // __AUTO_BITMAP__
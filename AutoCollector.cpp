@@ -0,0 +1,985 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoCollector.cpp
+    Stop the world, parallel marking collector
+ */
+
+#include "AutoCollector.h"
+#include "AutoLayout.h"
+#include "AutoRecorder.h"
+#include "AutoScan.h"
+#include "AutoTrace.h"
+#include "AutoZone.h"
+
+#include <setjmp.h>
+
+namespace Auto {
+
+    enum {
+        scan_chunk_size = 64 * 1024,                        // granularity of shared scanning work
+        finalize_chunk_count = 256,                         // garbage objects handed to batch_invalidate at once
+    };
+
+
+    //----- Marker -----//
+
+    void Marker::initialize(Collector *collector, usword_t index) {
+        _collector = collector;
+        _index = index;
+        _deque.initialize();
+        _blocks_marked = 0;
+        _bytes_scanned = 0;
+        _counting = false;
+        _inline_depth = 0;
+        bzero(_layout_isas, sizeof(_layout_isas));
+    }
+
+
+    void Marker::push_block(void *address, usword_t size, auto_memory_type_t layout) {
+        usword_t tag = is_exactly_scanned(layout) ? Range::object_tag : 0;
+        // split big blocks so that idle markers can share them.
+        for (usword_t offset = 0; offset < size; offset += scan_chunk_size) {
+            Range range = { displace(address, offset + tag), displace(address, offset + scan_chunk_size < size ? offset + scan_chunk_size : size) };
+            if (_deque.push(range) || _collector->overflow(range)) continue;
+            if (_inline_depth < inline_scan_depth) {
+                _inline_depth++;
+                scan_queued(range);
+                _inline_depth--;
+            } else if (!_collector->is_condemning()) {
+                // the block is marked but not scanned.  (What condemnation leaves alone stays marked,
+                // which is safe.)
+                _collector->set_mark_overflowed();
+            }
+        }
+    }
+
+
+    void Marker::rescan(Subzone *subzone) {
+        _counting = _collector->is_exhaustive();
+        usword_t size = subzone->block_size();
+        for (usword_t i = 0, count = subzone->block_count(); i < count; i++) {
+            if (!subzone->is_marked(i) || !subzone->is_allocated(i)) continue;
+            auto_memory_type_t layout = subzone->layout(i);
+            if (layout & AUTO_UNSCANNED) continue;
+            void *block = subzone->block_address(i);
+            scan_block_range(block, size, layout, subzone, NULL, block, displace(block, size));
+        }
+    }
+
+
+    void Marker::rescan(Large *large) {
+        _counting = _collector->is_exhaustive();
+        if (!large->is_marked() || (large->layout() & AUTO_UNSCANNED)) return;
+        scan_block_range(large->address(), large->size(), large->layout(), NULL, large, large->address(), displace(large->address(), large->size()));
+    }
+
+
+    bool Marker::mark_candidate(void *candidate, bool interior) {
+        usword_t address = (usword_t)candidate;
+        if (!_collector->in_heap(address)) return false;
+
+        // one page map lookup finds either kind of block.
+        PageMap::Entry entry = _collector->zone()->page_map().entry(candidate);
+        if (PageMap::is_subzone(entry)) {
+            Subzone *subzone = Subzone::subzone(candidate);
+            if (!subzone->is_initialized() || !subzone->in_blocks(candidate)) return false;
+            usword_t index = subzone->block_index(candidate);
+            void *block = subzone->block_address(index);
+            if ((block != candidate && !interior) || !subzone->is_allocated(index)) return false;
+            // old blocks are live during generational collections, and traced only by full ones.
+            bool young = subzone->is_young(index);
+            if ((young || !_collector->is_generational()) && subzone->test_set_mark(index)) {
+                _blocks_marked++;
+                auto_memory_type_t layout = subzone->layout(index);
+                if (!(layout & AUTO_UNSCANNED)) push_block(block, subzone->block_size(), layout);
+            } else if (_counting) {
+                subzone->set_shared(index);
+            }
+            return young;
+        }
+
+        Large *large = PageMap::large_in(entry, candidate);
+        if (!large || (!interior && large->address() != candidate)) return false;
+        bool young = large->is_young();
+        if ((young || !_collector->is_generational()) && large->test_set_mark()) {
+            _blocks_marked++;
+            if (!(large->layout() & AUTO_UNSCANNED)) push_block(large->address(), large->size(), large->layout());
+        } else if (_counting) {
+            large->set_shared();
+        }
+        return young;
+    }
+
+
+    bool Marker::condemn_candidate(void *candidate) {
+        if (!_collector->in_heap((usword_t)candidate)) return false;
+        // a block reached more than once, retained or thread local may have other references.
+        PageMap::Entry entry = _collector->zone()->page_map().entry(candidate);
+        if (PageMap::is_subzone(entry)) {
+            Subzone *subzone = Subzone::subzone(candidate);
+            if (!subzone->is_initialized() || !subzone->is_block_start(candidate)) return false;
+            usword_t index = subzone->block_index(candidate);
+            if (subzone->is_shared(index) || subzone->refcount(index) || subzone->is_local(index) || !subzone->test_clear_mark(index)) return false;
+            auto_memory_type_t layout = subzone->layout(index);
+            if (!(layout & AUTO_UNSCANNED)) push_block(candidate, subzone->block_size(), layout);
+            return true;
+        }
+        Large *large = PageMap::large_in(entry, candidate);
+        if (!large || large->address() != candidate || large->is_shared() || large->refcount() || !large->test_clear_mark()) return false;
+        if (!(large->layout() & AUTO_UNSCANNED)) push_block(candidate, large->size(), large->layout());
+        return true;
+    }
+
+
+    void Marker::scan_range(void *start, void *end, bool interior) {
+        void **p = (void **)align_up((usword_t)start, sizeof(void *));
+        void **limit = (void **)align_down((usword_t)end, sizeof(void *));
+        if (p >= limit) return;
+
+        // ranges within blocks keep the cards of words referring to young blocks dirty, so they are found
+        // once the block itself is old.  Stacks are never in blocks.
+        Subzone *card_subzone = NULL;
+        Large *card_large = NULL;
+        if (!interior && _collector->in_heap((usword_t)p)) {
+            Subzone *subzone = _collector->zone()->subzone_for(p);
+            if (subzone) {
+                if (subzone->in_blocks(p)) card_subzone = subzone;
+            } else {
+                card_large = _collector->large_for((usword_t)p, true);
+            }
+        }
+        scan_words(p, limit, card_subzone, card_large, interior);
+    }
+
+
+    void Marker::scan_words(void **p, void **limit, Subzone *card_subzone, Large *card_large, bool interior) {
+        if (p >= limit) return;
+        _bytes_scanned += (usword_t)limit - (usword_t)p;
+
+        // most words are not heap addresses; weed them out a batch at a time, then fetch the metadata of
+        // all survivors before looking any of them up.
+        const PageMap &page_map = _collector->zone()->page_map();
+        void **survivors[scan_batch_words];
+        while (p < limit) {
+            usword_t count = limit - p < scan_batch_words ? limit - p : scan_batch_words;
+            usword_t found = filter_candidates(p, count, _collector->heap_min(), _collector->heap_span(), survivors);
+            p += count;
+            for (usword_t i = 0; i < found; i++) {
+                void *candidate = *survivors[i];
+                page_map.prefetch(candidate);
+                __builtin_prefetch(Subzone::subzone(candidate));
+            }
+            if (_collector->is_condemning()) {
+                for (usword_t i = 0; i < found; i++) condemn_candidate(*survivors[i]);
+            } else if (card_subzone) {
+                for (usword_t i = 0; i < found; i++) if (mark_candidate(*survivors[i], false)) card_subzone->mark_card(survivors[i], card_young);
+            } else if (card_large) {
+                for (usword_t i = 0; i < found; i++) if (mark_candidate(*survivors[i], false)) card_large->mark_card(survivors[i], card_young);
+            } else {
+                for (usword_t i = 0; i < found; i++) mark_candidate(*survivors[i], interior);
+            }
+        }
+    }
+
+
+    const CompiledLayout *Marker::layout_for(void *block) {
+        const void *isa = *(void **)block;
+        if (!isa) return NULL;
+        usword_t slot = pointer_hash(isa) & (layout_lookaside_count - 1);
+        if (_layout_isas[slot] == isa) return _layouts[slot];
+        LayoutCache &cache = _collector->zone()->layout_cache();
+        const CompiledLayout *layout = _collector->is_world_stopped() ? cache.find(isa) : cache.layout_for(_collector->zone(), block);
+        if (!layout) return NULL;
+        _layout_isas[slot] = isa;
+        _layouts[slot] = layout;
+        return layout;
+    }
+
+
+    void Marker::scan_block_range(void *block, usword_t size, auto_memory_type_t layout, Subzone *subzone, Large *large, void *start, void *end) {
+        void **p = (void **)align_up((usword_t)start, sizeof(void *));
+        void **limit = (void **)align_down((usword_t)end, sizeof(void *));
+        const CompiledLayout *compiled = is_exactly_scanned(layout) ? layout_for(block) : NULL;
+        if (!compiled) {
+            scan_words(p, limit, subzone, large, false);
+            return;
+        }
+
+        // only the strong words the maps describe, then whatever lies past them.
+        void **base = (void **)block;
+        for (usword_t i = 0; i < compiled->run_count; i++) {
+            const LayoutRun &run = compiled->runs[i];
+            void **run_start = base + run.start, **run_end = run_start + run.count;
+            if (run_start >= limit) break;
+            scan_words(run_start > p ? run_start : p, run_end < limit ? run_end : limit, subzone, large, false);
+        }
+        void **rest = base + compiled->covered;
+        scan_words(rest > p ? rest : p, limit, subzone, large, false);
+    }
+
+
+    void Marker::scan_queued(const Range &range) {
+        if (_collector->is_condemning()) {
+            scan_condemned(range);
+            return;
+        }
+        _counting = _collector->is_exhaustive();
+        if (!((usword_t)range.start & Range::object_tag)) {
+            scan_range(range.start, range.end, false);
+            return;
+        }
+        void *start = displace(range.start, -(sword_t)Range::object_tag);
+        Subzone *subzone = _collector->zone()->subzone_for(start);
+        if (subzone) {
+            usword_t index = subzone->block_index(start);
+            scan_block_range(subzone->block_address(index), subzone->block_size(), subzone->layout(index), subzone, NULL, start, range.end);
+        } else {
+            Large *large = _collector->zone()->large_containing(start);
+            if (large) scan_block_range(large->address(), large->size(), large->layout(), NULL, large, start, range.end);
+        }
+    }
+
+
+    void Marker::scan_condemned(const Range &range) {
+        void *start = displace(range.start, -(sword_t)((usword_t)range.start & Range::object_tag));
+        Subzone *subzone = _collector->zone()->subzone_for(start);
+        Large *large = subzone ? NULL : _collector->zone()->large_containing(start);
+        void *block;
+        usword_t size;
+        auto_memory_type_t layout;
+        if (subzone) {
+            usword_t index = subzone->block_index(start);
+            block = subzone->block_address(index);
+            size = subzone->block_size();
+            layout = subzone->layout(index);
+        } else if (large) {
+            block = large->address();
+            size = large->size();
+            layout = large->layout();
+        } else {
+            return;
+        }
+        // the words marking followed are only known if the layout it used still is.
+        if (is_exactly_scanned(layout) && !layout_for(block)) return;
+        for (usword_t lo = (usword_t)start, end = (usword_t)range.end; lo < end; ) {
+            usword_t hi = align_down(lo, card_size) + card_size;
+            if (hi > end) hi = end;
+            unsigned char bits = subzone ? subzone->card(Subzone::card_index((void *)lo)) : large->card(large->card_index((void *)lo));
+            if (!(bits & card_marking)) scan_block_range(block, size, layout, subzone, large, (void *)lo, (void *)hi);
+            lo = hi;
+        }
+    }
+
+
+    bool Marker::needs_card_scan(bool young, bool marked, unsigned char bits) {
+        // young cards lead from old blocks, which are not traced by generational collections.  Marking
+        // cards lead from blocks already traced, or taken as live, when the store happened.
+        if (bits == card_young) return !young;
+        return marked || (!young && _collector->is_generational());
+    }
+
+
+    void Marker::scan_cards(Subzone *subzone, unsigned char bits) {
+        usword_t first = Subzone::card_index(subzone->first_block());
+        usword_t last = Subzone::card_index(displace(subzone->limit(), -1));
+        for (usword_t card = first; card <= last; card++) {
+            if (!(subzone->card(card) & bits)) continue;
+            subzone->clear_card(card, bits);
+            usword_t lo = (usword_t)subzone->card_address(card), hi = lo + card_size;
+            if (lo < (usword_t)subzone->first_block()) lo = (usword_t)subzone->first_block();
+            if (hi > (usword_t)subzone->limit()) hi = (usword_t)subzone->limit();
+            for (usword_t i = subzone->block_index((void *)lo), n = subzone->block_index((void *)(hi - 1)); i <= n; i++) {
+                if (!subzone->is_allocated(i) || (subzone->layout(i) & AUTO_UNSCANNED)) continue;
+                if (!needs_card_scan(subzone->is_young(i), subzone->is_marked(i), bits)) continue;
+                usword_t start = (usword_t)subzone->block_address(i), end = start + subzone->block_size();
+                scan_block_range((void *)start, subzone->block_size(), subzone->layout(i), subzone, NULL,
+                                 (void *)(start > lo ? start : lo), (void *)(end < hi ? end : hi));
+            }
+        }
+    }
+
+
+    void Marker::scan_cards(Large *large, unsigned char bits) {
+        if ((large->layout() & AUTO_UNSCANNED) || !needs_card_scan(large->is_young(), large->is_marked(), bits)) return;
+        for (usword_t card = 0, count = large->card_count(); card < count; card++) {
+            if (!(large->card(card) & bits)) continue;
+            large->clear_card(card, bits);
+            void *end = displace(large->card_address(card), card_size);
+            void *limit = displace(large->address(), large->size());
+            scan_block_range(large->address(), large->size(), large->layout(), NULL, large, large->card_address(card), end < limit ? end : limit);
+        }
+    }
+
+
+    void Marker::run_task(const MarkTask &task) {
+        // exhaustive collections count the references of blocks and the retains of the first pause.  The
+        // roots are scanned again by every later pass anyway, and counting them twice would make every
+        // retained block look shared.
+        _counting = _collector->is_exhaustive() && (_collector->is_roots_only() || task.kind == MarkTask::scan_cards || task.kind == MarkTask::scan_large_cards);
+        switch (task.kind) {
+            case MarkTask::scan_range:
+                scan_range(task.range.start, task.range.end, false);
+                break;
+            case MarkTask::scan_interior_range:
+                scan_range(task.range.start, task.range.end, true);
+                break;
+            case MarkTask::scan_retained: {
+                // retained blocks are roots.
+                Subzone *subzone = (Subzone *)task.range.start;
+                for (usword_t i = 0, count = subzone->block_count(); i < count; i++) {
+                    if (subzone->refcount(i) && subzone->is_allocated(i)) mark_candidate(subzone->block_address(i), false);
+                }
+                break;
+            }
+            case MarkTask::scan_cards:
+                scan_cards((Subzone *)task.range.start, (unsigned char)(usword_t)task.range.end);
+                break;
+            case MarkTask::scan_large_cards:
+                scan_cards((Large *)task.range.start, (unsigned char)(usword_t)task.range.end);
+                break;
+        }
+    }
+
+
+    void Marker::run() {
+        // during a pause the roots are only shaded; tracing from them continues concurrently.
+        bool roots_only = _collector->is_roots_only();
+        Range range;
+        MarkTask task;
+        for (;;) {
+            if (!roots_only) {
+                while (_deque.pop(range) || _collector->take_overflow(range)) scan_queued(range);
+            }
+
+            if (_collector->next_task(task)) {
+                run_task(task);
+                continue;
+            }
+            if (roots_only) return;
+
+            if (_collector->steal(_index, range)) {
+                scan_queued(range);
+                continue;
+            }
+
+            // out of work.  Leave once every marker is idle and nothing is left to steal.
+            sword_t *active = _collector->active_markers();
+            __atomic_sub_fetch(active, 1, __ATOMIC_SEQ_CST);
+            for (;;) {
+                if (_collector->has_work()) {
+                    __atomic_add_fetch(active, 1, __ATOMIC_SEQ_CST);
+                    break;
+                }
+                if (__atomic_load_n(active, __ATOMIC_SEQ_CST) == 0) return;
+                sched_yield();
+            }
+        }
+    }
+
+
+    //----- Collector -----//
+
+    static void foreach_garbage(auto_zone_cursor_t cursor, void (*op) (void *ptr, void *data), void *data) {
+        for (usword_t i = 0; i < cursor->count; i++) op(cursor->blocks[i], data);
+    }
+
+
+    Collector::Collector(Zone *zone, bool generational, bool exhaustive)
+        : _zone(zone), _generational(generational), _exhaustive(exhaustive), _condemning(false), _roots_only(false), _world_stopped(false), _next_task(0), _markers(NULL), _marker_count(0), _markers_bytes(0), _active_markers(0),
+          _overflow_count(0), _mark_overflowed(false), _next_finalize(0), _finalizing(false), _blocks_freed(0), _bytes_freed(0),
+          _unswept_blocks(0), _unswept_bytes(0)
+    {
+        _heap_min = zone->heap_min();
+        _heap_max = zone->heap_max();
+        _overflow_lock.value = 0;
+        bzero(&_durations, sizeof(_durations));
+    }
+
+
+    Collector::~Collector() {
+        if (_markers) {
+            for (usword_t i = 0; i < _marker_count; i++) _markers[i].destroy();
+            deallocate_memory(_markers, _markers_bytes);
+        }
+    }
+
+
+    Large *Collector::large_for(usword_t address, bool interior) const {
+        Large *large = _zone->large_containing((void *)address);
+        return large && (interior || (usword_t)large->address() == address) ? large : NULL;
+    }
+
+
+    bool Collector::is_garbage(void *address) const {
+        if (!in_heap((usword_t)address)) return false;
+        Subzone *subzone = _zone->subzone_for(address);
+        if (subzone) {
+            if (!subzone->in_blocks(address)) return false;
+            usword_t index = subzone->block_index(address);
+            return subzone->block_address(index) == address && subzone->is_allocated(index) && !subzone->is_marked(index) &&
+                   !subzone->is_local(index) && !(_generational && !subzone->is_young(index));
+        }
+        Large *large = large_for((usword_t)address, false);
+        return large && !large->is_marked() && !(_generational && !large->is_young());
+    }
+
+
+    bool Collector::next_task(MarkTask &task) {
+        if (__atomic_load_n(&_next_task, __ATOMIC_RELAXED) >= _tasks.count()) return false;
+        usword_t i = __atomic_fetch_add(&_next_task, 1, __ATOMIC_RELAXED);
+        if (i >= _tasks.count()) return false;
+        task = _tasks[i];
+        return true;
+    }
+
+
+    bool Collector::overflow(const Range &range) {
+        SpinLock lock(&_overflow_lock);
+        if (!_overflow.push(range)) return false;
+        __atomic_store_n(&_overflow_count, _overflow.count(), __ATOMIC_RELAXED);
+        return true;
+    }
+
+
+    bool Collector::take_overflow(Range &range) {
+        if (!__atomic_load_n(&_overflow_count, __ATOMIC_RELAXED)) return false;
+        SpinLock lock(&_overflow_lock);
+        if (!_overflow.count()) return false;
+        range = _overflow.pop();
+        __atomic_store_n(&_overflow_count, _overflow.count(), __ATOMIC_RELAXED);
+        return true;
+    }
+
+
+    bool Collector::steal(usword_t thief, Range &range) {
+        for (usword_t i = 1; i < _marker_count; i++) {
+            if (_markers[(thief + i) % _marker_count].deque().steal(range)) return true;
+        }
+        return false;
+    }
+
+
+    bool Collector::has_work() {
+        if (__atomic_load_n(&_next_task, __ATOMIC_RELAXED) < _tasks.count()) return true;
+        if (__atomic_load_n(&_overflow_count, __ATOMIC_RELAXED)) return true;
+        for (usword_t i = 0; i < _marker_count; i++) {
+            if (!_markers[i].deque().is_empty()) return true;
+        }
+        return false;
+    }
+
+
+    void Collector::add_task(MarkTask::Kind kind, void *start, void *end) {
+        // split long ranges so that they spread over the markers.
+        while (start < end) {
+            void *limit = (usword_t)end - (usword_t)start > scan_chunk_size ? displace(start, scan_chunk_size) : end;
+            MarkTask task = { kind, { start, limit } };
+            _tasks.push(task);
+            start = limit;
+        }
+    }
+
+
+    void Collector::suspend_threads(Thread *current) {
+        // take the locks guarding everything the roots come from before stopping anyone, so no stopped
+        // thread can be holding them.
+        _zone->lock_for_collection();
+        for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread != current) thread->suspend();
+        }
+        _world_stopped = true;
+    }
+
+
+    void Collector::resume_threads(Thread *current) {
+        _world_stopped = false;
+        for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread != current) thread->resume();
+        }
+        _zone->unlock_for_collection();
+    }
+
+
+    void Collector::gather_roots(Thread *current, void *stack_pointer, bool remark, bool retained) {
+        _tasks.clear();
+        _next_task = 0;
+        _root_values.clear();
+
+        // thread stacks and registers may hold interior pointers.
+        for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread == current) {
+                add_task(MarkTask::scan_interior_range, stack_pointer, thread->stack_base());
+            } else if (thread->is_suspended()) {
+                add_task(MarkTask::scan_interior_range, thread->stack_pointer(), thread->stack_base());
+                add_task(MarkTask::scan_interior_range, thread->registers(), thread->registers() + thread->register_count());
+            }
+        }
+
+        // registered data segments and explicit roots, sorted by address.  Touching or overlapping ones
+        // are scanned as one range, so neighbouring globals share a task and nothing is scanned twice.
+        RootTable::Snapshot *snapshot = _zone->roots().snapshot();
+        for (usword_t i = 0, count = snapshot ? snapshot->count : 0; i < count; ) {
+            usword_t start = snapshot->intervals[i].start, end = snapshot->intervals[i].end;
+            for (i++; i < count && snapshot->intervals[i].start <= end; i++) {
+                if (snapshot->intervals[i].end > end) end = snapshot->intervals[i].end;
+            }
+            add_task(MarkTask::scan_range, (void *)start, (void *)end);
+        }
+
+        // retained large blocks; their addresses are gathered and scanned as one range.
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            if (large->refcount()) _root_values.push(large->address());
+        }
+        add_task(MarkTask::scan_range, _root_values.items(), _root_values.items() + _root_values.count());
+
+        // retained subzone blocks, found from the refcount side tables, and the dirty cards: of old
+        // blocks for a generational collection, and at remark those stored into while marking.
+        unsigned char cards = remark ? card_marking : (_generational ? card_young : 0);
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                if (region->is_subzone_in_use(i) && region->subzone_at(i)->is_initialized()) {
+                    MarkTask task = { MarkTask::scan_retained, { region->subzone_at(i), NULL } };
+                    if (retained) _tasks.push(task);
+                    if (cards) {
+                        // the card bits to clean travel in the range end.
+                        task.kind = MarkTask::scan_cards;
+                        task.range.end = (void *)(usword_t)cards;
+                        _tasks.push(task);
+                    }
+                }
+            }
+        }
+        if (cards) {
+            for (Large *large = _zone->large_list(); large; large = large->next()) {
+                MarkTask task = { MarkTask::scan_large_cards, { large, (void *)(usword_t)cards } };
+                _tasks.push(task);
+            }
+        }
+    }
+
+
+    void Collector::clear_marks() {
+        // a full collection rescans every old block, dirtying again the cards that still matter.
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                subzone->clear_marks();
+                if (_exhaustive) {
+                    subzone->clear_shared();
+                    subzone->test_clear_uncounted();
+                }
+                if (_generational) subzone->clear_cards(card_marking);
+                else subzone->clear_cards();
+            }
+        }
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            large->clear_mark();
+            if (_exhaustive) {
+                large->clear_shared();
+                large->test_clear_uncounted();
+            }
+            if (_generational) large->clear_cards(card_marking);
+            else large->clear_cards();
+        }
+    }
+
+
+    bool Collector::mark_new_blocks() {
+        // the previous pass's garbage is swept, so unmarked blocks were allocated since.  They live, and
+        // their references were never counted: scanning them marks what they refer to shared.  So were
+        // those of blocks allocated marked, before the sweep or while marking; their subzones are scanned
+        // whole.  Every other block is marked already, so nothing else is reached.
+        Marker &marker = _markers[0];
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                bool uncounted = subzone->test_clear_uncounted();
+                usword_t *allocated = subzone->allocated_bitmap().address();
+                usword_t *marks = subzone->mark_bitmap().address();
+                usword_t *shared = subzone->shared_bitmap().address();
+                for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                    usword_t fresh = allocated[w] & ~marks[w];
+                    marks[w] |= fresh;
+                    shared[w] |= fresh;
+                    usword_t scan = uncounted ? allocated[w] : fresh;
+                    while (scan) {
+                        usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(scan);
+                        scan &= scan - 1;
+                        auto_memory_type_t layout = subzone->layout(index);
+                        if (!(layout & AUTO_UNSCANNED)) marker.push_block(subzone->block_address(index), subzone->block_size(), layout);
+                    }
+                }
+            }
+        }
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            bool fresh = large->test_set_mark();
+            bool uncounted = large->test_clear_uncounted();
+            if (fresh) large->set_shared();
+            if ((fresh || uncounted) && !(large->layout() & AUTO_UNSCANNED)) marker.push_block(large->address(), large->size(), large->layout());
+        }
+        Range range;
+        while (marker.deque().pop(range) || take_overflow(range)) marker.scan_queued(range);
+        // a new block left unscanned may hold an uncounted reference.
+        return !__atomic_exchange_n(&_mark_overflowed, false, __ATOMIC_RELAXED);
+    }
+
+
+    bool Collector::condemn(VMArray<void *> &candidates) {
+        // what condemned blocks refer to is condemned in turn, by one marker: there is rarely much.
+        Marker &marker = _markers[0];
+        bool condemned = false;
+        _condemning = true;
+        for (usword_t i = 0; i < candidates.count(); i++) {
+            if (marker.condemn_candidate(candidates[i])) condemned = true;
+        }
+        Range range;
+        while (marker.deque().pop(range) || take_overflow(range)) marker.scan_queued(range);
+        _condemning = false;
+        return condemned;
+    }
+
+
+    void Collector::initialize_markers() {
+        _marker_count = 1 + _zone->mark_worker_count();
+        _markers_bytes = align_up(_marker_count * sizeof(Marker), page_size);
+        _markers = (Marker *)allocate_memory(_markers_bytes);
+        for (usword_t i = 0; i < _marker_count; i++) _markers[i].initialize(this, i);
+    }
+
+
+    void Collector::run_worker(usword_t index) {
+        if (_finalizing) finalize_chunks();
+        else if (index < _marker_count) _markers[index].run();
+    }
+
+
+    void Collector::mark(bool roots_only) {
+        _roots_only = roots_only;
+        for (;;) {
+            _active_markers = _marker_count;
+            if (_marker_count > 1) _zone->run_mark_workers(this);
+            else _markers[0].run();
+            // tracing resumes from every marked block until none was left unscanned.
+            if (roots_only || !__atomic_exchange_n(&_mark_overflowed, false, __ATOMIC_RELAXED)) return;
+            rescan_marked();
+        }
+    }
+
+
+    void Collector::rescan_marked() {
+        // the markers are idle; what the rescan queues is drained by the next round of marking.
+        Marker &marker = _markers[0];
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (region->is_subzone_in_use(i) && subzone->is_initialized()) marker.rescan(subzone);
+            }
+        }
+        // large blocks freed while marking stay mapped until it is over, so the list may be walked unlocked.
+        for (Large *large = _zone->large_list(); large; large = large->next()) marker.rescan(large);
+    }
+
+
+    void Collector::mark_associations() {
+        // associated values live as long as their objects.  Marking them may bring more objects with
+        // associations to life, so repeat until no unmarked value of a surviving object is left.
+        AssociationTable &associations = _zone->associations();
+        if (associations.is_empty()) return;
+        for (;;) {
+            _root_values.clear();
+            associations.gather_values(*this, _root_values);
+            if (!_root_values.count()) break;
+            _tasks.clear();
+            _next_task = 0;
+            add_task(MarkTask::scan_range, _root_values.items(), _root_values.items() + _root_values.count());
+            mark(false);
+        }
+    }
+
+
+    void Collector::sweep() {
+        // unmarked young blocks are garbage, as are unmarked old ones after a full collection.
+        // Survivors age.  Large garbage is gathered now; subzones are left to find_garbage() and
+        // the lazy sweep, which see the marks as they are here.
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            if (large->is_marked()) {
+                large->mature();
+                continue;
+            }
+            if (_generational && !large->is_young()) continue;
+            _garbage.push(large->address());
+            _blocks_freed++;
+            _bytes_freed += large->size();
+            if ((large->layout() & AUTO_OBJECT) && !large->is_finalized()) _finalize.push(large->address());
+        }
+        _zone->begin_sweep(_generational);
+    }
+
+
+    void Collector::find_garbage() {
+        // the mutators are running.  Blocks they allocate or publish in pending subzones are marked
+        // before they look allocated or global.
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                if (!region->is_subzone_in_use(i)) continue;
+                Subzone *subzone = region->subzone_at(i);
+                if (!subzone->is_initialized() || !_zone->is_sweep_pending(subzone)) continue;
+                Bitmap &allocated = subzone->allocated_bitmap();
+                Bitmap &marks = subzone->mark_bitmap();
+                for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                    usword_t live = allocated.word(w);
+                    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                    usword_t garbage = live & ~marks.word(w);
+                    while (garbage) {
+                        usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(garbage);
+                        garbage &= garbage - 1;
+                        if (_generational && !subzone->is_young(index)) continue;
+                        // local blocks belong to their thread's local collections.
+                        if (subzone->is_local(index)) continue;
+                        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                        if (subzone->is_marked(index)) continue;
+                        _unswept_blocks++;
+                        _unswept_bytes += subzone->block_size();
+                        if ((subzone->layout(index) & AUTO_OBJECT) && !subzone->is_finalized(index)) _finalize.push(subzone->block_address(index));
+                    }
+                }
+            }
+        }
+        _blocks_freed += _unswept_blocks;
+        _bytes_freed += _unswept_bytes;
+    }
+
+
+    void Collector::finalize_chunks() {
+        auto_collection_control_t *control = _zone->control();
+        for (;;) {
+            usword_t first = __atomic_fetch_add(&_next_finalize, (usword_t)finalize_chunk_count, __ATOMIC_RELAXED);
+            if (first >= _finalize.count()) return;
+            usword_t end = first + finalize_chunk_count < _finalize.count() ? first + finalize_chunk_count : _finalize.count();
+            // earlier chunks' finalizers may have resurrected some of this one.
+            void **blocks = _finalize.items() + first;
+            usword_t count = 0;
+            for (usword_t i = first; i < end; i++) {
+                void *block = _finalize[i];
+                if (!_zone->is_dying(block, _generational)) continue;
+                _zone->set_finalized(block);
+                blocks[count++] = block;
+            }
+            if (!count) continue;
+            auto_zone_cursor cursor = { blocks, count };
+            trace_begin_span(span_finalize_batch, count);
+            control->batch_invalidate(_zone->basic_zone(), foreach_garbage, &cursor, sizeof(cursor));
+            trace_end_span(span_finalize_batch);
+        }
+    }
+
+
+    void Collector::finalize() {
+        auto_collection_control_t *control = _zone->control();
+        if (_finalize.count() && control->batch_invalidate) {
+            // finalizers may touch any garbage, so nothing is reclaimed until all have run.
+            _zone->set_finalizing(true, _generational);
+            _next_finalize = 0;
+            if (control->parallel_finalization && _marker_count > 1 && _finalize.count() > finalize_chunk_count) {
+                _finalizing = true;
+                _zone->run_mark_workers(this);
+                _finalizing = false;
+            } else {
+                finalize_chunks();
+            }
+            _zone->set_finalizing(false, false);
+        }
+
+        // garbage a finalizer retained lives on, as does everything it refers to.
+        for (usword_t i = 0; i < _finalize.count(); i++) {
+            void *block = _finalize[i];
+            if (_zone->block_retain_count(block) && _zone->is_dying(block, _generational)) _zone->resurrect(block, _generational);
+        }
+        for (usword_t i = 0; i < _garbage.count(); i++) {
+            void *block = _garbage[i];
+            if (_zone->block_retain_count(block) && _zone->is_dying(block, _generational)) _zone->resurrect(block, _generational);
+        }
+    }
+
+
+    void Collector::reclaim() {
+        // associations go first: the garbage's addresses are about to be reused.
+        _zone->associations().erase_dying(_zone, _generational);
+        _zone->forget_dying_observers(_generational);
+
+        // resurrected blocks were marked.
+        for (usword_t i = 0; i < _garbage.count(); i++) {
+            void *block = _garbage[i];
+            if (_zone->is_dying(block, _generational)) {
+                if (is_recording(_zone)) record_block(recording_death, block);
+                _zone->deallocate_large(block);
+            } else {
+                _blocks_freed--;
+                _bytes_freed -= _zone->block_size(block);
+            }
+        }
+        usword_t resurrected_blocks = _zone->resurrected_blocks(), resurrected_bytes = _zone->resurrected_bytes();
+        _blocks_freed -= resurrected_blocks;
+        _bytes_freed -= resurrected_bytes;
+        if (is_recording(_zone)) record_garbage(_zone, _generational);
+        _zone->enable_sweeping(_unswept_blocks - resurrected_blocks, _unswept_bytes - resurrected_bytes);
+    }
+
+
+    void Collector::dispose(uint64_t remarked) {
+        _zone->release_deferred_large();
+
+        // weak references to garbage are zeroed before finalizers can see them.
+        trace_begin_span(span_weak_clear);
+        auto_weak_callback_block_t *callbacks = _zone->weak_table().clear_dead(_zone);
+        _zone->weak_table().end_clearing();
+        WeakTable::run_callbacks(callbacks);
+        trace_end_span(span_weak_clear, _zone->weak_table().cleared_count());
+
+        find_garbage();
+        trace_begin_span(span_finalize);
+        finalize();
+        trace_end_span(span_finalize, _finalize.count());
+        uint64_t finalized = auto_date_now();
+
+        trace_begin_span(span_reclaim);
+        reclaim();
+        trace_end_span(span_reclaim);
+        _durations.finalize_duration = finalized - remarked;
+        _durations.reclaim_duration = auto_date_now() - finalized;
+    }
+
+
+    void Collector::collect() {
+        // callee saved registers may hold the caller's pointers; spill them where the stack scan sees them.
+        jmp_buf registers;
+        setjmp(registers);
+        collect_with_stack();
+    }
+
+
+    __attribute__((noinline)) void Collector::collect_with_stack() {
+        uint64_t start = auto_date_now();
+        Thread *current = _zone->current_thread();
+        void *stack_pointer = __builtin_frame_address(0);
+        trace_begin_span(span_collection, (_generational ? trace_generational : 0) | (_exhaustive ? trace_exhaustive : 0));
+
+        // the previous collection's garbage goes before its marks do.
+        _zone->finish_sweeping();
+
+        // initial pause: blocks allocated from here on are born marked; shade what the roots reach.
+        bool concurrent = !_zone->control()->disable_concurrent_marking;
+        trace_begin_span(span_pause);
+        suspend_threads(current);
+        _zone->set_marking(true);
+        gather_roots(current, stack_pointer, false, true);
+        clear_marks();
+        // later passes of an exhaustive collection reconsider what is released from here on.
+        if (_exhaustive) _zone->begin_noting_candidates();
+        initialize_markers();
+        mark(true);
+        if (concurrent) {
+            resume_threads(current);
+            trace_end_span(span_pause);
+        }
+        uint64_t resumed = auto_date_now();
+
+        // trace the heap while the mutators run, unless concurrent marking is disabled.  Their pointer
+        // stores dirty marking cards.
+        trace_begin_span(span_mark);
+        mark(false);
+        trace_end_span(span_mark);
+        uint64_t traced = auto_date_now();
+
+        // remark pause: rescan the roots and the marking cards, then determine the garbage.  Explicitly
+        // freed large blocks stayed mapped while marking read them.
+        if (concurrent) {
+            trace_begin_span(span_pause);
+            suspend_threads(current);
+        }
+        _heap_min = _zone->heap_min();
+        _heap_max = _zone->heap_max();
+        gather_roots(current, stack_pointer, true, true);
+        mark(false);
+        mark_associations();
+        sweep();
+        _zone->weak_table().begin_clearing(_generational);
+        _zone->set_marking(false);
+        resume_threads(current);
+        trace_end_span(span_pause);
+        uint64_t remarked = auto_date_now();
+        dispose(remarked);
+        uint64_t end = auto_date_now();
+        trace_end_span(span_collection, _blocks_freed, _bytes_freed);
+
+        // enlivening is the time the mutators were stopped.
+        _durations.total_duration = end - start;
+        _durations.enlivening_duration = concurrent ? (resumed - start) + (remarked - traced) : remarked - start;
+        _durations.scan_duration = traced - resumed;
+    }
+
+
+    void Collector::recollect(VMArray<void *> &candidates) {
+        jmp_buf registers;
+        setjmp(registers);
+        recollect_with_stack(candidates);
+    }
+
+
+    __attribute__((noinline)) void Collector::recollect_with_stack(VMArray<void *> &candidates) {
+        uint64_t start = auto_date_now();
+        Thread *current = _zone->current_thread();
+        void *stack_pointer = __builtin_frame_address(0);
+        trace_begin_span(span_collection, trace_exhaustive | trace_recollection);
+        _zone->finish_sweeping();
+
+        // a single pause: condemn, then rescan the roots and marking cards for condemned blocks still
+        // referred to.  Everything else keeps its mark, so only those are traced.
+        trace_begin_span(span_pause);
+        suspend_threads(current);
+        _heap_min = _zone->heap_min();
+        _heap_max = _zone->heap_max();
+        initialize_markers();
+        if (!mark_new_blocks() || !condemn(candidates)) {
+            resume_threads(current);
+            trace_end_span(span_pause);
+            trace_end_span(span_collection);
+            _durations.total_duration = _durations.enlivening_duration = auto_date_now() - start;
+            return;
+        }
+        gather_roots(current, stack_pointer, true, false);
+        mark(false);
+        mark_associations();
+        sweep();
+        _zone->weak_table().begin_clearing(_generational);
+        resume_threads(current);
+        trace_end_span(span_pause);
+        uint64_t remarked = auto_date_now();
+        dispose(remarked);
+        trace_end_span(span_collection, _blocks_freed, _bytes_freed);
+
+        _durations.total_duration = auto_date_now() - start;
+        _durations.enlivening_duration = remarked - start;
+    }
+
+};
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoCollector.h
+    Stop the world, parallel marking collector
+ */
+
+#ifndef __AUTO_COLLECTOR__
+#define __AUTO_COLLECTOR__
+
+#include "AutoDefs.h"
+#include "auto_zone.h"
+
+//
+// auto_zone_cursor
+//
+// Garbage handed to the batch_invalidate callback.
+//
+struct auto_zone_cursor {
+    void            **blocks;
+    Auto::usword_t  count;
+};
+
+
+namespace Auto {
+
+    class Large;
+    struct CompiledLayout;
+    class Subzone;
+    class Thread;
+    class Zone;
+
+    //
+    // Range
+    //
+    // A half open range of words.  Ranges queued for marking have object_tag set in start when they
+    // lie in an exactly scanned block.
+    //
+    struct Range {
+        enum { object_tag = 1 };
+
+        void            *start;
+        void            *end;
+
+        inline usword_t size() const { return (usword_t)end - (usword_t)start; }
+    };
+
+
+    //
+    // VMArray
+    //
+    // Growable array backed directly by virtual memory.  Used by the collector while mutator threads
+    // are suspended and may be holding malloc locks.
+    //
+    template <typename T> class VMArray {
+        T               *_items;
+        usword_t        _count;
+        usword_t        _capacity;
+        usword_t        _bytes;
+
+        bool grow() {
+            usword_t bytes = _bytes ? _bytes * 2 : align_up(16 * sizeof(T), page_size);
+            T *items = (T *)allocate_memory(bytes);
+            if (!items) return false;
+            if (_items) {
+                memcpy(items, _items, _count * sizeof(T));
+                deallocate_memory(_items, _bytes);
+            }
+            _items = items;
+            _bytes = bytes;
+            _capacity = bytes / sizeof(T);
+            return true;
+        }
+
+      public:
+        VMArray() : _items(NULL), _count(0), _capacity(0), _bytes(0) {}
+        ~VMArray() { if (_items) deallocate_memory(_items, _bytes); }
+
+        inline usword_t count() const { return _count; }
+        inline T *items() const { return _items; }
+        inline T &operator[](usword_t i) const { return _items[i]; }
+        inline void clear() { _count = 0; }
+        inline void truncate(usword_t count) { _count = count; }
+        inline void reset() {
+            if (_items) deallocate_memory(_items, _bytes);
+            _items = NULL;
+            _count = _capacity = _bytes = 0;
+        }
+        inline bool push(const T &item) {
+            if (_count == _capacity && !grow()) return false;
+            _items[_count++] = item;
+            return true;
+        }
+        inline T pop() { return _items[--_count]; }
+    };
+
+
+    //
+    // WorkDeque
+    //
+    // Fixed capacity Chase-Lev work stealing deque of ranges to scan.  The owning marker pushes and
+    // pops at the bottom; other markers steal from the top.
+    //
+    class WorkDeque {
+        enum { capacity = 1 << 16 };
+
+        Range           *_buffer;
+        sword_t         _top;
+        sword_t         _bottom;
+
+      public:
+        void initialize() {
+            _buffer = (Range *)allocate_memory(capacity * sizeof(Range));
+            _top = _bottom = 0;
+        }
+        void destroy() { deallocate_memory(_buffer, capacity * sizeof(Range)); }
+
+        inline bool is_empty() const {
+            return __atomic_load_n(&_bottom, __ATOMIC_ACQUIRE) <= __atomic_load_n(&_top, __ATOMIC_ACQUIRE);
+        }
+
+        //
+        // push
+        //
+        // Returns false if the deque is full.
+        //
+        inline bool push(const Range &range) {
+            sword_t b = __atomic_load_n(&_bottom, __ATOMIC_RELAXED);
+            sword_t t = __atomic_load_n(&_top, __ATOMIC_ACQUIRE);
+            if (b - t >= capacity) return false;
+            _buffer[b & (capacity - 1)] = range;
+            __atomic_store_n(&_bottom, b + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        inline bool pop(Range &range) {
+            sword_t b = __atomic_load_n(&_bottom, __ATOMIC_RELAXED) - 1;
+            __atomic_store_n(&_bottom, b, __ATOMIC_SEQ_CST);
+            sword_t t = __atomic_load_n(&_top, __ATOMIC_SEQ_CST);
+            if (t > b) {
+                __atomic_store_n(&_bottom, b + 1, __ATOMIC_RELAXED);
+                return false;
+            }
+            range = _buffer[b & (capacity - 1)];
+            if (t == b) {
+                // last entry; race any thieves for it.
+                bool won = __atomic_compare_exchange_n(&_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+                __atomic_store_n(&_bottom, b + 1, __ATOMIC_RELAXED);
+                return won;
+            }
+            return true;
+        }
+
+        inline bool steal(Range &range) {
+            sword_t t = __atomic_load_n(&_top, __ATOMIC_SEQ_CST);
+            sword_t b = __atomic_load_n(&_bottom, __ATOMIC_SEQ_CST);
+            if (t >= b) return false;
+            range = _buffer[t & (capacity - 1)];
+            return __atomic_compare_exchange_n(&_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        }
+    };
+
+
+    //
+    // MarkTask
+    //
+    // A unit of root scanning handed out to markers.
+    //
+    struct MarkTask {
+        enum Kind {
+            scan_range,                                     // conservatively scan [start, end) for block starts
+            scan_interior_range,                            // same, honoring interior pointers (stacks, registers)
+            scan_retained,                                  // mark retained blocks of the subzone at start
+            scan_cards,                                     // clean and scan cards of the subzone at start; end holds the card bits
+            scan_large_cards,                               // same, for the large block at start
+        };
+        Kind            kind;
+        Range           range;
+    };
+
+
+    class Collector;
+
+    //
+    // Marker
+    //
+    // Per worker marking state.  Padded so workers do not share cache lines.
+    //
+    class Marker {
+        enum {
+            layout_lookaside_count = 64,                    // power of 2
+            inline_scan_depth = 16,                         // nesting of ranges scanned for want of room to queue them
+        };
+
+        Collector       *_collector;
+        usword_t        _index;
+        WorkDeque       _deque;
+        usword_t        _blocks_marked;
+        usword_t        _bytes_scanned;
+        bool            _counting;                          // reaching a marked block again marks it shared
+        usword_t        _inline_depth;
+        const void      *_layout_isas[layout_lookaside_count];  // recently used layouts, by hash of isa
+        const CompiledLayout *_layouts[layout_lookaside_count];
+        char            _padding[64];
+
+        //
+        // scan_words
+        //
+        // Mark the blocks the words of [p, limit) designate, dirtying the young card of each word
+        // that refers to a young block when the words lie in card_subzone or card_large.
+        //
+        void scan_words(void **p, void **limit, Subzone *card_subzone, Large *card_large, bool interior);
+
+        //
+        // layout_for
+        //
+        // Returns the compiled layout of the object starting at block, or NULL to scan it
+        // conservatively.  Layouts not compiled yet are only compiled while the mutators run, since
+        // the runtime may take locks a suspended thread holds.
+        //
+        const CompiledLayout *layout_for(void *block);
+
+      public:
+        void initialize(Collector *collector, usword_t index);
+        void destroy() { _deque.destroy(); }
+
+        inline WorkDeque &deque() { return _deque; }
+        inline usword_t blocks_marked() const { return _blocks_marked; }
+        inline usword_t bytes_scanned() const { return _bytes_scanned; }
+
+        //
+        // mark_candidate
+        //
+        // Mark the block the word designates, if any, and queue it for scanning.  Returns true if the
+        // word refers to a young block.
+        //
+        bool mark_candidate(void *candidate, bool interior);
+
+        //
+        // condemn_candidate
+        //
+        // The converse of mark_candidate() for Collector::recollect(): unmark the block starting at the
+        // word and queue it, unless something other than the reference being followed may keep it alive.
+        // Returns true if the block was condemned.
+        //
+        bool condemn_candidate(void *candidate);
+
+        //
+        // scan_range
+        //
+        // Conservatively scan a range of words.  When the range lies in a block, the cards of words
+        // referring to young blocks are dirtied so that generational collections see them.
+        //
+        void scan_range(void *start, void *end, bool interior);
+
+        //
+        // scan_block_range
+        //
+        // Scan [start, end), part of the block at block, following its layout maps if it is exactly
+        // scanned.  Exactly one of subzone or large holds the block.
+        //
+        void scan_block_range(void *block, usword_t size, auto_memory_type_t layout, Subzone *subzone, Large *large, void *start, void *end);
+
+        //
+        // scan_queued
+        //
+        // Scan a range taken from a deque or the overflow.
+        //
+        void scan_queued(const Range &range);
+
+        //
+        // scan_condemned
+        //
+        // Condemn what a queued range of a condemned block refers to, skipping the words stored into since
+        // the block was last scanned.
+        //
+        void scan_condemned(const Range &range);
+
+        //
+        // scan_cards
+        //
+        // Clean the given card bits, scanning the parts of dirty cards in blocks the collection does not
+        // otherwise trace.
+        //
+        bool needs_card_scan(bool young, bool marked, unsigned char bits);
+        void scan_cards(Subzone *subzone, unsigned char bits);
+        void scan_cards(Large *large, unsigned char bits);
+
+        //
+        // run_task
+        //
+        // Carry out one unit of root scanning.
+        //
+        void run_task(const MarkTask &task);
+
+        //
+        // push_block
+        //
+        // Queue a newly marked block's contents, split in pieces if large.  A piece that fits neither
+        // the deque nor the overflow is scanned right away, or once nested too deep, left to
+        // Collector::rescan_marked().
+        //
+        void push_block(void *address, usword_t size, auto_memory_type_t layout);
+
+        //
+        // rescan
+        //
+        // Scan every marked block of the subzone, or the large block if marked, again.
+        //
+        void rescan(Subzone *subzone);
+        void rescan(Large *large);
+
+        //
+        // run
+        //
+        // Mark until no marker can find work, or while the roots are only being shaded, until the root
+        // tasks are gone.
+        //
+        void run();
+    };
+
+
+    //
+    // Collector
+    //
+    // Carries out one collection of a zone.  The collecting thread stops all registered threads,
+    // snapshots the roots and marks in parallel with the zone's mark workers, determines the
+    // garbage, then restarts the world before finalizing and reclaiming it.
+    //
+    // A generational collection treats old blocks as live without tracing them; pointers from old
+    // to young blocks are found through the dirty cards.  Blocks age each time they survive.
+    //
+    // Marking is mostly concurrent.  The first pause only shades the blocks the roots refer to; the
+    // heap is traced with the mutators running, allocating marked blocks and dirtying marking cards
+    // as they store pointers.  The second pause rescans the roots and the marking cards.
+    //
+    // Only large garbage is freed by the collection itself.  Subzone garbage is found and finalized
+    // with the mutators running, then swept lazily by the admins; see Zone::begin_sweep().
+    //
+    // An exhaustive collection also notes which marked blocks it reached more than once.  After its
+    // finalizers ran, recollect() uses that to collect only what they let go of; see there.
+    //
+    class Collector {
+
+      private:
+        Zone            *_zone;
+        bool            _generational;                      // only young blocks are collected
+        bool            _exhaustive;                        // note blocks reached more than once
+        bool            _condemning;                        // markers unmark rather than mark
+        bool            _roots_only;                        // markers only shade the roots
+        bool            _world_stopped;                     // registered threads are suspended
+        usword_t        _heap_min;                          // bounds of the heap, for quick rejection
+        usword_t        _heap_max;
+
+        VMArray<MarkTask> _tasks;                           // root scanning work
+        usword_t        _next_task;
+
+        Marker          *_markers;
+        usword_t        _marker_count;
+        usword_t        _markers_bytes;
+        sword_t         _active_markers;                    // for termination
+
+        spin_lock_t     _overflow_lock;                     // ranges that did not fit a deque
+        VMArray<Range>  _overflow;
+        usword_t        _overflow_count;                    // read without the lock
+        bool            _mark_overflowed;                   // marked blocks were left unscanned
+
+        VMArray<void *> _root_values;                       // retained large blocks, association values
+
+        VMArray<void *> _garbage;                           // unmarked large blocks
+        VMArray<void *> _finalize;                          // garbage objects not yet finalized
+        usword_t        _next_finalize;                     // first of _finalize not yet handed out
+        bool            _finalizing;                        // workers finalize rather than mark
+        usword_t        _blocks_freed;
+        usword_t        _bytes_freed;
+        usword_t        _unswept_blocks;                    // subzone garbage left to the sweep
+        usword_t        _unswept_bytes;
+
+        auto_collection_durations_t _durations;
+
+        //
+        // Phases
+        //
+        void suspend_threads(Thread *current);
+        void resume_threads(Thread *current);
+        void gather_roots(Thread *current, void *stack_pointer, bool remark, bool retained);
+        void clear_marks();
+        bool mark_new_blocks();
+        bool condemn(VMArray<void *> &candidates);
+        void initialize_markers();
+        void mark(bool roots_only);
+        void rescan_marked();
+        void mark_associations();
+        void sweep();
+        void find_garbage();
+        void finalize();
+        void finalize_chunks();
+        void reclaim();
+        void dispose(uint64_t remarked);
+
+        void add_task(MarkTask::Kind kind, void *start, void *end);
+        void collect_with_stack();
+        void recollect_with_stack(VMArray<void *> &candidates);
+
+      public:
+
+        Collector(Zone *zone, bool generational, bool exhaustive);
+        ~Collector();
+
+        //
+        // Accessors
+        //
+        inline Zone *zone() const { return _zone; }
+        inline bool is_generational() const { return _generational; }
+        inline bool is_exhaustive() const { return _exhaustive; }
+        inline bool is_condemning() const { return _condemning; }
+        inline bool is_roots_only() const { return _roots_only; }
+        inline bool is_world_stopped() const { return _world_stopped; }
+        inline bool in_heap(usword_t address) const { return address - _heap_min < _heap_max - _heap_min; }
+        inline usword_t heap_min() const { return _heap_min; }
+        inline usword_t heap_span() const { return _heap_max - _heap_min; }
+        inline usword_t marker_count() const { return _marker_count; }
+        inline Marker &marker(usword_t i) { return _markers[i]; }
+        inline usword_t bytes_freed() const { return _bytes_freed; }
+        inline usword_t garbage_count() const { return _blocks_freed; }
+        inline const auto_collection_durations_t &durations() const { return _durations; }
+
+        //
+        // large_for
+        //
+        // Returns the large block containing (interior) or starting at address, or NULL.
+        //
+        Large *large_for(usword_t address, bool interior) const;
+
+        //
+        // is_garbage
+        //
+        // Whether address starts a block this collection would collect, were marking to end now.
+        //
+        bool is_garbage(void *address) const;
+
+        //
+        // next_task
+        //
+        // Hand out the next root scanning task.  Returns false when all are taken.
+        //
+        bool next_task(MarkTask &task);
+
+        //
+        // run_worker
+        //
+        // The work of one of the zone's helper threads in the current phase.
+        //
+        void run_worker(usword_t index);
+
+        //
+        // Work distribution between markers
+        //
+        bool overflow(const Range &range);
+        bool take_overflow(Range &range);
+        inline void set_mark_overflowed() { __atomic_store_n(&_mark_overflowed, true, __ATOMIC_RELAXED); }
+        bool steal(usword_t thief, Range &range);
+        bool has_work();
+        inline sword_t *active_markers() { return &_active_markers; }
+
+        //
+        // collect
+        //
+        // Run the collection.  Caller holds the zone's collection lock.
+        //
+        void collect();
+
+        //
+        // recollect
+        //
+        // Run a later pass of an exhaustive collection, whose earlier passes were exhaustive Collectors,
+        // considering only the candidates: blocks released, unlinked or resurrected since.  With the
+        // world stopped, a candidate that no marking reached more than once, and that is neither retained
+        // nor thread local, is unmarked, as is, transitively, whatever such a block was the only
+        // reference to.  Blocks allocated since the last pass are marked and scanned first, counting their
+        // references.  Then the roots and the marking cards are rescanned as at a remark, bringing back
+        // whatever they still reach; the rest of the condemned blocks are garbage.  Words stored into
+        // since they were last scanned are never followed when condemning, since what they refer to may
+        // have uncounted references.
+        //
+        // This relies on every reference from a surviving heap block having been counted: by an earlier
+        // pass's marking, by scanning the new blocks, by Zone::resurrect() for blocks a finalizer brought
+        // back, or, for words stored since, by the dirty marking cards the rescan covers.  The rescan only
+        // finds references from roots and those cards.  Anything missed waits for the next full collection.
+        //
+        void recollect(VMArray<void *> &candidates);
+    };
+
+};
+
+#endif // __AUTO_COLLECTOR__
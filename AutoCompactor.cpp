@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoCompactor.cpp
+    Heap compaction
+ */
+
+#include "AutoCompactor.h"
+#include "AutoLarge.h"
+#include "AutoLayout.h"
+#include "AutoRegion.h"
+#include "AutoScan.h"
+#include "AutoSubzone.h"
+#include "AutoThread.h"
+#include "AutoZone.h"
+
+#include <setjmp.h>
+
+namespace Auto {
+
+    Compactor::Compactor(Zone *zone) : _zone(zone), _blocks_moved(0), _bytes_moved(0), _bytes_released(0) {
+        bzero(_reports, sizeof(_reports));
+    }
+
+
+    Compactor::~Compactor() {
+        for (usword_t i = 0; i < _sources.count(); i++) {
+            Subzone *subzone = _sources[i];
+            if (!subzone->forwarding()) continue;
+            deallocate_memory(subzone->forwarding(), align_up(subzone->block_count() * sizeof(void *), page_size));
+            subzone->set_forwarding(NULL);
+        }
+    }
+
+
+    void *Compactor::relocated(const void *address) const {
+        if (!_zone->in_heap(address)) return (void *)address;
+        Subzone *subzone = _zone->subzone_for(address);
+        if (!subzone || !subzone->forwarding() || !subzone->in_blocks(address)) return (void *)address;
+        usword_t index = subzone->block_index(address);
+        void *copy = subzone->forwarding()[index];
+        if (!copy) return (void *)address;
+        return displace(copy, (usword_t)address - (usword_t)subzone->block_address(index));
+    }
+
+
+    bool Compactor::is_movable(Subzone *subzone, usword_t index) {
+        // retained blocks may be referred to from memory the collector never sees.
+        if (subzone->is_marked(index) || subzone->refcount(index) || subzone->is_local(index)) return false;
+        auto_memory_type_t layout = subzone->layout(index);
+        return is_exactly_scanned(layout) || layout == AUTO_MEMORY_ALL_POINTERS;
+    }
+
+
+    void Compactor::suspend_threads(Thread *current) {
+        // as for a collection, take every lock guarding what is updated before stopping anyone.
+        _zone->lock_for_collection();
+        _zone->weak_table().lock_all();
+        _zone->lock_compaction_observers();
+        for (usword_t sc = 0; sc < size_class_count; sc++) spin_lock(_zone->admin(sc).lock());
+        for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread != current) thread->suspend();
+        }
+    }
+
+
+    void Compactor::resume_threads(Thread *current) {
+        for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread != current) thread->resume();
+        }
+    }
+
+
+    void Compactor::pin(const void *address) {
+        Subzone *subzone = _zone->subzone_for(address);
+        if (!subzone || !subzone->in_blocks(address)) return;
+        usword_t index = subzone->block_index(address);
+        if (subzone->is_allocated(index)) subzone->test_set_mark(index);
+    }
+
+
+    void Compactor::pin_range(void **p, void **limit) {
+        usword_t min = _zone->heap_min(), span = _zone->heap_max() - min;
+        void **survivors[scan_batch_words];
+        while (p < limit) {
+            usword_t count = limit - p < scan_batch_words ? limit - p : scan_batch_words;
+            usword_t found = filter_candidates(p, count, min, span, survivors);
+            for (usword_t i = 0; i < found; i++) pin(*survivors[i]);
+            p += count;
+        }
+    }
+
+
+    void Compactor::update_range(void **p, void **limit, Subzone *subzone, Large *large) {
+        for ( ; p < limit; p++) {
+            void *value = *p;
+            void *moved = relocated(value);
+            if (moved == value) continue;
+            *p = moved;
+            // the copy is as young as the original.
+            if (subzone) subzone->dirty_card(p);
+            else large->dirty_card(p);
+        }
+    }
+
+
+    void Compactor::visit_block(void *block, usword_t size, auto_memory_type_t layout, Subzone *subzone, Large *large, bool update) {
+        if (layout & AUTO_UNSCANNED) return;
+        void **words = (void **)block, **limit = words + size / sizeof(void *);
+        if (!(layout & AUTO_OBJECT)) {
+            if (layout & AUTO_POINTERS_ONLY) {
+                if (update) update_range(words, limit, subzone, large);
+            } else if (!update) {
+                pin_range(words, limit);
+            }
+            return;
+        }
+
+        // the world is stopped: only layouts already compiled are used, as by the collector.
+        const void *isa = *(void **)block;
+        const CompiledLayout *compiled = isa ? _zone->layout_cache().find(isa) : NULL;
+        if (!compiled) {
+            if (!update) pin_range(words, limit);
+            return;
+        }
+        if (update) {
+            for (usword_t i = 0; i < compiled->run_count; i++) {
+                void **run = words + compiled->runs[i].start, **end = run + compiled->runs[i].count;
+                if (run >= limit) break;
+                update_range(run, end < limit ? end : limit, subzone, large);
+            }
+        }
+        void **rest = words + compiled->covered;
+        if (rest >= limit) return;
+        if (layout & AUTO_POINTERS_ONLY) {
+            if (update) update_range(rest, limit, subzone, large);
+        } else if (!update) {
+            pin_range(rest, limit);
+        }
+    }
+
+
+    void Compactor::find_pins(Thread *current, void *stack_pointer) {
+        // the mark bits are free until the next collection clears them.
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (region->is_subzone_in_use(i) && subzone->is_initialized()) subzone->clear_marks();
+            }
+        }
+
+        // thread stacks and registers.
+        for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread == current) {
+                pin_range((void **)align_up((usword_t)stack_pointer, sizeof(void *)), (void **)thread->stack_base());
+            } else if (thread->is_suspended()) {
+                pin_range((void **)thread->stack_pointer(), (void **)thread->stack_base());
+                pin_range((void **)thread->registers(), (void **)(thread->registers() + thread->register_count()));
+            }
+        }
+
+        // registered data segments pin what they reach.  Explicit roots are updated where they are, so a
+        // block holding one stays put.
+        RootTable::Snapshot *snapshot = _zone->roots().snapshot();
+        for (usword_t i = 0, count = snapshot ? snapshot->count : 0; i < count; i++) {
+            RootTable::Interval &interval = snapshot->intervals[i];
+            if (interval.kind == RootTable::datasegment) pin_range((void **)interval.start, (void **)interval.end);
+            else if (_zone->in_heap((void *)interval.start)) pin((void *)interval.start);
+        }
+
+        // conservatively scanned heap memory.
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                Bitmap &allocated = subzone->allocated_bitmap();
+                for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                    for (usword_t bits = allocated.word(w); bits; bits &= bits - 1) {
+                        usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                        visit_block(subzone->block_address(index), subzone->block_size(), subzone->layout(index), subzone, NULL, false);
+                    }
+                }
+            }
+        }
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            visit_block(large->address(), large->size(), large->layout(), NULL, large, false);
+        }
+    }
+
+
+    void Compactor::select_sources() {
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            Admin &admin = _zone->admin(sc);
+            SizeClassReport &report = _reports[sc];
+            report.block_size = admin.block_size();
+
+            // room for the moves is what the subzones staying put have unclaimed.
+            usword_t room = 0;
+            for (Subzone *subzone = admin.subzones(); subzone; subzone = subzone->admin_next()) {
+                usword_t in_use = 0;
+                for (usword_t index = 0; index < subzone->block_count(); index++) {
+                    if (!subzone->is_allocated(index)) continue;
+                    in_use++;
+                    if (subzone->is_marked(index)) report.pinned++;
+                    else if (!is_movable(subzone, index)) report.immovable++;
+                }
+                report.subzones++;
+                report.capacity += subzone->block_count();
+                report.in_use += in_use;
+                if ((in_use << sparse_occupancy_log2) > subzone->block_count()) room += subzone->block_count() - subzone->claimed_count();
+            }
+
+            for (Subzone *subzone = admin.subzones(); subzone; subzone = subzone->admin_next()) {
+                usword_t in_use = 0, movable = 0;
+                for (usword_t index = 0; index < subzone->block_count(); index++) {
+                    if (!subzone->is_allocated(index)) continue;
+                    in_use++;
+                    if (is_movable(subzone, index)) movable++;
+                }
+                if ((in_use << sparse_occupancy_log2) > subzone->block_count() || report.moves + movable > room) continue;
+                if (!_sources.push(subzone)) return;
+                report.sources++;
+                report.moves += movable;
+                // blocks sitting in thread caches keep only their own pages.
+                if (in_use == movable) report.emptied++;
+            }
+        }
+    }
+
+
+    void Compactor::evacuate() {
+        // every source is known before any block moves, so none becomes a destination.
+        for (usword_t i = 0; i < _sources.count(); i++) {
+            Subzone *subzone = _sources[i];
+            subzone->set_forwarding((void **)allocate_memory(align_up(subzone->block_count() * sizeof(void *), page_size)));
+        }
+        for (usword_t i = 0; i < _sources.count(); i++) {
+            Subzone *subzone = _sources[i];
+            void **forwarding = subzone->forwarding();
+            if (!forwarding) continue;
+            Admin *admin = subzone->admin();
+            for (usword_t index = 0; index < subzone->block_count(); index++) {
+                if (!subzone->is_allocated(index) || !is_movable(subzone, index)) continue;
+                void *copy = admin->move_block(subzone->block_address(index));
+                if (!copy) break;
+                forwarding[index] = copy;
+                _blocks_moved++;
+                _bytes_moved += subzone->block_size();
+            }
+        }
+    }
+
+
+    void Compactor::update_references() {
+        RootTable::Snapshot *snapshot = _zone->roots().snapshot();
+        for (usword_t i = 0, count = snapshot ? snapshot->count : 0; i < count; i++) {
+            RootTable::Interval &interval = snapshot->intervals[i];
+            if (interval.kind == RootTable::explicit_root) *(void **)interval.start = relocated(*(void **)interval.start);
+        }
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                Bitmap &allocated = subzone->allocated_bitmap();
+                for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                    for (usword_t bits = allocated.word(w); bits; bits &= bits - 1) {
+                        usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                        visit_block(subzone->block_address(index), subzone->block_size(), subzone->layout(index), subzone, NULL, true);
+                    }
+                }
+            }
+        }
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            visit_block(large->address(), large->size(), large->layout(), NULL, large, true);
+        }
+        // weak locations are read without locks, so they change now too.
+        _zone->weak_table().relocate_locations(*this);
+    }
+
+
+    void Compactor::release_pages() {
+        // pages no claimed block overlaps go back to the system.  Caller holds the admin locks.
+        for (usword_t i = 0; i < _sources.count(); i++) {
+            Subzone *subzone = _sources[i];
+            usword_t start = align_up((usword_t)subzone->first_block(), page_size), end = align_down((usword_t)subzone->limit(), page_size);
+            usword_t run = 0;
+            for (usword_t page = start; page <= end; page += page_size) {
+                bool free = page < end;
+                if (free) {
+                    usword_t last = subzone->block_index((void *)(page + page_size - 1));
+                    for (usword_t index = subzone->block_index((void *)page); free && index <= last; index++) free = !subzone->is_claimed(index);
+                }
+                if (free) {
+                    if (!run) run = page;
+                    continue;
+                }
+                if (run) {
+                    uncommit_memory((void *)run, page - run);
+                    _bytes_released += page - run;
+                    run = 0;
+                }
+            }
+        }
+    }
+
+
+    __attribute__((noinline)) void Compactor::run(bool analyze_only) {
+        Thread *current = _zone->current_thread();
+        void *stack_pointer = __builtin_frame_address(0);
+
+        suspend_threads(current);
+        find_pins(current, stack_pointer);
+        select_sources();
+        if (!analyze_only) {
+            evacuate();
+            update_references();
+        }
+        resume_threads(current);
+
+        // mutators wanting the tables wait on their locks until the moved keys are rehashed.
+        if (!analyze_only) release_pages();
+        for (usword_t sc = 0; sc < size_class_count; sc++) spin_unlock(_zone->admin(sc).lock());
+        if (_blocks_moved) {
+            _zone->associations().relocate(*this);
+            _zone->weak_table().relocate_referents(*this);
+            _zone->relocate_compaction_observers(*this);
+        }
+        _zone->unlock_compaction_observers();
+        _zone->weak_table().unlock_all();
+        _zone->unlock_for_collection();
+    }
+
+
+    usword_t Compactor::compact() {
+        // callee saved registers may hold the caller's pointers; spill them where the stack scan sees them.
+        jmp_buf registers;
+        setjmp(registers);
+        run(false);
+        return _blocks_moved;
+    }
+
+
+    void Compactor::analyze() {
+        jmp_buf registers;
+        setjmp(registers);
+        run(true);
+    }
+
+
+    void Compactor::write_report(FILE *file) {
+        usword_t capacity_bytes = 0, in_use_bytes = 0, move_bytes = 0, emptied = 0;
+        fprintf(file, "compaction analysis of zone %s\n", _zone->name());
+        fprintf(file, "%8s %8s %10s %10s %10s %10s %8s %10s %8s\n", "size", "subzones", "capacity", "in use", "pinned", "immovable", "sources", "moves", "emptied");
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            SizeClassReport &report = _reports[sc];
+            if (!report.subzones) continue;
+            fprintf(file, "%8lu %8lu %10lu %10lu %10lu %10lu %8lu %10lu %8lu\n",
+                    (unsigned long)report.block_size, (unsigned long)report.subzones, (unsigned long)report.capacity,
+                    (unsigned long)report.in_use, (unsigned long)report.pinned, (unsigned long)report.immovable,
+                    (unsigned long)report.sources, (unsigned long)report.moves, (unsigned long)report.emptied);
+            capacity_bytes += report.capacity * report.block_size;
+            in_use_bytes += report.in_use * report.block_size;
+            move_bytes += report.moves * report.block_size;
+            emptied += report.emptied;
+        }
+        fprintf(file, "%lu of %lu bytes in use (%lu%%); moving %lu bytes empties %lu subzones\n",
+                (unsigned long)in_use_bytes, (unsigned long)capacity_bytes,
+                (unsigned long)(capacity_bytes ? in_use_bytes * 100 / capacity_bytes : 0), (unsigned long)move_bytes, (unsigned long)emptied);
+        if (_blocks_moved) {
+            fprintf(file, "moved %lu blocks (%lu bytes), released %lu bytes\n",
+                    (unsigned long)_blocks_moved, (unsigned long)_bytes_moved, (unsigned long)_bytes_released);
+        }
+    }
+
+};
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoCompactor.h
+    Heap compaction
+ */
+
+#ifndef __AUTO_COMPACTOR__
+#define __AUTO_COMPACTOR__
+
+#include "AutoDefs.h"
+#include "AutoAdmin.h"
+#include "AutoCollector.h"
+
+#include <stdio.h>
+
+namespace Auto {
+
+    class Large;
+    class Subzone;
+    class Thread;
+    class Zone;
+
+    //
+    // Compactor
+    //
+    // Moves the blocks out of sparsely occupied subzones so that their pages can be given back to the
+    // system.  Runs with the collection mutex held, right after a full collection has been swept, and
+    // moves blocks with the world stopped.
+    //
+    // A block moves only if every reference to it can be found and updated: it must be exactly
+    // scanned, neither retained nor thread local, and not referred to from anything scanned
+    // conservatively, i.e. thread stacks and registers, data segments, conservatively scanned blocks
+    // and the parts of objects their layout maps do not describe.  Such references pin their blocks,
+    // recorded in the mark bits, which the next collection clears anyway.
+    //
+    class Compactor {
+
+      public:
+        enum {
+            sparse_occupancy_log2 = 2,                      // subzones at most a quarter occupied are evacuated
+        };
+
+        //
+        // SizeClassReport
+        //
+        // What compaction finds, and would do, in one size class.
+        //
+        struct SizeClassReport {
+            usword_t    block_size;
+            usword_t    subzones;
+            usword_t    capacity;                           // blocks
+            usword_t    in_use;                             // allocated blocks
+            usword_t    pinned;                             // referred to conservatively
+            usword_t    immovable;                          // not exactly scanned, retained or thread local
+            usword_t    sources;                            // sparse subzones to evacuate
+            usword_t    moves;                              // blocks to move out of them
+            usword_t    emptied;                            // sources all of whose blocks move
+        };
+
+      private:
+        Zone            *_zone;
+        VMArray<Subzone *> _sources;                        // subzones being evacuated
+        usword_t        _blocks_moved;
+        usword_t        _bytes_moved;
+        usword_t        _bytes_released;
+        SizeClassReport _reports[size_class_count];
+
+        //
+        // Phases
+        //
+        void suspend_threads(Thread *current);
+        void resume_threads(Thread *current);
+        void find_pins(Thread *current, void *stack_pointer);
+        void select_sources();
+        void evacuate();
+        void update_references();
+        void release_pages();
+        void run(bool analyze_only);
+
+        //
+        // pin
+        //
+        // Keep the block containing address, if any, where it is.
+        //
+        void pin(const void *address);
+        void pin_range(void **p, void **limit);
+
+        //
+        // visit_block
+        //
+        // Pin the blocks the conservatively scanned words of a block refer to or, when updating,
+        // relocate the references in its exactly scanned words.  Exactly one of subzone or large holds
+        // the block.
+        //
+        void visit_block(void *block, usword_t size, auto_memory_type_t layout, Subzone *subzone, Large *large, bool update);
+        void update_range(void **p, void **limit, Subzone *subzone, Large *large);
+
+        //
+        // is_movable
+        //
+        // Whether the allocated block at index may move.
+        //
+        static bool is_movable(Subzone *subzone, usword_t index);
+
+      public:
+
+        Compactor(Zone *zone);
+        ~Compactor();
+
+        //
+        // compact
+        //
+        // Evacuate the sparse subzones, update every reference to the blocks moved and return the
+        // emptied pages.  Returns the number of blocks moved.
+        //
+        usword_t compact();
+
+        //
+        // analyze
+        //
+        // Work out what compact() would do without moving anything.
+        //
+        void analyze();
+
+        //
+        // relocated
+        //
+        // Returns where the block containing address has moved, adjusted for address's offset in it,
+        // or address itself.  Valid until the compactor goes away.
+        //
+        void *relocated(const void *address) const;
+
+        //
+        // write_report
+        //
+        // Write a fragmentation report of what compact() or analyze() found.  Not to be called while
+        // the world is stopped.
+        //
+        void write_report(FILE *file);
+
+        inline usword_t blocks_moved() const { return _blocks_moved; }
+        inline usword_t bytes_released() const { return _bytes_released; }
+    };
+
+};
+
+#endif // __AUTO_COMPACTOR__
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoDefs.cpp
+    Auxiliary memory and virtual memory helpers
+ */
+
+#include "AutoDefs.h"
+
+#include <sys/mman.h>
+#include <mach/mach_time.h>
+
+namespace Auto {
+
+    malloc_zone_t *aux_zone;
+
+    static pthread_once_t aux_once = PTHREAD_ONCE_INIT;
+
+    static void aux_create(void) {
+        aux_zone = malloc_create_zone(4096, 0);
+        malloc_set_zone_name(aux_zone, "auto_aux_zone");
+    }
+
+    void aux_init(void) {
+        pthread_once(&aux_once, aux_create);
+    }
+
+
+    void *allocate_memory(usword_t size, usword_t alignment) {
+        // over map, then trim to the requested alignment.
+        usword_t padded = size + (alignment > page_size ? alignment - page_size : 0);
+        void *mapped = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (mapped == MAP_FAILED) return NULL;
+        usword_t address = align_up((usword_t)mapped, alignment);
+        usword_t leading = address - (usword_t)mapped;
+        usword_t trailing = padded - leading - size;
+        if (leading) munmap(mapped, leading);
+        if (trailing) munmap((void *)(address + size), trailing);
+        return (void *)address;
+    }
+
+
+    void deallocate_memory(void *address, usword_t size) {
+        munmap(address, size);
+    }
+
+
+    void uncommit_memory(void *address, usword_t size) {
+        // MADV_FREE only lets the system take the pages under pressure, and they stay resident until then.
+        if (madvise(address, size, MADV_DONTNEED)) madvise(address, size, MADV_FREE);
+    }
+
+
+    uint64_t auto_date_now(void) {
+        static mach_timebase_info_data_t timebase;
+        if (!timebase.denom) mach_timebase_info(&timebase);
+        return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+    }
+
+};
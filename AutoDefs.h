@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoDefs.h
+    Common definitions, locks and auxiliary memory for the collector
+ */
+
+#ifndef __AUTO_DEFS__
+#define __AUTO_DEFS__
+
+// the collector is built against the new weak callback layout throughout.
+#ifndef AUTO_USE_NEW_WEAK_CALLBACK
+#define AUTO_USE_NEW_WEAK_CALLBACK
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <new>
+#include <malloc/malloc.h>
+
+namespace Auto {
+
+    //
+    // Basic types
+    //
+    typedef uintptr_t usword_t;                             // unsigned machine word
+    typedef intptr_t  sword_t;                              // signed machine word
+
+    //
+    // Sizing constants
+    //
+    enum {
+        bits_per_word_log2      = sizeof(usword_t) == 8 ? 6 : 5,
+        bits_per_word           = 1 << bits_per_word_log2,
+
+#if defined(__arm64__) || defined(__aarch64__)
+        page_size_log2          = 14,                       // 16K pages
+#else
+        page_size_log2          = 12,                       // 4K pages
+#endif
+        page_size               = 1 << page_size_log2,
+
+        allocate_quantum_log2   = 4,                        // all blocks are 16 byte aligned
+        allocate_quantum        = 1 << allocate_quantum_log2,
+
+        subzone_quantum_log2    = 20,                       // subzones are 1M and 1M aligned
+        subzone_quantum         = 1 << subzone_quantum_log2,
+
+#if defined(__LP64__)
+        region_subzone_count    = 256,                      // a region reserves 256M of address space
+#else
+        region_subzone_count    = 32,                       // a region reserves 32M of address space
+#endif
+
+        maximum_small_size      = 32768,                    // larger blocks are allocated page granular
+
+        card_size_log2          = 9,                        // write barrier granularity
+        card_size               = 1 << card_size_log2,
+        subzone_card_count      = subzone_quantum >> card_size_log2,
+    };
+
+
+    //
+    // Alignment helpers
+    //
+    inline usword_t align_down(usword_t value, usword_t alignment) { return value & ~(alignment - 1); }
+    inline usword_t align_up(usword_t value, usword_t alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+    inline void *displace(void *address, sword_t offset) { return (void *)((char *)address + offset); }
+    inline bool is_power_of_2(usword_t value) { return value && !(value & (value - 1)); }
+    inline usword_t ilog2(usword_t value) { return (bits_per_word - 1) - __builtin_clzl(value); }
+
+
+    //
+    // Locks
+    //
+    // spin_lock_t is used for short critical sections on allocation paths, pthread_mutex_t elsewhere.
+    // Neither may be taken by the collector while mutator threads are suspended unless it acquired
+    // the lock before suspending them.
+    //
+    typedef struct { volatile int32_t value; } spin_lock_t;
+    #define AUTO_SPIN_LOCK_INIT { 0 }
+
+    inline void spin_lock(spin_lock_t *lock) {
+        while (__atomic_exchange_n(&lock->value, 1, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&lock->value, __ATOMIC_RELAXED)) sched_yield();
+        }
+    }
+    inline bool spin_lock_try(spin_lock_t *lock) { return __atomic_exchange_n(&lock->value, 1, __ATOMIC_ACQUIRE) == 0; }
+    inline void spin_unlock(spin_lock_t *lock) { __atomic_store_n(&lock->value, 0, __ATOMIC_RELEASE); }
+
+    class SpinLock {
+        spin_lock_t *_lock;
+      public:
+        SpinLock(spin_lock_t *lock) : _lock(lock) { spin_lock(_lock); }
+        ~SpinLock() { spin_unlock(_lock); }
+    };
+
+    class Mutex {
+        pthread_mutex_t *_mutex;
+      public:
+        Mutex(pthread_mutex_t *mutex) : _mutex(mutex) { pthread_mutex_lock(_mutex); }
+        ~Mutex() { pthread_mutex_unlock(_mutex); }
+    };
+
+
+    //
+    // Auxiliary memory
+    //
+    // Collector data structures are allocated from a private malloc zone so that the collector never
+    // contends for a malloc lock held by a thread it has suspended.
+    //
+    extern malloc_zone_t *aux_zone;
+    void aux_init(void);
+
+    inline void *aux_malloc(size_t size) { return malloc_zone_malloc(aux_zone, size); }
+    inline void *aux_calloc(size_t count, size_t size) { return malloc_zone_calloc(aux_zone, count, size); }
+    inline void *aux_realloc(void *ptr, size_t size) { return malloc_zone_realloc(aux_zone, ptr, size); }
+    inline void aux_free(void *ptr) { malloc_zone_free(aux_zone, ptr); }
+
+    //
+    // AuxAllocator
+    //
+    // STL allocator that draws from the auxiliary zone.
+    //
+    template <typename T> struct AuxAllocator {
+        typedef T value_type;
+        typedef T *pointer;
+        typedef const T *const_pointer;
+        typedef T &reference;
+        typedef const T &const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+        template <typename U> struct rebind { typedef AuxAllocator<U> other; };
+
+        AuxAllocator() {}
+        template <typename U> AuxAllocator(const AuxAllocator<U> &) {}
+
+        T *allocate(size_t n, const void * = 0) { return (T *)aux_malloc(n * sizeof(T)); }
+        void deallocate(T *p, size_t) { aux_free(p); }
+        size_t max_size() const { return (size_t)-1 / sizeof(T); }
+        void construct(T *p, const T &value) { new ((void *)p) T(value); }
+        void destroy(T *p) { p->~T(); }
+        bool operator==(const AuxAllocator &) const { return true; }
+        bool operator!=(const AuxAllocator &) const { return false; }
+    };
+
+
+    //
+    // Virtual memory
+    //
+    void *allocate_memory(usword_t size, usword_t alignment = page_size);
+    void deallocate_memory(void *address, usword_t size);
+
+    //
+    // uncommit_memory
+    //
+    // Return whole pages whose contents no longer matter to the system at once, keeping them mapped.
+    //
+    void uncommit_memory(void *address, usword_t size);
+
+
+    //
+    // auto_date_now
+    //
+    // Current time in microseconds, the unit of auto_date_t.
+    //
+    uint64_t auto_date_now(void);
+
+
+    //
+    // decay_due
+    //
+    // Whether memory idle since the given date has been idle for decay microseconds by now.  If not,
+    // lowers next, 0 while nothing is pending, to when it will have been.
+    //
+    inline bool decay_due(uint64_t since, uint64_t now, uint64_t decay, uint64_t &next) {
+        if (since <= now && now - since >= decay) return true;
+        uint64_t due = since + decay < since ? ~(uint64_t)0 : since + decay;
+        if (!next || due < next) next = due;
+        return false;
+    }
+
+
+    //
+    // radix_sort
+    //
+    // Stable sort of count items by key(item) - bias, all below 2^key_bits, a digit at a time from the
+    // least significant.  scratch holds count items.  Allocates nothing.
+    //
+    template <typename T, usword_t (*key)(const T &)> void radix_sort(T *items, T *scratch, usword_t count, usword_t bias, usword_t key_bits) {
+        enum { digit_bits = 11, digit_count = 1 << digit_bits };
+        usword_t offsets[digit_count];
+        T *from = items, *to = scratch;
+        for (usword_t shift = 0; shift < key_bits && count; shift += digit_bits) {
+            bzero(offsets, sizeof(offsets));
+            for (usword_t i = 0; i < count; i++) offsets[((key(from[i]) - bias) >> shift) & (digit_count - 1)]++;
+            // a digit all items share leaves the order alone.
+            if (offsets[((key(from[0]) - bias) >> shift) & (digit_count - 1)] == count) continue;
+            for (usword_t d = 0, total = 0; d < digit_count; d++) {
+                usword_t n = offsets[d];
+                offsets[d] = total;
+                total += n;
+            }
+            for (usword_t i = 0; i < count; i++) to[offsets[((key(from[i]) - bias) >> shift) & (digit_count - 1)]++] = from[i];
+            T *swap = from;
+            from = to;
+            to = swap;
+        }
+        if (from != items) memcpy(items, from, count * sizeof(T));
+    }
+
+};
+
+#endif // __AUTO_DEFS__
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoHashTable.h
+    Open addressed pointer keyed hash map
+ */
+
+#ifndef __AUTO_HASH_TABLE__
+#define __AUTO_HASH_TABLE__
+
+#include "AutoDefs.h"
+
+namespace Auto {
+
+    //
+    // pointer_hash
+    //
+    // Mixes the significant bits of an address.
+    //
+    inline usword_t pointer_hash(const void *key) {
+        uint64_t h = (uint64_t)(usword_t)key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return (usword_t)h;
+    }
+
+
+    //
+    // PointerHashMap
+    //
+    // Linear probing map from non-NULL pointers to values, stored flat in auxiliary memory.  Removal
+    // shifts later entries of the probe sequence back, so there are no tombstones.  Not thread safe.
+    //
+    template <typename V> class PointerHashMap {
+
+      public:
+        struct Entry {
+            const void  *key;
+            V           value;
+        };
+
+      private:
+        Entry           *_entries;
+        usword_t        _capacity;                          // always a power of 2
+        usword_t        _count;
+
+        inline usword_t slot(const void *key) const { return pointer_hash(key) & (_capacity - 1); }
+
+        void grow() {
+            Entry *old_entries = _entries;
+            usword_t old_capacity = _capacity;
+            _capacity = old_capacity ? old_capacity * 2 : 16;
+            _entries = (Entry *)aux_calloc(_capacity, sizeof(Entry));
+            for (usword_t i = 0; i < old_capacity; i++) {
+                if (old_entries[i].key) {
+                    usword_t j = slot(old_entries[i].key);
+                    while (_entries[j].key) j = (j + 1) & (_capacity - 1);
+                    _entries[j] = old_entries[i];
+                }
+            }
+            if (old_entries) aux_free(old_entries);
+        }
+
+      public:
+        PointerHashMap() : _entries(NULL), _capacity(0), _count(0) {}
+        ~PointerHashMap() { if (_entries) aux_free(_entries); }
+
+        inline usword_t count() const { return _count; }
+        inline usword_t capacity() const { return _capacity; }
+        inline Entry *entries() const { return _entries; }
+
+        //
+        // clear
+        //
+        // Removes every entry, keeping the storage.
+        //
+        void clear() {
+            if (_entries) bzero(_entries, _capacity * sizeof(Entry));
+            _count = 0;
+        }
+
+        //
+        // find
+        //
+        // Returns the value's address, or NULL if the key is absent.
+        //
+        V *find(const void *key) const {
+            if (!_count) return NULL;
+            for (usword_t i = slot(key); _entries[i].key; i = (i + 1) & (_capacity - 1)) {
+                if (_entries[i].key == key) return &_entries[i].value;
+            }
+            return NULL;
+        }
+
+        //
+        // insert
+        //
+        // Adds or replaces the value for key.
+        //
+        void insert(const void *key, const V &value) {
+            if ((_count + 1) * 4 > _capacity * 3) grow();
+            usword_t i = slot(key);
+            while (_entries[i].key && _entries[i].key != key) i = (i + 1) & (_capacity - 1);
+            if (!_entries[i].key) _count++;
+            _entries[i].key = key;
+            _entries[i].value = value;
+        }
+
+        //
+        // remove
+        //
+        // Removes key if present, returning true if it was.
+        //
+        bool remove(const void *key) {
+            if (!_count) return false;
+            usword_t mask = _capacity - 1;
+            usword_t i = slot(key);
+            while (_entries[i].key != key) {
+                if (!_entries[i].key) return false;
+                i = (i + 1) & mask;
+            }
+            // backward shift: move up any entry whose probe sequence passes through the hole.
+            usword_t hole = i;
+            for (usword_t j = (i + 1) & mask; _entries[j].key; j = (j + 1) & mask) {
+                usword_t home = slot(_entries[j].key);
+                if (((j - home) & mask) >= ((j - hole) & mask)) {
+                    _entries[hole] = _entries[j];
+                    hole = j;
+                }
+            }
+            _entries[hole].key = NULL;
+            _count--;
+            return true;
+        }
+    };
+
+};
+
+#endif // __AUTO_HASH_TABLE__
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoHeapWalker.cpp
+    Heap walks for visitors, dumps and snapshots
+ */
+
+#include "AutoHeapWalker.h"
+#include "AutoLarge.h"
+#include "AutoLayout.h"
+#include "AutoRegion.h"
+#include "AutoScan.h"
+#include "AutoSubzone.h"
+#include "AutoThread.h"
+#include "AutoZone.h"
+
+#include <setjmp.h>
+
+namespace Auto {
+
+    void HeapWalker::suspend_threads(Zone *zone, Thread *current) {
+        // as for a collection, take every lock guarding what is reported before stopping anyone.
+        zone->lock_for_collection();
+        zone->weak_table().lock_all();
+        zone->retain_table().lock_all();
+        for (Thread *thread = zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread != current) thread->suspend();
+        }
+    }
+
+
+    void HeapWalker::resume_threads(Zone *zone, Thread *current) {
+        for (Thread *thread = zone->registered_threads(); thread; thread = thread->next()) {
+            if (thread != current) thread->resume();
+        }
+        zone->retain_table().unlock_all();
+        zone->weak_table().unlock_all();
+        zone->unlock_for_collection();
+    }
+
+
+    void HeapWalker::add_node(HeapVisitor &visitor, const void *address, usword_t size, auto_memory_type_t layout, usword_t refcount, bool is_local) {
+        auto_node_info_t &node = _nodes[_node_count];
+        node.address = address;
+        node.size = size;
+        node.type = layout;
+        node.refcount = (uint32_t)refcount;
+        node.is_thread_local = is_local;
+        if (++_node_count == node_batch) flush_nodes(visitor);
+    }
+
+
+    void HeapWalker::flush_nodes(HeapVisitor &visitor) {
+        if (_node_count && visitor.visit_nodes) visitor.visit_nodes(_nodes, _node_count, visitor.context);
+        _node_count = 0;
+    }
+
+
+    void HeapWalker::walk(HeapVisitor &visitor) {
+        // the caller's callee saved registers land in its stack range.
+        jmp_buf saved;
+        setjmp(saved);
+        Thread *current = _zone->current_thread();
+        suspend_threads(_zone, current);
+
+        if (visitor.visit_thread) {
+            for (Thread *thread = _zone->registered_threads(); thread; thread = thread->next()) {
+                auto_address_range_t stack = { NULL, thread->stack_base() }, registers = { NULL, NULL };
+                if (thread == current) {
+                    stack.begin = (void *)&saved;
+                } else if (thread->is_suspended()) {
+                    stack.begin = thread->stack_pointer();
+                    registers.begin = thread->registers();
+                    registers.end = thread->registers() + thread->register_count();
+                } else {
+                    continue;
+                }
+                visitor.visit_thread(thread, stack, registers, visitor.context);
+            }
+        }
+
+        if (visitor.visit_nodes) {
+            RetainTable &retain_table = _zone->retain_table();
+            for (Region *region = _zone->region_list(); region; region = region->next()) {
+                for (usword_t i = 0; i < region_subzone_count; i++) {
+                    Subzone *subzone = region->subzone_at(i);
+                    if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                    Bitmap &allocated = subzone->allocated_bitmap();
+                    for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                        for (usword_t bits = allocated.word(w); bits; bits &= bits - 1) {
+                            usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                            void *address = subzone->block_address(index);
+                            usword_t refcount = subzone->refcount(index);
+                            if (refcount == RetainTable::overflowed) refcount = retain_table.overflowed_count(address);
+                            add_node(visitor, address, subzone->block_size(), subzone->layout(index), refcount, subzone->is_local(index));
+                        }
+                    }
+                }
+            }
+            for (Large *large = _zone->large_list(); large; large = large->next()) {
+                add_node(visitor, large->address(), large->size(), large->layout(), large->refcount(), false);
+            }
+            flush_nodes(visitor);
+        }
+
+        RootTable::Snapshot *snapshot = _zone->roots().snapshot();
+        for (usword_t i = 0, count = snapshot ? snapshot->count : 0; i < count; i++) {
+            RootTable::Interval &interval = snapshot->intervals[i];
+            if (interval.kind == RootTable::explicit_root) {
+                if (visitor.visit_root) visitor.visit_root((const void **)interval.start, visitor.context);
+            } else if (visitor.visit_datasegment) {
+                auto_address_range_t segment = { (void *)interval.start, (void *)interval.end };
+                visitor.visit_datasegment(segment, visitor.context);
+            }
+        }
+
+        if (visitor.visit_weak) _zone->weak_table().visit(visitor.visit_weak, visitor.context);
+        if (visitor.visit_association) _zone->associations().visit(visitor.visit_association, visitor.context);
+
+        resume_threads(_zone, current);
+    }
+
+
+    void HeapWalker::scan_references(Zone *zone, void *start, void *limit, const CompiledLayout *compiled, reference_t reference, void *context) {
+        void **base = (void **)start, **p = base, **end = (void **)align_down((usword_t)limit, sizeof(void *));
+        usword_t heap_min = zone->heap_min(), heap_span = zone->heap_max() - heap_min;
+        void **survivors[scan_batch_words];
+        // the strong runs of the words the layout describes, then every word past them.
+        usword_t run = 0;
+        while (p < end) {
+            void **run_end = end;
+            if (compiled && p < base + compiled->covered) {
+                if (run == compiled->run_count) {
+                    p = base + compiled->covered;
+                    continue;
+                }
+                const LayoutRun &next = compiled->runs[run++];
+                p = base + next.start;
+                run_end = base + next.start + next.count;
+                if (run_end > end) run_end = end;
+            }
+            while (p < run_end) {
+                usword_t count = run_end - p < scan_batch_words ? run_end - p : scan_batch_words;
+                usword_t found = filter_candidates(p, count, heap_min, heap_span, survivors);
+                p += count;
+                for (usword_t i = 0; i < found; i++) {
+                    void *block = zone->block_start(*survivors[i]);
+                    if (block) reference((usword_t)survivors[i] - (usword_t)start, *survivors[i], block, context);
+                }
+            }
+        }
+    }
+
+};
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoHeapWalker.h
+    Heap walks for visitors, dumps and snapshots
+ */
+
+#ifndef __AUTO_HEAP_WALKER__
+#define __AUTO_HEAP_WALKER__
+
+#include "AutoDefs.h"
+#include "AutoAssociations.h"
+#include "AutoWeak.h"
+#include "auto_zone.h"
+
+namespace Auto {
+
+    struct CompiledLayout;
+    class Thread;
+    class Zone;
+
+    //
+    // HeapVisitor
+    //
+    // What a heap walk reports, as functions called with context.  Any may be NULL.  They run with
+    // the world stopped and the zone's tables locked, so they must not allocate from the zone, retain,
+    // release or touch weak references or associations.
+    //
+    struct HeapVisitor {
+        void    *context;
+        void    (*visit_thread)(Thread *thread, auto_address_range_t stack, auto_address_range_t registers, void *context);
+        void    (*visit_nodes)(const auto_node_info_t *nodes, usword_t count, void *context);
+        void    (*visit_root)(const void **root, void *context);
+        void    (*visit_datasegment)(auto_address_range_t segment, void *context);
+        WeakTable::visitor_t visit_weak;
+        AssociationTable::visitor_t visit_association;
+    };
+
+
+    //
+    // HeapWalker
+    //
+    // Stops the world and reports the threads, the blocks, the roots, the weak references and the
+    // associations of a zone.  Blocks are read straight from the subzone bitmaps and side data and
+    // handed over node_batch at a time.  Runs with the collection mutex held, after sweeping, so that
+    // every allocated block is live or at least not yet known to be garbage.
+    //
+    class HeapWalker {
+
+      public:
+        enum {
+            node_batch = 256,                               // nodes per visit_nodes call
+        };
+
+        //
+        // reference_t
+        //
+        // Called with the byte offset of a word within the scanned memory, its value and the block the
+        // value points into.
+        //
+        typedef void (*reference_t)(usword_t offset, void *value, void *block, void *context);
+
+      private:
+        Zone            *_zone;
+        auto_node_info_t _nodes[node_batch];
+        usword_t        _node_count;
+
+        void add_node(HeapVisitor &visitor, const void *address, usword_t size, auto_memory_type_t layout, usword_t refcount, bool is_local);
+        void flush_nodes(HeapVisitor &visitor);
+
+      public:
+        HeapWalker(Zone *zone) : _zone(zone), _node_count(0) {}
+
+        //
+        // walk
+        //
+        // Report everything to visitor.
+        //
+        void walk(HeapVisitor &visitor);
+
+        //
+        // suspend_threads, resume_threads
+        //
+        // Take every lock guarding what a walk reports and stop every registered thread but current,
+        // and undo that.  Called with the collection mutex held.
+        //
+        static void suspend_threads(Zone *zone, Thread *current);
+        static void resume_threads(Zone *zone, Thread *current);
+
+        //
+        // scan_references
+        //
+        // Report the words of [start, limit) that refer to blocks, scanning only the strong runs of
+        // compiled, if given, over the words it describes.  start is the block's address when compiled
+        // is given.
+        //
+        static void scan_references(Zone *zone, void *start, void *limit, const CompiledLayout *compiled, reference_t reference, void *context);
+    };
+
+};
+
+#endif // __AUTO_HEAP_WALKER__
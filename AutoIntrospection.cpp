@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoIntrospection.cpp
+    Malloc zone enumeration
+ */
+
+#include "AutoIntrospection.h"
+#include "AutoLarge.h"
+#include "AutoRegion.h"
+#include "AutoSubzone.h"
+#include "AutoZone.h"
+
+namespace Auto {
+
+    static kern_return_t read_local(task_t task, vm_address_t address, vm_size_t size, void **local) {
+        *local = (void *)address;
+        return KERN_SUCCESS;
+    }
+
+
+    //
+    // nonzero_bytes
+    //
+    // A bit per byte of the 8 at bytes, bit i set if byte i is nonzero.
+    //
+    static inline usword_t nonzero_bytes(const unsigned char *bytes) {
+        uint64_t x;
+        memcpy(&x, bytes, sizeof(x));
+        // sets the high bit of each byte that has any bit set, with no carry between bytes.
+        x = (x | ((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL)) & 0x8080808080808080ULL;
+        // gathers the high bits into the top byte.
+        return (usword_t)(((x >> 7) * 0x0102040810204080ULL) >> 56);
+    }
+
+
+    //
+    // RangeBatch
+    //
+    // Ranges of one type on their way to the recorder, batch_size at a time.  Adjacent ranges are
+    // merged if coalesce is set.
+    //
+    class RangeBatch {
+        enum {
+            batch_size = 512,
+        };
+
+        task_t          _task;
+        void            *_context;
+        vm_range_recorder_t *_recorder;
+        unsigned        _type;
+        bool            _coalesce;
+        usword_t        _count;
+        vm_range_t      _ranges[batch_size];
+
+      public:
+        RangeBatch(task_t task, void *context, vm_range_recorder_t *recorder, unsigned type, bool coalesce)
+            : _task(task), _context(context), _recorder(recorder), _type(type), _coalesce(coalesce), _count(0) {}
+
+        inline void add(usword_t address, usword_t size) {
+            if (_coalesce && _count && _ranges[_count - 1].address + _ranges[_count - 1].size == address) {
+                _ranges[_count - 1].size += size;
+                return;
+            }
+            if (_count == batch_size) flush();
+            _ranges[_count].address = address;
+            _ranges[_count].size = size;
+            _count++;
+        }
+
+        void flush() {
+            if (_count) _recorder(_task, _context, _type, _ranges, (unsigned)_count);
+            _count = 0;
+        }
+    };
+
+
+    //
+    // ZoneEnumerator
+    //
+    // Walks the regions and large blocks of a zone through a memory reader.  A reader may reuse its
+    // buffer on the next read, so whatever a read returns is used up before the next one.
+    //
+    class ZoneEnumerator {
+        task_t          _task;
+        memory_reader_t *_reader;
+        unsigned        _type_mask;
+        bool            _retained_only;
+        usword_t        _sweep_epoch;                       // of the zone, to find unswept garbage
+        bool            _sweeping_enabled;
+        bool            _sweep_generational;
+        RangeBatch      _in_use;
+        RangeBatch      _regions;
+        RangeBatch      _admin;
+
+        template <typename T> inline kern_return_t read(usword_t address, usword_t size, T *&local) {
+            return _reader(_task, (vm_address_t)address, (vm_size_t)size, (void **)&local);
+        }
+
+        //
+        // retained_mask
+        //
+        // A bit per block of the bitmap word starting at block first, set if the block's reference
+        // count is nonzero, 8 blocks at a time.
+        //
+        static usword_t retained_mask(const unsigned char *refcounts, usword_t first, usword_t count) {
+            const unsigned char *bytes = refcounts + first;
+            unsigned char tail[bits_per_word];
+            if (first + bits_per_word > count) {
+                // the last word of the bitmap covers refcounts past the table.
+                bzero(tail, sizeof(tail));
+                memcpy(tail, bytes, count - first);
+                bytes = tail;
+            }
+            usword_t mask = 0;
+            for (usword_t i = 0; i < bits_per_word; i += 8) mask |= nonzero_bytes(bytes + i) << i;
+            return mask;
+        }
+
+        kern_return_t enumerate_subzone(usword_t address) {
+            if (_type_mask & MALLOC_PTR_REGION_RANGE_TYPE) _regions.add(address, subzone_quantum);
+            if (!(_type_mask & (MALLOC_PTR_IN_USE_RANGE_TYPE | MALLOC_ADMIN_REGION_RANGE_TYPE))) return KERN_SUCCESS;
+            Subzone *subzone;
+            kern_return_t err = read(address, sizeof(Subzone), subzone);
+            if (err) return err;
+            // a subzone just taken from its region has no header yet.
+            if (!subzone->is_initialized()) return KERN_SUCCESS;
+
+            // one read covers the header and the side tables.
+            usword_t metadata_size = (usword_t)subzone->first_block() - address;
+            if ((err = read(address, metadata_size, subzone))) return err;
+            if (_type_mask & MALLOC_ADMIN_REGION_RANGE_TYPE) _admin.add(address, metadata_size);
+            if (!(_type_mask & MALLOC_PTR_IN_USE_RANGE_TYPE)) return KERN_SUCCESS;
+
+            usword_t local = (usword_t)subzone - address;
+            const usword_t *allocated = (const usword_t *)((usword_t)subzone->allocated_bitmap().address() + local);
+            const usword_t *marks = (const usword_t *)((usword_t)subzone->mark_bitmap().address() + local);
+            const unsigned char *side_data = subzone->side_data_address(0) + local;
+            const unsigned char *refcounts = subzone->refcount_address(0) + local;
+            usword_t count = subzone->block_count(), block_size = subzone->block_size(), start = (usword_t)subzone->first_block();
+            bool unswept = subzone->swept_epoch() != _sweep_epoch && _sweeping_enabled;
+            for (usword_t w = 0, words = Bitmap::words_for_bits(count); w < words; w++) {
+                usword_t bits = allocated[w];
+                if (!bits) continue;
+                if (unswept) {
+                    // unmarked blocks are garbage, as Admin::sweep() would find them.
+                    for (usword_t garbage = bits & ~marks[w]; garbage; garbage &= garbage - 1) {
+                        usword_t bit = __builtin_ctzl(garbage);
+                        unsigned char side = side_data[(w << bits_per_word_log2) + bit];
+                        if (_sweep_generational && !(side & side_age_mask)) continue;
+                        if (side & side_local) continue;
+                        bits &= ~((usword_t)1 << bit);
+                    }
+                }
+                if (_retained_only && bits) bits &= retained_mask(refcounts, w << bits_per_word_log2, count);
+                while (bits) {
+                    usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                    bits &= bits - 1;
+                    _in_use.add(start + index * block_size, block_size);
+                }
+            }
+            return KERN_SUCCESS;
+        }
+
+      public:
+        ZoneEnumerator(task_t task, void *context, unsigned type_mask, memory_reader_t *reader, vm_range_recorder_t *recorder)
+            : _task(task), _reader(reader ? reader : read_local), _type_mask(type_mask), _retained_only((type_mask & AUTO_RETAINED_BLOCK_TYPE) != 0),
+              _sweep_epoch(0), _sweeping_enabled(false), _sweep_generational(false),
+              _in_use(task, context, recorder, MALLOC_PTR_IN_USE_RANGE_TYPE, false),
+              _regions(task, context, recorder, MALLOC_PTR_REGION_RANGE_TYPE, true),
+              _admin(task, context, recorder, MALLOC_ADMIN_REGION_RANGE_TYPE, false) {}
+
+        kern_return_t enumerate(usword_t zone_address) {
+            Zone *zone;
+            kern_return_t err = read(zone_address, sizeof(Zone), zone);
+            if (err) return err;
+            _sweep_epoch = zone->sweep_epoch();
+            _sweeping_enabled = zone->is_sweeping_enabled();
+            _sweep_generational = zone->sweep_generational();
+            usword_t region_address = (usword_t)zone->region_list(), large_address = (usword_t)zone->large_list();
+
+            while (region_address) {
+                Region *region;
+                if ((err = read(region_address, sizeof(Region), region))) return err;
+                usword_t address = region->address();
+                usword_t in_use[(region_subzone_count + bits_per_word - 1) / bits_per_word];
+                memcpy(in_use, region->in_use_words(), sizeof(in_use));
+                region_address = (usword_t)region->next();
+                for (usword_t w = 0; w < sizeof(in_use) / sizeof(usword_t); w++) {
+                    for (usword_t bits = in_use[w]; bits; bits &= bits - 1) {
+                        usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                        if ((err = enumerate_subzone(address + (index << subzone_quantum_log2)))) return err;
+                    }
+                }
+            }
+
+            while (large_address && (_type_mask & (MALLOC_PTR_IN_USE_RANGE_TYPE | MALLOC_PTR_REGION_RANGE_TYPE))) {
+                Large *large;
+                if ((err = read(large_address, sizeof(Large), large))) return err;
+                if ((_type_mask & MALLOC_PTR_IN_USE_RANGE_TYPE) && (!_retained_only || large->refcount())) _in_use.add((usword_t)large->address(), large->size());
+                if (_type_mask & MALLOC_PTR_REGION_RANGE_TYPE) _regions.add((usword_t)large->address(), large->vm_size());
+                large_address = (usword_t)large->next();
+            }
+
+            // batches of types not asked for stay empty.
+            _in_use.flush();
+            _regions.flush();
+            _admin.flush();
+            return KERN_SUCCESS;
+        }
+    };
+
+
+    kern_return_t enumerate_zone(task_t task, void *context, unsigned type_mask, vm_address_t zone_address, memory_reader_t reader, vm_range_recorder_t recorder) {
+        ZoneEnumerator enumerator(task, context, type_mask, reader, recorder);
+        return enumerator.enumerate(zone_address);
+    }
+
+};
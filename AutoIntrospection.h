@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoIntrospection.h
+    Malloc zone enumeration
+ */
+
+#ifndef __AUTO_INTROSPECTION__
+#define __AUTO_INTROSPECTION__
+
+#include "AutoDefs.h"
+
+namespace Auto {
+
+    //
+    // enumerate_zone
+    //
+    // The enumerator of the zone's malloc introspection.  Reports, in batches, the blocks in use,
+    // the subzones and large block mappings as regions, and the subzone side tables as admin
+    // ranges, as type_mask selects.  With AUTO_RETAINED_BLOCK_TYPE only blocks with a nonzero
+    // retain count are in use.  Everything is read through reader, from task if the zone is
+    // another task's, and the caller makes sure the zone does not change meanwhile: the task is
+    // suspended or the zone force locked.  Garbage the last collection left unswept is not in use.
+    //
+    kern_return_t enumerate_zone(task_t task, void *context, unsigned type_mask, vm_address_t zone_address, memory_reader_t reader, vm_range_recorder_t recorder);
+
+};
+
+#endif // __AUTO_INTROSPECTION__
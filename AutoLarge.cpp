@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoLarge.cpp
+    Page granular blocks
+ */
+
+#include "AutoLarge.h"
+
+namespace Auto {
+
+    Large *Large::allocate(usword_t size, auto_memory_type_t layout, usword_t refcount, void *pages, usword_t pages_size) {
+        usword_t vm_size = pages ? pages_size : align_up(size, page_size);
+        void *address = pages ? pages : allocate_memory(vm_size);
+        if (!address) return NULL;
+        // the card table follows the descriptor.
+        size = align_up(size, allocate_quantum);
+        Large *large = (Large *)aux_calloc(1, sizeof(Large) + ((size + card_size - 1) >> card_size_log2));
+        if (!large) {
+            if (!pages) deallocate_memory(address, vm_size);
+            return NULL;
+        }
+        // kept pages hold whatever the last block left, purged or not.
+        if (pages) bzero(address, size);
+        large->_address = address;
+        large->_size = size;
+        large->_cards = (unsigned char *)(large + 1);
+        large->_vm_size = vm_size;
+        large->_refcount = (uint32_t)refcount;
+        large->_side_data = side_data_for(layout);
+        return large;
+    }
+
+
+    void Large::deallocate() {
+        deallocate_memory(_address, _vm_size);
+        aux_free(this);
+    }
+
+
+    void Large::destroy() {
+        aux_free(this);
+    }
+
+};
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoLarge.h
+    Page granular blocks
+ */
+
+#ifndef __AUTO_LARGE__
+#define __AUTO_LARGE__
+
+#include "AutoDefs.h"
+#include "AutoSubzone.h"
+
+namespace Auto {
+
+    //
+    // Large
+    //
+    // Descriptor of a block too big for any size class.  The block itself is a page aligned, page
+    // granular mapping; the descriptor, holding the same metadata a subzone keeps in its side tables,
+    // lives in auxiliary memory so the block's pages are touched only by its owner.
+    //
+    class Large {
+
+      private:
+        Large           *_prev;                             // zone's list of large blocks
+        Large           *_next;
+        void            *_address;                          // the block
+        usword_t        _size;                              // allocation size, quantum rounded
+        usword_t        _vm_size;                           // mapped size, page rounded
+        uint32_t        _refcount;
+        unsigned char   _side_data;                         // same encoding as subzone side data
+        bool            _marked;
+        bool            _shared;                            // see Subzone
+        bool            _uncounted;                         // see Subzone
+        bool            _weak;                              // see Subzone
+        unsigned char   *_cards;                            // one per card_size bytes of the block
+
+      public:
+
+        //
+        // allocate
+        //
+        // Make a zero filled block and its descriptor, in pages_size bytes of pages kept from a block
+        // freed earlier if pages is given, else in a new mapping.  Returns NULL on failure, leaving any
+        // pages given alone.
+        //
+        static Large *allocate(usword_t size, auto_memory_type_t layout, usword_t refcount, void *pages = NULL, usword_t pages_size = 0);
+
+        //
+        // deallocate
+        //
+        // Unmap the block and free the descriptor.
+        //
+        void deallocate();
+
+        //
+        // destroy
+        //
+        // Free the descriptor only; the caller keeps the block's pages.
+        //
+        void destroy();
+
+        //
+        // Accessors
+        //
+        inline Large *prev() const { return _prev; }
+        inline Large *next() const { return _next; }
+        inline void set_prev(Large *prev) { _prev = prev; }
+        inline void set_next(Large *next) { _next = next; }
+        inline void *address() const { return _address; }
+        inline usword_t size() const { return _size; }
+        inline usword_t vm_size() const { return _vm_size; }
+        inline bool in_block(const void *address) const { return (usword_t)address - (usword_t)_address < _size; }
+
+        inline unsigned char side_data() const { return _side_data; }
+        inline auto_memory_type_t layout() const { return _side_data & side_layout_mask; }
+        inline void set_layout(auto_memory_type_t layout) { side_set_layout(&_side_data, layout); }
+        inline usword_t age() const { return (_side_data & side_age_mask) >> side_age_shift; }
+        inline bool is_young() const { return (_side_data & side_age_mask) != 0; }
+        inline void mature() { side_mature(&_side_data); }
+        inline bool is_finalized() const { return (_side_data & side_finalized) != 0; }
+        inline void set_finalized() { side_set(&_side_data, side_finalized); }
+
+        inline uint32_t *refcount_address() { return &_refcount; }
+        inline usword_t refcount() const { return _refcount; }
+        inline void set_refcount(usword_t refcount) { _refcount = (uint32_t)refcount; }
+
+        inline usword_t card_count() const { return (_size + card_size - 1) >> card_size_log2; }
+        inline usword_t card_index(const void *address) const { return ((usword_t)address - (usword_t)_address) >> card_size_log2; }
+        inline void *card_address(usword_t card) const { return displace(_address, card << card_size_log2); }
+        inline unsigned char card(usword_t card) const { return _cards[card]; }
+        inline void dirty_card(const void *address) { _cards[card_index(address)] = card_dirty; }
+        inline void mark_card(const void *address, unsigned char bits) { __atomic_fetch_or(_cards + card_index(address), bits, __ATOMIC_RELAXED); }
+        inline void mark_cards(const void *address, usword_t size) {
+            memset(_cards + card_index(address), card_dirty, card_index((void *)((usword_t)address + size - 1)) - card_index(address) + 1);
+        }
+        inline void clear_card(usword_t card, unsigned char bits) { _cards[card] &= ~bits; }
+        inline void clear_cards() { bzero(_cards, card_count()); }
+        inline void clear_cards(unsigned char bits) { for (usword_t i = 0, count = card_count(); i < count; i++) _cards[i] &= ~bits; }
+
+        inline bool is_marked() const { return _marked; }
+        inline bool test_set_mark() { return !__atomic_exchange_n(&_marked, true, __ATOMIC_RELAXED); }
+        inline bool test_clear_mark() { return __atomic_exchange_n(&_marked, false, __ATOMIC_RELAXED); }
+        inline void clear_mark() { _marked = false; }
+        inline bool is_shared() const { return _shared; }
+        inline void set_shared() { _shared = true; }
+        inline void clear_shared() { _shared = false; }
+        inline void set_uncounted() { _uncounted = true; }
+        inline bool test_clear_uncounted() { bool uncounted = _uncounted; _uncounted = false; return uncounted; }
+        inline bool has_weak_locations() const { return _weak; }
+        inline void set_weak_locations() { if (!_weak) _weak = true; }
+    };
+
+};
+
+#endif // __AUTO_LARGE__
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoLayout.cpp
+    Compiled layout maps for exact scanning
+ */
+
+#include "AutoLayout.h"
+#include "AutoZone.h"
+
+namespace Auto {
+
+    //
+    // map_words
+    //
+    // Number of words a layout map describes.
+    //
+    static usword_t map_words(const unsigned char *map) {
+        usword_t words = 0;
+        if (map) for ( ; *map; map++) words += (*map >> 4) + (*map & 0x0f);
+        return words;
+    }
+
+
+    CompiledLayout *CompiledLayout::compile(const unsigned char *strong, const unsigned char *weak) {
+        usword_t strong_words = map_words(strong), weak_words = map_words(weak);
+        usword_t covered = strong_words > weak_words ? strong_words : weak_words;
+
+        // no run is longer than 15 words or preceded by nothing, so a map byte makes at most one run.
+        usword_t capacity = strong ? strlen((const char *)strong) : 0;
+        CompiledLayout *layout = (CompiledLayout *)aux_malloc(sizeof(CompiledLayout) + (capacity ? capacity - 1 : 0) * sizeof(LayoutRun));
+        if (!layout) return NULL;
+        layout->covered = covered;
+        layout->run_count = 0;
+        usword_t word = 0;
+        if (strong) {
+            for ( ; *strong; strong++) {
+                word += *strong >> 4;
+                usword_t count = *strong & 0x0f;
+                if (!count) continue;
+                // adjacent map bytes without a skip extend the same run.
+                LayoutRun *last = layout->run_count ? &layout->runs[layout->run_count - 1] : NULL;
+                if (last && last->start + last->count == word) {
+                    last->count += (uint32_t)count;
+                } else {
+                    LayoutRun &run = layout->runs[layout->run_count++];
+                    run.start = (uint32_t)word;
+                    run.count = (uint32_t)count;
+                }
+                word += count;
+            }
+        }
+        return layout;
+    }
+
+
+    const CompiledLayout *LayoutCache::find(const void *isa) {
+        SpinLock lock(&_lock);
+        CompiledLayout **layout = _layouts.find(isa);
+        return layout ? *layout : NULL;
+    }
+
+
+    const CompiledLayout *LayoutCache::layout_for(Zone *zone, void *object) {
+        const void *isa = *(void **)object;
+        if (!isa) return NULL;
+        const CompiledLayout *cached = find(isa);
+        if (cached) return cached;
+
+        auto_collection_control_t *control = zone->control();
+        if (!control->layout_for_address) return NULL;
+        const unsigned char *strong = control->layout_for_address(zone->basic_zone(), object);
+        const unsigned char *weak = control->weak_layout_for_address ? control->weak_layout_for_address(zone->basic_zone(), object) : NULL;
+        CompiledLayout *layout = CompiledLayout::compile(strong, weak);
+        if (!layout) return NULL;
+
+        SpinLock lock(&_lock);
+        CompiledLayout **existing = _layouts.find(isa);
+        if (existing) {
+            // compiled by another thread meanwhile.
+            aux_free(layout);
+            return *existing;
+        }
+        _layouts.insert(isa, layout);
+        return layout;
+    }
+
+};
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoLayout.h
+    Compiled layout maps for exact scanning
+ */
+
+#ifndef __AUTO_LAYOUT__
+#define __AUTO_LAYOUT__
+
+#include "AutoDefs.h"
+#include "AutoHashTable.h"
+#include "auto_zone.h"
+
+namespace Auto {
+
+    class Zone;
+
+    //
+    // is_exactly_scanned
+    //
+    // Whether blocks of the layout are scanned through their class's layout maps.
+    //
+    inline bool is_exactly_scanned(auto_memory_type_t layout) { return (layout & (AUTO_OBJECT | AUTO_UNSCANNED)) == AUTO_OBJECT; }
+
+
+    //
+    // LayoutRun
+    //
+    // Consecutive strong words of an object, in words from its start.
+    //
+    struct LayoutRun {
+        uint32_t        start;
+        uint32_t        count;
+    };
+
+
+    //
+    // CompiledLayout
+    //
+    // The strong and weak layout maps of a class reduced to the runs of words to scan.  Words past
+    // those the maps describe are scanned like conservative memory; weak words are never scanned.
+    //
+    struct CompiledLayout {
+        usword_t        covered;                            // words described by the maps
+        usword_t        run_count;
+        LayoutRun       runs[1];                            // run_count runs, in address order
+
+        //
+        // compile
+        //
+        // Build the runs from a strong and a weak layout map, either of which may be NULL.  Each map
+        // byte skips its high nibble of words, then lists its low nibble of words; 0 ends the map.
+        //
+        static CompiledLayout *compile(const unsigned char *strong, const unsigned char *weak);
+    };
+
+
+    //
+    // LayoutCache
+    //
+    // Compiled layouts by class.  The class of an object is its first word, so looking up a layout
+    // costs no call into the runtime once its class has been seen.  Layouts live as long as the zone.
+    //
+    class LayoutCache {
+        spin_lock_t     _lock;
+        PointerHashMap<CompiledLayout *> _layouts;          // isa -> layout
+
+      public:
+        LayoutCache() { _lock.value = 0; }
+
+        //
+        // find
+        //
+        // Returns the cached layout of objects of class isa, or NULL if there is none yet.
+        //
+        const CompiledLayout *find(const void *isa);
+
+        //
+        // layout_for
+        //
+        // Returns the layout of object, compiling and caching it on first sight of its class.  Returns
+        // NULL if the object has no class yet or the runtime supplies no layouts, in which case it is
+        // scanned conservatively.  May call into the runtime.
+        //
+        const CompiledLayout *layout_for(Zone *zone, void *object);
+
+        inline void lock() { spin_lock(&_lock); }
+        inline void unlock() { spin_unlock(&_lock); }
+    };
+
+};
+
+#endif // __AUTO_LAYOUT__
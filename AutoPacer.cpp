@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoPacer.cpp
+    Collection pacing
+ */
+
+#include "AutoPacer.h"
+
+namespace Auto {
+
+    void Pacer::initialize(usword_t threshold) {
+        _trigger = threshold;
+        _live = 0;
+        _last_finished = auto_date_now();
+        _in_use_at_start = 0;
+        _started = 0;
+        _allocation_rate = 0;
+        _collection_time = 0;
+        _survival_percent = 0;
+        _poll_interval = minimum_poll_interval;
+        _next_poll = 0;
+    }
+
+
+    bool Pacer::poll_due(uint64_t now) {
+        uint64_t next = __atomic_load_n(&_next_poll, __ATOMIC_RELAXED);
+        if (now < next) return false;
+        // one caller wins the poll.
+        return __atomic_compare_exchange_n(&_next_poll, &next, now + _poll_interval, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+
+    void Pacer::collection_started(usword_t in_use, uint64_t now) {
+        _in_use_at_start = in_use;
+        _started = now;
+    }
+
+
+    void Pacer::collection_finished(bool generational, usword_t in_use, usword_t freed, uint64_t duration, uint64_t now,
+                                    const auto_collection_control_t &control) {
+        if (_started) {
+            // frees outside collections make the net allocation an underestimate, never negative.
+            usword_t allocated = _in_use_at_start > _live ? _in_use_at_start - _live : 0;
+            uint64_t mutator_time = _started > _last_finished ? _started - _last_finished : 0;
+            if (mutator_time) _allocation_rate = smooth(_allocation_rate, (uint64_t)allocated * 1000000 / mutator_time);
+            _collection_time = smooth(_collection_time, duration);
+            // a generational collection only looks at what was allocated since the last one.
+            if (generational && allocated) {
+                usword_t survived = freed < allocated ? allocated - freed : 0;
+                _survival_percent = (usword_t)smooth(_survival_percent, (uint64_t)survived * 100 / allocated);
+            } else if (!generational) {
+                _survival_percent = 0;
+            }
+            _started = 0;
+        }
+        _live = in_use;
+        _last_finished = now;
+
+        // let the heap grow by the target ratio.
+        usword_t growth_percent = control.heap_growth_percent ? control.heap_growth_percent : default_heap_growth_percent;
+        uint64_t allowance = (uint64_t)in_use * growth_percent / 100;
+
+        // but not if collecting would then take too much of the time: the mutator must run for the
+        // collection time scaled by (100 - cpu) / cpu, and allocates at the observed rate meanwhile.
+        usword_t cpu_percent = control.collection_cpu_percent ? control.collection_cpu_percent : default_collection_cpu_percent;
+        if (cpu_percent < 100) {
+            uint64_t mutator_time = _collection_time * (100 - cpu_percent) / cpu_percent;
+            uint64_t paced = mutator_time / 1000 * _allocation_rate / 1000;
+            if (paced > 2 * allowance) paced = 2 * allowance;
+            if (paced > allowance) allowance = paced;
+        }
+        if (allowance < control.collection_threshold) allowance = control.collection_threshold;
+        __atomic_store_n(&_trigger, in_use + (usword_t)allowance, __ATOMIC_RELAXED);
+
+        // poll trackers about as often as collections are expected.
+        uint64_t interval = _allocation_rate ? allowance * 1000 / _allocation_rate * 1000 : maximum_poll_interval;
+        if (interval < minimum_poll_interval) interval = minimum_poll_interval;
+        if (interval > maximum_poll_interval) interval = maximum_poll_interval;
+        _poll_interval = interval;
+    }
+
+};
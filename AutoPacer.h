@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoPacer.h
+    Collection pacing
+ */
+
+#ifndef __AUTO_PACER__
+#define __AUTO_PACER__
+
+#include "auto_zone.h"
+#include "AutoDefs.h"
+
+namespace Auto {
+
+    //
+    // Pacer
+    //
+    // Decides when a conditional collection is due.  Each collection reports how much was allocated
+    // since the previous one, how long that took, how long collecting took and how much survived; the
+    // pacer smooths these over recent cycles and sets the bytes in use at which the next collection
+    // is due.  The trigger lets the heap grow by heap_growth_percent over the live data, unless
+    // collecting that often would take more than collection_cpu_percent of the time, in which case it
+    // lets the heap grow further, up to twice as far.  It is never closer than collection_threshold.
+    //
+    // Only the collecting thread reports collections; the trigger is read without locking.
+    //
+    class Pacer {
+
+      public:
+        enum {
+            default_heap_growth_percent = 100,
+            default_collection_cpu_percent = 10,
+            minimum_poll_interval = 10 * 1000,              // microseconds between resource tracker polls
+            maximum_poll_interval = 1000 * 1000,
+            full_collection_survival_percent = 50,          // generational collections that keep more are not worth it
+        };
+
+      private:
+        usword_t        _trigger;                           // bytes in use at which a conditional collection is due
+        usword_t        _live;                              // bytes in use after the last collection
+        uint64_t        _last_finished;                     // auto_date_now() when the last collection finished
+        usword_t        _in_use_at_start;                   // bytes in use when the current collection started
+        uint64_t        _started;                           // auto_date_now() then, or 0 if not measuring this cycle
+        uint64_t        _allocation_rate;                   // bytes allocated per second of mutator time, smoothed
+        uint64_t        _collection_time;                   // microseconds per collection, smoothed
+        usword_t        _survival_percent;                  // of the bytes allocated between collections, smoothed
+        uint64_t        _poll_interval;                     // microseconds between resource tracker polls
+        uint64_t        _next_poll;                         // auto_date_now() when trackers may be polled again
+
+        //
+        // smooth
+        //
+        // Fold a sample into a running average that weighs recent cycles most.
+        //
+        static inline uint64_t smooth(uint64_t average, uint64_t sample) { return average ? (3 * average + sample) / 4 : sample; }
+
+      public:
+
+        //
+        // initialize
+        //
+        // Start out collecting once the threshold has been allocated.
+        //
+        void initialize(usword_t threshold);
+
+        //
+        // Accessors
+        //
+        inline usword_t trigger() const { return __atomic_load_n(&_trigger, __ATOMIC_RELAXED); }
+        inline uint64_t allocation_rate() const { return _allocation_rate; }
+        inline uint64_t collection_time() const { return _collection_time; }
+        inline usword_t survival_percent() const { return _survival_percent; }
+
+        //
+        // collection_due
+        //
+        // True if a conditional collection should run with this many bytes in use.
+        //
+        inline bool collection_due(usword_t in_use) const { return in_use >= trigger(); }
+
+        //
+        // prefers_full
+        //
+        // True if most of what recent generational collections looked at survived them, so a ratio
+        // collection had better be a full one.
+        //
+        inline bool prefers_full() const { return _survival_percent > full_collection_survival_percent; }
+
+        //
+        // poll_due
+        //
+        // True, at most once per poll interval, when resource trackers should be asked whether they
+        // want a collection.  Safe to call from any thread.
+        //
+        bool poll_due(uint64_t now);
+
+        //
+        // collection_started
+        //
+        // Note the bytes in use as a collection starts.
+        //
+        void collection_started(usword_t in_use, uint64_t now);
+
+        //
+        // collection_finished
+        //
+        // Fold a finished collection into the averages and set the next trigger.  Exhaustive collections
+        // report every round, but only the first one measures the mutator.
+        //
+        void collection_finished(bool generational, usword_t in_use, usword_t freed, uint64_t duration, uint64_t now,
+                                 const auto_collection_control_t &control);
+    };
+
+};
+
+#endif // __AUTO_PACER__
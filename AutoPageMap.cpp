@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoPageMap.cpp
+    Address to block map
+ */
+
+#include "AutoPageMap.h"
+
+namespace Auto {
+
+    //
+    // leaf_for
+    //
+    // Returns the leaf for a granule, creating it if needed.  Subzones and large blocks are added under
+    // different locks, so leaves are installed with a compare and swap.
+    //
+    static PageMap::Entry *leaf_for(PageMap::Entry **root, usword_t granule) {
+        PageMap::Entry **slot = root + (granule >> PageMap::leaf_bits);
+        PageMap::Entry *leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (leaf) return leaf;
+        leaf = (PageMap::Entry *)allocate_memory(align_up(PageMap::leaf_count * sizeof(PageMap::Entry), page_size));
+        if (!leaf) return NULL;
+        PageMap::Entry *existing = NULL;
+        if (__atomic_compare_exchange_n(slot, &existing, leaf, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) return leaf;
+        deallocate_memory(leaf, align_up(PageMap::leaf_count * sizeof(PageMap::Entry), page_size));
+        return existing;
+    }
+
+
+    bool PageMap::add_subzone(Subzone *subzone) {
+        usword_t granule = (usword_t)subzone >> subzone_quantum_log2;
+        Entry *leaf = leaf_for(_root, granule);
+        if (!leaf) return false;
+        __atomic_store_n(&leaf[granule & (leaf_count - 1)], (Entry)subzone_entry, __ATOMIC_RELEASE);
+        return true;
+    }
+
+
+    PageMap::LargePages *PageMap::large_pages(usword_t granule) {
+        Entry *leaf = leaf_for(_root, granule);
+        if (!leaf) return NULL;
+        Entry *slot = &leaf[granule & (leaf_count - 1)];
+        Entry entry = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (entry > subzone_entry) return (LargePages *)entry;
+        LargePages *pages = (LargePages *)aux_calloc(1, sizeof(LargePages));
+        if (!pages) return NULL;
+        __atomic_store_n(slot, (Entry)pages, __ATOMIC_RELEASE);
+        return pages;
+    }
+
+
+    bool PageMap::add_large(Large *large) {
+        usword_t start = (usword_t)large->address(), end = start + large->vm_size();
+        for (usword_t page = start; page < end; page += page_size) {
+            LargePages *pages = large_pages(page >> subzone_quantum_log2);
+            if (!pages) {
+                remove_large(large);
+                return false;
+            }
+            __atomic_store_n(&pages->pages[(page & (subzone_quantum - 1)) >> page_size_log2], large, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+
+    void PageMap::remove_large(Large *large) {
+        usword_t start = (usword_t)large->address(), end = start + large->vm_size();
+        for (usword_t page = start; page < end; page += page_size) {
+            Entry entry = this->entry((void *)page);
+            if (entry <= subzone_entry) continue;
+            LargePages *pages = (LargePages *)entry;
+            Large **slot = &pages->pages[(page & (subzone_quantum - 1)) >> page_size_log2];
+            if (__atomic_load_n(slot, __ATOMIC_RELAXED) == large) __atomic_store_n(slot, (Large *)NULL, __ATOMIC_RELEASE);
+        }
+    }
+
+};
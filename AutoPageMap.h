@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoPageMap.h
+    Address to block map
+ */
+
+#ifndef __AUTO_PAGE_MAP__
+#define __AUTO_PAGE_MAP__
+
+#include "AutoDefs.h"
+#include "AutoLarge.h"
+#include "AutoSubzone.h"
+
+namespace Auto {
+
+    //
+    // PageMap
+    //
+    // Two level radix map from subzone sized granules of the address space to what the zone keeps
+    // there: nothing, a subzone, or a table giving the large block covering each page.  Lookups take
+    // no locks and a few loads; a subzone then finds the block start by its reciprocal division.
+    // Updates come from the zone under its region or large lock.  Leaves and page tables are never
+    // freed, so a reader racing an update sees either the old or the new entry.
+    //
+    class PageMap {
+
+      public:
+        enum {
+#if defined(__LP64__)
+            address_bits        = 48,
+#else
+            address_bits        = 32,
+#endif
+            granule_bits        = address_bits - subzone_quantum_log2,
+            leaf_bits           = granule_bits > 14 ? 14 : granule_bits,
+            root_bits           = granule_bits - leaf_bits,
+            root_count          = 1 << root_bits,
+            leaf_count          = 1 << leaf_bits,
+            pages_per_granule   = subzone_quantum >> page_size_log2,
+        };
+
+        //
+        // Entry
+        //
+        // 0, subzone_entry, or the LargePages of the granule.
+        //
+        typedef usword_t Entry;
+        enum { subzone_entry = 1 };
+
+        struct LargePages {
+            Large       *pages[pages_per_granule];
+        };
+
+      private:
+        Entry           *_root[root_count];                 // leaves of leaf_count entries
+
+        LargePages *large_pages(usword_t granule);
+
+      public:
+
+        PageMap() { bzero(_root, sizeof(_root)); }
+
+        //
+        // entry
+        //
+        // Returns the entry covering address.
+        //
+        inline Entry entry(const void *address) const {
+            usword_t granule = (usword_t)address >> subzone_quantum_log2;
+            if (granule >> granule_bits) return 0;
+            Entry *leaf = __atomic_load_n(&_root[granule >> leaf_bits], __ATOMIC_ACQUIRE);
+            return leaf ? __atomic_load_n(&leaf[granule & (leaf_count - 1)], __ATOMIC_ACQUIRE) : 0;
+        }
+
+        //
+        // Entry decoding
+        //
+        //
+        // prefetch
+        //
+        // Start loading the entry covering address, ahead of a batch of lookups.
+        //
+        inline void prefetch(const void *address) const {
+            usword_t granule = (usword_t)address >> subzone_quantum_log2;
+            if (granule >> granule_bits) return;
+            Entry *leaf = __atomic_load_n(&_root[granule >> leaf_bits], __ATOMIC_RELAXED);
+            if (leaf) __builtin_prefetch(&leaf[granule & (leaf_count - 1)]);
+        }
+
+        static inline bool is_subzone(Entry entry) { return entry == subzone_entry; }
+        static inline Large *large_in(Entry entry, const void *address) {
+            if (entry <= subzone_entry) return NULL;
+            usword_t page = ((usword_t)address & (subzone_quantum - 1)) >> page_size_log2;
+            Large *large = __atomic_load_n(&((LargePages *)entry)->pages[page], __ATOMIC_ACQUIRE);
+            // the last page of a block may extend past its size.
+            return large && large->in_block(address) ? large : NULL;
+        }
+
+        //
+        // subzone_for
+        //
+        // Returns the subzone containing address, or NULL.
+        //
+        inline Subzone *subzone_for(const void *address) const {
+            return is_subzone(entry(address)) ? Subzone::subzone(address) : NULL;
+        }
+
+        //
+        // large_containing
+        //
+        // Returns the large block containing address, or NULL.
+        //
+        inline Large *large_containing(const void *address) const { return large_in(entry(address), address); }
+
+        //
+        // Updates
+        //
+        // Record a subzone put into use, or the pages of a large block as it comes and goes.  Returns
+        // false if memory for the map ran out.
+        //
+        bool add_subzone(Subzone *subzone);
+        bool add_large(Large *large);
+        void remove_large(Large *large);
+    };
+
+};
+
+#endif // __AUTO_PAGE_MAP__
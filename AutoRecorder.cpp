@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRecorder.cpp
+    Recordings of zone operations, for replay
+ */
+
+#include "AutoRecorder.h"
+#include "AutoRegion.h"
+#include "AutoSubzone.h"
+#include "AutoZone.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+namespace Auto {
+
+    bool recording_enabled;
+    Zone *recorded_zone;
+
+    enum {
+        record_maximum_size = 4096,                         // room a record may need, a full copy record's
+        chunk_header_size = 3 * varint_maximum_bytes,
+    };
+
+    //
+    // RecordChunk
+    //
+    // A chunk of a thread's records in a mapping of recording_chunk_size.  length counts the bytes of
+    // complete records, published as each is.
+    //
+    struct RecordChunk {
+        RecordChunk     *next;                              // on the list of chunks to write
+        uint32_t        thread_number;
+        uint64_t        index;
+        usword_t        length;
+        uint8_t         bytes[0];
+    };
+
+    enum {
+        chunk_capacity = recording_chunk_size - sizeof(RecordChunk),
+    };
+
+    //
+    // RecordBuffer
+    //
+    // A thread's chunk being filled, and the state its records are encoded relative to.
+    //
+    struct RecordBuffer {
+        RecordBuffer    *next;                              // every buffer, newest first
+        bool            in_use;                             // owned by a live thread
+        uint32_t        thread_number;
+        uint64_t        chunk_count;
+        RecordChunk     *chunk;
+        uint64_t        previous_sequence;
+        uint64_t        previous_address;
+    };
+
+    static RecordBuffer *record_buffers;
+    static uint32_t record_thread_count;
+    static uint64_t record_sequence;
+    static RecordChunk *record_pending;                     // full chunks to write
+    static int record_fd = -1;
+    static pthread_key_t record_key;
+    static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+    static pthread_mutex_t record_write_mutex = PTHREAD_MUTEX_INITIALIZER;     // serializes writes to record_fd
+
+
+    static bool write_fully(const void *bytes, usword_t size) {
+        for (usword_t done = 0; done < size; ) {
+            ssize_t written = ::write(record_fd, (const uint8_t *)bytes + done, size - done);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            done += written;
+        }
+        return true;
+    }
+
+
+    //
+    // write_chunk
+    //
+    // Write the first length bytes of records of chunk.  Called with the write mutex held.
+    //
+    static void write_chunk(RecordChunk *chunk, usword_t length) {
+        uint8_t header[chunk_header_size], *p = header;
+        p = put_varint(p, chunk->thread_number);
+        p = put_varint(p, chunk->index);
+        p = put_varint(p, length);
+        if (write_fully(header, p - header)) write_fully(chunk->bytes, length);
+    }
+
+
+    //
+    // write_pending
+    //
+    // Write out and unmap the full chunks.  Unless wait is set, leaves them to a later call if another
+    // thread is writing, which may be one the collector has suspended.
+    //
+    static void write_pending(bool wait) {
+        if (wait) pthread_mutex_lock(&record_write_mutex);
+        else if (pthread_mutex_trylock(&record_write_mutex)) return;
+        RecordChunk *chunk = __atomic_exchange_n(&record_pending, (RecordChunk *)NULL, __ATOMIC_ACQUIRE);
+        while (chunk) {
+            RecordChunk *next = chunk->next;
+            write_chunk(chunk, chunk->length);
+            deallocate_memory(chunk, recording_chunk_size);
+            chunk = next;
+        }
+        pthread_mutex_unlock(&record_write_mutex);
+    }
+
+
+    //
+    // retire_chunk
+    //
+    // Queue the buffer's chunk, if it holds anything, to be written.
+    //
+    static void retire_chunk(RecordBuffer *buffer) {
+        RecordChunk *chunk = buffer->chunk;
+        if (!chunk) return;
+        buffer->chunk = NULL;
+        if (!chunk->length) {
+            deallocate_memory(chunk, recording_chunk_size);
+            return;
+        }
+        chunk->next = __atomic_load_n(&record_pending, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&record_pending, &chunk->next, chunk, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    }
+
+
+    static void release_buffer(void *data) {
+        RecordBuffer *buffer = (RecordBuffer *)data;
+        retire_chunk(buffer);
+        write_pending(false);
+        __atomic_store_n(&buffer->in_use, false, __ATOMIC_RELEASE);
+    }
+
+    static void create_record_key(void) {
+        pthread_key_create(&record_key, release_buffer);
+    }
+
+
+    //
+    // claim_buffer
+    //
+    // A buffer for the calling thread, one an exited thread left or a new one.  Takes no lock.
+    //
+    static RecordBuffer *claim_buffer() {
+        RecordBuffer *buffer;
+        for (buffer = __atomic_load_n(&record_buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+            bool in_use = false;
+            if (__atomic_compare_exchange_n(&buffer->in_use, &in_use, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+        }
+        if (!buffer) {
+            buffer = (RecordBuffer *)allocate_memory(sizeof(RecordBuffer));
+            if (!buffer) return NULL;
+            buffer->in_use = true;
+            buffer->chunk = NULL;
+            buffer->next = __atomic_load_n(&record_buffers, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&record_buffers, &buffer->next, buffer, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+        }
+        buffer->thread_number = __atomic_add_fetch(&record_thread_count, 1, __ATOMIC_RELAXED);
+        buffer->chunk_count = 0;
+        pthread_setspecific(record_key, buffer);
+        return buffer;
+    }
+
+
+    //
+    // RecordWriter
+    //
+    // Encodes one record into the calling thread's chunk, starting a new chunk if it has too little
+    // room left, and publishes it when destroyed.  Records nothing if memory ran out.
+    //
+    class RecordWriter {
+        RecordBuffer    *_buffer;
+        uint8_t         *_p;
+
+      public:
+        RecordWriter(RecordTag tag) : _buffer((RecordBuffer *)pthread_getspecific(record_key)), _p(NULL) {
+            if (!_buffer && !(_buffer = claim_buffer())) return;
+            RecordChunk *chunk = _buffer->chunk;
+            if (!chunk || chunk_capacity - chunk->length < record_maximum_size) {
+                retire_chunk(_buffer);
+                write_pending(false);
+                chunk = (RecordChunk *)allocate_memory(recording_chunk_size);
+                if (!chunk) return;
+                chunk->thread_number = _buffer->thread_number;
+                chunk->index = _buffer->chunk_count++;
+                chunk->length = 0;
+                _buffer->previous_sequence = 0;
+                _buffer->previous_address = 0;
+                __atomic_store_n(&_buffer->chunk, chunk, __ATOMIC_RELEASE);
+            }
+            _p = chunk->bytes + chunk->length;
+            *_p++ = (uint8_t)tag;
+            uint64_t sequence = __atomic_fetch_add(&record_sequence, 1, __ATOMIC_RELAXED);
+            put(sequence - _buffer->previous_sequence);
+            _buffer->previous_sequence = sequence;
+        }
+
+        ~RecordWriter() {
+            if (_p) __atomic_store_n(&_buffer->chunk->length, _p - _buffer->chunk->bytes, __ATOMIC_RELEASE);
+        }
+
+        inline bool ok() const { return _p != NULL; }
+
+        inline void put(uint64_t value) { if (_p) _p = put_varint(_p, value); }
+
+        inline void put_address(const void *address) {
+            put(zigzag((int64_t)((uint64_t)(usword_t)address - _buffer->previous_address)));
+            if (_p) _buffer->previous_address = (usword_t)address;
+        }
+
+        void put_value(Zone *zone, const void *value) {
+            void *block = zone->block_start(value);
+            put_address(block);
+            put(block ? (usword_t)value - (usword_t)block : 0);
+        }
+    };
+
+
+    bool start_recording(Zone *zone, int fd) {
+        pthread_once(&record_once, create_record_key);
+        Mutex lock(&record_write_mutex);
+        if (recorded_zone) return false;
+        record_fd = fd;
+        uint8_t header[sizeof(recording_magic) + 2 * varint_maximum_bytes], *p = header;
+        memcpy(p, recording_magic, sizeof(recording_magic));
+        p = put_varint(p + sizeof(recording_magic), recording_version);
+        p = put_varint(p, sizeof(void *));
+        if (!write_fully(header, p - header)) return false;
+        recorded_zone = zone;
+        __atomic_store_n(&recording_enabled, true, __ATOMIC_RELEASE);
+        return true;
+    }
+
+
+    void stop_recording() {
+        __atomic_store_n(&recording_enabled, false, __ATOMIC_RELEASE);
+        write_pending(true);
+        // chunks being filled are written as far as they are complete.  A thread still recording
+        // may write its chunk again, whole, once full.
+        Mutex lock(&record_write_mutex);
+        for (RecordBuffer *buffer = __atomic_load_n(&record_buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+            RecordChunk *chunk = __atomic_load_n(&buffer->chunk, __ATOMIC_ACQUIRE);
+            usword_t length = chunk ? __atomic_load_n(&chunk->length, __ATOMIC_ACQUIRE) : 0;
+            if (length) write_chunk(chunk, length);
+        }
+        recorded_zone = NULL;
+    }
+
+
+    void record_allocate(const void *block, uint64_t size, int32_t type, unsigned flags) {
+        RecordWriter writer(recording_allocate);
+        writer.put_address(block);
+        writer.put(size);
+        writer.put(zigzag(type));
+        writer.put(flags);
+    }
+
+
+    void record_block(RecordTag tag, const void *block) {
+        RecordWriter writer(tag);
+        writer.put_address(block);
+    }
+
+
+    void record_store(Zone *zone, const void *location, const void *value) {
+        void *block = zone->block_start(location);
+        if (!block) return;
+        RecordWriter writer(recording_store);
+        writer.put_address(block);
+        writer.put((usword_t)location - (usword_t)block);
+        writer.put_value(zone, value);
+    }
+
+
+    void record_copy(Zone *zone, const void *destination, uint64_t size) {
+        void *block = zone->block_start(destination);
+        if (!block) return;
+        void **words = (void **)align_up((usword_t)destination, sizeof(void *));
+        void **end = (void **)align_down((usword_t)destination + size, sizeof(void *));
+        // the words copied that point into blocks, recording_copy_batch to a record.
+        while (words < end) {
+            void **pointers[recording_copy_batch];
+            usword_t count = 0;
+            void **first = words;
+            for (; words < end && count < recording_copy_batch; words++) {
+                if (zone->block_start(*words)) pointers[count++] = words;
+            }
+            if (!count && words < end) continue;
+            RecordWriter writer(recording_copy);
+            writer.put_address(block);
+            writer.put((usword_t)first - (usword_t)block);
+            writer.put((usword_t)words - (usword_t)first);
+            writer.put(count);
+            for (usword_t i = 0; i < count; i++) {
+                writer.put((usword_t)pointers[i] - (usword_t)first);
+                writer.put_value(zone, *pointers[i]);
+            }
+        }
+    }
+
+
+    void record_weak(Zone *zone, const void *location, const void *value) {
+        void *block = zone->block_start(location);
+        RecordWriter writer(recording_weak);
+        writer.put_address(block);
+        writer.put((usword_t)location - (usword_t)block);
+        writer.put_value(zone, value);
+    }
+
+
+    void record_root(RecordTag tag, Zone *zone, const void *root, const void *value) {
+        RecordWriter writer(tag);
+        writer.put_address(root);
+        if (tag != recording_root_remove) writer.put_value(zone, value);
+    }
+
+
+    void record_mode(RecordTag tag, uint64_t mode) {
+        RecordWriter writer(tag);
+        writer.put(mode);
+    }
+
+
+    void record_move(const void *block, const void *copy) {
+        RecordWriter writer(recording_move);
+        writer.put_address(block);
+        writer.put_address(copy);
+    }
+
+
+    void record_garbage(Zone *zone, bool generational) {
+        for (Region *region = zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                Bitmap &allocated = subzone->allocated_bitmap(), &marks = subzone->mark_bitmap();
+                for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                    // is_dying() settles the unmarked blocks, as sweeping will.
+                    for (usword_t unmarked = allocated.word(w) & ~marks.word(w); unmarked; unmarked &= unmarked - 1) {
+                        void *block = subzone->block_address((w << bits_per_word_log2) + __builtin_ctzl(unmarked));
+                        if (zone->is_dying(block, generational)) record_block(recording_death, block);
+                    }
+                }
+            }
+        }
+    }
+
+};
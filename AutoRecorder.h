@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRecorder.h
+    Recordings of zone operations, for replay
+ */
+
+#ifndef __AUTO_RECORDER__
+#define __AUTO_RECORDER__
+
+#include "AutoSnapshot.h"
+
+//
+// Recording format
+//
+// Shared with the replay driver (tools/auto_replay.cpp), so this header includes nothing of the
+// library's but the varints of snapshots.  A recording is the 8 byte magic "AUTORCRD", the version
+// and the pointer size in bytes, then chunks.  Every thread records into chunks of its own; a chunk
+// is the thread's number, the chunk's index among the thread's chunks and its length in bytes,
+// followed by that many bytes of records.  A chunk may be written twice, the first time cut short;
+// readers keep the longer.
+//
+// A record is a tag byte, its sequence number and its fields.  Sequence numbers order the records
+// of all threads as the operations happened; each is a delta from the one before in the chunk (from
+// 0 for the first).  Fields are varints.  Addresses are zigzag encoded deltas from the address
+// before them in the chunk (from 0 for the first).  A value is the address of the block a pointer
+// refers into, or 0 if it refers to none, and the pointer's offset in the block.
+//
+//  allocate        address, size, type (zigzag), record flags
+//  free            address                         freed through the malloc interface
+//  retain          address
+//  release         address
+//  store           block, offset, value            a pointer stored into a block through a write barrier
+//  copy            block, offset, size, count, then count times offset and value
+//                                                  a write barrier memmove; the pointers copied, each
+//                                                  at an offset from the first
+//  weak            location, offset, value         a weak reference assigned; location is a block, or
+//                                                  0 with the location's address as the offset
+//  root_add        root, value                     root addresses are not in the heap
+//  root_remove     root
+//  root_store      root, value                     auto_zone_root_write_barrier()
+//  collect         auto_collection_mode_t          auto_collect()
+//  zone_collect    auto_zone_options_t             auto_zone_collect()
+//  death           address                         a collection found the block garbage
+//  move            address, new address            compaction moved the block
+//
+namespace Auto {
+
+    enum {
+        recording_version = 1,
+        recording_chunk_size = 256 * 1024,              // including the chunk's header
+        recording_copy_batch = 64,                      // pointers per copy record
+    };
+
+    enum RecordTag {
+        recording_allocate = 1,
+        recording_free,
+        recording_retain,
+        recording_release,
+        recording_store,
+        recording_copy,
+        recording_weak,
+        recording_root_add,
+        recording_root_remove,
+        recording_root_store,
+        recording_collect,
+        recording_zone_collect,
+        recording_death,
+        recording_move,
+    };
+
+    enum {
+        recording_retained = 1,                         // allocate flags: the block starts retained
+        recording_cleared = 2,                          // its memory was cleared
+    };
+
+    static const char recording_magic[8] = { 'A', 'U', 'T', 'O', 'R', 'C', 'R', 'D' };
+
+    class Zone;
+
+    //
+    // Recording
+    //
+    // Operations on the zone being recorded go into per-thread chunks, taken from virtual memory so
+    // that the collector may record with the world stopped.  Full chunks are written out by whichever
+    // thread gets the write lock without waiting for it.  While nothing is being recorded each
+    // operation costs one load and one branch predicted not taken.
+    //
+    extern bool recording_enabled;
+    extern Zone *recorded_zone;
+
+    inline bool is_recording(Zone *zone) { return __builtin_expect(recording_enabled, false) && zone == recorded_zone; }
+
+    //
+    // start_recording, stop_recording
+    //
+    // Record the operations on zone to fd, and stop, writing out what every thread recorded.  Only
+    // one zone is recorded at a time.  start_recording() returns false if a recording is under way or
+    // the header could not be written.
+    //
+    bool start_recording(Zone *zone, int fd);
+    void stop_recording();
+
+    //
+    // Recording operations
+    //
+    // Stores and copies into memory outside the heap are not recorded.  Frees and deaths are
+    // recorded before the block is freed, since its address may be reused right away, and requests
+    // for collections before they are made, so that the deaths they find follow them; everything
+    // else once done.
+    //
+    void record_allocate(const void *block, uint64_t size, int32_t type, unsigned flags);
+    void record_block(RecordTag tag, const void *block);
+    void record_store(Zone *zone, const void *location, const void *value);
+    void record_copy(Zone *zone, const void *destination, uint64_t size);
+    void record_weak(Zone *zone, const void *location, const void *value);
+    void record_root(RecordTag tag, Zone *zone, const void *root, const void *value);
+    void record_mode(RecordTag tag, uint64_t mode);
+    void record_move(const void *block, const void *copy);
+
+    //
+    // record_garbage
+    //
+    // Record the death of every subzone block the collection that just finished found garbage.
+    // Called before sweeping is enabled.
+    //
+    void record_garbage(Zone *zone, bool generational);
+
+};
+
+#endif // __AUTO_RECORDER__
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoReferenceIndex.cpp
+    Reverse references from referents to the words that hold them
+ */
+
+#include "AutoReferenceIndex.h"
+#include "AutoHeapWalker.h"
+#include "AutoLarge.h"
+#include "AutoLayout.h"
+#include "AutoRegion.h"
+#include "AutoSubzone.h"
+#include "AutoZone.h"
+
+namespace Auto {
+
+    ReferenceIndex::ReferenceIndex(Zone *zone)
+        : _zone(zone), _is_built(false), _epoch(0), _referents(NULL), _starts(NULL), _referrers(NULL),
+          _referent_count(0), _referrer_count(0), _memory(NULL), _memory_size(0), _roots(NULL),
+          _unit_count(0), _next_unit(0), _failed(false)
+    {
+        pthread_mutex_init(&_mutex, NULL);
+    }
+
+
+    ReferenceIndex::~ReferenceIndex() {
+        discard();
+        pthread_mutex_destroy(&_mutex);
+    }
+
+
+    void ReferenceIndex::discard() {
+        if (_memory) deallocate_memory(_memory, _memory_size);
+        _memory = NULL;
+        _memory_size = 0;
+        _referents = _starts = NULL;
+        _referrers = NULL;
+        _referent_count = _referrer_count = 0;
+        _is_built = false;
+    }
+
+
+    bool ReferenceIndex::is_current() const {
+        return _is_built && _epoch == _zone->sweep_epoch();
+    }
+
+
+    void ReferenceIndex::gather_units() {
+        _subzones.clear();
+        _larges.clear();
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (region->is_subzone_in_use(i) && subzone->is_initialized() && !_subzones.push(subzone)) _failed = true;
+            }
+        }
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            if (!(large->layout() & AUTO_UNSCANNED) && !_larges.push(large)) _failed = true;
+        }
+        _roots = _zone->roots().snapshot();
+        _unit_count = _subzones.count() + _larges.count() + (_roots ? _roots->count : 0);
+        _next_unit = 0;
+    }
+
+
+    void ReferenceIndex::add_reference(usword_t offset, void *value, void *block, void *context) {
+        ScanContext *scan = (ScanContext *)context;
+        Edge edge;
+        edge.referent = (usword_t)block;
+        if (scan->is_root) {
+            edge.referrer.base = scan->base + offset;
+            edge.referrer.offset = root_offset;
+        } else {
+            edge.referrer.base = scan->base;
+            edge.referrer.offset = offset;
+        }
+        if (!scan->edges->push(edge)) scan->failed = true;
+    }
+
+
+    void ReferenceIndex::scan_unit(Worker &worker, usword_t unit) {
+        ScanContext scan = { &worker.edges, 0, false, false };
+        LayoutCache &cache = _zone->layout_cache();
+        if (unit < _subzones.count()) {
+            Subzone *subzone = _subzones[unit];
+            Bitmap &allocated = subzone->allocated_bitmap();
+            usword_t size = subzone->block_size();
+            for (usword_t w = 0, words = Bitmap::words_for_bits(subzone->block_count()); w < words; w++) {
+                for (usword_t bits = allocated.word(w); bits; bits &= bits - 1) {
+                    usword_t index = (w << bits_per_word_log2) + __builtin_ctzl(bits);
+                    auto_memory_type_t layout = subzone->layout(index);
+                    if (layout & AUTO_UNSCANNED) continue;
+                    void *block = subzone->block_address(index);
+                    // with the world stopped only layouts already compiled are used, as by the collector.
+                    const CompiledLayout *compiled = is_exactly_scanned(layout) && *(void **)block ? cache.find(*(void **)block) : NULL;
+                    scan.base = (usword_t)block;
+                    HeapWalker::scan_references(_zone, block, displace(block, size), compiled, add_reference, &scan);
+                }
+            }
+        } else if ((unit -= _subzones.count()) < _larges.count()) {
+            Large *large = _larges[unit];
+            void *block = large->address();
+            const CompiledLayout *compiled = is_exactly_scanned(large->layout()) && *(void **)block ? cache.find(*(void **)block) : NULL;
+            scan.base = (usword_t)block;
+            HeapWalker::scan_references(_zone, block, displace(block, large->size()), compiled, add_reference, &scan);
+        } else {
+            RootTable::Interval &interval = _roots->intervals[unit - _larges.count()];
+            // an explicit root inside a scanned block is found with the block.
+            void *block = _zone->block_start((void *)interval.start);
+            if (block && !(_zone->block_layout(block) & AUTO_UNSCANNED)) return;
+            scan.base = interval.start;
+            scan.is_root = true;
+            HeapWalker::scan_references(_zone, (void *)interval.start, (void *)interval.end, NULL, add_reference, &scan);
+        }
+        if (scan.failed) _failed = true;
+    }
+
+
+    void ReferenceIndex::scan_job(void *context, usword_t worker) {
+        ReferenceIndex *index = (ReferenceIndex *)context;
+        if (worker >= maximum_workers) return;
+        for (;;) {
+            usword_t unit = __atomic_fetch_add(&index->_next_unit, 1, __ATOMIC_RELAXED);
+            if (unit >= index->_unit_count) break;
+            index->scan_unit(index->_workers[worker], unit);
+        }
+    }
+
+
+    bool ReferenceIndex::group_edges() {
+        usword_t count = 0;
+        for (usword_t w = 0; w < maximum_workers; w++) count += _workers[w].edges.count();
+
+        // gather every worker's edges and sort them by referent.
+        usword_t edges_size = align_up(2 * count * sizeof(Edge), page_size);
+        Edge *edges = count ? (Edge *)allocate_memory(edges_size) : NULL;
+        if (count && !edges) return false;
+        Edge *cursor = edges;
+        for (usword_t w = 0; w < maximum_workers; w++) {
+            VMArray<Edge> &worker_edges = _workers[w].edges;
+            if (worker_edges.count()) memcpy(cursor, worker_edges.items(), worker_edges.count() * sizeof(Edge));
+            cursor += worker_edges.count();
+            worker_edges.reset();
+        }
+        usword_t heap_min = _zone->heap_min(), span = _zone->heap_max() - heap_min;
+        usword_t key_bits = span ? bits_per_word - __builtin_clzl(span) : 0;
+        radix_sort<Edge, edge_key>(edges, edges + count, count, heap_min, key_bits);
+
+        usword_t referents = 0;
+        for (usword_t i = 0; i < count; i++) {
+            if (!i || edges[i].referent != edges[i - 1].referent) referents++;
+        }
+        _memory_size = align_up((2 * referents + 1) * sizeof(usword_t) + count * sizeof(Referrer), page_size);
+        _memory = allocate_memory(_memory_size);
+        if (!_memory) {
+            if (edges) deallocate_memory(edges, edges_size);
+            _memory_size = 0;
+            return false;
+        }
+        _referrers = (Referrer *)_memory;
+        _referents = (usword_t *)(_referrers + count);
+        _starts = _referents + referents;
+        _referent_count = 0;
+        for (usword_t i = 0; i < count; i++) {
+            if (!i || edges[i].referent != edges[i - 1].referent) {
+                _referents[_referent_count] = edges[i].referent;
+                _starts[_referent_count++] = i;
+            }
+            _referrers[i] = edges[i].referrer;
+        }
+        _starts[_referent_count] = count;
+        _referrer_count = count;
+        if (edges) deallocate_memory(edges, edges_size);
+        return true;
+    }
+
+
+    bool ReferenceIndex::build() {
+        discard();
+        _epoch = _zone->sweep_epoch();
+        _failed = false;
+
+        // only gather edges while the world is stopped.
+        Thread *current = _zone->current_thread();
+        HeapWalker::suspend_threads(_zone, current);
+        gather_units();
+        if (!_failed) _zone->run_mark_workers(scan_job, this);
+        HeapWalker::resume_threads(_zone, current);
+        _subzones.reset();
+        _larges.reset();
+        _roots = NULL;
+
+        if (_failed || !group_edges()) {
+            for (usword_t w = 0; w < maximum_workers; w++) _workers[w].edges.reset();
+            discard();
+            return false;
+        }
+        _is_built = true;
+        return true;
+    }
+
+
+    void ReferenceIndex::enumerate(void *referent, auto_reference_recorder_t callback, void *stack_top, void *stack_bottom, void *context) {
+        auto_reference_t reference;
+        reference.referent = (vm_address_t)referent;
+
+        usword_t low = 0, high = _referent_count;
+        while (low < high) {
+            usword_t middle = (low + high) / 2;
+            if (_referents[middle] < (usword_t)referent) low = middle + 1;
+            else high = middle;
+        }
+        if (low < _referent_count && _referents[low] == (usword_t)referent) {
+            for (usword_t i = _starts[low]; i < _starts[low + 1]; i++) {
+                const Referrer &referrer = _referrers[i];
+                void **word;
+                // the word or its block may have gone away since the build.
+                if (referrer.offset == root_offset) {
+                    if (!_zone->roots().contains((void *)referrer.base)) continue;
+                    word = (void **)referrer.base;
+                    reference.referrer_base = referrer.base;
+                    reference.referrer_offset = 0;
+                } else {
+                    if (_zone->block_start((void *)referrer.base) != (void *)referrer.base) continue;
+                    word = (void **)(referrer.base + referrer.offset);
+                    reference.referrer_base = referrer.base;
+                    reference.referrer_offset = referrer.offset;
+                }
+                if (_zone->block_start(__atomic_load_n(word, __ATOMIC_RELAXED)) != referent) continue;
+                callback((auto_zone_t *)_zone, context, reference);
+            }
+        }
+
+        // the calling thread's stack changes with every call, so it is scanned each time.
+        if (!stack_top || !stack_bottom) return;
+        for (void **p = (void **)align_up((usword_t)stack_top, sizeof(void *)); p < (void **)stack_bottom; p++) {
+            if (_zone->block_start(*p) != referent) continue;
+            reference.referrer_base = (vm_address_t)p;
+            reference.referrer_offset = 0;
+            callback((auto_zone_t *)_zone, context, reference);
+        }
+    }
+
+};
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoReferenceIndex.h
+    Reverse references from referents to the words that hold them
+ */
+
+#ifndef __AUTO_REFERENCE_INDEX__
+#define __AUTO_REFERENCE_INDEX__
+
+#include "AutoDefs.h"
+#include "AutoCollector.h"
+#include "AutoRoots.h"
+#include "auto_zone.h"
+
+namespace Auto {
+
+    class Large;
+    class Subzone;
+    class Zone;
+
+    //
+    // ReferenceIndex
+    //
+    // Every word of the heap, the data segments and the explicit roots that refers to a block, grouped
+    // by the block referred to: a sorted array of referents, each with the start of its run in one
+    // array of referrers.  Built by one parallel scan with the world stopped, which only gathers
+    // edges; sorting and grouping them happen once mutators run again.  Queries reuse the index until
+    // a collection has run since it was built, checking each word they report still refers to the
+    // referent, so stores since the build are missed until then but stale words are never reported.
+    //
+    class ReferenceIndex {
+
+      public:
+        enum {
+            maximum_workers = 16,                           // scanners beyond this only claim no work
+            root_offset = ~(usword_t)0,                     // offset of a referrer word outside any block
+        };
+
+        //
+        // Referrer
+        //
+        // A word at offset in the block at base, or the root word at base if offset is root_offset.
+        //
+        struct Referrer {
+            usword_t    base;
+            usword_t    offset;
+        };
+
+      private:
+        struct Edge {
+            usword_t    referent;
+            Referrer    referrer;
+        };
+
+        //
+        // ScanContext
+        //
+        // Where add_reference files the references found in one block or root interval.
+        //
+        struct ScanContext {
+            VMArray<Edge> *edges;
+            usword_t    base;
+            bool        is_root;
+            bool        failed;
+        };
+
+        struct Worker {
+            VMArray<Edge> edges;
+            char        padding[64];
+        };
+
+        Zone            *_zone;
+        pthread_mutex_t _mutex;                             // held by queries and builds
+        bool            _is_built;
+        usword_t        _epoch;                             // zone sweep epoch when built
+
+        usword_t        *_referents;                        // sorted block addresses, _referent_count of them
+        usword_t        *_starts;                           // referent i's referrers are [_starts[i], _starts[i + 1])
+        Referrer        *_referrers;
+        usword_t        _referent_count;
+        usword_t        _referrer_count;
+        void            *_memory;                           // one mapping holding the three arrays
+        usword_t        _memory_size;
+
+        // scan state
+        Worker          _workers[maximum_workers];
+        VMArray<Subzone *> _subzones;                       // units to claim: subzones, large blocks, root intervals
+        VMArray<Large *> _larges;
+        RootTable::Snapshot *_roots;
+        usword_t        _unit_count;
+        usword_t        _next_unit;
+        bool            _failed;                            // an edge array could not grow
+
+        static inline usword_t edge_key(const Edge &edge) { return edge.referent; }
+        static void add_reference(usword_t offset, void *value, void *block, void *context);
+        static void scan_job(void *context, usword_t index);
+        void scan_unit(Worker &worker, usword_t unit);
+        void gather_units();
+        bool group_edges();
+        void discard();
+
+      public:
+        ReferenceIndex(Zone *zone);
+        ~ReferenceIndex();
+
+        //
+        // mutex
+        //
+        // Held around a query, and around a build, which also takes the zone's collection mutex.
+        //
+        inline pthread_mutex_t *mutex() { return &_mutex; }
+
+        //
+        // is_current
+        //
+        // Whether the index was built since the last collection.  Called with the mutex held.
+        //
+        bool is_current() const;
+
+        //
+        // build
+        //
+        // Rebuild the index.  Called with the mutex and the collection mutex held, after sweeping.
+        // Returns false if memory ran out, leaving no index.
+        //
+        bool build();
+
+        //
+        // enumerate
+        //
+        // Report each indexed word still referring to referent, then each word of the calling thread's
+        // stack in [stack_top, stack_bottom) that does.  Called with the mutex held; callback must not
+        // query the index again.
+        //
+        void enumerate(void *referent, auto_reference_recorder_t callback, void *stack_top, void *stack_bottom, void *context);
+    };
+
+};
+
+#endif // __AUTO_REFERENCE_INDEX__
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRegion.cpp
+    Address space reservation for subzones
+ */
+
+#include "AutoRegion.h"
+#include "AutoSubzone.h"
+
+namespace Auto {
+
+    Region *Region::new_region() {
+        void *address = allocate_memory(region_subzone_count * subzone_quantum, subzone_quantum);
+        if (!address) return NULL;
+        Region *region = (Region *)aux_calloc(1, sizeof(Region));
+        if (!region) {
+            deallocate_memory(address, region_subzone_count * subzone_quantum);
+            return NULL;
+        }
+        region->_address = (usword_t)address;
+        region->_in_use = Bitmap(region->_in_use_bits);
+        return region;
+    }
+
+
+    Subzone *Region::allocate_subzone() {
+        usword_t index = _in_use.find_clear(0, region_subzone_count);
+        if (index == region_subzone_count) return NULL;
+        _in_use.set(index);
+        _subzone_count++;
+        return subzone_at(index);
+    }
+
+};
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRegion.h
+    Address space reservation for subzones
+ */
+
+#ifndef __AUTO_REGION__
+#define __AUTO_REGION__
+
+#include "AutoDefs.h"
+#include "AutoBitmap.h"
+
+namespace Auto {
+
+    class Subzone;
+
+    //
+    // Region
+    //
+    // A region is a subzone aligned reservation of region_subzone_count subzones.  Pages are only
+    // committed as subzones touch them.  The descriptor lives in auxiliary memory.
+    //
+    class Region {
+
+      private:
+        Region          *_next;                             // next region in the zone
+        usword_t        _address;                           // first subzone
+        usword_t        _subzone_count;                     // subzones in use
+        usword_t        _in_use_bits[(region_subzone_count + bits_per_word - 1) / bits_per_word];
+        Bitmap          _in_use;                            // which subzones are in use
+
+      public:
+
+        //
+        // new_region
+        //
+        // Reserve address space for a new region.  Returns NULL if the space is unavailable.
+        //
+        static Region *new_region();
+
+        //
+        // Accessors
+        //
+        inline Region *next() const { return _next; }
+        inline void set_next(Region *next) { _next = next; }
+        inline usword_t address() const { return _address; }
+        inline usword_t end() const { return _address + region_subzone_count * subzone_quantum; }
+        inline usword_t subzone_count() const { return _subzone_count; }
+        inline bool in_range(const void *address) const { return (usword_t)address - _address < (usword_t)region_subzone_count * subzone_quantum; }
+        inline usword_t subzone_index(const void *address) const { return ((usword_t)address - _address) >> subzone_quantum_log2; }
+        inline bool is_subzone_in_use(usword_t index) const { return _in_use.test(index); }
+        inline Subzone *subzone_at(usword_t index) const { return (Subzone *)(_address + (index << subzone_quantum_log2)); }
+
+        //
+        // in_use_words
+        //
+        // The in use bits as words.  Unlike is_subzone_in_use(), also valid in a copy of the
+        // descriptor read from another task.
+        //
+        inline const usword_t *in_use_words() const { return _in_use_bits; }
+
+        //
+        // is_in_subzone
+        //
+        // Returns true if the address lies within an in use subzone of this region.
+        //
+        inline bool is_in_subzone(const void *address) const {
+            return in_range(address) && is_subzone_in_use(subzone_index(address));
+        }
+
+        //
+        // allocate_subzone
+        //
+        // Returns an unused subzone's memory, or NULL if the region is full.  Caller holds the zone's region lock.
+        //
+        Subzone *allocate_subzone();
+    };
+
+};
+
+#endif // __AUTO_REGION__
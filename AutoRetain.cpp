@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRetain.cpp
+    Reference counts of subzone blocks
+ */
+
+#include "AutoRetain.h"
+
+namespace Auto {
+
+    usword_t RetainTable::retain(unsigned char *refcount, const void *block) {
+        for (;;) {
+            unsigned char count = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+            if (count < inline_maximum) {
+                if (__atomic_compare_exchange_n(refcount, &count, count + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return count + 1;
+                continue;
+            }
+
+            Shard &s = shard(block);
+            SpinLock lock(&s.lock);
+            count = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+            if (count == overflowed) {
+                usword_t *overflow = s.counts.find(block);
+                return ++*overflow;
+            }
+            // releases of inline counts race the move to the table.
+            if (count == inline_maximum && __atomic_compare_exchange_n(refcount, &count, (unsigned char)overflowed, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                s.counts.insert(block, inline_maximum + 1);
+                return inline_maximum + 1;
+            }
+        }
+    }
+
+
+    usword_t RetainTable::release(unsigned char *refcount, const void *block) {
+        for (;;) {
+            unsigned char count = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+            if (count == 0) return 0;
+            if (count != overflowed) {
+                if (__atomic_compare_exchange_n(refcount, &count, count - 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return count - 1;
+                continue;
+            }
+
+            Shard &s = shard(block);
+            SpinLock lock(&s.lock);
+            if (__atomic_load_n(refcount, __ATOMIC_RELAXED) != overflowed) continue;
+            usword_t *overflow = s.counts.find(block);
+            usword_t result = --*overflow;
+            if (result == inline_maximum) {
+                s.counts.remove(block);
+                __atomic_store_n(refcount, (unsigned char)inline_maximum, __ATOMIC_RELAXED);
+            }
+            return result;
+        }
+    }
+
+
+    usword_t RetainTable::count(unsigned char *refcount, const void *block) {
+        unsigned char count = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+        if (count != overflowed) return count;
+        Shard &s = shard(block);
+        SpinLock lock(&s.lock);
+        if (__atomic_load_n(refcount, __ATOMIC_RELAXED) != overflowed) return __atomic_load_n(refcount, __ATOMIC_RELAXED);
+        return *s.counts.find(block);
+    }
+
+
+    void RetainTable::erase(const void *block) {
+        Shard &s = shard(block);
+        SpinLock lock(&s.lock);
+        s.counts.remove(block);
+    }
+
+
+    void RetainTable::lock_all() {
+        for (usword_t i = 0; i < shard_count; i++) spin_lock(&_shards[i].lock);
+    }
+
+
+    void RetainTable::unlock_all() {
+        for (usword_t i = shard_count; i--; ) spin_unlock(&_shards[i].lock);
+    }
+
+};
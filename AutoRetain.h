@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRetain.h
+    Reference counts of subzone blocks
+ */
+
+#ifndef __AUTO_RETAIN__
+#define __AUTO_RETAIN__
+
+#include "AutoDefs.h"
+#include "AutoHashTable.h"
+
+namespace Auto {
+
+    //
+    // RetainTable
+    //
+    // Subzone blocks keep their reference count in a side table byte, updated with atomic
+    // operations.  Counts beyond inline_maximum set the byte to overflowed and move to this table,
+    // sharded by block address with a spin lock per shard.  A byte only moves to or from overflowed
+    // under its shard's lock.
+    //
+    class RetainTable {
+      public:
+        enum {
+            inline_maximum = 254,                           // largest count kept in the side byte
+            overflowed = 255,                               // side byte value when the count is here
+        };
+
+      private:
+        enum {
+            shard_count_log2 = 5,
+            shard_count = 1 << shard_count_log2,
+        };
+
+        struct Shard {
+            spin_lock_t                     lock;
+            PointerHashMap<usword_t>        counts;         // block -> count
+            char                            padding[64];
+        };
+
+        Shard           _shards[shard_count];
+
+        inline Shard &shard(const void *block) { return _shards[pointer_hash(block) >> (bits_per_word - shard_count_log2)]; }
+
+      public:
+
+        RetainTable() { for (usword_t i = 0; i < shard_count; i++) _shards[i].lock.value = 0; }
+
+        //
+        // retain
+        //
+        // Increment the count of block, whose side byte is at refcount.  Returns the new count.
+        //
+        usword_t retain(unsigned char *refcount, const void *block);
+
+        //
+        // release
+        //
+        // Decrement the count of block, leaving a zero count alone.  Returns the new count.
+        //
+        usword_t release(unsigned char *refcount, const void *block);
+
+        //
+        // count
+        //
+        // Returns the count of block.
+        //
+        usword_t count(unsigned char *refcount, const void *block);
+
+        //
+        // erase
+        //
+        // Forget the overflowed count of a block being freed.
+        //
+        void erase(const void *block);
+
+        //
+        // Heap walks
+        //
+        // lock_all() and unlock_all() bracket the world being stopped for a heap walk, during which
+        // overflowed_count() reads the count of a block whose side byte is overflowed.
+        //
+        void lock_all();
+        void unlock_all();
+        inline usword_t overflowed_count(const void *block) {
+            usword_t *count = shard(block).counts.find(block);
+            return count ? *count : overflowed;
+        }
+    };
+
+};
+
+#endif // __AUTO_RETAIN__
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRoots.cpp
+    Registered data segments and explicit roots
+ */
+
+#include "AutoRoots.h"
+
+namespace Auto {
+
+    RootTable::RootTable() : _phase(0), _snapshot(NULL) {
+        bzero(_readers, sizeof(_readers));
+        pthread_mutex_init(&_mutex, NULL);
+    }
+
+
+    RootTable::~RootTable() {
+        if (_snapshot) aux_free(_snapshot);
+        pthread_mutex_destroy(&_mutex);
+    }
+
+
+    void RootTable::replace(Snapshot *snapshot) {
+        Snapshot *old = _snapshot;
+        __atomic_store_n(&_snapshot, snapshot, __ATOMIC_SEQ_CST);
+        if (!old) return;
+        // a reader that chose its counters before a flip may still count in the old set, so drain both.
+        for (int round = 0; round < 2; round++) {
+            usword_t phase = __atomic_fetch_add(&_phase, 1, __ATOMIC_SEQ_CST) & 1;
+            for (usword_t i = 0; i < reader_stripes; i++) {
+                while (__atomic_load_n(&_readers[phase][i].count, __ATOMIC_ACQUIRE)) sched_yield();
+            }
+        }
+        aux_free(old);
+    }
+
+
+    void RootTable::insert(usword_t start, usword_t end, Kind kind) {
+        usword_t count = _snapshot ? _snapshot->count : 0;
+        Interval *intervals = _snapshot ? _snapshot->intervals : NULL;
+        usword_t position = 0;
+        while (position < count && intervals[position].start <= start) {
+            Interval &interval = intervals[position];
+            if (interval.start == start && interval.end == end && interval.kind == kind) return;
+            position++;
+        }
+        Snapshot *snapshot = (Snapshot *)aux_malloc(sizeof(Snapshot) + (count + 1) * sizeof(Interval));
+        snapshot->count = count + 1;
+        memcpy(snapshot->intervals, intervals, position * sizeof(Interval));
+        Interval added = { start, end, end, kind };
+        snapshot->intervals[position] = added;
+        memcpy(snapshot->intervals + position + 1, intervals + position, (count - position) * sizeof(Interval));
+        for (usword_t i = position; i <= count; i++) {
+            usword_t reach = i ? snapshot->intervals[i - 1].reach : 0;
+            snapshot->intervals[i].reach = snapshot->intervals[i].end > reach ? snapshot->intervals[i].end : reach;
+        }
+        replace(snapshot);
+    }
+
+
+    bool RootTable::remove(usword_t start, usword_t end, Kind kind) {
+        if (!_snapshot) return false;
+        usword_t count = _snapshot->count;
+        Interval *intervals = _snapshot->intervals;
+        usword_t position = 0;
+        while (position < count && !(intervals[position].start == start && intervals[position].end == end && intervals[position].kind == kind)) position++;
+        if (position == count) return false;
+        Snapshot *snapshot = NULL;
+        if (count > 1) {
+            snapshot = (Snapshot *)aux_malloc(sizeof(Snapshot) + (count - 1) * sizeof(Interval));
+            snapshot->count = count - 1;
+            memcpy(snapshot->intervals, intervals, position * sizeof(Interval));
+            memcpy(snapshot->intervals + position, intervals + position + 1, (count - position - 1) * sizeof(Interval));
+            for (usword_t i = position; i < count - 1; i++) {
+                usword_t reach = i ? snapshot->intervals[i - 1].reach : 0;
+                snapshot->intervals[i].reach = snapshot->intervals[i].end > reach ? snapshot->intervals[i].end : reach;
+            }
+        }
+        replace(snapshot);
+        return true;
+    }
+
+
+    bool RootTable::find(Snapshot *snapshot, usword_t address) {
+        if (!snapshot) return false;
+        // the last interval starting at or below address, then back while an earlier one may reach it.
+        usword_t low = 0, high = snapshot->count;
+        while (low < high) {
+            usword_t middle = (low + high) / 2;
+            if (snapshot->intervals[middle].start <= address) low = middle + 1;
+            else high = middle;
+        }
+        for (usword_t i = low; i > 0 && snapshot->intervals[i - 1].reach > address; i--) {
+            if (snapshot->intervals[i - 1].end > address) return true;
+        }
+        return false;
+    }
+
+
+    void RootTable::add_root(void *root) {
+        Mutex lock(&_mutex);
+        insert((usword_t)root, (usword_t)root + sizeof(void *), explicit_root);
+    }
+
+
+    bool RootTable::remove_root(void *root) {
+        Mutex lock(&_mutex);
+        return remove((usword_t)root, (usword_t)root + sizeof(void *), explicit_root);
+    }
+
+
+    void RootTable::add_datasegment(void *address, usword_t size) {
+        Mutex lock(&_mutex);
+        insert((usword_t)address, (usword_t)address + size, datasegment);
+    }
+
+
+    void RootTable::remove_datasegment(void *address, usword_t size) {
+        Mutex lock(&_mutex);
+        remove((usword_t)address, (usword_t)address + size, datasegment);
+    }
+
+
+    bool RootTable::contains(const void *address) {
+        usword_t *count = begin_read();
+        bool found = find(__atomic_load_n(&_snapshot, __ATOMIC_SEQ_CST), (usword_t)address);
+        end_read(count);
+        return found;
+    }
+
+};
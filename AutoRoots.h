@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoRoots.h
+    Registered data segments and explicit roots
+ */
+
+#ifndef __AUTO_ROOTS__
+#define __AUTO_ROOTS__
+
+#include "AutoDefs.h"
+#include "AutoHashTable.h"
+
+namespace Auto {
+
+    //
+    // RootTable
+    //
+    // The registered data segments and explicit roots, as one array of address intervals sorted by
+    // start.  An explicit root is the one word interval at its address.  The array is never changed
+    // once published: writers, serialized by a mutex, build a new copy, publish it, wait until no
+    // reader can still hold the old one and free it.  Readers take no lock; they count themselves in
+    // one of two sets of striped counters, and a writer waits for each set to drain in turn.
+    //
+    // The collector locks the table, so that its snapshot stays put while the world is stopped.
+    //
+    class RootTable {
+
+      public:
+        enum Kind {
+            datasegment,
+            explicit_root,
+        };
+
+        struct Interval {
+            usword_t    start;
+            usword_t    end;
+            usword_t    reach;                              // greatest end of this and every earlier interval
+            Kind        kind;
+        };
+
+        struct Snapshot {
+            usword_t    count;
+            Interval    intervals[0];
+        };
+
+        enum {
+            reader_stripes = 16,                            // counters per phase, each on its own cache line
+        };
+
+      private:
+        struct ReaderCount {
+            usword_t    count;
+            char        pad[64 - sizeof(usword_t)];
+        };
+
+        ReaderCount     _readers[2][reader_stripes];
+        usword_t        _phase;                             // which set of counters new readers use
+        Snapshot        *_snapshot;
+        pthread_mutex_t _mutex;                             // serializes writers
+
+        static inline usword_t stripe() { return pointer_hash((void *)pthread_self()) & (reader_stripes - 1); }
+
+        //
+        // begin_read, end_read
+        //
+        // Bracket a read of the snapshot.  begin_read returns the counter to hand to end_read.
+        //
+        inline usword_t *begin_read() {
+            usword_t *count = &_readers[__atomic_load_n(&_phase, __ATOMIC_RELAXED) & 1][stripe()].count;
+            __atomic_add_fetch(count, 1, __ATOMIC_SEQ_CST);
+            return count;
+        }
+        inline void end_read(usword_t *count) { __atomic_sub_fetch(count, 1, __ATOMIC_RELEASE); }
+
+        //
+        // replace
+        //
+        // Publish snapshot in place of the current one and free the old one once no reader holds it.
+        // Called with the mutex held.
+        //
+        void replace(Snapshot *snapshot);
+
+        //
+        // insert, remove
+        //
+        // Publish a copy with the interval added or removed.  Called with the mutex held.  remove returns
+        // false if there was no such interval.
+        //
+        void insert(usword_t start, usword_t end, Kind kind);
+        bool remove(usword_t start, usword_t end, Kind kind);
+
+        static bool find(Snapshot *snapshot, usword_t address);
+
+      public:
+        RootTable();
+        ~RootTable();
+
+        //
+        // Registration
+        //
+        void add_root(void *root);
+        bool remove_root(void *root);
+        void add_datasegment(void *address, usword_t size);
+        void remove_datasegment(void *address, usword_t size);
+
+        //
+        // contains
+        //
+        // Whether address lies in a registered data segment or is an explicit root.  Takes no lock.
+        //
+        bool contains(const void *address);
+
+        //
+        // Collector access.  snapshot() stays valid while the table is locked.
+        //
+        inline void lock() { pthread_mutex_lock(&_mutex); }
+        inline void unlock() { pthread_mutex_unlock(&_mutex); }
+        inline Snapshot *snapshot() const { return _snapshot; }
+    };
+
+};
+
+#endif // __AUTO_ROOTS__
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoScan.cpp
+    Conservative scanning kernel
+ */
+
+#include "AutoScan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Auto {
+
+    //
+    // filter_words
+    //
+    // One word at a time; also finishes the tails of the vector filters.
+    //
+    static uintptr_t filter_words(void **start, uintptr_t count, uintptr_t min, uintptr_t span, void ***survivors) {
+        uintptr_t found = 0;
+        for (uintptr_t i = 0; i < count; i++) {
+            if ((uintptr_t)start[i] - min < span) survivors[found++] = start + i;
+        }
+        return found;
+    }
+
+
+#if defined(__x86_64__)
+
+    //
+    // filter_sse2
+    //
+    // Four words per iteration.  SSE2 has no 64 bit compare, so (word - min) < span is evaluated on
+    // the 32 bit halves: the high halves are less, or equal with the low halves less.
+    //
+    static uintptr_t filter_sse2(void **start, uintptr_t count, uintptr_t min, uintptr_t span, void ***survivors) {
+        const __m128i vmin = _mm_set1_epi64x((long long)min);
+        const __m128i vspan = _mm_set1_epi64x((long long)span);
+        const __m128i bias = _mm_set1_epi32((int)0x80000000);
+        const __m128i vspan_biased = _mm_xor_si128(vspan, bias);
+        uintptr_t found = 0, i = 0;
+        for ( ; i + 4 <= count; i += 4) {
+            __m128i d0 = _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(start + i)), vmin);
+            __m128i d1 = _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(start + i + 2)), vmin);
+            __m128i lt0 = _mm_cmplt_epi32(_mm_xor_si128(d0, bias), vspan_biased);
+            __m128i lt1 = _mm_cmplt_epi32(_mm_xor_si128(d1, bias), vspan_biased);
+            __m128i eq0 = _mm_cmpeq_epi32(d0, vspan);
+            __m128i eq1 = _mm_cmpeq_epi32(d1, vspan);
+            __m128i in0 = _mm_or_si128(_mm_shuffle_epi32(lt0, _MM_SHUFFLE(3, 3, 1, 1)),
+                                       _mm_and_si128(_mm_shuffle_epi32(eq0, _MM_SHUFFLE(3, 3, 1, 1)), _mm_shuffle_epi32(lt0, _MM_SHUFFLE(2, 2, 0, 0))));
+            __m128i in1 = _mm_or_si128(_mm_shuffle_epi32(lt1, _MM_SHUFFLE(3, 3, 1, 1)),
+                                       _mm_and_si128(_mm_shuffle_epi32(eq1, _MM_SHUFFLE(3, 3, 1, 1)), _mm_shuffle_epi32(lt1, _MM_SHUFFLE(2, 2, 0, 0))));
+            int mask = _mm_movemask_pd(_mm_castsi128_pd(in0)) | (_mm_movemask_pd(_mm_castsi128_pd(in1)) << 2);
+            while (mask) {
+                survivors[found++] = start + i + __builtin_ctz(mask);
+                mask &= mask - 1;
+            }
+        }
+        return found + filter_words(start + i, count - i, min, span, survivors + found);
+    }
+
+
+    //
+    // filter_avx2
+    //
+    // Eight words per iteration.  Biasing by the sign bit turns the signed compare unsigned.
+    //
+    __attribute__((target("avx2")))
+    static uintptr_t filter_avx2(void **start, uintptr_t count, uintptr_t min, uintptr_t span, void ***survivors) {
+        const __m256i vmin = _mm256_set1_epi64x((long long)min);
+        const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+        const __m256i vspan_biased = _mm256_xor_si256(_mm256_set1_epi64x((long long)span), bias);
+        uintptr_t found = 0, i = 0;
+        for ( ; i + 8 <= count; i += 8) {
+            __m256i d0 = _mm256_xor_si256(_mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(start + i)), vmin), bias);
+            __m256i d1 = _mm256_xor_si256(_mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(start + i + 4)), vmin), bias);
+            int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vspan_biased, d0))) |
+                       (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vspan_biased, d1))) << 4);
+            while (mask) {
+                survivors[found++] = start + i + __builtin_ctz(mask);
+                mask &= mask - 1;
+            }
+        }
+        return found + filter_words(start + i, count - i, min, span, survivors + found);
+    }
+
+#endif
+
+
+    candidate_filter_t filter_candidates = filter_words;
+
+
+    void initialize_scanning(void) {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        filter_candidates = __builtin_cpu_supports("avx2") ? filter_avx2 : filter_sse2;
+#endif
+    }
+
+
+    candidate_filter_t candidate_filter(uintptr_t kind) {
+        switch (kind) {
+        case candidate_filter_words:
+            return filter_words;
+#if defined(__x86_64__)
+        case candidate_filter_sse2:
+            return filter_sse2;
+        case candidate_filter_avx2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? filter_avx2 : NULL;
+#endif
+        }
+        return NULL;
+    }
+
+};
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoScan.h
+    Conservative scanning kernel
+ */
+
+#ifndef __AUTO_SCAN__
+#define __AUTO_SCAN__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Shared with the filter test (tests/test_scan_filters.cpp) and benchmark (tools/bench_scan.cpp),
+// which compile AutoScan.cpp into host programs, so this header and AutoScan.cpp include nothing of
+// the library's; uintptr_t is usword_t.
+//
+namespace Auto {
+
+    enum {
+        scan_batch_words        = 256,                      // words filtered before their survivors are looked up
+    };
+
+    enum {
+        candidate_filter_words,
+        candidate_filter_sse2,
+        candidate_filter_avx2,
+        candidate_filter_count,
+    };
+
+    //
+    // candidate_filter_t
+    //
+    // Stores in survivors the addresses of the words of [start, start + count) whose values lie in
+    // [min, min + span), in order, and returns how many there are.  survivors has room for count.
+    //
+    typedef uintptr_t (*candidate_filter_t)(void **start, uintptr_t count, uintptr_t min, uintptr_t span, void ***survivors);
+
+    //
+    // filter_candidates
+    //
+    // The fastest filter the processor supports: AVX2 or SSE2 on x86_64, plain words elsewhere.  Set
+    // by initialize_scanning().
+    //
+    extern candidate_filter_t filter_candidates;
+
+    //
+    // candidate_filter
+    //
+    // The filter of a kind, or NULL if the build or the processor lacks it; for checking and
+    // measuring the filters against each other.
+    //
+    candidate_filter_t candidate_filter(uintptr_t kind);
+
+    //
+    // initialize_scanning
+    //
+    // Pick filter_candidates.  Called once, before any zone is created.
+    //
+    void initialize_scanning(void);
+
+};
+
+#endif // __AUTO_SCAN__
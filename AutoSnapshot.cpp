@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoSnapshot.cpp
+    Binary heap snapshots
+ */
+
+#include "AutoSnapshot.h"
+#include "AutoCollector.h"
+#include "AutoHeapWalker.h"
+#include "AutoLayout.h"
+#include "AutoZone.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+namespace Auto {
+
+    //
+    // SnapshotWriter
+    //
+    // Encodes a heap walk into a chain of chunks of virtual memory, which the walk may allocate with
+    // the world stopped, and writes them out afterwards.
+    //
+    class SnapshotWriter {
+        enum {
+            chunk_size = 1024 * 1024,
+        };
+
+        struct Chunk {
+            Chunk       *next;
+            usword_t    used;
+            uint8_t     bytes[0];
+        };
+
+        Zone            *_zone;
+        Chunk           *_first;
+        Chunk           *_last;
+        uint8_t         *_p;                                // next byte of _last
+        uint8_t         *_limit;
+        bool            _failed;                            // out of memory; the snapshot is incomplete
+        usword_t        _previous_node;
+        VMArray<usword_t> _references;                      // of the record being encoded
+
+        bool ensure(usword_t bytes) {
+            if (_limit - _p >= (sword_t)bytes) return true;
+            if (_failed) return false;
+            Chunk *chunk = (Chunk *)allocate_memory(chunk_size);
+            if (!chunk) {
+                _failed = true;
+                return false;
+            }
+            chunk->next = NULL;
+            chunk->used = 0;
+            if (_last) {
+                _last->used = _p - _last->bytes;
+                _last->next = chunk;
+            } else {
+                _first = chunk;
+            }
+            _last = chunk;
+            _p = chunk->bytes;
+            _limit = (uint8_t *)chunk + chunk_size;
+            return true;
+        }
+
+        inline void put(uint64_t value) { if (ensure(varint_maximum_bytes)) _p = put_varint(_p, value); }
+        inline void put_tag(SnapshotTag tag) { if (ensure(1)) *_p++ = (uint8_t)tag; }
+
+        static void add_reference(usword_t offset, void *value, void *block, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            if (!writer->_references.push(offset) || !writer->_references.push((usword_t)block)) writer->_failed = true;
+        }
+
+        //
+        // scan_roots, put_root_references
+        //
+        // Gather the blocks that conservatively scanned memory refers to, then encode them as a list,
+        // each a delta from the one before.
+        //
+        void scan_roots(void *begin, void *end) {
+            begin = (void *)align_up((usword_t)begin, sizeof(void *));
+            if (begin < end) HeapWalker::scan_references(_zone, begin, end, NULL, add_reference, this);
+        }
+
+        void put_root_references() {
+            usword_t count = _references.count() / 2, previous = 0;
+            put(count);
+            for (usword_t i = 0; i < count; i++) {
+                usword_t block = _references[2 * i + 1];
+                put(zigzag((sword_t)(block - previous)));
+                previous = block;
+            }
+            _references.clear();
+        }
+
+      public:
+        SnapshotWriter(Zone *zone) : _zone(zone), _first(NULL), _last(NULL), _p(NULL), _limit(NULL), _failed(false), _previous_node(0) {}
+
+        ~SnapshotWriter() {
+            for (Chunk *chunk = _first, *next; chunk; chunk = next) {
+                next = chunk->next;
+                deallocate_memory(chunk, chunk_size);
+            }
+        }
+
+        void begin() {
+            if (!ensure(sizeof(snapshot_magic))) return;
+            memcpy(_p, snapshot_magic, sizeof(snapshot_magic));
+            _p += sizeof(snapshot_magic);
+            put_tag(snapshot_header);
+            put(snapshot_version);
+            put(sizeof(void *));
+        }
+
+        void end() {
+            put_tag(snapshot_end);
+            if (_last) _last->used = _p - _last->bytes;
+        }
+
+        //
+        // write
+        //
+        // Write the snapshot to fd.  Returns false if it is incomplete or a write failed.
+        //
+        bool write(int fd) {
+            if (_failed) return false;
+            for (Chunk *chunk = _first; chunk; chunk = chunk->next) {
+                for (usword_t done = 0; done < chunk->used; ) {
+                    ssize_t written = ::write(fd, chunk->bytes + done, chunk->used - done);
+                    if (written < 0 && errno == EINTR) continue;
+                    if (written <= 0) return false;
+                    done += written;
+                }
+            }
+            return true;
+        }
+
+        //
+        // HeapVisitor functions
+        //
+        static void visit_thread(Thread *thread, auto_address_range_t stack, auto_address_range_t registers, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            writer->scan_roots(stack.begin, stack.end);
+            writer->scan_roots(registers.begin, registers.end);
+            writer->put_tag(snapshot_thread);
+            writer->put((usword_t)stack.begin);
+            writer->put((usword_t)stack.end);
+            writer->put_root_references();
+        }
+
+        static void visit_nodes(const auto_node_info_t *nodes, usword_t count, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            Zone *zone = writer->_zone;
+            for (usword_t n = 0; n < count; n++) {
+                const auto_node_info_t &node = nodes[n];
+                usword_t address = (usword_t)node.address;
+                if (!(node.type & AUTO_UNSCANNED)) {
+                    // with the world stopped only layouts already compiled are used, as by the collector.
+                    const CompiledLayout *compiled = is_exactly_scanned(node.type) && *(void **)address ? zone->layout_cache().find(*(void **)address) : NULL;
+                    HeapWalker::scan_references(zone, (void *)address, displace((void *)address, node.size), compiled, add_reference, writer);
+                }
+                writer->put_tag(snapshot_node);
+                writer->put(zigzag((sword_t)(address - writer->_previous_node)));
+                writer->put(node.size);
+                writer->put((uint32_t)node.type);
+                writer->put(node.refcount);
+                writer->put(node.is_thread_local ? snapshot_node_thread_local : 0);
+                usword_t references = writer->_references.count() / 2;
+                writer->put(references);
+                for (usword_t i = 0; i < references; i++) {
+                    writer->put(writer->_references[2 * i] / sizeof(void *));
+                    writer->put(zigzag((sword_t)(writer->_references[2 * i + 1] - address)));
+                }
+                writer->_references.clear();
+                writer->_previous_node = address;
+            }
+        }
+
+        static void visit_root(const void **root, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            writer->put_tag(snapshot_root);
+            writer->put((usword_t)root);
+            writer->put((usword_t)*root);
+        }
+
+        static void visit_datasegment(auto_address_range_t segment, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            writer->scan_roots(segment.begin, segment.end);
+            writer->put_tag(snapshot_datasegment);
+            writer->put((usword_t)segment.begin);
+            writer->put((usword_t)segment.end);
+            writer->put_root_references();
+        }
+
+        static void visit_weak(const void *referent, const void **location, auto_weak_callback_block_t *block, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            writer->put_tag(snapshot_weak);
+            writer->put((usword_t)location);
+            writer->put((usword_t)referent);
+        }
+
+        static void visit_association(const void *object, const void *key, void *value, void *context) {
+            SnapshotWriter *writer = (SnapshotWriter *)context;
+            writer->put_tag(snapshot_association);
+            writer->put((usword_t)object);
+            writer->put((usword_t)key);
+            writer->put((usword_t)value);
+        }
+    };
+
+
+    bool write_snapshot(Zone *zone, int fd) {
+        SnapshotWriter writer(zone);
+        writer.begin();
+        HeapVisitor visitor = {
+            &writer,
+            SnapshotWriter::visit_thread,
+            SnapshotWriter::visit_nodes,
+            SnapshotWriter::visit_root,
+            SnapshotWriter::visit_datasegment,
+            SnapshotWriter::visit_weak,
+            SnapshotWriter::visit_association,
+        };
+        zone->visit_heap(visitor);
+        writer.end();
+        return writer.write(fd);
+    }
+
+};
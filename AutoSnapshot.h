@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoSnapshot.h
+    Binary heap snapshots
+ */
+
+#ifndef __AUTO_SNAPSHOT__
+#define __AUTO_SNAPSHOT__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Snapshot format
+//
+// Everything the library and the offline reader (tools/auto_snapshot.cpp) share, so this header
+// includes nothing of the library's.  A snapshot is the 8 byte magic "AUTOSNAP" followed by records,
+// each a tag byte and its fields.  Every field is an unsigned LEB128 varint; signed deltas are
+// zigzag encoded first.  A reference list is a count followed by that many references.
+//
+//  header          version, pointer size in bytes
+//  thread          stack begin, stack end, references from the stack and registers: each the
+//                  block's delta from the previous block in the list (from 0 for the first)
+//  node            address delta from the previous node (from 0 for the first), size, type,
+//                  refcount, flags, references: each the word offset in the node and the block's
+//                  delta from the node's address
+//  datasegment     begin, end, references as for a thread
+//  root            address, value
+//  weak            location, referent
+//  association     object, key, value
+//  end             nothing; the last record
+//
+namespace Auto {
+
+    enum {
+        snapshot_version = 1,
+        snapshot_node_thread_local = 1,                     // node flags
+    };
+
+    enum SnapshotTag {
+        snapshot_end = 0,
+        snapshot_header,
+        snapshot_thread,
+        snapshot_node,
+        snapshot_datasegment,
+        snapshot_root,
+        snapshot_weak,
+        snapshot_association,
+    };
+
+    static const char snapshot_magic[8] = { 'A', 'U', 'T', 'O', 'S', 'N', 'A', 'P' };
+
+    enum {
+        varint_maximum_bytes = 10,                          // a 64 bit value in 7 bit groups
+    };
+
+    //
+    // put_varint
+    //
+    // Store value at p and return the byte past it.
+    //
+    inline uint8_t *put_varint(uint8_t *p, uint64_t value) {
+        while (value >= 0x80) {
+            *p++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *p++ = (uint8_t)value;
+        return p;
+    }
+
+    //
+    // get_varint
+    //
+    // Read a value from [p, limit) into value and return the byte past it, or NULL if it is cut short.
+    //
+    inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *limit, uint64_t &value) {
+        value = 0;
+        for (unsigned shift = 0; p < limit && shift < 64; shift += 7) {
+            uint8_t byte = *p++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return p;
+        }
+        return NULL;
+    }
+
+    inline uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    inline int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+    class Zone;
+
+    //
+    // write_snapshot
+    //
+    // Walk the heap of zone and write its snapshot to fd.  The world is stopped only while the
+    // snapshot is encoded into memory; it is written once every thread runs again.  Returns false if
+    // memory ran out or a write failed.
+    //
+    bool write_snapshot(Zone *zone, int fd);
+
+};
+
+#endif // __AUTO_SNAPSHOT__
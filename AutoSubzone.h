@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoSubzone.h
+    Fixed size block storage for one size class
+ */
+
+#ifndef __AUTO_SUBZONE__
+#define __AUTO_SUBZONE__
+
+#include "AutoDefs.h"
+#include "AutoBitmap.h"
+#include "auto_zone.h"
+
+namespace Auto {
+
+    class Admin;
+
+    //
+    // Side data
+    //
+    // Every block has one byte of side data describing it.  The same encoding is used for large blocks.
+    //
+    enum {
+        side_layout_mask        = 0x07,                     // auto_memory_type_t bits
+        side_age_shift          = 3,
+        side_age_mask           = 0x03 << side_age_shift,   // generations survived, counting down
+        side_finalized          = 0x20,                     // block has been finalized
+        side_local              = 0x40,                     // block is reachable only from the allocating thread
+        side_local_mark         = 0x80,                     // set by that thread's local collection
+    };
+
+    enum {
+        youngest_age            = 3,
+        eldest_age              = 0,
+    };
+
+    //
+    // Cards
+    //
+    // A card byte records pointer stores into card_size bytes of blocks.  The write barrier sets both
+    // bits; each kind of scan cleans only its own.
+    //
+    enum {
+        card_young              = 0x01,                     // may refer to young blocks; cleaned by generational scans
+        card_marking            = 0x02,                     // stored into during concurrent marking; cleaned at remark
+        card_dirty              = card_young | card_marking,
+    };
+
+    inline unsigned char side_data_for(auto_memory_type_t layout) {
+        return (unsigned char)((layout & side_layout_mask) | (youngest_age << side_age_shift));
+    }
+
+    //
+    // Side data updates
+    //
+    // Once a block is allocated its side byte is shared: the collector ages it while the owner
+    // finalizes, publishes or changes the layout of it, so every change is an atomic read-modify-write.
+    //
+    inline void side_set(unsigned char *side, unsigned char bits) { __atomic_fetch_or(side, bits, __ATOMIC_RELAXED); }
+    inline void side_clear(unsigned char *side, unsigned char bits) { __atomic_fetch_and(side, (unsigned char)~bits, __ATOMIC_RELAXED); }
+
+    inline void side_set_layout(unsigned char *side, auto_memory_type_t layout) {
+        unsigned char old = __atomic_load_n(side, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(side, &old, (unsigned char)((old & ~side_layout_mask) | (layout & side_layout_mask)), true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+
+    inline void side_mature(unsigned char *side) {
+        unsigned char old = __atomic_load_n(side, __ATOMIC_RELAXED);
+        while ((old & side_age_mask) && !__atomic_compare_exchange_n(side, &old, (unsigned char)(old - (1 << side_age_shift)), true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+
+
+    //
+    // Subzone
+    //
+    // A subzone is a subzone_quantum sized, subzone_quantum aligned piece of a region holding blocks of
+    // a single size class.  The first pages hold this header followed by the per-block side tables;
+    // blocks start on the first page boundary after them.  Keeping the metadata out of the blocks means
+    // block payloads are dense, and the collector can reason about blocks without touching their pages.
+    //
+    // Per block we keep:
+    //      side data       one byte, see above
+    //      refcount        one byte
+    //      claimed         one bit, block is allocated or held in an allocation cache
+    //      allocated       one bit, block is a live allocation (the collector's domain)
+    //      mark            one bit, set by the collector
+    //      shared          one bit, set by an exhaustive collection reaching a marked block again
+    //
+    // and one card byte per card_size bytes of the subzone, set by the write barrier when a pointer is
+    // stored into the card, so that collections need only scan the dirty cards of blocks they do not trace.
+    //
+    class Subzone {
+
+      private:
+        Subzone         *_next;                             // link on the admin's list of subzones with free blocks
+        Subzone         *_admin_next;                       // link on the admin's list of all its subzones
+        Admin           *_admin;                            // owning size class
+        usword_t        _swept_epoch;                       // zone sweep epoch whose garbage is swept
+        usword_t        _block_size;                        // size of each block
+        usword_t        _block_count;                       // number of blocks
+        uint64_t        _reciprocal;                        // ceil(2^40 / _block_size), for index computation
+        usword_t        _start;                             // address of the first block
+        usword_t        _claimed_count;                     // number of claimed blocks
+        usword_t        _hint;                              // lowest index that may be unclaimed
+        bool            _on_free_list;                      // subzone is on the admin's list
+        bool            _uncounted;                         // blocks were allocated marked while references were counted
+        void            **_forwarding;                      // new block addresses, while compaction evacuates the subzone
+        uint64_t        _empty_since;                       // auto_date_now() when the last block was unclaimed; 0 while in use or purged
+        unsigned char   *_side_data;
+        unsigned char   *_refcounts;
+        Bitmap          _claimed;
+        Bitmap          _allocated;
+        Bitmap          _marks;
+        Bitmap          _shared;
+        Bitmap          _weak;                              // block may hold registered weak locations
+        unsigned char   _cards[subzone_card_count];         // nonzero if dirty
+
+        static usword_t metadata_size(usword_t block_count) {
+            return block_count * 2 + 5 * Bitmap::words_for_bits(block_count) * sizeof(usword_t);
+        }
+
+      public:
+
+        //
+        // layout_for_block_size
+        //
+        // Computes the number of blocks and the offset of the first block for the given block size.
+        //
+        static void layout_for_block_size(usword_t block_size, usword_t &block_count, usword_t &start_offset) {
+            usword_t header = align_up(sizeof(Subzone), sizeof(usword_t));
+            usword_t count = (subzone_quantum - header) / (block_size + 2);
+            while (count && align_up(header + metadata_size(count), page_size) + count * block_size > subzone_quantum) count--;
+            block_count = count;
+            start_offset = align_up(header + metadata_size(count), page_size);
+        }
+
+        //
+        // initialize
+        //
+        // Set up the header of a fresh (zero filled) subzone.  It has no garbage to sweep.
+        //
+        void initialize(Admin *admin, usword_t block_size, usword_t sweep_epoch) {
+            usword_t start_offset;
+            layout_for_block_size(block_size, _block_count, start_offset);
+            _next = NULL;
+            _admin_next = NULL;
+            _forwarding = NULL;
+            _empty_since = 0;
+            _swept_epoch = sweep_epoch;
+            _block_size = block_size;
+            _reciprocal = ((uint64_t)1 << 40) / block_size + 1;
+            _start = (usword_t)this + start_offset;
+            _claimed_count = 0;
+            _hint = 0;
+            _on_free_list = false;
+            _uncounted = false;
+
+            usword_t words = Bitmap::words_for_bits(_block_count);
+            usword_t *bits = (usword_t *)align_up((usword_t)this + sizeof(Subzone), sizeof(usword_t));
+            _claimed = Bitmap(bits);
+            _allocated = Bitmap(bits + words);
+            _marks = Bitmap(bits + 2 * words);
+            _shared = Bitmap(bits + 3 * words);
+            _weak = Bitmap(bits + 4 * words);
+            _side_data = (unsigned char *)(bits + 5 * words);
+            _refcounts = _side_data + _block_count;
+
+            // the collector ignores subzones whose admin is not yet set.
+            __atomic_store_n(&_admin, admin, __ATOMIC_RELEASE);
+        }
+
+        //
+        // Accessors
+        //
+        static inline Subzone *subzone(const void *address) { return (Subzone *)align_down((usword_t)address, subzone_quantum); }
+        inline Subzone *next() const { return _next; }
+        inline void set_next(Subzone *next) { _next = next; }
+        inline Subzone *admin_next() const { return _admin_next; }
+        inline void set_admin_next(Subzone *next) { _admin_next = next; }
+        inline usword_t swept_epoch() const { return __atomic_load_n(&_swept_epoch, __ATOMIC_ACQUIRE); }
+        inline void set_swept_epoch(usword_t epoch) { __atomic_store_n(&_swept_epoch, epoch, __ATOMIC_RELEASE); }
+        inline Admin *admin() const { return _admin; }
+        inline bool is_initialized() const { return __atomic_load_n(&_admin, __ATOMIC_ACQUIRE) != NULL; }
+        inline usword_t block_size() const { return _block_size; }
+        inline usword_t block_count() const { return _block_count; }
+        inline usword_t claimed_count() const { return _claimed_count; }
+        inline bool is_full() const { return _claimed_count == _block_count; }
+        inline bool is_empty() const { return _claimed_count == 0; }
+        inline bool on_free_list() const { return _on_free_list; }
+        inline void set_on_free_list(bool on) { _on_free_list = on; }
+        inline void **forwarding() const { return _forwarding; }
+        inline void set_forwarding(void **forwarding) { _forwarding = forwarding; }
+        inline uint64_t empty_since() const { return _empty_since; }
+        inline void set_empty_since(uint64_t date) { _empty_since = date; }
+        inline void *first_block() const { return (void *)_start; }
+        inline void *limit() const { return (void *)(_start + _block_count * _block_size); }
+
+        //
+        // Address to block index mapping
+        //
+        inline bool in_blocks(const void *address) const { return (usword_t)address - _start < _block_count * _block_size; }
+        inline usword_t block_index(const void *address) const {
+            return (usword_t)((((uint64_t)((usword_t)address - _start)) * _reciprocal) >> 40);
+        }
+        inline void *block_address(usword_t index) const { return (void *)(_start + index * _block_size); }
+        inline bool is_block_start(const void *address) const {
+            if (!in_blocks(address)) return false;
+            usword_t index = block_index(address);
+            return block_address(index) == address && is_allocated(index);
+        }
+
+        //
+        // Per block state
+        //
+        inline bool is_claimed(usword_t index) const { return _claimed.test(index); }
+        inline bool is_allocated(usword_t index) const { return _allocated.test(index); }
+        inline bool is_marked(usword_t index) const { return _marks.test(index); }
+        inline bool test_set_mark(usword_t index) { return _marks.test_set_atomic(index); }
+        inline bool test_clear_mark(usword_t index) { return _marks.test_clear_atomic(index); }
+        inline void clear_marks() { _marks.clear_all(_block_count); }
+        inline void mark_blocks(usword_t index, usword_t count) { _marks.set_range_atomic(index, count); }
+        inline bool is_shared(usword_t index) const { return _shared.test(index); }
+        inline void set_shared(usword_t index) { if (!_shared.test(index)) _shared.set_atomic(index); }
+        inline void clear_shared() { _shared.clear_all(_block_count); }
+
+        //
+        // Whether a weak location inside a block was ever registered, so that freeing the block must
+        // erase its registrations; see Zone::block_deallocate().  Cleared when the block is freed.
+        //
+        inline bool has_weak_locations(usword_t index) const { return _weak.test(index); }
+        inline void set_weak_locations(usword_t index) { if (!_weak.test(index)) _weak.set_atomic(index); }
+
+        //
+        // Whether blocks were allocated marked during an exhaustive collection, so that no marking
+        // counted their references; see Collector::mark_new_blocks().
+        //
+        inline void set_uncounted() { if (!_uncounted) _uncounted = true; }
+        inline bool test_clear_uncounted() { bool uncounted = _uncounted; _uncounted = false; return uncounted; }
+
+        inline unsigned char *side_data_address(usword_t index) const { return _side_data + index; }
+        inline unsigned char side_data(usword_t index) const { return _side_data[index]; }
+        inline void set_side_data(usword_t index, unsigned char side) { _side_data[index] = side; }
+        inline auto_memory_type_t layout(usword_t index) const { return _side_data[index] & side_layout_mask; }
+        inline void set_layout(usword_t index, auto_memory_type_t layout) { side_set_layout(_side_data + index, layout); }
+        inline usword_t age(usword_t index) const { return (_side_data[index] & side_age_mask) >> side_age_shift; }
+        inline bool is_young(usword_t index) const { return (_side_data[index] & side_age_mask) != 0; }
+        inline void mature(usword_t index) { side_mature(_side_data + index); }
+        inline bool is_finalized(usword_t index) const { return (_side_data[index] & side_finalized) != 0; }
+        inline void set_finalized(usword_t index) { side_set(_side_data + index, side_finalized); }
+        inline bool is_local(usword_t index) const { return (_side_data[index] & side_local) != 0; }
+        inline void set_global(usword_t index) { side_clear(_side_data + index, side_local | side_local_mark); }
+        inline bool is_local_marked(usword_t index) const { return (_side_data[index] & side_local_mark) != 0; }
+        inline void set_local_mark(usword_t index) { side_set(_side_data + index, side_local_mark); }
+        inline void clear_local_mark(usword_t index) { side_clear(_side_data + index, side_local_mark); }
+
+        inline unsigned char *refcount_address(usword_t index) const { return _refcounts + index; }
+        inline usword_t refcount(usword_t index) const { return _refcounts[index]; }
+        inline void set_refcount(usword_t index, usword_t refcount) { _refcounts[index] = (unsigned char)refcount; }
+
+        //
+        // Cards
+        //
+        static inline usword_t card_index(const void *address) { return ((usword_t)address & (subzone_quantum - 1)) >> card_size_log2; }
+        inline void *card_address(usword_t card) const { return (void *)((usword_t)this + (card << card_size_log2)); }
+        inline unsigned char card(usword_t card) const { return _cards[card]; }
+        inline void dirty_card(const void *address) { _cards[card_index(address)] = card_dirty; }
+        inline void mark_card(const void *address, unsigned char bits) { __atomic_fetch_or(_cards + card_index(address), bits, __ATOMIC_RELAXED); }
+        inline void mark_cards(const void *address, usword_t size) {
+            memset(_cards + card_index(address), card_dirty, card_index((void *)((usword_t)address + size - 1)) - card_index(address) + 1);
+        }
+        inline void clear_card(usword_t card, unsigned char bits) { _cards[card] &= ~bits; }
+        inline void clear_cards() { bzero(_cards, sizeof(_cards)); }
+        inline void clear_cards(unsigned char bits) { for (usword_t i = 0; i < subzone_card_count; i++) _cards[i] &= ~bits; }
+
+        inline Bitmap &claimed_bitmap() { return _claimed; }
+        inline Bitmap &allocated_bitmap() { return _allocated; }
+        inline Bitmap &mark_bitmap() { return _marks; }
+        inline Bitmap &shared_bitmap() { return _shared; }
+
+        //
+        // claim_blocks
+        //
+        // Claims up to n unclaimed blocks, storing their addresses in results.  Caller holds the admin lock.
+        //
+        usword_t claim_blocks(void **results, usword_t n) {
+            usword_t count = 0;
+            usword_t index = _hint;
+            while (count < n) {
+                index = _claimed.find_clear(index, _block_count);
+                if (index == _block_count) break;
+                _claimed.set(index);
+                results[count++] = block_address(index);
+                index++;
+            }
+            _hint = index;
+            _claimed_count += count;
+            if (count) _empty_since = 0;
+            return count;
+        }
+
+        //
+        // unclaim_block
+        //
+        // Returns a block to the pool of unclaimed blocks.  Caller holds the admin lock.
+        //
+        void unclaim_block(usword_t index) {
+            _claimed.clear(index);
+            _claimed_count--;
+            if (index < _hint) _hint = index;
+        }
+
+        //
+        // allocate_block
+        //
+        // Makes a claimed block a live allocation.  Other blocks' allocated bits may change concurrently.
+        //
+        inline void allocate_block(usword_t index, auto_memory_type_t layout, usword_t refcount, bool local = false) {
+            _side_data[index] = side_data_for(layout) | (local ? side_local : 0);
+            _refcounts[index] = (unsigned char)refcount;
+            _allocated.set_atomic(index);
+        }
+
+        //
+        // allocate_blocks
+        //
+        // Makes a run of count consecutive claimed blocks live allocations, writing their side table
+        // entries together.
+        //
+        inline void allocate_blocks(usword_t index, usword_t count, auto_memory_type_t layout, usword_t refcount) {
+            memset(_side_data + index, side_data_for(layout), count);
+            memset(_refcounts + index, (int)refcount, count);
+            _allocated.set_range_atomic(index, count);
+        }
+
+        //
+        // deallocate_block
+        //
+        // Ends a live allocation; the block remains claimed.
+        //
+        inline void deallocate_block(usword_t index) {
+            _allocated.clear_atomic(index);
+            if (_weak.test(index)) _weak.clear_atomic(index);
+            _side_data[index] = 0;
+            _refcounts[index] = 0;
+        }
+    };
+
+};
+
+#endif // __AUTO_SUBZONE__
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoThread.cpp
+    Registered thread state
+ */
+
+#include "AutoThread.h"
+#include "AutoZone.h"
+
+namespace Auto {
+
+    Thread::Thread(Zone *zone)
+        : _next(NULL), _zone(zone), _pthread(pthread_self()), _stack_pointer(NULL), _register_count(0),
+          _suspended(false), _blocks_allocated(0), _bytes_allocated(0), _local_collection_threshold(local_collection_minimum),
+          _in_local_collection(false)
+    {
+        _thread = pthread_mach_thread_np(_pthread);
+        _stack_base = pthread_get_stackaddr_np(_pthread);
+        bzero(_registers, sizeof(_registers));
+        bzero(_caches, sizeof(_caches));
+    }
+
+
+    bool Thread::suspend() {
+        if (thread_suspend(_thread) != KERN_SUCCESS) return false;
+        _suspended = true;
+
+#if defined(__x86_64__)
+        x86_thread_state64_t state;
+        mach_msg_type_number_t count = x86_THREAD_STATE64_COUNT;
+        kern_return_t err = thread_get_state(_thread, x86_THREAD_STATE64, (thread_state_t)&state, &count);
+        usword_t sp = state.__rsp;
+#elif defined(__i386__)
+        i386_thread_state_t state;
+        mach_msg_type_number_t count = i386_THREAD_STATE_COUNT;
+        kern_return_t err = thread_get_state(_thread, i386_THREAD_STATE, (thread_state_t)&state, &count);
+        usword_t sp = state.__esp;
+#elif defined(__arm64__)
+        arm_thread_state64_t state;
+        mach_msg_type_number_t count = ARM_THREAD_STATE64_COUNT;
+        kern_return_t err = thread_get_state(_thread, ARM_THREAD_STATE64, (thread_state_t)&state, &count);
+        usword_t sp = arm_thread_state64_get_sp(state);
+#else
+#error Unknown architecture
+#endif
+        if (err != KERN_SUCCESS) {
+            // without a stack pointer the whole stack has to be considered live.
+            _stack_pointer = displace(_stack_base, -(sword_t)pthread_get_stacksize_np(_pthread));
+            _register_count = 0;
+            return true;
+        }
+        _stack_pointer = (void *)(sp - stack_red_zone);
+        _register_count = sizeof(state) / sizeof(usword_t);
+        memcpy(_registers, &state, _register_count * sizeof(usword_t));
+        return true;
+    }
+
+
+    void Thread::resume() {
+        if (_suspended) {
+            thread_resume(_thread);
+            _suspended = false;
+        }
+    }
+
+
+    bool Thread::refill(Admin &admin) {
+        void *blocks[64];
+        usword_t count = admin.claim_blocks(blocks, cache_refill_count(admin.block_size()));
+        if (!count) return false;
+        AllocationCache &cache = _caches[admin.size_class()];
+        // push in reverse so blocks pop in address order.
+        while (count) cache.push(blocks[--count]);
+        return true;
+    }
+
+
+    void Thread::flush_caches() {
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            AllocationCache &cache = _caches[sc];
+            if (cache.head) {
+                _zone->admin(sc).unclaim_blocks(cache.head);
+                cache.head = NULL;
+                cache.count = 0;
+            }
+        }
+    }
+
+
+    void *Thread::take_local(const void *candidate) {
+        if (!_zone->in_heap(candidate)) return NULL;
+        Subzone *subzone = _zone->subzone_for(candidate);
+        if (!subzone || !subzone->in_blocks(candidate)) return NULL;
+        usword_t index = subzone->block_index(candidate);
+        if (!subzone->is_allocated(index) || !subzone->is_local(index)) return NULL;
+        void *block = subzone->block_address(index);
+        // other threads' local blocks are theirs to publish.
+        if (!_local_blocks.find(block)) return NULL;
+        _zone->make_global(subzone, index);
+        _local_blocks.remove(block);
+        return block;
+    }
+
+
+    void Thread::publish_reachable(void *block) {
+        enum { pending_capacity = 64 };
+        void *pending[pending_capacity];
+        usword_t count = 0;
+        pending[count++] = block;
+        while (count) {
+            block = pending[--count];
+            Subzone *subzone = Subzone::subzone(block);
+            if (subzone->layout(subzone->block_index(block)) & AUTO_UNSCANNED) continue;
+            for (void **p = (void **)block, **limit = (void **)displace(block, subzone->block_size()); p < limit; p++) {
+                void *child = take_local(*p);
+                if (!child) continue;
+                if (count < pending_capacity) pending[count++] = child;
+                else publish_reachable(child);
+            }
+        }
+    }
+
+
+    void Thread::publish(const void *candidate) {
+        if (!_local_blocks.count()) return;
+        void *block = take_local(candidate);
+        if (!block) return;
+        publish_reachable(block);
+        // once most local blocks have been published, collect again at the usual pace.
+        if (2 * _local_blocks.count() < _local_collection_threshold) local_collection_finished();
+    }
+
+
+    void Thread::publish_all() {
+        for (usword_t i = 0; i < _local_blocks.capacity(); i++) {
+            const void *block = _local_blocks.entries()[i].key;
+            if (!block) continue;
+            Subzone *subzone = Subzone::subzone(block);
+            usword_t index = subzone->block_index(block);
+            if (subzone->is_allocated(index)) _zone->make_global(subzone, index);
+        }
+        _local_blocks.clear();
+        local_collection_finished();
+    }
+
+};
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoThread.h
+    Registered thread state
+ */
+
+#ifndef __AUTO_THREAD__
+#define __AUTO_THREAD__
+
+#include "AutoDefs.h"
+#include "AutoAdmin.h"
+#include "AutoHashTable.h"
+
+#include <mach/mach.h>
+
+namespace Auto {
+
+    class Zone;
+
+    //
+    // AllocationCache
+    //
+    // Claimed but unallocated blocks of one size class, owned by a single thread and threaded
+    // through their first word.
+    //
+    struct AllocationCache {
+        void            *head;
+        usword_t        count;
+
+        inline void *pop() {
+            void *block = head;
+            if (block) {
+                head = *(void **)block;
+                count--;
+            }
+            return block;
+        }
+
+        inline void push(void *block) {
+            *(void **)block = head;
+            head = block;
+            count++;
+        }
+    };
+
+
+    //
+    // Thread
+    //
+    // State kept for each thread registered with a zone.  Only the owning thread touches its
+    // allocation caches and counters.
+    //
+    class Thread {
+
+      public:
+        enum {
+            register_words = 64,                            // room for any machine thread state
+#if defined(__x86_64__)
+            stack_red_zone = 128,                           // leaf frames may use memory below the stack pointer
+#else
+            stack_red_zone = 0,
+#endif
+            local_collection_minimum = 1024,                // local blocks that trigger a thread local collection
+        };
+
+      private:
+        Thread          *_next;                             // zone's list of registered threads
+        Zone            *_zone;
+        pthread_t       _pthread;
+        mach_port_t     _thread;                            // for suspension
+        void            *_stack_base;                       // highest address of the stack
+        void            *_stack_pointer;                    // lowest live stack address, valid while suspended
+        usword_t        _register_count;                    // words of _registers valid while suspended
+        usword_t        _registers[register_words];
+        bool            _suspended;
+        usword_t        _blocks_allocated;                  // statistics, net of blocks freed through this thread
+        usword_t        _bytes_allocated;
+        AllocationCache _caches[size_class_count];
+        PointerHashMap<bool> _local_blocks;                 // blocks allocated here that are still thread local
+        usword_t        _local_collection_threshold;        // collect locally once this many blocks are local
+        bool            _in_local_collection;               // finalizers may allocate; do not nest
+
+        //
+        // take_local
+        //
+        // If candidate refers to one of this thread's local blocks, make the block global and return it.
+        //
+        void *take_local(const void *candidate);
+
+        //
+        // publish_reachable
+        //
+        // Make global every local block reachable from an already published block.
+        //
+        void publish_reachable(void *block);
+
+      public:
+
+        Thread(Zone *zone);
+
+        //
+        // Accessors
+        //
+        inline Thread *next() const { return _next; }
+        inline Thread **next_address() { return &_next; }
+        inline void set_next(Thread *next) { _next = next; }
+        inline Zone *zone() const { return _zone; }
+        inline pthread_t pthread() const { return _pthread; }
+        inline void *stack_base() const { return _stack_base; }
+        inline void *stack_pointer() const { return _stack_pointer; }
+        inline usword_t *registers() { return _registers; }
+        inline usword_t register_count() const { return _register_count; }
+        inline bool is_suspended() const { return _suspended; }
+        inline bool is_current_thread() const { return pthread_equal(_pthread, pthread_self()); }
+        inline usword_t blocks_allocated() const { return _blocks_allocated; }
+        inline usword_t bytes_allocated() const { return _bytes_allocated; }
+
+        //
+        // cache_refill_count
+        //
+        // Number of blocks claimed at once when a cache runs dry; about 8K worth.
+        //
+        static inline usword_t cache_refill_count(usword_t block_size) {
+            usword_t count = 8192 / block_size;
+            return count < 1 ? 1 : (count > 64 ? 64 : count);
+        }
+
+        //
+        // allocate
+        //
+        // Pop a block of the given class from this thread's cache, refilling it from the admin when empty.
+        // Returns NULL if out of memory.
+        //
+        inline void *allocate(Admin &admin) {
+            AllocationCache &cache = _caches[admin.size_class()];
+            void *block = cache.pop();
+            if (!block) {
+                if (!refill(admin)) return NULL;
+                block = cache.pop();
+            }
+            _blocks_allocated++;
+            _bytes_allocated += admin.block_size();
+            return block;
+        }
+
+        //
+        // take_cached
+        //
+        // Pop up to n cached blocks of the admin's class, counting them as allocated.
+        //
+        inline usword_t take_cached(Admin &admin, void **results, usword_t n) {
+            AllocationCache &cache = _caches[admin.size_class()];
+            usword_t count = 0;
+            while (count < n && cache.head) results[count++] = cache.pop();
+            note_allocated(count, count * admin.block_size());
+            return count;
+        }
+
+        //
+        // note_allocated
+        //
+        // Count blocks this thread claimed directly from an admin.
+        //
+        inline void note_allocated(usword_t blocks, usword_t bytes) {
+            _blocks_allocated += blocks;
+            _bytes_allocated += bytes;
+        }
+
+        //
+        // deallocate
+        //
+        // Free a live block into this thread's cache.  Returns false, leaving the block alone, if the
+        // cache is full and the block must go back to the admin.
+        //
+        inline bool deallocate(Admin &admin, void *block) {
+            AllocationCache &cache = _caches[admin.size_class()];
+            if (cache.count >= 2 * cache_refill_count(admin.block_size())) return false;
+            Subzone *subzone = Subzone::subzone(block);
+            subzone->deallocate_block(subzone->block_index(block));
+            cache.push(block);
+            _blocks_allocated--;
+            _bytes_allocated -= admin.block_size();
+            return true;
+        }
+
+        //
+        // refill
+        //
+        // Claim a batch of blocks into an empty cache.
+        //
+        bool refill(Admin &admin);
+
+        //
+        // suspend
+        //
+        // Stop the thread and capture its stack pointer and registers.  Returns false if the thread
+        // could not be suspended, i.e. it has exited.  Never called on the current thread.
+        //
+        bool suspend();
+
+        //
+        // resume
+        //
+        // Undo suspend().
+        //
+        void resume();
+
+        //
+        // flush_caches
+        //
+        // Return every cached block to its admin.
+        //
+        void flush_caches();
+
+        //
+        // Thread local blocks
+        //
+        // Blocks stay local, collected by this thread alone, until a pointer to them is stored in global
+        // memory through a write barrier.
+        //
+        inline PointerHashMap<bool> &local_blocks() { return _local_blocks; }
+        inline void add_local_block(void *block) { _local_blocks.insert(block, true); }
+        inline void remove_local_block(void *block) { _local_blocks.remove(block); }
+        inline bool should_collect_locally() const { return _local_blocks.count() >= _local_collection_threshold && !_in_local_collection; }
+        inline bool in_local_collection() const { return _in_local_collection; }
+        inline void set_in_local_collection(bool in) { _in_local_collection = in; }
+
+        //
+        // local_collection_finished
+        //
+        // Wait for the local blocks to double again before the next local collection.
+        //
+        inline void local_collection_finished() {
+            _local_collection_threshold = 2 * _local_blocks.count();
+            if (_local_collection_threshold < local_collection_minimum) _local_collection_threshold = local_collection_minimum;
+        }
+
+        //
+        // publish
+        //
+        // If candidate refers to a local block, make it and every local block it reaches global.
+        //
+        void publish(const void *candidate);
+
+        //
+        // publish_all
+        //
+        // Make every local block global, as when the thread goes away.
+        //
+        void publish_all();
+    };
+
+};
+
+#endif // __AUTO_THREAD__
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoThreadLocalCollector.cpp
+    Collection of a single thread's local blocks
+ */
+
+#include "AutoThreadLocalCollector.h"
+#include "AutoRecorder.h"
+#include "AutoScan.h"
+#include "AutoTrace.h"
+#include "AutoZone.h"
+
+#include <setjmp.h>
+
+namespace Auto {
+
+    static void foreach_local_garbage(auto_zone_cursor_t cursor, void (*op) (void *ptr, void *data), void *data) {
+        for (usword_t i = 0; i < cursor->count; i++) op(cursor->blocks[i], data);
+    }
+
+
+    void ThreadLocalCollector::mark_candidate(void *candidate, bool interior) {
+        if (!_zone->in_heap(candidate)) return;
+        Subzone *subzone = _zone->subzone_for(candidate);
+        if (!subzone || !subzone->in_blocks(candidate)) return;
+        usword_t index = subzone->block_index(candidate);
+        void *block = subzone->block_address(index);
+        if ((block != candidate && !interior) || !subzone->is_allocated(index)) return;
+        if (!subzone->is_local(index) || subzone->is_local_marked(index)) return;
+        // stale words may refer to other threads' local blocks; leave those alone.
+        if (!_thread->local_blocks().find(block)) return;
+        subzone->set_local_mark(index);
+        if (!(subzone->layout(index) & AUTO_UNSCANNED)) _pending.push(block);
+    }
+
+
+    void ThreadLocalCollector::scan_range(void *start, void *end, bool interior) {
+        void **p = (void **)align_up((usword_t)start, sizeof(void *));
+        void **limit = (void **)align_down((usword_t)end, sizeof(void *));
+        void **survivors[scan_batch_words];
+        usword_t heap_min = _zone->heap_min(), heap_span = _zone->heap_max() - heap_min;
+        while (p < limit) {
+            usword_t count = limit - p < scan_batch_words ? limit - p : scan_batch_words;
+            usword_t found = filter_candidates(p, count, heap_min, heap_span, survivors);
+            p += count;
+            for (usword_t i = 0; i < found; i++) mark_candidate(*survivors[i], interior);
+        }
+    }
+
+
+    void ThreadLocalCollector::scan_block(void *block, usword_t size, auto_memory_type_t layout) {
+        const CompiledLayout *compiled = is_exactly_scanned(layout) ? _zone->layout_cache().layout_for(_zone, block) : NULL;
+        if (!compiled) {
+            scan_range(block, displace(block, size), false);
+            return;
+        }
+        void **base = (void **)block, **limit = (void **)displace(block, size);
+        for (usword_t i = 0; i < compiled->run_count; i++) {
+            const LayoutRun &run = compiled->runs[i];
+            void **run_end = base + run.start + run.count;
+            if (base + run.start >= limit) break;
+            scan_range(base + run.start, run_end < limit ? run_end : limit, false);
+        }
+        if (base + compiled->covered < limit) scan_range(base + compiled->covered, limit, false);
+    }
+
+
+    void ThreadLocalCollector::collect() {
+        // callee saved registers may hold local pointers; spill them where the stack scan sees them.
+        jmp_buf registers;
+        setjmp(registers);
+        trace_begin_span(span_local_collection);
+        collect_with_stack();
+        trace_end_span(span_local_collection, blocks_freed(), _bytes_freed);
+    }
+
+
+    __attribute__((noinline)) void ThreadLocalCollector::collect_with_stack() {
+        scan_range(__builtin_frame_address(0), _thread->stack_base(), true);
+        while (_pending.count()) {
+            void *block = _pending.pop();
+            Subzone *subzone = Subzone::subzone(block);
+            scan_block(block, subzone->block_size(), subzone->layout(subzone->block_index(block)));
+        }
+
+        PointerHashMap<bool> &local_blocks = _thread->local_blocks();
+        for (usword_t i = 0; i < local_blocks.capacity(); i++) {
+            void *block = (void *)local_blocks.entries()[i].key;
+            if (!block) continue;
+            Subzone *subzone = Subzone::subzone(block);
+            usword_t index = subzone->block_index(block);
+            if (subzone->is_local_marked(index)) subzone->clear_local_mark(index);
+            else _garbage.push(block);
+        }
+        finalize_and_free();
+    }
+
+
+    void ThreadLocalCollector::reap() {
+        PointerHashMap<bool> &local_blocks = _thread->local_blocks();
+        for (usword_t i = 0; i < local_blocks.capacity(); i++) {
+            void *block = (void *)local_blocks.entries()[i].key;
+            if (block) _garbage.push(block);
+        }
+        finalize_and_free();
+    }
+
+
+    void ThreadLocalCollector::finalize_and_free() {
+        // garbage stays local, out of reach of global collections, until block_deallocate frees it.
+        for (usword_t i = 0; i < _garbage.count(); i++) {
+            void *block = _garbage[i];
+            Subzone *subzone = Subzone::subzone(block);
+            usword_t index = subzone->block_index(block);
+            if (!subzone->is_allocated(index) || !subzone->is_local(index)) {
+                // freed or published behind our back; not ours any more.
+                _thread->remove_local_block(block);
+                _garbage[i--] = _garbage.pop();
+                continue;
+            }
+            _bytes_freed += subzone->block_size();
+            if ((subzone->layout(index) & AUTO_OBJECT) && !subzone->is_finalized(index)) {
+                subzone->set_finalized(index);
+                _finalize.push(block);
+            }
+        }
+
+        auto_collection_control_t *control = _zone->control();
+        if (_finalize.count() && control->batch_invalidate) {
+            auto_zone_cursor cursor = { _finalize.items(), _finalize.count() };
+            trace_begin_span(span_finalize_batch, _finalize.count());
+            control->batch_invalidate(_zone->basic_zone(), foreach_local_garbage, &cursor, sizeof(cursor));
+            trace_end_span(span_finalize_batch);
+        }
+
+        bool recording = is_recording(_zone);
+        for (usword_t i = 0; i < _garbage.count(); i++) {
+            if (recording) record_block(recording_death, _garbage[i]);
+            _zone->block_deallocate(_garbage[i]);
+        }
+    }
+
+};
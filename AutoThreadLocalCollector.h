@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoThreadLocalCollector.h
+    Collection of a single thread's local blocks
+ */
+
+#ifndef __AUTO_THREAD_LOCAL_COLLECTOR__
+#define __AUTO_THREAD_LOCAL_COLLECTOR__
+
+#include "AutoDefs.h"
+#include "AutoCollector.h"
+
+namespace Auto {
+
+    class Thread;
+    class Zone;
+
+    //
+    // ThreadLocalCollector
+    //
+    // Collects the calling thread's local blocks without stopping any other thread.  Local blocks are
+    // referenced only from the owning thread's stack and registers and from other local blocks, so
+    // those are all that need scanning.  Blocks not reached are finalized and freed at once.
+    //
+    class ThreadLocalCollector {
+
+      private:
+        Zone            *_zone;
+        Thread          *_thread;
+        VMArray<void *> _pending;                           // reached local blocks still to scan
+        VMArray<void *> _garbage;
+        VMArray<void *> _finalize;                          // garbage objects not yet finalized
+        usword_t        _bytes_freed;
+
+        void mark_candidate(void *candidate, bool interior);
+        void scan_range(void *start, void *end, bool interior);
+        void scan_block(void *block, usword_t size, auto_memory_type_t layout);
+        void collect_with_stack();
+        void finalize_and_free();
+
+      public:
+
+        ThreadLocalCollector(Zone *zone, Thread *thread) : _zone(zone), _thread(thread), _bytes_freed(0) {}
+
+        //
+        // Accessors
+        //
+        inline usword_t blocks_freed() const { return _garbage.count(); }
+        inline usword_t bytes_freed() const { return _bytes_freed; }
+
+        //
+        // collect
+        //
+        // Scan this thread's stack for its local blocks and free the unreachable ones.
+        //
+        void collect();
+
+        //
+        // reap
+        //
+        // Free every local block of the thread without scanning, for when nothing can refer to them.
+        //
+        void reap();
+    };
+
+};
+
+#endif // __AUTO_THREAD_LOCAL_COLLECTOR__
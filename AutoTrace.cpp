@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoTrace.cpp
+    Binary event tracing into per-thread ring buffers
+ */
+
+#include "AutoTrace.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <mach/mach_time.h>
+
+namespace Auto {
+
+    bool trace_enabled;
+
+    enum {
+        trace_buffer_events = 1 << 14,                      // per thread, a power of 2
+        trace_drain_batch = 256,                            // events copied out at a time
+        trace_output_size = 64 * 1024,
+    };
+
+    //
+    // TraceBuffer
+    //
+    // One thread's ring.  head and drained count events ever written and ever drained; the event with
+    // count n lives in slot n mod trace_buffer_events.
+    //
+    struct TraceBuffer {
+        TraceBuffer     *next;                              // every buffer, newest first
+        bool            in_use;                             // owned by a live thread
+        uint32_t        thread_number;                      // the tid its events are shown under
+        usword_t        head;
+        usword_t        drained;
+        TraceEvent      events[trace_buffer_events];
+    };
+
+    static TraceBuffer *trace_buffers;
+    static uint32_t trace_thread_count;
+    static pthread_key_t trace_key;
+    static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+    static pthread_mutex_t trace_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static void release_buffer(void *data) {
+        __atomic_store_n(&((TraceBuffer *)data)->in_use, false, __ATOMIC_RELEASE);
+    }
+
+    static void create_trace_key(void) {
+        pthread_key_create(&trace_key, release_buffer);
+    }
+
+
+    //
+    // claim_buffer
+    //
+    // A buffer for the calling thread: one an exited thread left and a drain emptied, or a new one.
+    // Takes no lock, since the collector records events with other threads suspended.
+    //
+    static TraceBuffer *claim_buffer() {
+        uint32_t number = __atomic_add_fetch(&trace_thread_count, 1, __ATOMIC_RELAXED);
+        for (TraceBuffer *buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+            bool in_use = false;
+            if (__atomic_load_n(&buffer->drained, __ATOMIC_ACQUIRE) != buffer->head) continue;
+            if (__atomic_compare_exchange_n(&buffer->in_use, &in_use, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                buffer->thread_number = number;
+                return buffer;
+            }
+        }
+        TraceBuffer *buffer = (TraceBuffer *)allocate_memory(sizeof(TraceBuffer));
+        if (!buffer) return NULL;
+        buffer->in_use = true;
+        buffer->thread_number = number;
+        buffer->head = buffer->drained = 0;
+        buffer->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_buffers, &buffer->next, buffer, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+        return buffer;
+    }
+
+
+    void trace_record(TraceKind kind, uint32_t detail, uint64_t argument0, uint64_t argument1) {
+        TraceBuffer *buffer = (TraceBuffer *)pthread_getspecific(trace_key);
+        if (!buffer) {
+            buffer = claim_buffer();
+            if (!buffer) return;
+            pthread_setspecific(trace_key, buffer);
+        }
+        usword_t head = buffer->head;
+        TraceEvent &event = buffer->events[head & (trace_buffer_events - 1)];
+        event.time = mach_absolute_time();
+        event.kind = kind;
+        event.detail = detail;
+        event.arguments[0] = argument0;
+        event.arguments[1] = argument1;
+        __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+        // a drain trusts the slots the head has not reached; the next event's stores must not pass it.
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+
+    void set_tracing(bool enabled) {
+        pthread_once(&trace_once, create_trace_key);
+        __atomic_store_n(&trace_enabled, enabled, __ATOMIC_RELEASE);
+    }
+
+
+    //
+    // TraceWriter
+    //
+    // Formats drained events as Chrome trace events into a buffer written to fd as it fills.
+    //
+    class TraceWriter {
+        int             _fd;
+        bool            _failed;
+        bool            _first;
+        usword_t        _used;
+        int             _pid;
+        mach_timebase_info_data_t _timebase;
+        char            _output[trace_output_size];
+
+        static const char *span_name(uint32_t span) {
+            static const char *names[span_count] = {
+                "collection", "pause", "mark", "weak clear", "finalize", "finalize batch", "reclaim", "local collection",
+            };
+            return span < span_count ? names[span] : "unknown";
+        }
+
+        void flush() {
+            for (usword_t done = 0; done < _used && !_failed; ) {
+                ssize_t written = ::write(_fd, _output + done, _used - done);
+                if (written < 0 && errno == EINTR) continue;
+                if (written <= 0) _failed = true;
+                else done += written;
+            }
+            _used = 0;
+        }
+
+        void put(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+            if (_used > trace_output_size - 512) flush();
+            va_list arguments;
+            va_start(arguments, format);
+            int length = vsnprintf(_output + _used, trace_output_size - _used, format, arguments);
+            va_end(arguments);
+            if (length > 0 && (usword_t)length < trace_output_size - _used) _used += length;
+        }
+
+        void begin_event(const char *name, const char *phase, uint32_t thread, uint64_t time) {
+            double microseconds = (double)time * _timebase.numer / _timebase.denom / 1000.0;
+            put("%s\n{\"name\":\"%s\",\"cat\":\"gc\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u", _first ? "" : ",", name, phase, microseconds, _pid, thread);
+            _first = false;
+        }
+
+      public:
+        TraceWriter(int fd) : _fd(fd), _failed(false), _first(true), _used(0), _pid(getpid()) {
+            mach_timebase_info(&_timebase);
+            put("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        }
+
+        void put_event(const TraceEvent &event, uint32_t thread) {
+            switch (event.kind) {
+            case trace_begin:
+                begin_event(span_name(event.detail), "B", thread, event.time);
+                if (event.detail == span_collection) {
+                    put(",\"args\":{\"generational\":%d,\"exhaustive\":%d,\"recollection\":%d}}",
+                        (event.arguments[0] & trace_generational) != 0, (event.arguments[0] & trace_exhaustive) != 0, (event.arguments[0] & trace_recollection) != 0);
+                } else if (event.detail == span_finalize_batch) {
+                    put(",\"args\":{\"blocks\":%llu}}", (unsigned long long)event.arguments[0]);
+                } else {
+                    put("}");
+                }
+                break;
+            case trace_end:
+                begin_event(span_name(event.detail), "E", thread, event.time);
+                if (event.detail == span_collection || event.detail == span_local_collection) {
+                    put(",\"args\":{\"blocks_freed\":%llu,\"bytes_freed\":%llu}}", (unsigned long long)event.arguments[0], (unsigned long long)event.arguments[1]);
+                } else if (event.detail == span_weak_clear) {
+                    put(",\"args\":{\"cleared\":%llu}}", (unsigned long long)event.arguments[0]);
+                } else if (event.detail == span_finalize) {
+                    put(",\"args\":{\"blocks\":%llu}}", (unsigned long long)event.arguments[0]);
+                } else {
+                    put("}");
+                }
+                break;
+            case trace_region_growth:
+                begin_event(event.detail == growth_region ? "region added" : "subzone added", "i", thread, event.time);
+                put(",\"s\":\"p\",\"args\":{\"address\":\"0x%llx\",\"size\":%llu}}", (unsigned long long)event.arguments[0], (unsigned long long)event.arguments[1]);
+                break;
+            case trace_retain:
+            case trace_release:
+                begin_event(event.kind == trace_retain ? "retain" : "release", "i", thread, event.time);
+                put(",\"s\":\"t\",\"args\":{\"block\":\"0x%llx\",\"count\":%llu}}", (unsigned long long)event.arguments[0], (unsigned long long)event.arguments[1]);
+                break;
+            }
+        }
+
+        bool finish(usword_t dropped) {
+            put("\n],\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)dropped);
+            flush();
+            return !_failed;
+        }
+    };
+
+
+    //
+    // drain_buffer
+    //
+    // Hand writer the events of buffer not yet drained, returning how many were overwritten first.
+    //
+    static usword_t drain_buffer(TraceBuffer *buffer, TraceWriter &writer) {
+        TraceEvent copies[trace_drain_batch];
+        usword_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+        usword_t next = buffer->drained, dropped = 0;
+        if (head - next > trace_buffer_events) {
+            dropped += head - trace_buffer_events - next;
+            next = head - trace_buffer_events;
+        }
+        while (next < head) {
+            usword_t count = head - next < trace_drain_batch ? head - next : trace_drain_batch;
+            for (usword_t i = 0; i < count; i++) copies[i] = buffer->events[(next + i) & (trace_buffer_events - 1)];
+            // the slots the owner may have been writing meanwhile, up to the one it writes now, are suspect.
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            usword_t now = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+            usword_t trusted = now + 1 > trace_buffer_events ? now + 1 - trace_buffer_events : 0;
+            for (usword_t i = 0; i < count; i++) {
+                if (next + i < trusted) dropped++;
+                else writer.put_event(copies[i], buffer->thread_number);
+            }
+            next += count;
+        }
+        __atomic_store_n(&buffer->drained, head, __ATOMIC_RELEASE);
+        return dropped;
+    }
+
+
+    bool write_trace(int fd) {
+        Mutex lock(&trace_drain_mutex);
+        void *memory = aux_malloc(sizeof(TraceWriter));
+        if (!memory) return false;
+        TraceWriter *writer = new (memory) TraceWriter(fd);
+        usword_t dropped = 0;
+        for (TraceBuffer *buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+            dropped += drain_buffer(buffer, *writer);
+        }
+        bool ok = writer->finish(dropped);
+        writer->~TraceWriter();
+        aux_free(writer);
+        return ok;
+    }
+
+};
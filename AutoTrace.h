@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoTrace.h
+    Binary event tracing into per-thread ring buffers
+ */
+
+#ifndef __AUTO_TRACE__
+#define __AUTO_TRACE__
+
+#include "AutoDefs.h"
+
+namespace Auto {
+
+    //
+    // TraceKind
+    //
+    // What an event records.  Spans begin and end on one thread, the span itself in the event's detail.
+    //
+    enum TraceKind {
+        trace_begin,                                        // detail a TraceSpan
+        trace_end,
+        trace_region_growth,                                // detail a TraceGrowth; address, size
+        trace_retain,                                       // block, count after
+        trace_release,
+    };
+
+    //
+    // TraceSpan
+    //
+    // The spans of work traced, with what their begin and end events carry.
+    //
+    enum TraceSpan {
+        span_collection,                                    // begin: trace_generational, trace_exhaustive, trace_recollection; end: blocks freed, bytes freed
+        span_pause,                                         // the world stopped
+        span_mark,                                          // concurrent marking
+        span_weak_clear,                                    // end: locations zeroed
+        span_finalize,                                      // end: blocks to finalize
+        span_finalize_batch,                                // one batch_invalidate call; begin: blocks
+        span_reclaim,
+        span_local_collection,                              // end: blocks freed, bytes freed
+        span_count
+    };
+
+    enum {
+        trace_generational  = 1,                            // span_collection begin flags
+        trace_exhaustive    = 2,
+        trace_recollection  = 4,
+    };
+
+    enum TraceGrowth {
+        growth_region,
+        growth_subzone,
+    };
+
+    //
+    // TraceEvent
+    //
+    // One fixed size record.  time is in mach_absolute_time() units, converted when drained.
+    //
+    struct TraceEvent {
+        uint64_t        time;
+        uint32_t        kind;
+        uint32_t        detail;
+        uint64_t        arguments[2];
+    };
+
+    //
+    // Tracing
+    //
+    // Events go into a ring buffer of the recording thread, without locks: only its thread writes a
+    // buffer, publishing each event by advancing its head.  A drain copies what is new in every buffer
+    // and keeps the copies no write overtook meanwhile; events overwritten before a drain are counted
+    // as dropped.  Buffers are never freed; those of exited threads are drained and reused.
+    //
+    // While tracing is off each instrumentation point is one load and one branch predicted not taken.
+    //
+    extern bool trace_enabled;
+
+    void trace_record(TraceKind kind, uint32_t detail, uint64_t argument0, uint64_t argument1);
+
+    inline void trace(TraceKind kind, uint32_t detail = 0, uint64_t argument0 = 0, uint64_t argument1 = 0) {
+        if (__builtin_expect(trace_enabled, false)) trace_record(kind, detail, argument0, argument1);
+    }
+
+    inline void trace_begin_span(TraceSpan span, uint64_t argument0 = 0, uint64_t argument1 = 0) { trace(trace_begin, span, argument0, argument1); }
+    inline void trace_end_span(TraceSpan span, uint64_t argument0 = 0, uint64_t argument1 = 0) { trace(trace_end, span, argument0, argument1); }
+
+    //
+    // set_tracing
+    //
+    // Start or stop recording.  Starting drops nothing already recorded.
+    //
+    void set_tracing(bool enabled);
+
+    //
+    // write_trace
+    //
+    // Drain every buffer to fd in the Chrome trace event format, a JSON object whose traceEvents
+    // array the common trace viewers load.  Drains are serialized.  Returns false if a write failed.
+    //
+    bool write_trace(int fd);
+
+};
+
+#endif // __AUTO_TRACE__
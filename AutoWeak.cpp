@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoWeak.cpp
+    Weak reference table
+ */
+
+#include "AutoWeak.h"
+#include "AutoCompactor.h"
+#include "AutoZone.h"
+
+namespace Auto {
+
+    // ends a list of queued callbacks, so that every queued block has a non-NULL next.
+    static auto_weak_callback_block_t *const callbacks_end = (auto_weak_callback_block_t *)~(usword_t)0;
+
+
+    bool WeakReferrers::add(const void **location, auto_weak_callback_block_t *block) {
+        WeakReferrer *items = this->items();
+        for (usword_t i = 0; i < count; i++) {
+            if (items[i].location == location) {
+                items[i].block = block;
+                return false;
+            }
+        }
+        usword_t limit = capacity ? capacity : (usword_t)inline_capacity;
+        if (count == limit) {
+            WeakReferrer *grown = (WeakReferrer *)aux_malloc(2 * limit * sizeof(WeakReferrer));
+            memcpy(grown, items, count * sizeof(WeakReferrer));
+            destroy();
+            referrers = items = grown;
+            capacity = 2 * limit;
+        }
+        items[count].location = location;
+        items[count].block = block;
+        count++;
+        return true;
+    }
+
+
+    bool WeakReferrers::remove(const void **location) {
+        WeakReferrer *items = this->items();
+        for (usword_t i = 0; i < count; i++) {
+            if (items[i].location == location) {
+                items[i] = items[--count];
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    WeakTable::WeakTable()
+        : _clearing_epoch(0), _clearing_generational(false), _cleared_count(0), _registered_count(0), _locations(NULL), _location_count(0), _locations_size(0), _index_epoch(~(usword_t)0)
+    {
+        for (usword_t i = 0; i < shard_count; i++) {
+            _shards[i].lock.value = 0;
+            _shards[i].mutations = 0;
+        }
+        pthread_mutex_init(&_index_mutex, NULL);
+    }
+
+
+    void WeakTable::register_location(Shard &shard, const void *referent, const void **location, auto_weak_callback_block_t *block) {
+        WeakReferrers *referrers = shard.referents.find(referent);
+        if (!referrers) {
+            WeakReferrers empty = { 0, 0 };
+            shard.referents.insert(referent, empty);
+            referrers = shard.referents.find(referent);
+        }
+        if (referrers->add(location, block)) count_registered(1);
+        changed(shard);
+    }
+
+
+    void WeakTable::unregister_location(Shard &shard, const void *referent, const void **location) {
+        WeakReferrers *referrers = shard.referents.find(referent);
+        if (!referrers || !referrers->remove(location)) return;
+        count_registered(-1);
+        changed(shard);
+        if (referrers->count) return;
+        referrers->destroy();
+        shard.referents.remove(referent);
+    }
+
+
+    void WeakTable::assign(Zone *zone, const void *value, const void **location, auto_weak_callback_block_t *block) {
+        // local collections do not clear weak references; keep both ends global.
+        zone->publish(value);
+        zone->publish(location);
+        // a block freed explicitly erases the registrations of the locations in it only when flagged.
+        if (value) zone->note_weak_location(location);
+
+        // location's registration is keyed by the referent it holds.  Assignments to location serialize
+        // on the shard lock its address hashes to, and the collector zeroes it only holding its
+        // referent's, so a referent that is still there once both are held is the one to unregister.
+        for (;;) {
+            const void *old = __atomic_load_n(location, __ATOMIC_RELAXED);
+            uint64_t shards = shard_bit(location) | shard_bit(old) | shard_bit(value);
+            lock_shards(shards);
+            if (__atomic_load_n(location, __ATOMIC_RELAXED) != old) {
+                unlock_shards(shards);
+                continue;
+            }
+            if (old && old != value) unregister_location(_shards[shard_index(old)], old, location);
+            if (value) register_location(_shards[shard_index(value)], value, location, block);
+            *location = value;
+            unlock_shards(shards);
+            return;
+        }
+    }
+
+
+    void WeakTable::lock_shards(uint64_t shards) {
+        // in index order, like lock_all().
+        for (; shards; shards &= shards - 1) spin_lock(&_shards[__builtin_ctzll(shards)].lock);
+    }
+
+
+    void WeakTable::unlock_shards(uint64_t shards) {
+        for (; shards; shards &= shards - 1) spin_unlock(&_shards[__builtin_ctzll(shards)].lock);
+    }
+
+
+    void *WeakTable::read(Zone *zone, void **location) {
+        for (;;) {
+            usword_t epoch = __atomic_load_n(&_clearing_epoch, __ATOMIC_ACQUIRE);
+            void *value = __atomic_load_n(location, __ATOMIC_ACQUIRE);
+            bool dying = (epoch & 1) && value && zone->is_dying(value, _clearing_generational);
+            // a clearing phase that began or ended meanwhile may have changed the answer.
+            if (__atomic_load_n(&_clearing_epoch, __ATOMIC_ACQUIRE) == epoch) return dying ? NULL : value;
+        }
+    }
+
+
+    usword_t WeakTable::mutation_epoch() const {
+        usword_t epoch = 0;
+        for (usword_t s = 0; s < shard_count; s++) epoch += __atomic_load_n(&_shards[s].mutations, __ATOMIC_RELAXED);
+        return epoch;
+    }
+
+
+    bool WeakTable::build_location_index() {
+        if (_locations) deallocate_memory(_locations, _locations_size);
+        _locations = NULL;
+        _location_count = _locations_size = 0;
+        _index_epoch = ~(usword_t)0;
+
+        lock_all();
+        usword_t count = 0;
+        for (usword_t s = 0; s < shard_count; s++) {
+            PointerHashMap<WeakReferrers> &referents = _shards[s].referents;
+            for (usword_t i = 0; i < referents.capacity(); i++) {
+                if (referents.entries()[i].key) count += referents.entries()[i].value.count;
+            }
+        }
+        // twice the room, the second half for sorting.
+        usword_t size = align_up(2 * count * sizeof(usword_t) + 1, page_size);
+        usword_t *locations = (usword_t *)allocate_memory(size);
+        usword_t low = ~(usword_t)0, high = 0;
+        if (locations) {
+            usword_t n = 0;
+            for (usword_t s = 0; s < shard_count; s++) {
+                PointerHashMap<WeakReferrers> &referents = _shards[s].referents;
+                for (usword_t i = 0; i < referents.capacity(); i++) {
+                    PointerHashMap<WeakReferrers>::Entry &entry = referents.entries()[i];
+                    if (!entry.key) continue;
+                    WeakReferrer *items = entry.value.items();
+                    for (usword_t j = 0; j < entry.value.count; j++) {
+                        usword_t address = (usword_t)items[j].location;
+                        if (address < low) low = address;
+                        if (address > high) high = address;
+                        locations[n++] = address;
+                    }
+                }
+            }
+            _index_epoch = mutation_epoch();
+        }
+        unlock_all();
+        if (!locations) return false;
+
+        if (count > 1 && high > low) radix_sort<usword_t, location_key>(locations, locations + count, count, low, bits_per_word - __builtin_clzl(high - low));
+        _locations = locations;
+        _location_count = count;
+        _locations_size = size;
+        return true;
+    }
+
+
+    void **WeakTable::find_first_referrer(void **location, usword_t count) {
+        if (count >= index_threshold) {
+            Mutex lock(&_index_mutex);
+            if (_index_epoch == mutation_epoch() || build_location_index()) {
+                usword_t low = 0, high = _location_count;
+                while (low < high) {
+                    usword_t middle = (low + high) / 2;
+                    if (_locations[middle] < (usword_t)location) low = middle + 1;
+                    else high = middle;
+                }
+                return low < _location_count && _locations[low] < (usword_t)(location + count) ? (void **)_locations[low] : NULL;
+            }
+        }
+        for (usword_t i = 0; i < count; i++) {
+            const void *referent = __atomic_load_n(location + i, __ATOMIC_RELAXED);
+            if (!referent) continue;
+            Shard &shard = _shards[shard_index(referent)];
+            SpinLock lock(&shard.lock);
+            WeakReferrers *referrers = shard.referents.find(referent);
+            if (!referrers) continue;
+            WeakReferrer *items = referrers->items();
+            for (usword_t j = 0; j < referrers->count; j++) {
+                if (items[j].location == (const void **)(location + i)) return location + i;
+            }
+        }
+        return NULL;
+    }
+
+
+    void WeakTable::erase_locations(const void *start, usword_t size) {
+        // a registered location holds its referent, which keys its registration.
+        const void **location = (const void **)align_up((usword_t)start, sizeof(void *));
+        const void **limit = (const void **)align_down((usword_t)start + size, sizeof(void *));
+        for (; location < limit; location++) {
+            const void *referent = __atomic_load_n(location, __ATOMIC_RELAXED);
+            if (!referent) continue;
+            Shard &shard = _shards[shard_index(referent)];
+            SpinLock lock(&shard.lock);
+            unregister_location(shard, referent, location);
+        }
+    }
+
+
+    void WeakTable::begin_clearing(bool generational) {
+        _clearing_generational = generational;
+        __atomic_add_fetch(&_clearing_epoch, 1, __ATOMIC_RELEASE);
+    }
+
+
+    void WeakTable::end_clearing() {
+        __atomic_add_fetch(&_clearing_epoch, 1, __ATOMIC_RELEASE);
+    }
+
+
+    auto_weak_callback_block_t *WeakTable::clear_dead(Zone *zone) {
+        auto_weak_callback_block_t *callbacks = callbacks_end;
+        usword_t cleared = 0;
+        for (usword_t s = 0; s < shard_count; s++) {
+            Shard &shard = _shards[s];
+            SpinLock lock(&shard.lock);
+            PointerHashMap<WeakReferrers> &referents = shard.referents;
+            for (usword_t i = 0; i < referents.capacity(); ) {
+                PointerHashMap<WeakReferrers>::Entry &entry = referents.entries()[i];
+                if (!entry.key) {
+                    i++;
+                    continue;
+                }
+                WeakReferrers &referrers = entry.value;
+                WeakReferrer *items = referrers.items();
+                bool dead = zone->is_dying(entry.key, _clearing_generational);
+                for (usword_t j = 0; j < referrers.count; ) {
+                    WeakReferrer &referrer = items[j];
+                    // locations in garbage go away with it.
+                    if (zone->is_dying(referrer.location, _clearing_generational)) {
+                        items[j] = items[--referrers.count];
+                        count_registered(-1);
+                        changed(shard);
+                        continue;
+                    }
+                    if (dead) {
+                        if (*referrer.location == entry.key) {
+                            *referrer.location = NULL;
+                            cleared++;
+                        }
+                        auto_weak_callback_block_t *block = referrer.block;
+                        if (block && !block->next) {
+                            block->next = callbacks;
+                            callbacks = block;
+                        }
+                    }
+                    j++;
+                }
+                if (dead || !referrers.count) {
+                    // removal shifts a later entry into slot i; look at it again.
+                    count_registered(-(sword_t)referrers.count);
+                    referrers.destroy();
+                    referents.remove(entry.key);
+                    changed(shard);
+                    continue;
+                }
+                i++;
+            }
+        }
+        _cleared_count = cleared;
+        return callbacks == callbacks_end ? NULL : callbacks;
+    }
+
+
+    void WeakTable::run_callbacks(auto_weak_callback_block_t *callbacks) {
+        while (callbacks && callbacks != callbacks_end) {
+            auto_weak_callback_block_t *block = callbacks;
+            callbacks = block->next;
+            // the block may be queued again from here on.
+            block->next = NULL;
+            block->callback_function(block->target);
+        }
+    }
+
+
+
+    void WeakTable::lock_all() {
+        for (usword_t s = 0; s < shard_count; s++) spin_lock(&_shards[s].lock);
+    }
+
+
+    void WeakTable::unlock_all() {
+        for (usword_t s = 0; s < shard_count; s++) spin_unlock(&_shards[s].lock);
+    }
+
+
+    void WeakTable::visit(visitor_t visitor, void *context) {
+        for (usword_t s = 0; s < shard_count; s++) {
+            PointerHashMap<WeakReferrers> &referents = _shards[s].referents;
+            for (usword_t i = 0; i < referents.capacity(); i++) {
+                PointerHashMap<WeakReferrers>::Entry &entry = referents.entries()[i];
+                if (!entry.key) continue;
+                WeakReferrer *items = entry.value.items();
+                for (usword_t j = 0; j < entry.value.count; j++) visitor(entry.key, items[j].location, items[j].block, context);
+            }
+        }
+    }
+
+
+    void WeakTable::relocate_locations(Compactor &compactor) {
+        for (usword_t s = 0; s < shard_count; s++) {
+            PointerHashMap<WeakReferrers> &referents = _shards[s].referents;
+            changed(_shards[s]);
+            for (usword_t i = 0; i < referents.capacity(); i++) {
+                PointerHashMap<WeakReferrers>::Entry &entry = referents.entries()[i];
+                if (!entry.key) continue;
+                void *referent = compactor.relocated(entry.key);
+                WeakReferrer *items = entry.value.items();
+                for (usword_t j = 0; j < entry.value.count; j++) {
+                    WeakReferrer &referrer = items[j];
+                    referrer.location = (const void **)compactor.relocated(referrer.location);
+                    referrer.block = (auto_weak_callback_block_t *)compactor.relocated(referrer.block);
+                    if (*referrer.location == entry.key) *referrer.location = referent;
+                }
+            }
+        }
+    }
+
+
+    void WeakTable::relocate_referents(Compactor &compactor) {
+        // gather the moved entries first; inserting while iterating could grow the map being walked.
+        PointerHashMap<WeakReferrers> moved;
+        for (usword_t s = 0; s < shard_count; s++) {
+            PointerHashMap<WeakReferrers> &referents = _shards[s].referents;
+            for (usword_t i = 0; i < referents.capacity(); ) {
+                PointerHashMap<WeakReferrers>::Entry &entry = referents.entries()[i];
+                void *referent = entry.key ? compactor.relocated(entry.key) : NULL;
+                if (referent == entry.key) {
+                    i++;
+                    continue;
+                }
+                moved.insert(referent, entry.value);
+                // removal shifts a later entry into slot i; look at it again.
+                referents.remove(entry.key);
+            }
+        }
+        for (usword_t i = 0; i < moved.capacity(); i++) {
+            PointerHashMap<WeakReferrers>::Entry &entry = moved.entries()[i];
+            if (!entry.key) continue;
+            Shard &shard = _shards[shard_index(entry.key)];
+            WeakReferrers *existing = shard.referents.find(entry.key);
+            if (!existing) {
+                shard.referents.insert(entry.key, entry.value);
+                continue;
+            }
+            WeakReferrer *items = entry.value.items();
+            for (usword_t j = 0; j < entry.value.count; j++) {
+                if (!existing->add(items[j].location, items[j].block)) count_registered(-1);
+            }
+            entry.value.destroy();
+        }
+    }
+
+};
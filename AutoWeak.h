@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoWeak.h
+    Weak reference table
+ */
+
+#ifndef __AUTO_WEAK__
+#define __AUTO_WEAK__
+
+#include "AutoDefs.h"
+#include "AutoHashTable.h"
+#include "auto_zone.h"
+
+namespace Auto {
+
+    class Compactor;
+    class Zone;
+
+    //
+    // WeakReferrer
+    //
+    // A registered weak location and the callback to queue when its referent is collected.
+    //
+    struct WeakReferrer {
+        const void      **location;
+        auto_weak_callback_block_t *block;
+    };
+
+
+    //
+    // WeakReferrers
+    //
+    // The locations referring weakly to one referent.  Most referents have one or two, kept inline;
+    // more spill to an array in auxiliary memory.  Copied by value when its table rehashes.
+    //
+    struct WeakReferrers {
+        enum { inline_capacity = 2 };
+
+        usword_t        count;
+        usword_t        capacity;                           // 0 while inline
+        union {
+            WeakReferrer inline_referrers[inline_capacity];
+            WeakReferrer *referrers;
+        };
+
+        inline WeakReferrer *items() { return capacity ? referrers : inline_referrers; }
+        inline void destroy() { if (capacity) aux_free(referrers); }
+
+        bool add(const void **location, auto_weak_callback_block_t *block);      // false if already there
+        bool remove(const void **location);
+    };
+
+
+    //
+    // WeakTable
+    //
+    // Referent -> referrers, sharded by referent address with a spin lock per shard.  Assigning a weak
+    // location also holds the lock of the shard the location's own address hashes to.  Reading a weak
+    // location never takes a lock: outside of a collection's clearing phase whatever a registered
+    // location holds is live.  While clearing, readers check the referent against the collection's
+    // marks themselves.
+    //
+    class WeakTable {
+        enum {
+            shard_count_log2 = 6,
+            shard_count = 1 << shard_count_log2,
+            index_threshold = 64,                           // words from which find_first_referrer uses the location index
+        };
+
+        struct Shard {
+            spin_lock_t                     lock;
+            PointerHashMap<WeakReferrers>   referents;
+            usword_t                        mutations;      // bumped whenever its set of locations changes
+            char                            padding[64];
+        };
+
+        Shard           _shards[shard_count];
+        usword_t        _clearing_epoch;                    // odd while a collection clears dead referents
+        bool            _clearing_generational;
+        usword_t        _cleared_count;                     // locations the last clear_dead() zeroed
+        usword_t        _registered_count;                  // locations registered, for is_empty()
+
+        // every registered location, sorted, as of the sum of the shards' mutations in _index_epoch.
+        pthread_mutex_t _index_mutex;
+        usword_t        *_locations;
+        usword_t        _location_count;
+        usword_t        _locations_size;
+        usword_t        _index_epoch;
+
+        static inline usword_t shard_index(const void *referent) {
+            return pointer_hash(referent) >> (bits_per_word - shard_count_log2);
+        }
+        static inline uint64_t shard_bit(const void *address) { return address ? (uint64_t)1 << shard_index(address) : 0; }
+
+        // a set of shards is a mask of shard_bit()s; shard_count fits in its 64 bits.
+        void lock_shards(uint64_t shards);
+        void unlock_shards(uint64_t shards);
+
+        void register_location(Shard &shard, const void *referent, const void **location, auto_weak_callback_block_t *block);
+        void unregister_location(Shard &shard, const void *referent, const void **location);
+        static inline void changed(Shard &shard) { __atomic_store_n(&shard.mutations, shard.mutations + 1, __ATOMIC_RELAXED); }
+        inline void count_registered(sword_t delta) { __atomic_add_fetch(&_registered_count, delta, __ATOMIC_RELAXED); }
+        usword_t mutation_epoch() const;
+        bool build_location_index();
+        static inline usword_t location_key(const usword_t &location) { return location; }
+
+      public:
+
+        WeakTable();
+
+        inline bool is_empty() const { return __atomic_load_n(&_registered_count, __ATOMIC_RELAXED) == 0; }
+
+        //
+        // assign
+        //
+        // Store value at location, moving location's registration from its previous referent to
+        // value.  A NULL value unregisters location.
+        //
+        void assign(Zone *zone, const void *value, const void **location, auto_weak_callback_block_t *block);
+
+        //
+        // read
+        //
+        // Returns the referent at location, or NULL if it is being collected.  Lock free.
+        //
+        void *read(Zone *zone, void **location);
+
+        //
+        // find_first_referrer
+        //
+        // Returns the lowest of the count words at location registered as a weak location, or NULL.
+        // Long ranges search a sorted index of every location, rebuilt once the table has changed.
+        //
+        void **find_first_referrer(void **location, usword_t count);
+
+        //
+        // erase_locations
+        //
+        // Unregister the locations in [start, start + size), a block being freed explicitly, so that no
+        // later clear writes into whatever reuses its memory.
+        //
+        void erase_locations(const void *start, usword_t size);
+
+        //
+        // Clearing
+        //
+        // Once a collection knows its garbage, and with the world still stopped, begin_clearing()
+        // switches readers to checking referents.  clear_dead() then sweeps every shard, zeroing the
+        // locations of dead referents and dropping locations that lie in garbage, and returns the
+        // callbacks to run as a list linked through their next fields.  end_clearing() restores
+        // lock free reads.  run_callbacks() runs the list with no locks held.
+        //
+        void begin_clearing(bool generational);
+        auto_weak_callback_block_t *clear_dead(Zone *zone);
+        inline usword_t cleared_count() const { return _cleared_count; }
+        void end_clearing();
+        static void run_callbacks(auto_weak_callback_block_t *callbacks);
+
+        //
+        // Compaction
+        //
+        // lock_all() takes every shard lock, which compaction holds from before the world stops until
+        // the table is rehashed.  relocate_locations() runs with the world stopped and allocates
+        // nothing: it repoints registered locations that moved and the moved referents they hold.
+        // relocate_referents() then rekeys the moved referents once mutators are running again.
+        //
+        void lock_all();
+        void unlock_all();
+        void relocate_locations(Compactor &compactor);
+        void relocate_referents(Compactor &compactor);
+
+        //
+        // visit
+        //
+        // Calls visitor(referent, location, block, context) for each registered location.  Called with
+        // every shard locked.
+        //
+        typedef void (*visitor_t)(const void *referent, const void **location, auto_weak_callback_block_t *block, void *context);
+        void visit(visitor_t visitor, void *context);
+    };
+
+};
+
+#endif // __AUTO_WEAK__
@@ -0,0 +1,1564 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoZone.cpp
+    Garbage collected zone
+ */
+
+#include "AutoZone.h"
+#include "AutoCollector.h"
+#include "AutoCompactor.h"
+#include "AutoScan.h"
+#include "AutoThreadLocalCollector.h"
+#include "AutoTrace.h"
+
+#include <Block.h>
+#include <sys/sysctl.h>
+
+namespace Auto {
+
+    enum {
+        default_collection_threshold = 4 * 1024 * 1024,     // least bytes allocated between AUTO_COLLECT_IF_NEEDED collections
+        default_full_vs_gen_frequency = 10,
+        maximum_exhaustive_collections = 8,                 // passes, as many as auto_statistics_t records
+        maximum_mark_threads = 8,
+        default_purge_decay = 10 * 1000 * 1000,             // microseconds free pages stay committed
+        idle_compaction_delay = 5 * 1000 * 1000,            // microseconds without collection requests before an idle compaction
+    };
+
+    Zone::Zone(const char *name) : _reference_index(this) {
+        bzero(&_basic_zone, sizeof(_basic_zone));
+        _basic_zone.zone_name = name;
+        for (usword_t sc = 0; sc < size_class_count; sc++) _admins[sc].initialize(this, sc);
+        _region_lock.value = 0;
+        _region_list = NULL;
+        _large_lock.value = 0;
+        _large_list = NULL;
+        _large_bytes_in_use = 0;
+        _large_vm_bytes = 0;
+        _large_max_size = 0;
+        _deferred_large = NULL;
+        _kept_large_count = 0;
+        _pending_growth = 0;
+        pthread_key_create(&_registered_threads_key, destroy_registered_thread);
+        pthread_mutex_init(&_registered_threads_mutex, NULL);
+        _registered_threads = NULL;
+        _retired_blocks_allocated = 0;
+        _retired_bytes_allocated = 0;
+        _max_bytes_in_use = 0;
+        _heap_min = ~(usword_t)0;
+        _heap_max = 0;
+        pthread_mutex_init(&_collection_mutex, NULL);
+        _collector_disable_count = 0;
+        _is_collecting = false;
+        _marking = false;
+        _finalizing = false;
+        _finalizing_generational = false;
+        _resurrected_blocks = 0;
+        _resurrected_bytes = 0;
+        _noting_candidates = false;
+        _candidates_lock.value = 0;
+        _sweep_epoch = 0;
+        _sweep_generational = false;
+        _sweeping_enabled = false;
+        _unswept_blocks = 0;
+        _unswept_bytes = 0;
+        bzero(&_control, sizeof(_control));
+        _control.version = sizeof(_control);
+        _control.collection_threshold = default_collection_threshold;
+        _control.full_vs_gen_frequency = default_full_vs_gen_frequency;
+        _control.purge_decay = default_purge_decay;
+        _control.heap_growth_percent = Pacer::default_heap_growth_percent;
+        _control.collection_cpu_percent = Pacer::default_collection_cpu_percent;
+        _pacer.initialize(default_collection_threshold);
+        _generational_count = 0;
+        _compaction_disabled = false;
+        _observers_lock.value = 0;
+        _compaction_observer_count = 0;
+        pthread_mutex_init(&_trackers_mutex, NULL);
+        _resource_trackers = NULL;
+        _statistics_lock.value = 0;
+        bzero(&_statistics, sizeof(_statistics));
+        pthread_mutex_init(&_mark_mutex, NULL);
+        pthread_cond_init(&_mark_start_cond, NULL);
+        pthread_cond_init(&_mark_done_cond, NULL);
+        _mark_worker_count = 0;
+        _mark_generation = 0;
+        _mark_workers_running = 0;
+        _mark_job = NULL;
+        _mark_context = NULL;
+        pthread_key_create(&_mark_worker_key, NULL);
+        pthread_mutex_init(&_request_mutex, NULL);
+        pthread_cond_init(&_request_cond, NULL);
+        _collector_thread_started = false;
+        _request_pending = false;
+        _cycle_running = false;
+        _requested_mode = 0;
+        _pending_completions = NULL;
+        _running_completions = NULL;
+        _compaction_pending = false;
+        _compaction_options = 0;
+        _compaction_deadline = 0;
+        _compaction_completions = NULL;
+    }
+
+
+    static pthread_once_t scanning_once = PTHREAD_ONCE_INIT;
+
+    Zone *Zone::create(const char *name) {
+        aux_init();
+        pthread_once(&scanning_once, initialize_scanning);
+        void *memory = allocate_memory(align_up(sizeof(Zone), page_size));
+        if (!memory) return NULL;
+        return new (memory) Zone(name);
+    }
+
+
+    Thread *Zone::register_thread() {
+        Thread *thread = current_thread();
+        if (thread) return thread;
+        // finalizers may run, and allocate, on a mark worker.
+        if (pthread_getspecific(_mark_worker_key)) return NULL;
+        void *memory = aux_malloc(sizeof(Thread));
+        if (!memory) return NULL;
+        thread = new (memory) Thread(this);
+        {
+            Mutex lock(&_registered_threads_mutex);
+            thread->set_next(_registered_threads);
+            _registered_threads = thread;
+        }
+        pthread_setspecific(_registered_threads_key, thread);
+        return thread;
+    }
+
+
+    void Zone::unregister_thread() {
+        Thread *thread = current_thread();
+        if (!thread) return;
+        // nothing can collect the thread's local blocks once it is gone.
+        thread->publish_all();
+        pthread_setspecific(_registered_threads_key, NULL);
+        thread->flush_caches();
+        {
+            Mutex lock(&_registered_threads_mutex);
+            for (Thread **link = &_registered_threads; *link; link = (*link)->next_address()) {
+                if (*link == thread) {
+                    *link = thread->next();
+                    break;
+                }
+            }
+            _retired_blocks_allocated += thread->blocks_allocated();
+            _retired_bytes_allocated += thread->bytes_allocated();
+        }
+        thread->~Thread();
+        aux_free(thread);
+    }
+
+
+    void Zone::note_heap_range(usword_t start, usword_t end) {
+        usword_t min = __atomic_load_n(&_heap_min, __ATOMIC_RELAXED);
+        while (start < min && !__atomic_compare_exchange_n(&_heap_min, &min, start, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+        usword_t max = __atomic_load_n(&_heap_max, __ATOMIC_RELAXED);
+        while (end > max && !__atomic_compare_exchange_n(&_heap_max, &max, end, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+
+
+    void Zone::destroy_registered_thread(void *data) {
+        Thread *thread = (Thread *)data;
+        // the key's value is cleared before destructors run; restore it so unregister_thread finds it.
+        pthread_setspecific(thread->zone()->_registered_threads_key, thread);
+        thread->zone()->unregister_thread();
+    }
+
+
+    Subzone *Zone::allocate_subzone() {
+        SpinLock lock(&_region_lock);
+        Subzone *subzone = NULL;
+        for (Region *region = _region_list; region && !subzone; region = region->next()) subzone = region->allocate_subzone();
+        if (!subzone) {
+            Region *region = Region::new_region();
+            if (!region) return NULL;
+            note_heap_range(region->address(), region->end());
+            region->set_next(_region_list);
+            // readers walk the list without the lock.
+            __atomic_store_n(&_region_list, region, __ATOMIC_RELEASE);
+            subzone = region->allocate_subzone();
+            note_growth(AUTO_HEAP_REGION_EXHAUSTED);
+            if (_control.log & AUTO_LOG_REGIONS) log_regions("added region", (void *)region->address(), region->end() - region->address());
+            trace(trace_region_growth, growth_region, region->address(), region->end() - region->address());
+        }
+        if (!subzone || !_page_map.add_subzone(subzone)) return NULL;
+        note_growth(AUTO_HEAP_SUBZONE_EXHAUSTED);
+        if (_control.log & AUTO_LOG_REGIONS) log_regions("added subzone", subzone, subzone_quantum);
+        trace(trace_region_growth, growth_subzone, (usword_t)subzone, subzone_quantum);
+        return subzone;
+    }
+
+
+    void Zone::note_growth(auto_heap_growth_info_t info) {
+        // a new region says more than a new subzone.
+        auto_heap_growth_info_t pending = __atomic_load_n(&_pending_growth, __ATOMIC_RELAXED);
+        while (info > pending && !__atomic_compare_exchange_n(&_pending_growth, &pending, info, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+
+
+    void Zone::deliver_growth() {
+        auto_heap_growth_info_t info = __atomic_exchange_n(&_pending_growth, 0, __ATOMIC_RELAXED);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+        void (*will_grow)(auto_zone_t *, auto_heap_growth_info_t) = _control.will_grow;
+#pragma GCC diagnostic pop
+        if (info && will_grow) will_grow(basic_zone(), info);
+    }
+
+
+    void Zone::log_regions(const char *event, const void *address, usword_t size) {
+        fprintf(stderr, "auto zone %s: %s at %p, %lu bytes\n", name(), event, address, (unsigned long)size);
+    }
+
+
+    void *Zone::block_start(const void *address) const {
+        if (!in_heap(address)) return NULL;
+        PageMap::Entry entry = _page_map.entry(address);
+        if (PageMap::is_subzone(entry)) {
+            Subzone *subzone = Subzone::subzone(address);
+            if (!subzone->is_initialized() || !subzone->in_blocks(address)) return NULL;
+            usword_t index = subzone->block_index(address);
+            return subzone->is_allocated(index) ? subzone->block_address(index) : NULL;
+        }
+        Large *large = PageMap::large_in(entry, address);
+        return large ? large->address() : NULL;
+    }
+
+
+    void Zone::publish_range(const void *address, usword_t size) {
+        Thread *thread = current_thread();
+        if (!thread || !thread->local_blocks().count()) return;
+        void **limit = (void **)displace((void *)address, size);
+        for (void **p = (void **)align_up((usword_t)address, sizeof(void *)); p < limit; p++) {
+            if (in_heap(*p)) thread->publish(*p);
+        }
+    }
+
+
+    bool Zone::write_barrier(const void *address, usword_t size) {
+        if (!in_heap(address)) return false;
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (!subzone->in_blocks(address)) return false;
+            subzone->mark_cards(address, size);
+            if (!subzone->is_local(subzone->block_index(address))) publish_range(address, size);
+            return true;
+        }
+        Large *large = large_containing(address);
+        if (!large) return false;
+        large->mark_cards(address, size);
+        publish_range(address, size);
+        return true;
+    }
+
+
+    bool Zone::set_write_barrier(const void *address, const void *value) {
+        if (!in_heap(address)) return false;
+        Subzone *subzone = subzone_for(address);
+        Large *large = NULL;
+        if (subzone ? !subzone->in_blocks(address) : !(large = large_containing(address))) return false;
+        if (!subzone || !subzone->is_local(subzone->block_index(address))) publish(value);
+        if (__builtin_expect(is_finalizing(), 0) && !is_dying(address, _finalizing_generational)) {
+            if (is_dying(value, _finalizing_generational)) {
+                // a finalizer is storing garbage where it survives the collection.
+                void *block = block_start(value);
+                resurrect(block, _finalizing_generational);
+                if (_control.resurrect) _control.resurrect(basic_zone(), block);
+            }
+            // or unlinking what may have been the only reference to a block.  Only a word whose card is
+            // clean was scanned as it is.
+            if (is_noting_candidates()) {
+                unsigned char card = subzone ? subzone->card(Subzone::card_index(address)) : large->card(large->card_index(address));
+                if (!(card & card_marking)) note_candidate(*(void **)address);
+            }
+        }
+        // store first: until the card is dirty the value is still in the storing thread's registers.
+        *(const void **)address = value;
+        if (in_heap(value)) {
+            if (subzone) subzone->dirty_card(address);
+            else large->dirty_card(address);
+        }
+        return true;
+    }
+
+
+    void *Zone::block_allocate(usword_t size, auto_memory_type_t layout, bool initial_refcount_to_one, bool clear) {
+        usword_t refcount = initial_refcount_to_one ? 1 : 0;
+        if (size <= maximum_small_size) {
+            Admin &admin = _admins[size_class(size)];
+            Thread *thread = registered_thread();
+            if (!thread) return admin.allocate(layout, refcount, clear);
+            if (thread->should_collect_locally()) collect_local();
+            void *block = thread->allocate(admin);
+            if (!block) return NULL;
+            Subzone *subzone = Subzone::subzone(block);
+            usword_t index = subzone->block_index(block);
+            // retained blocks are roots of global collections, so only unretained ones can be local.
+            bool local = refcount == 0;
+            // the mark must be visible before the block looks allocated to a sweep.
+            if (allocates_marked(subzone)) {
+                subzone->test_set_mark(index);
+                if (__builtin_expect(is_noting_candidates(), 0)) subzone->set_uncounted();
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+            }
+            subzone->allocate_block(index, layout, refcount, local);
+            if (local) thread->add_local_block(block);
+            if (clear) bzero(block, admin.block_size());
+            return block;
+        }
+
+        // large blocks are mapped zero filled, or cleared in pages kept from a freed one.
+        void *pages = NULL;
+        usword_t pages_size = 0;
+        take_kept_large(align_up(size, page_size), pages, pages_size);
+        Large *large = Large::allocate(size, layout, refcount, pages, pages_size);
+        if (!large) {
+            if (pages) deallocate_memory(pages, pages_size);
+            return NULL;
+        }
+        note_heap_range((usword_t)large->address(), (usword_t)large->address() + large->size());
+        SpinLock lock(&_large_lock);
+        if (!_page_map.add_large(large)) {
+            large->deallocate();
+            return NULL;
+        }
+        if (is_marking()) {
+            large->test_set_mark();
+            if (__builtin_expect(is_noting_candidates(), 0)) large->set_uncounted();
+        }
+        large->set_next(_large_list);
+        if (_large_list) _large_list->set_prev(large);
+        _large_list = large;
+        _large_map.insert(large->address(), large);
+        _large_bytes_in_use += large->size();
+        _large_vm_bytes += large->vm_size();
+        if (large->size() > _large_max_size) _large_max_size = large->size();
+        return large->address();
+    }
+
+
+    unsigned Zone::batch_allocate(usword_t size, auto_memory_type_t layout, bool initial_refcount_to_one, bool clear, void **results, unsigned n) {
+        Thread *thread = registered_thread();
+        if (size > maximum_small_size || !thread) {
+            unsigned count = 0;
+            while (count < n && (results[count] = block_allocate(size, layout, initial_refcount_to_one, clear))) count++;
+            return count;
+        }
+
+        // drain this thread's cache, then claim the remainder under a single admin lock.
+        Admin &admin = _admins[size_class(size)];
+        usword_t block_size = admin.block_size();
+        usword_t count = thread->take_cached(admin, results, n);
+        if (count < n) {
+            usword_t claimed = admin.claim_blocks(results + count, n - count);
+            thread->note_allocated(claimed, claimed * block_size);
+            count += claimed;
+        }
+
+        // claiming hands out ascending addresses within a subzone, so most of the batch forms a few
+        // contiguous runs.  Initialize and clear each run at once.
+        usword_t refcount = initial_refcount_to_one ? 1 : 0;
+        for (usword_t i = 0; i < count; ) {
+            void *first = results[i];
+            usword_t run = 1;
+            while (i + run < count && results[i + run] == displace(first, run * block_size) && Subzone::subzone(results[i + run]) == Subzone::subzone(first)) run++;
+            Subzone *subzone = Subzone::subzone(first);
+            if (allocates_marked(subzone)) {
+                subzone->mark_blocks(subzone->block_index(first), run);
+                if (__builtin_expect(is_noting_candidates(), 0)) subzone->set_uncounted();
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+            }
+            subzone->allocate_blocks(subzone->block_index(first), run, layout, refcount);
+            if (clear) bzero(first, run * block_size);
+            i += run;
+        }
+        return (unsigned)count;
+    }
+
+
+    void Zone::note_weak_location(const void *location) {
+        if (!in_heap(location)) return;
+        Subzone *subzone = subzone_for(location);
+        if (subzone) {
+            if (subzone->in_blocks(location)) subzone->set_weak_locations(subzone->block_index(location));
+            return;
+        }
+        Large *large = large_containing(location);
+        if (large) large->set_weak_locations();
+    }
+
+
+    bool Zone::holds_weak_locations(const void *block) {
+        Subzone *subzone = subzone_for(block);
+        if (subzone) return subzone->in_blocks(block) && subzone->has_weak_locations(subzone->block_index(block));
+        Large *large = large_containing(block);
+        return large && large->has_weak_locations();
+    }
+
+
+    void Zone::block_deallocate(void *block) {
+        // the address may soon be another object's.
+        if (!_associations.is_empty()) _associations.erase(block);
+        if (!_weak_table.is_empty() && holds_weak_locations(block)) _weak_table.erase_locations(block, block_size(block));
+        if (__atomic_load_n(&_compaction_observer_count, __ATOMIC_RELAXED)) set_compaction_observer(block, NULL);
+        Subzone *subzone = subzone_for(block);
+        if (subzone) {
+            if (subzone->is_block_start(block)) {
+                Thread *thread = current_thread();
+                usword_t index = subzone->block_index(block);
+                if (subzone->refcount(index) == RetainTable::overflowed) _retain_table.erase(block);
+                if (subzone->is_local(index)) {
+                    // another thread's local block is still in that thread's set; leave it to the global collector.
+                    if (!thread || !thread->local_blocks().find(block)) {
+                        make_global(subzone, index);
+                        return;
+                    }
+                    thread->remove_local_block(block);
+                }
+                if (!thread || !thread->deallocate(*subzone->admin(), block)) subzone->admin()->deallocate(block);
+            }
+            return;
+        }
+        deallocate_large(block);
+    }
+
+
+    void Zone::deallocate_large(void *address) {
+        Large *large;
+        {
+            SpinLock lock(&_large_lock);
+            Large **entry = _large_map.find(address);
+            if (!entry) return;
+            large = *entry;
+            _large_map.remove(address);
+            _page_map.remove_large(large);
+            if (large->prev()) large->prev()->set_next(large->next());
+            else _large_list = large->next();
+            if (large->next()) large->next()->set_prev(large->prev());
+            _large_bytes_in_use -= large->size();
+            _large_vm_bytes -= large->vm_size();
+            if (is_marking()) {
+                // concurrent marking may be reading the block.
+                large->set_next(_deferred_large);
+                _deferred_large = large;
+                return;
+            }
+        }
+        retire_large(large);
+    }
+
+
+    bool Zone::take_kept_large(usword_t vm_size, void *&address, usword_t &size) {
+        SpinLock lock(&_large_lock);
+        usword_t best = _kept_large_count;
+        for (usword_t i = 0; i < _kept_large_count; i++) {
+            usword_t kept = _kept_large[i].size;
+            if (kept < vm_size || kept - vm_size > vm_size / 4) continue;
+            if (best == _kept_large_count || kept < _kept_large[best].size) best = i;
+        }
+        if (best == _kept_large_count) return false;
+        address = _kept_large[best].address;
+        size = _kept_large[best].size;
+        _kept_large[best] = _kept_large[--_kept_large_count];
+        return true;
+    }
+
+
+    void Zone::retire_large(Large *large) {
+        KeptPages kept = { large->address(), large->vm_size(), auto_date_now() };
+        KeptPages evicted = { NULL, 0, 0 };
+        large->destroy();
+        {
+            SpinLock lock(&_large_lock);
+            if (_kept_large_count == kept_large_count) {
+                // purged mappings sort first, having no date.
+                usword_t oldest = 0;
+                for (usword_t i = 1; i < _kept_large_count; i++) {
+                    if (_kept_large[i].freed_since < _kept_large[oldest].freed_since) oldest = i;
+                }
+                evicted = _kept_large[oldest];
+                _kept_large[oldest] = _kept_large[--_kept_large_count];
+            }
+            _kept_large[_kept_large_count++] = kept;
+        }
+        if (evicted.address) {
+            deallocate_memory(evicted.address, evicted.size);
+            if (_control.log & AUTO_LOG_REGIONS) log_regions("unmapped large block pages", evicted.address, evicted.size);
+        }
+    }
+
+
+    uint64_t Zone::purge_decayed() {
+        uint64_t now = auto_date_now(), decay = _control.purge_decay, next = 0;
+        for (usword_t sc = 0; sc < size_class_count; sc++) _admins[sc].purge_empty(now, decay, next);
+
+        // kept pages being purged are out of the table, so no allocation reuses them meanwhile.
+        for (;;) {
+            KeptPages pages = { NULL, 0, 0 };
+            {
+                SpinLock lock(&_large_lock);
+                for (usword_t i = 0; i < _kept_large_count; i++) {
+                    uint64_t since = _kept_large[i].freed_since;
+                    if (!since || !decay_due(since, now, decay, next)) continue;
+                    pages = _kept_large[i];
+                    _kept_large[i] = _kept_large[--_kept_large_count];
+                    break;
+                }
+            }
+            if (!pages.address) break;
+            uncommit_memory(pages.address, pages.size);
+            if (_control.log & AUTO_LOG_REGIONS) log_regions("purged large block pages", pages.address, pages.size);
+            pages.freed_since = 0;
+            bool kept = false;
+            {
+                SpinLock lock(&_large_lock);
+                if (_kept_large_count < kept_large_count) {
+                    _kept_large[_kept_large_count++] = pages;
+                    kept = true;
+                }
+            }
+            if (!kept) deallocate_memory(pages.address, pages.size);
+        }
+        return next;
+    }
+
+
+    void Zone::release_deferred_large() {
+        Large *large;
+        {
+            SpinLock lock(&_large_lock);
+            large = _deferred_large;
+            _deferred_large = NULL;
+        }
+        while (large) {
+            Large *next = large->next();
+            retire_large(large);
+            large = next;
+        }
+    }
+
+
+    usword_t Zone::block_size(const void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) return subzone->is_block_start(address) ? subzone->block_size() : 0;
+        Large *large = large_for(address);
+        return large ? large->size() : 0;
+    }
+
+
+    auto_memory_type_t Zone::block_layout(const void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) return subzone->is_block_start(address) ? subzone->layout(subzone->block_index(address)) : (auto_memory_type_t)AUTO_TYPE_UNKNOWN;
+        Large *large = large_for(address);
+        return large ? large->layout() : (auto_memory_type_t)AUTO_TYPE_UNKNOWN;
+    }
+
+
+    usword_t Zone::block_retain(void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (!subzone->is_block_start(address)) return 0;
+            usword_t index = subzone->block_index(address);
+            // retained blocks are roots of global collections, which do not trace local blocks.
+            if (subzone->is_local(index)) publish(address);
+            if (__builtin_expect(is_noting_candidates(), 0)) subzone->set_shared(index);
+            return _retain_table.retain(subzone->refcount_address(index), address);
+        }
+        Large *large = large_for(address);
+        if (!large) return 0;
+        if (__builtin_expect(is_noting_candidates(), 0)) large->set_shared();
+        return __atomic_add_fetch(large->refcount_address(), 1, __ATOMIC_RELAXED);
+    }
+
+
+    usword_t Zone::block_release(void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (!subzone->is_block_start(address)) return 0;
+            usword_t count = _retain_table.release(subzone->refcount_address(subzone->block_index(address)), address);
+            if (__builtin_expect(is_noting_candidates(), 0) && !count) note_candidate(address);
+            return count;
+        }
+        Large *large = large_for(address);
+        if (!large) return 0;
+        uint32_t *refcount = large->refcount_address();
+        uint32_t count = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+        while (count && !__atomic_compare_exchange_n(refcount, &count, count - 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+        if (__builtin_expect(is_noting_candidates(), 0) && count == 1) note_candidate(address);
+        return count ? count - 1 : 0;
+    }
+
+
+    usword_t Zone::block_retain_count(const void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (!subzone->is_block_start(address)) return 0;
+            return _retain_table.count(subzone->refcount_address(subzone->block_index(address)), address);
+        }
+        Large *large = large_for(address);
+        return large ? __atomic_load_n(large->refcount_address(), __ATOMIC_RELAXED) : 0;
+    }
+
+
+    void Zone::set_block_layout(const void *address, auto_memory_type_t layout) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (subzone->is_block_start(address)) subzone->set_layout(subzone->block_index(address), layout);
+            return;
+        }
+        Large *large = large_for(address);
+        if (large) large->set_layout(layout);
+    }
+
+
+    void Zone::statistics(malloc_statistics_t &stats) {
+        usword_t blocks = 0, bytes = 0, allocated = 0;
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            Admin &admin = _admins[sc];
+            blocks += admin.blocks_in_use();
+            bytes += admin.blocks_in_use() * admin.block_size();
+        }
+        // garbage waiting to be swept is no longer in use.
+        blocks -= __atomic_load_n(&_unswept_blocks, __ATOMIC_RELAXED);
+        bytes -= __atomic_load_n(&_unswept_bytes, __ATOMIC_RELAXED);
+        {
+            Mutex lock(&_registered_threads_mutex);
+            for (Thread *thread = _registered_threads; thread; thread = thread->next()) {
+                blocks += thread->blocks_allocated();
+                bytes += thread->bytes_allocated();
+            }
+            blocks += _retired_blocks_allocated;
+            bytes += _retired_bytes_allocated;
+        }
+        {
+            SpinLock lock(&_region_lock);
+            for (Region *region = region_list(); region; region = region->next()) {
+                allocated += region->subzone_count() * subzone_quantum;
+            }
+        }
+        {
+            SpinLock lock(&_large_lock);
+            blocks += _large_map.count();
+            bytes += _large_bytes_in_use;
+            allocated += _large_vm_bytes;
+        }
+        if (bytes > _max_bytes_in_use) _max_bytes_in_use = bytes;
+        stats.blocks_in_use = (unsigned)blocks;
+        stats.size_in_use = bytes;
+        stats.max_size_in_use = _max_bytes_in_use;
+        stats.size_allocated = allocated;
+    }
+
+
+    void Zone::collection_statistics(auto_statistics_t &stats) {
+        // a version 1 caller's struct ends before exhaustive_passes.
+        usword_t end = stats.version >= 2 ? sizeof(stats) : offsetof(auto_statistics_t, exhaustive_passes);
+        SpinLock lock(&_statistics_lock);
+        memcpy(stats.num_collections, _statistics.num_collections, end - offsetof(auto_statistics_t, num_collections));
+    }
+
+
+    usword_t Zone::good_size(usword_t size) {
+        if (size > maximum_small_size) return align_up(size, allocate_quantum);
+        return size_class_size(size_class(size));
+    }
+
+
+    bool Zone::check() {
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            if (!_admins[sc].check()) return false;
+        }
+        SpinLock lock(&_large_lock);
+        usword_t count = 0, bytes = 0, vm_bytes = 0;
+        for (Large *large = _large_list; large; large = large->next()) {
+            Large **entry = _large_map.find(large->address());
+            if (!entry || *entry != large || (large->next() && large->next()->prev() != large)) {
+                fprintf(stderr, "auto zone %s: large block %p is not linked or mapped consistently\n", name(), large->address());
+                return false;
+            }
+            count++;
+            bytes += large->size();
+            vm_bytes += large->vm_size();
+        }
+        if (count != _large_map.count() || bytes != _large_bytes_in_use || vm_bytes != _large_vm_bytes) {
+            fprintf(stderr, "auto zone %s: %lu large blocks of %lu bytes listed, %lu of %lu bytes counted\n", name(),
+                    (unsigned long)count, (unsigned long)bytes, (unsigned long)_large_map.count(), (unsigned long)_large_bytes_in_use);
+            return false;
+        }
+        return true;
+    }
+
+
+    void Zone::print(bool verbose) {
+        malloc_statistics_t stats;
+        statistics(stats);
+        fprintf(stderr, "auto zone %s: %u blocks, %lu bytes in use (high water %lu), %lu bytes allocated\n", name(),
+                stats.blocks_in_use, (unsigned long)stats.size_in_use, (unsigned long)stats.max_size_in_use, (unsigned long)stats.size_allocated);
+        if (!verbose) return;
+        // claimed blocks include those held in thread caches.
+        fprintf(stderr, "%8s %8s %10s %10s\n", "size", "subzones", "capacity", "claimed");
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            Admin &admin = _admins[sc];
+            usword_t subzones = 0, capacity = 0, claimed = 0;
+            {
+                SpinLock lock(admin.lock());
+                for (Subzone *subzone = admin.subzones(); subzone; subzone = subzone->admin_next()) {
+                    subzones++;
+                    capacity += subzone->block_count();
+                    claimed += subzone->claimed_count();
+                }
+            }
+            if (subzones) fprintf(stderr, "%8lu %8lu %10lu %10lu\n", (unsigned long)admin.block_size(), (unsigned long)subzones, (unsigned long)capacity, (unsigned long)claimed);
+        }
+        SpinLock lock(&_large_lock);
+        fprintf(stderr, "%8s %8lu blocks of %lu bytes in %lu bytes of pages\n", "large", (unsigned long)_large_map.count(),
+                (unsigned long)_large_bytes_in_use, (unsigned long)_large_vm_bytes);
+    }
+
+
+    void Zone::force_lock() {
+        // the order collections take them in, then the allocator's, size classes before regions.
+        pthread_mutex_lock(&_collection_mutex);
+        lock_for_collection();
+        _weak_table.lock_all();
+        _retain_table.lock_all();
+        _layout_cache.lock();
+        for (usword_t sc = 0; sc < size_class_count; sc++) spin_lock(_admins[sc].lock());
+        spin_lock(&_region_lock);
+        spin_lock(&_candidates_lock);
+        spin_lock(&_observers_lock);
+        spin_lock(&_statistics_lock);
+    }
+
+
+    void Zone::force_unlock() {
+        spin_unlock(&_statistics_lock);
+        spin_unlock(&_observers_lock);
+        spin_unlock(&_candidates_lock);
+        spin_unlock(&_region_lock);
+        for (usword_t sc = size_class_count; sc--; ) spin_unlock(_admins[sc].lock());
+        _layout_cache.unlock();
+        _retain_table.unlock_all();
+        _weak_table.unlock_all();
+        unlock_for_collection();
+        pthread_mutex_unlock(&_collection_mutex);
+    }
+
+
+    void Zone::add_root(void *root, void *value) {
+        publish(value);
+        _roots.add_root(root);
+        *(void **)root = value;
+    }
+
+
+    void Zone::remove_root(void *root) {
+        _roots.remove_root(root);
+        if (__builtin_expect(is_noting_candidates(), 0)) note_candidate(*(void **)root);
+    }
+
+
+    void Zone::add_datasegment(void *address, usword_t size) {
+        _roots.add_datasegment(address, size);
+    }
+
+
+    void Zone::remove_datasegment(void *address, usword_t size) {
+        _roots.remove_datasegment(address, size);
+    }
+
+
+    void Zone::root_write_barrier(void *address, void *value) {
+        if (in_heap(address) && set_write_barrier(address, value)) return;
+        // only registered ranges are roots; an address outside them would otherwise stay one forever.
+        if (!_roots.contains(address)) {
+            *(void **)address = value;
+            return;
+        }
+        publish(value);
+        void *old = *(void **)address;
+        *(void **)address = value;
+        if (__builtin_expect(is_noting_candidates(), 0)) note_candidate(old);
+    }
+
+
+    void Zone::lock_for_collection() {
+        pthread_mutex_lock(&_registered_threads_mutex);
+        _roots.lock();
+        spin_lock(&_large_lock);
+        _associations.lock_all();
+    }
+
+
+    void Zone::unlock_for_collection() {
+        _associations.unlock_all();
+        spin_unlock(&_large_lock);
+        _roots.unlock();
+        pthread_mutex_unlock(&_registered_threads_mutex);
+    }
+
+
+    bool Zone::is_dying(const void *address, bool generational) {
+        if (!in_heap(address)) return false;
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (!subzone->in_blocks(address)) return false;
+            usword_t index = subzone->block_index(address);
+            // swept subzones hold no garbage.  Publishing marks a block before making it global.
+            if (!is_sweep_pending(subzone) || !subzone->is_allocated(index) || subzone->is_local(index)) return false;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            return !subzone->is_marked(index) && !(generational && !subzone->is_young(index));
+        }
+        Large *large = large_containing(address);
+        return large && !large->is_marked() && !(generational && !large->is_young());
+    }
+
+
+    void Zone::set_finalized(void *block) {
+        Subzone *subzone = subzone_for(block);
+        if (subzone) {
+            subzone->set_finalized(subzone->block_index(block));
+            return;
+        }
+        Large *large = large_for(block);
+        if (large) large->set_finalized();
+    }
+
+
+    bool Zone::is_finalized(const void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) return subzone->is_block_start(address) && subzone->is_finalized(subzone->block_index(address));
+        Large *large = large_for(address);
+        return large && large->is_finalized();
+    }
+
+
+    void Zone::resurrect(void *block, bool generational) {
+        // a dying block no queue has room for is marked without being scanned.  Rescanning every marked
+        // block then reaches what it refers to, a level at a time.
+        bool unscanned = resurrect_from(block, generational);
+        while (unscanned) unscanned = rescan_resurrected(generational);
+    }
+
+
+    bool Zone::mark_resurrected(void *block, auto_memory_type_t &layout, usword_t &size) {
+        // marking takes blocks out of the dying; each is scanned once.
+        Subzone *subzone = subzone_for(block);
+        if (subzone) {
+            usword_t index = subzone->block_index(block);
+            if (!subzone->test_set_mark(index)) return false;
+            if (is_noting_candidates()) subzone->set_shared(index);
+            // the collection counted the block as garbage its sweep would free.
+            __atomic_add_fetch(&_resurrected_blocks, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&_resurrected_bytes, subzone->block_size(), __ATOMIC_RELAXED);
+            layout = subzone->layout(index);
+            size = subzone->block_size();
+            return true;
+        }
+        Large *large = large_for(block);
+        if (!large || !large->test_set_mark()) return false;
+        if (is_noting_candidates()) large->set_shared();
+        layout = large->layout();
+        size = large->size();
+        return true;
+    }
+
+
+    bool Zone::scan_resurrected(void *block, usword_t size, bool generational, VMArray<void *> *pending) {
+        bool unscanned = false;
+        bool noting = is_noting_candidates();
+        for (void **p = (void **)block, **limit = (void **)displace(block, size); p < limit; p++) {
+            if (is_dying(*p, generational)) {
+                void *start = block_start(*p);
+                if (pending && pending->push(start)) continue;
+                auto_memory_type_t layout;
+                usword_t start_size;
+                if (mark_resurrected(start, layout, start_size) && !(layout & AUTO_UNSCANNED)) unscanned = true;
+            } else if (noting) {
+                note_shared(*p);
+            }
+        }
+        return unscanned;
+    }
+
+
+    bool Zone::resurrect_from(void *block, bool generational) {
+        VMArray<void *> pending;
+        bool unscanned = false;
+        do {
+            auto_memory_type_t layout;
+            usword_t size;
+            if (!mark_resurrected(block, layout, size) || (layout & AUTO_UNSCANNED)) continue;
+            if (scan_resurrected(block, size, generational, &pending)) unscanned = true;
+        } while (pending.count() && (block = pending.pop()));
+        return unscanned;
+    }
+
+
+    bool Zone::rescan_resurrected(bool generational) {
+        bool unscanned = false;
+        for (Region *region = region_list(); region; region = region->next()) {
+            for (usword_t i = 0; i < region_subzone_count; i++) {
+                Subzone *subzone = region->subzone_at(i);
+                if (!region->is_subzone_in_use(i) || !subzone->is_initialized()) continue;
+                for (usword_t index = 0, count = subzone->block_count(); index < count; index++) {
+                    if (!subzone->is_marked(index) || !subzone->is_allocated(index) || (subzone->layout(index) & AUTO_UNSCANNED)) continue;
+                    if (scan_resurrected(subzone->block_address(index), subzone->block_size(), generational, NULL)) unscanned = true;
+                }
+            }
+        }
+        SpinLock lock(&_large_lock);
+        for (Large *large = _large_list; large; large = large->next()) {
+            if (!large->is_marked() || (large->layout() & AUTO_UNSCANNED)) continue;
+            if (scan_resurrected(large->address(), large->size(), generational, NULL)) unscanned = true;
+        }
+        return unscanned;
+    }
+
+
+    void Zone::begin_sweep(bool generational) {
+        // the previous collection's garbage was swept before this one cleared the marks.
+        _sweep_generational = generational;
+        _resurrected_blocks = 0;
+        _resurrected_bytes = 0;
+        __atomic_store_n(&_sweeping_enabled, false, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&_sweep_epoch, 1, __ATOMIC_RELEASE);
+    }
+
+
+    void Zone::enable_sweeping(usword_t blocks, usword_t bytes) {
+        __atomic_store_n(&_unswept_blocks, blocks, __ATOMIC_RELAXED);
+        __atomic_store_n(&_unswept_bytes, bytes, __ATOMIC_RELAXED);
+        for (usword_t sc = 0; sc < size_class_count; sc++) _admins[sc].reset_sweep_cursor();
+        __atomic_store_n(&_sweeping_enabled, true, __ATOMIC_RELEASE);
+    }
+
+
+    void Zone::note_swept(usword_t blocks, usword_t bytes) {
+        if (!blocks) return;
+        __atomic_sub_fetch(&_unswept_blocks, blocks, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&_unswept_bytes, bytes, __ATOMIC_RELAXED);
+    }
+
+
+    bool Zone::sweep_some() {
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            if (_admins[sc].sweep_next()) return true;
+        }
+        return false;
+    }
+
+
+    void Zone::finish_sweeping() {
+        for (usword_t sc = 0; sc < size_class_count; sc++) {
+            while (_admins[sc].sweep_next()) {}
+        }
+    }
+
+
+    void Zone::collection_finished(Collector &collector, bool generational) {
+        malloc_statistics_t stats;
+        statistics(stats);
+        const auto_collection_durations_t &durations = collector.durations();
+        _pacer.collection_finished(generational, stats.size_in_use, collector.bytes_freed(), durations.total_duration, auto_date_now(), _control);
+
+        const auto_date_t *fields = &durations.total_duration;
+        usword_t field_count = sizeof(durations) / sizeof(auto_date_t);
+        usword_t kind = generational ? 1 : 0;
+
+        SpinLock lock(&_statistics_lock);
+        _statistics.num_collections[kind]++;
+        _statistics.last_collection_was_generational = generational;
+        _statistics.bytes_in_use_after_last_collection[kind] = stats.size_in_use;
+        _statistics.bytes_allocated_after_last_collection[kind] = stats.size_allocated;
+        _statistics.bytes_freed_during_last_collection[kind] = collector.bytes_freed();
+        _statistics.last[kind] = durations;
+        auto_date_t *total = &_statistics.total[kind].total_duration;
+        auto_date_t *maximum = &_statistics.maximum[kind].total_duration;
+        for (usword_t i = 0; i < field_count; i++) {
+            total[i] += fields[i];
+            if (fields[i] > maximum[i]) maximum[i] = fields[i];
+        }
+    }
+
+
+    void Zone::collect(auto_collection_mode_t mode) {
+        malloc_statistics_t stats;
+        statistics(stats);
+        if ((mode & AUTO_COLLECT_IF_NEEDED) && !_pacer.collection_due(stats.size_in_use) &&
+            !(_pacer.poll_due(auto_date_now()) && resource_tracker_wants_collection())) return;
+
+        // a collection already under way satisfies the request.
+        if (pthread_mutex_trylock(&_collection_mutex)) return;
+        if (!is_enabled()) {
+            pthread_mutex_unlock(&_collection_mutex);
+            return;
+        }
+        __atomic_store_n(&_is_collecting, true, __ATOMIC_RELAXED);
+
+        // generational requests escalate to a full collection every full_vs_gen_frequency collections,
+        // and ratio requests also once generational collections stop paying.
+        usword_t kind = mode & 0x3;
+        bool generational = (kind == AUTO_COLLECT_GENERATIONAL_COLLECTION || (kind == AUTO_COLLECT_RATIO_COLLECTION && !_pacer.prefers_full())) &&
+                            !_control.disable_generational && _generational_count + 1 < _control.full_vs_gen_frequency;
+        _generational_count = generational ? _generational_count + 1 : 0;
+        _pacer.collection_started(stats.size_in_use, auto_date_now());
+
+        if (kind == AUTO_COLLECT_EXHAUSTIVE_COLLECTION) {
+            collect_exhaustively();
+        } else {
+            Collector collector(this, generational, false);
+            collector.collect();
+            collection_finished(collector, generational);
+        }
+
+        __atomic_store_n(&_is_collecting, false, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&_collection_mutex);
+
+        // a synchronous collection leaves its garbage to the collector thread to sweep, then purge.
+        wake_collector_thread();
+    }
+
+
+    void Zone::collect_exhaustively() {
+        auto_date_t durations[maximum_exhaustive_collections];
+        usword_t passes = 0;
+        usword_t garbage;
+        {
+            Collector collector(this, false, true);
+            collector.collect();
+            collection_finished(collector, false);
+            durations[passes++] = collector.durations().total_duration;
+            garbage = collector.garbage_count();
+        }
+        // what a pass frees can only have kept alive what its finalizers released or unlinked.
+        VMArray<void *> candidates;
+        while (garbage && passes < maximum_exhaustive_collections && take_candidates(candidates)) {
+            Collector collector(this, false, true);
+            collector.recollect(candidates);
+            collection_finished(collector, false);
+            durations[passes++] = collector.durations().total_duration;
+            garbage = collector.garbage_count();
+        }
+        end_noting_candidates();
+
+        SpinLock lock(&_statistics_lock);
+        _statistics.exhaustive_passes = passes;
+        for (usword_t i = 0; i < maximum_exhaustive_collections; i++) _statistics.exhaustive_pass_durations[i] = i < passes ? durations[i] : 0;
+    }
+
+
+    void Zone::end_noting_candidates() {
+        __atomic_store_n(&_noting_candidates, false, __ATOMIC_RELAXED);
+        SpinLock lock(&_candidates_lock);
+        _candidates.clear();
+    }
+
+
+    void Zone::note_candidate(const void *block) {
+        if (!in_heap(block)) return;
+        SpinLock lock(&_candidates_lock);
+        _candidates.insert(block, true);
+    }
+
+
+    void Zone::note_shared(const void *address) {
+        if (!in_heap(address)) return;
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (subzone->in_blocks(address)) subzone->set_shared(subzone->block_index(address));
+            return;
+        }
+        Large *large = large_containing(address);
+        if (large) large->set_shared();
+    }
+
+
+    bool Zone::take_candidates(VMArray<void *> &candidates) {
+        candidates.clear();
+        SpinLock lock(&_candidates_lock);
+        for (usword_t i = 0; i < _candidates.capacity(); i++) {
+            const void *block = _candidates.entries()[i].key;
+            if (block) candidates.push((void *)block);
+        }
+        _candidates.clear();
+        return candidates.count() != 0;
+    }
+
+
+    void Zone::register_resource_tracker(const char *description, boolean_t (^should_collect)(void)) {
+        ResourceTracker *tracker = (ResourceTracker *)aux_malloc(sizeof(ResourceTracker));
+        if (!tracker) return;
+        usword_t length = strlen(description) + 1;
+        tracker->description = (char *)aux_malloc(length);
+        if (!tracker->description) {
+            aux_free(tracker);
+            return;
+        }
+        memcpy(tracker->description, description, length);
+        tracker->should_collect = Block_copy(should_collect);
+        Mutex lock(&_trackers_mutex);
+        tracker->next = _resource_trackers;
+        _resource_trackers = tracker;
+    }
+
+
+    void Zone::unregister_resource_tracker(const char *description) {
+        ResourceTracker *tracker = NULL;
+        {
+            Mutex lock(&_trackers_mutex);
+            for (ResourceTracker **link = &_resource_trackers; *link; link = &(*link)->next) {
+                if (!strcmp((*link)->description, description)) {
+                    tracker = *link;
+                    *link = tracker->next;
+                    break;
+                }
+            }
+        }
+        if (!tracker) return;
+        Block_release(tracker->should_collect);
+        aux_free(tracker->description);
+        aux_free(tracker);
+    }
+
+
+    bool Zone::resource_tracker_wants_collection() {
+        Mutex lock(&_trackers_mutex);
+        for (ResourceTracker *tracker = _resource_trackers; tracker; tracker = tracker->next) {
+            if (tracker->should_collect()) return true;
+        }
+        return false;
+    }
+
+
+    void Zone::local_collection_finished(ThreadLocalCollector &collector) {
+        SpinLock lock(&_statistics_lock);
+        _statistics.thread_collections_total++;
+        _statistics.thread_blocks_recovered_total += collector.blocks_freed();
+        _statistics.thread_bytes_recovered_total += collector.bytes_freed();
+    }
+
+
+    void Zone::collect_local() {
+        Thread *thread = current_thread();
+        if (!thread || !thread->local_blocks().count() || thread->in_local_collection() || !is_enabled()) return;
+        thread->set_in_local_collection(true);
+        ThreadLocalCollector collector(this, thread);
+        collector.collect();
+        thread->local_collection_finished();
+        thread->set_in_local_collection(false);
+        local_collection_finished(collector);
+    }
+
+
+    void Zone::reap_local_blocks() {
+        Thread *thread = current_thread();
+        if (!thread || !thread->local_blocks().count() || thread->in_local_collection()) return;
+        thread->set_in_local_collection(true);
+        ThreadLocalCollector collector(this, thread);
+        collector.reap();
+        thread->local_collection_finished();
+        thread->set_in_local_collection(false);
+        local_collection_finished(collector);
+    }
+
+
+    void *Zone::mark_worker(void *arg) {
+        Zone *zone = (Zone *)((usword_t *)arg)[0];
+        usword_t index = ((usword_t *)arg)[1];
+        aux_free(arg);
+        pthread_setspecific(zone->_mark_worker_key, zone);
+
+        usword_t generation = 0;
+        for (;;) {
+            mark_job_t job;
+            void *context;
+            {
+                Mutex lock(&zone->_mark_mutex);
+                while (zone->_mark_generation == generation) pthread_cond_wait(&zone->_mark_start_cond, &zone->_mark_mutex);
+                generation = zone->_mark_generation;
+                job = zone->_mark_job;
+                context = zone->_mark_context;
+            }
+            job(context, index);
+            Mutex lock(&zone->_mark_mutex);
+            if (--zone->_mark_workers_running == 0) pthread_cond_signal(&zone->_mark_done_cond);
+        }
+        return NULL;
+    }
+
+
+    void Zone::start_mark_workers(usword_t count) {
+        int ncpu = 1;
+        size_t length = sizeof(ncpu);
+        sysctlbyname("hw.activecpu", &ncpu, &length, NULL, 0);
+        if (count > (usword_t)ncpu) count = ncpu;
+        if (count > maximum_mark_threads) count = maximum_mark_threads;
+
+        // the pool only changes between collections.
+        Mutex collection(&_collection_mutex);
+        while (_mark_worker_count + 1 < count) {
+            usword_t *arg = (usword_t *)aux_malloc(2 * sizeof(usword_t));
+            if (!arg) break;
+            arg[0] = (usword_t)this;
+            arg[1] = _mark_worker_count + 1;
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, mark_worker, arg)) {
+                aux_free(arg);
+                break;
+            }
+            pthread_detach(thread);
+            _mark_worker_count++;
+        }
+    }
+
+
+    void Zone::run_mark_workers(mark_job_t job, void *context) {
+        {
+            Mutex lock(&_mark_mutex);
+            _mark_job = job;
+            _mark_context = context;
+            _mark_workers_running = _mark_worker_count;
+            _mark_generation++;
+            pthread_cond_broadcast(&_mark_start_cond);
+        }
+        job(context, 0);
+        Mutex lock(&_mark_mutex);
+        while (_mark_workers_running) pthread_cond_wait(&_mark_done_cond, &_mark_mutex);
+    }
+
+
+    static void run_collector_worker(void *context, usword_t index) {
+        ((Collector *)context)->run_worker(index);
+    }
+
+
+    void Zone::run_mark_workers(Collector *collector) {
+        run_mark_workers(run_collector_worker, collector);
+    }
+
+
+    uint64_t Zone::purge_in_background() {
+        pthread_mutex_unlock(&_request_mutex);
+        uint64_t next = purge_decayed();
+        pthread_mutex_lock(&_request_mutex);
+        return next;
+    }
+
+
+    bool Zone::sweep_in_background() {
+        // a collection in progress sweeps whatever is left itself.
+        if (!is_sweeping_enabled() || pthread_mutex_trylock(&_collection_mutex)) return false;
+        pthread_mutex_unlock(&_request_mutex);
+        bool swept = sweep_some();
+        pthread_mutex_unlock(&_collection_mutex);
+        pthread_mutex_lock(&_request_mutex);
+        return swept;
+    }
+
+
+    Zone::Completion *Zone::make_completion(dispatch_queue_t queue, dispatch_block_t block) {
+        if (!block) return NULL;
+        Completion *completion = (Completion *)aux_malloc(sizeof(Completion));
+        if (completion) {
+            completion->queue = queue;
+            completion->block = (dispatch_block_t)Block_copy(block);
+        }
+        return completion;
+    }
+
+
+    void Zone::run_completions(Completion *completion) {
+        while (completion) {
+            Completion *next = completion->next;
+            dispatch_async(completion->queue, completion->block);
+            Block_release(completion->block);
+            aux_free(completion);
+            completion = next;
+        }
+    }
+
+
+    void Zone::start_collector_thread() {
+        if (_collector_thread_started) return;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, collector_thread, this) == 0) {
+            pthread_detach(thread);
+            _collector_thread_started = true;
+        }
+    }
+
+
+    void Zone::wake_collector_thread() {
+        Mutex lock(&_request_mutex);
+        start_collector_thread();
+        pthread_cond_signal(&_request_cond);
+    }
+
+
+    void *Zone::collector_thread(void *arg) {
+        Zone *zone = (Zone *)arg;
+        for (;;) {
+            auto_collection_mode_t mode = 0;
+            auto_zone_compact_options_t options = 0;
+            bool compacting;
+            Completion *completion;
+            {
+                Mutex lock(&zone->_request_mutex);
+                while (!zone->_request_pending && !zone->compaction_due()) {
+                    if (zone->sweep_in_background()) continue;
+                    // sleep until a compaction is due or free pages decay.
+                    uint64_t deadline = zone->purge_in_background();
+                    // purging drops the lock, and a request that came meanwhile found no one waiting.
+                    if (zone->_request_pending || zone->compaction_due()) break;
+                    if (zone->_compaction_pending && (!deadline || zone->_compaction_deadline < deadline)) deadline = zone->_compaction_deadline;
+                    if (!deadline) {
+                        pthread_cond_wait(&zone->_request_cond, &zone->_request_mutex);
+                        continue;
+                    }
+                    uint64_t now = auto_date_now();
+                    if (now >= deadline) continue;
+                    uint64_t delay = deadline - now;
+                    struct timespec timeout = { (time_t)(delay / 1000000), (long)(delay % 1000000) * 1000 };
+                    pthread_cond_timedwait_relative_np(&zone->_request_cond, &zone->_request_mutex, &timeout);
+                }
+                // collections go first; they push an idle compaction back anyway.
+                compacting = !zone->_request_pending;
+                if (compacting) {
+                    options = zone->_compaction_options;
+                    zone->_compaction_pending = false;
+                    completion = zone->_compaction_completions;
+                    zone->_compaction_completions = NULL;
+                } else {
+                    mode = zone->_requested_mode;
+                    zone->_request_pending = false;
+                    zone->_cycle_running = true;
+                    zone->_running_completions = zone->_pending_completions;
+                    zone->_pending_completions = NULL;
+                }
+            }
+
+            if (compacting) {
+                zone->compact(options);
+            } else {
+                zone->collect(mode);
+                Mutex lock(&zone->_request_mutex);
+                zone->_cycle_running = false;
+                completion = zone->_running_completions;
+                zone->_running_completions = NULL;
+            }
+            run_completions(completion);
+        }
+        return NULL;
+    }
+
+
+    void Zone::request_collection(auto_collection_mode_t mode, bool coalesce, dispatch_queue_t queue, dispatch_block_t block) {
+        Completion *completion = make_completion(queue, block);
+
+        Mutex lock(&_request_mutex);
+        start_collector_thread();
+
+        // the heap is not idle yet.
+        if (_compaction_pending && (_compaction_options & AUTO_ZONE_COMPACT_IF_IDLE)) _compaction_deadline = auto_date_now() + idle_compaction_delay;
+
+        if (coalesce && _cycle_running && !_request_pending) {
+            // ride along with the collection in progress.
+            if (completion) {
+                completion->next = _running_completions;
+                _running_completions = completion;
+            }
+            return;
+        }
+        if (_request_pending) {
+            // merge: the stronger kind wins, and the request is conditional only if both are.
+            auto_collection_mode_t kind = (mode & 0x3) > (_requested_mode & 0x3) ? (mode & 0x3) : (_requested_mode & 0x3);
+            _requested_mode = kind | (mode & _requested_mode & AUTO_COLLECT_IF_NEEDED);
+        } else {
+            _requested_mode = mode & (0x3 | AUTO_COLLECT_IF_NEEDED);
+            _request_pending = true;
+            pthread_cond_signal(&_request_cond);
+        }
+        if (completion) {
+            completion->next = _pending_completions;
+            _pending_completions = completion;
+        }
+    }
+
+
+    void Zone::request_compaction(auto_zone_compact_options_t options, dispatch_queue_t queue, dispatch_block_t block) {
+        Completion *completion = make_completion(queue, block);
+
+        Mutex lock(&_request_mutex);
+        start_collector_thread();
+
+        // merge: the compaction waits for idleness, or only analyzes, if every request said so.
+        uint64_t deadline = auto_date_now() + ((options & AUTO_ZONE_COMPACT_IF_IDLE) ? idle_compaction_delay : 0);
+        if (_compaction_pending) {
+            _compaction_options &= options;
+            if (deadline < _compaction_deadline) _compaction_deadline = deadline;
+        } else {
+            _compaction_options = options & (AUTO_ZONE_COMPACT_IF_IDLE | AUTO_ZONE_COMPACT_ANALYZE);
+            _compaction_deadline = deadline;
+            _compaction_pending = true;
+        }
+        pthread_cond_signal(&_request_cond);
+        if (completion) {
+            completion->next = _compaction_completions;
+            _compaction_completions = completion;
+        }
+    }
+
+
+    void Zone::compact(auto_zone_compact_options_t options) {
+        usword_t moved = 0;
+        {
+            Mutex collection(&_collection_mutex);
+            if (is_compaction_disabled() || !is_enabled()) return;
+            __atomic_store_n(&_is_collecting, true, __ATOMIC_RELAXED);
+
+            // garbage is not worth moving, and its weak references and associations must be gone first.
+            malloc_statistics_t stats;
+            statistics(stats);
+            _pacer.collection_started(stats.size_in_use, auto_date_now());
+            Collector collector(this, false, false);
+            collector.collect();
+            collection_finished(collector, false);
+            _generational_count = 0;
+            finish_sweeping();
+
+            Compactor compactor(this);
+            if (options & AUTO_ZONE_COMPACT_ANALYZE) {
+                compactor.analyze();
+                const char *path = getenv("AUTO_COMPACTION_ANALYSIS_FILE");
+                FILE *file = path ? fopen(path, "a") : NULL;
+                compactor.write_report(file ? file : stderr);
+                if (file) fclose(file);
+            } else {
+                moved = compactor.compact();
+            }
+            __atomic_store_n(&_is_collecting, false, __ATOMIC_RELAXED);
+        }
+        if (moved) run_compaction_observers();
+    }
+
+
+    void Zone::visit_heap(HeapVisitor &visitor) {
+        Mutex collection(&_collection_mutex);
+        // blocks found dead by the last collection are not reported.
+        finish_sweeping();
+        HeapWalker walker(this);
+        walker.walk(visitor);
+    }
+
+
+    void Zone::enumerate_references(void *referent, auto_reference_recorder_t callback, void *stack_top, void *stack_bottom, void *context) {
+        Mutex index(_reference_index.mutex());
+        if (!_reference_index.is_current()) {
+            Mutex collection(&_collection_mutex);
+            // blocks found dead by the last collection refer to nothing.
+            finish_sweeping();
+            if (!_reference_index.build()) return;
+        }
+        _reference_index.enumerate(referent, callback, stack_top, stack_bottom, context);
+    }
+
+
+    void Zone::set_compaction_observer(void *block, dispatch_block_t observer) {
+        // observers run on another thread.
+        if (observer) publish(block);
+        dispatch_block_t copy = observer ? (dispatch_block_t)Block_copy(observer) : NULL;
+        dispatch_block_t old = NULL;
+        {
+            SpinLock lock(&_observers_lock);
+            dispatch_block_t *entry = _compaction_observers.find(block);
+            if (entry) old = *entry;
+            if (copy) _compaction_observers.insert(block, copy);
+            else if (entry) _compaction_observers.remove(block);
+            __atomic_store_n(&_compaction_observer_count, _compaction_observers.count(), __ATOMIC_RELAXED);
+        }
+        if (old) Block_release(old);
+    }
+
+
+    void Zone::forget_dying_observers(bool generational) {
+        if (!__atomic_load_n(&_compaction_observer_count, __ATOMIC_RELAXED)) return;
+        VMArray<dispatch_block_t> dead;
+        {
+            SpinLock lock(&_observers_lock);
+            for (usword_t i = 0; i < _compaction_observers.capacity(); ) {
+                PointerHashMap<dispatch_block_t>::Entry &entry = _compaction_observers.entries()[i];
+                if (!entry.key || !is_dying(entry.key, generational)) {
+                    i++;
+                    continue;
+                }
+                dead.push(entry.value);
+                // removal shifts a later entry into slot i; look at it again.
+                _compaction_observers.remove(entry.key);
+            }
+            __atomic_store_n(&_compaction_observer_count, _compaction_observers.count(), __ATOMIC_RELAXED);
+        }
+        for (usword_t i = 0; i < dead.count(); i++) Block_release(dead[i]);
+    }
+
+
+    void Zone::relocate_compaction_observers(Compactor &compactor) {
+        PointerHashMap<dispatch_block_t> moved;
+        for (usword_t i = 0; i < _compaction_observers.capacity(); ) {
+            PointerHashMap<dispatch_block_t>::Entry &entry = _compaction_observers.entries()[i];
+            void *block = entry.key ? compactor.relocated(entry.key) : NULL;
+            if (block == entry.key) {
+                i++;
+                continue;
+            }
+            moved.insert(block, entry.value);
+            _compaction_observers.remove(entry.key);
+        }
+        for (usword_t i = 0; i < moved.capacity(); i++) {
+            PointerHashMap<dispatch_block_t>::Entry &entry = moved.entries()[i];
+            if (entry.key) _compaction_observers.insert(entry.key, entry.value);
+        }
+    }
+
+
+    void Zone::run_compaction_observers() {
+        VMArray<dispatch_block_t> observers;
+        {
+            SpinLock lock(&_observers_lock);
+            for (usword_t i = 0; i < _compaction_observers.capacity(); i++) {
+                PointerHashMap<dispatch_block_t>::Entry &entry = _compaction_observers.entries()[i];
+                if (!entry.key) continue;
+                dispatch_block_t observer = (dispatch_block_t)Block_copy(entry.value);
+                if (!observers.push(observer)) Block_release(observer);
+            }
+        }
+        for (usword_t i = 0; i < observers.count(); i++) {
+            observers[i]();
+            Block_release(observers[i]);
+        }
+    }
+
+};
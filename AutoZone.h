@@ -0,0 +1,835 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    AutoZone.h
+    Garbage collected zone
+ */
+
+#ifndef __AUTO_ZONE_CORE__
+#define __AUTO_ZONE_CORE__
+
+#include "auto_zone.h"
+#include "AutoDefs.h"
+#include "AutoAdmin.h"
+#include "AutoAssociations.h"
+#include "AutoHashTable.h"
+#include "AutoHeapWalker.h"
+#include "AutoLarge.h"
+#include "AutoLayout.h"
+#include "AutoPacer.h"
+#include "AutoPageMap.h"
+#include "AutoReferenceIndex.h"
+#include "AutoRegion.h"
+#include "AutoRetain.h"
+#include "AutoRoots.h"
+#include "AutoSubzone.h"
+#include "AutoThread.h"
+#include "AutoWeak.h"
+
+namespace Auto {
+
+    class Collector;
+    class Compactor;
+    class ThreadLocalCollector;
+
+    typedef void (*mark_job_t)(void *context, usword_t index);
+
+    //
+    // Zone
+    //
+    // The collected heap.  The malloc_zone_t handed out as the auto_zone_t is the first member, so
+    // the two convert with a cast.
+    //
+    class Zone {
+
+        enum {
+            kept_large_count = 16,                          // freed large blocks whose pages are kept for reuse
+        };
+
+        //
+        // KeptPages
+        //
+        // The mapping of a freed large block, kept for a later large block of about the same size.
+        //
+        struct KeptPages {
+            void                    *address;
+            usword_t                size;
+            uint64_t                freed_since;            // auto_date_now() when freed; 0 once purged
+        };
+
+      private:
+        malloc_zone_t               _basic_zone;            // must be first
+
+        Admin                       _admins[size_class_count];
+
+        spin_lock_t                 _region_lock;           // protects region growth
+        Region                      *_region_list;          // regions, newest first; never shrinks
+
+        spin_lock_t                 _large_lock;            // protects the large block list and map
+        Large                       *_large_list;
+        PointerHashMap<Large *>     _large_map;             // block address -> descriptor
+        PageMap                     _page_map;              // address -> subzone or large block, lock free
+        usword_t                    _large_bytes_in_use;
+        usword_t                    _large_vm_bytes;        // mapped by large blocks in use
+        usword_t                    _large_max_size;        // bounds interior pointer searches
+        Large                       *_deferred_large;       // freed while marking; retired afterwards
+        KeptPages                   _kept_large[kept_large_count];  // protected by _large_lock
+        usword_t                    _kept_large_count;
+        auto_heap_growth_info_t     _pending_growth;        // not yet reported to will_grow
+
+        pthread_key_t               _registered_threads_key;    // this thread's Thread
+        pthread_mutex_t             _registered_threads_mutex;  // protects the list and the retired counters
+        Thread                      *_registered_threads;
+        usword_t                    _retired_blocks_allocated;  // counters of threads that have unregistered
+        usword_t                    _retired_bytes_allocated;
+
+        usword_t                    _max_bytes_in_use;      // statistics high water mark
+
+        usword_t                    _heap_min;              // lowest and highest addresses ever handed out
+        usword_t                    _heap_max;
+
+        RootTable                   _roots;                 // data segments and explicit roots
+        ReferenceIndex              _reference_index;       // built on demand by enumerate_references
+
+        WeakTable                   _weak_table;
+        AssociationTable            _associations;
+        LayoutCache                 _layout_cache;
+        RetainTable                 _retain_table;          // overflowed subzone block reference counts
+
+        pthread_mutex_t             _collection_mutex;      // held for the duration of a collection
+        sword_t                     _collector_disable_count;
+        bool                        _is_collecting;
+        bool                        _marking;               // concurrent marking in progress; allocate marked
+        bool                        _finalizing;            // finalizers are running; watch for resurrections
+        bool                        _finalizing_generational;
+        usword_t                    _resurrected_blocks;    // subzone garbage resurrected while finalizing
+        usword_t                    _resurrected_bytes;
+        bool                        _noting_candidates;     // an exhaustive collection is under way
+        spin_lock_t                 _candidates_lock;       // protects _candidates
+        PointerHashMap<bool>        _candidates;            // blocks its next pass reconsiders
+
+        usword_t                    _sweep_epoch;           // bumped as each collection determines its garbage
+        bool                        _sweep_generational;    // only young unmarked blocks are garbage
+        bool                        _sweeping_enabled;      // garbage is final; pending subzones may be swept
+        usword_t                    _unswept_blocks;        // garbage not swept yet, left out of statistics
+        usword_t                    _unswept_bytes;
+
+        auto_collection_control_t   _control;
+        Pacer                       _pacer;                 // when conditional collections are due
+        usword_t                    _generational_count;    // generational collections since the last full one
+
+        bool                        _compaction_disabled;
+        spin_lock_t                 _observers_lock;        // protects the compaction observers
+        PointerHashMap<dispatch_block_t> _compaction_observers;  // block -> called after compaction moved blocks
+        usword_t                    _compaction_observer_count;
+
+        //
+        // ResourceTracker
+        //
+        // A client resource, other than memory, whose use can make a conditional collection worthwhile.
+        //
+        struct ResourceTracker {
+            ResourceTracker         *next;
+            char                    *description;
+            boolean_t               (^should_collect)(void);
+        };
+
+        pthread_mutex_t             _trackers_mutex;        // protects the resource trackers, held while polling
+        ResourceTracker             *_resource_trackers;
+
+        spin_lock_t                 _statistics_lock;       // protects _statistics
+        auto_statistics_t           _statistics;            // collection part only
+
+        pthread_mutex_t             _mark_mutex;            // mark worker pool
+        pthread_cond_t              _mark_start_cond;
+        pthread_cond_t              _mark_done_cond;
+        usword_t                    _mark_worker_count;     // helper threads, excluding the collecting thread
+        usword_t                    _mark_generation;       // bumped to start the workers
+        usword_t                    _mark_workers_running;
+        mark_job_t                  _mark_job;              // what the workers run, with _mark_context
+        void                        *_mark_context;
+        pthread_key_t               _mark_worker_key;       // set on the pool's threads, which are never registered
+
+        //
+        // Completion
+        //
+        // A callback to schedule when a background collection finishes.
+        //
+        struct Completion {
+            Completion              *next;
+            dispatch_queue_t        queue;
+            dispatch_block_t        block;
+        };
+
+        pthread_mutex_t             _request_mutex;         // background collection requests
+        pthread_cond_t              _request_cond;
+        bool                        _collector_thread_started;
+        bool                        _request_pending;
+        bool                        _cycle_running;
+        auto_collection_mode_t      _requested_mode;
+        Completion                  *_pending_completions;  // run after the requested collection
+        Completion                  *_running_completions;  // run after the collection in progress
+        bool                        _compaction_pending;
+        auto_zone_compact_options_t _compaction_options;
+        uint64_t                    _compaction_deadline;   // auto_date_now() once the requested compaction is due
+        Completion                  *_compaction_completions;   // run after the requested compaction
+
+        static Completion *make_completion(dispatch_queue_t queue, dispatch_block_t block);
+        static void run_completions(Completion *completion);
+        void start_collector_thread();
+        void wake_collector_thread();
+        static void destroy_registered_thread(void *data);
+        static void *mark_worker(void *arg);
+        static void *collector_thread(void *arg);
+
+        //
+        // sweep_in_background
+        //
+        // Sweep one pending subzone unless a collection is running.  Called by the collector thread
+        // with _request_mutex held, which is dropped meanwhile.  Returns false when there was nothing
+        // to sweep.
+        //
+        bool sweep_in_background();
+
+        //
+        // compaction_due
+        //
+        // Whether the collector thread should run the requested compaction now.  Called with
+        // _request_mutex held.
+        //
+        inline bool compaction_due() const { return _compaction_pending && auto_date_now() >= _compaction_deadline; }
+
+        //
+        // run_compaction_observers
+        //
+        // Call every compaction observer, with no locks held.
+        //
+        void run_compaction_observers();
+
+        void note_heap_range(usword_t start, usword_t end);
+
+        //
+        // Large block pages
+        //
+        // Freed large blocks keep their pages mapped, purged once idle for the purge decay.  A large
+        // block wasting at most a quarter of a kept mapping reuses it.  When all slots are full the
+        // mapping kept longest is unmapped.
+        //
+        bool take_kept_large(usword_t vm_size, void *&address, usword_t &size);
+        void retire_large(Large *large);
+
+        //
+        // purge_in_background
+        //
+        // Purge what has decayed.  Called by the collector thread with _request_mutex held, which is
+        // dropped meanwhile.  Returns when something decays next, or 0.
+        //
+        uint64_t purge_in_background();
+
+        //
+        // note_growth
+        //
+        // Remember that the heap grew, for report_growth().
+        //
+        void note_growth(auto_heap_growth_info_t info);
+        void publish_range(const void *address, usword_t size);
+        void collection_finished(Collector &collector, bool generational);
+        void local_collection_finished(ThreadLocalCollector &collector);
+
+        //
+        // collect_exhaustively
+        //
+        // Run a full collection, then as long as the previous pass freed something, passes that only
+        // reconsider what its finalizers let go of; see Collector::recollect().  Caller holds the
+        // collection mutex.
+        //
+        void collect_exhaustively();
+
+        //
+        // Resurrection
+        //
+        // mark_resurrected() takes a block out of the dying.  scan_resurrected() queues the dying
+        // blocks a resurrected block refers to on pending, or marks those that do not fit.  Both scans
+        // return whether they left a marked block unscanned.
+        //
+        bool mark_resurrected(void *block, auto_memory_type_t &layout, usword_t &size);
+        bool scan_resurrected(void *block, usword_t size, bool generational, VMArray<void *> *pending);
+        bool resurrect_from(void *block, bool generational);
+        bool rescan_resurrected(bool generational);
+
+        Zone(const char *name);
+
+      public:
+
+        //
+        // create
+        //
+        // Allocate and initialize a zone.
+        //
+        static Zone *create(const char *name);
+
+        //
+        // Conversion
+        //
+        static inline Zone *zone(auto_zone_t *zone) { return reinterpret_cast<Zone *>(zone); }
+        inline auto_zone_t *basic_zone() { return &_basic_zone; }
+        inline const char *name() const { return _basic_zone.zone_name; }
+        inline Admin &admin(usword_t sc) { return _admins[sc]; }
+
+        //
+        // current_thread
+        //
+        // Returns the calling thread's registration, or NULL.
+        //
+        inline Thread *current_thread() const { return (Thread *)pthread_getspecific(_registered_threads_key); }
+
+        //
+        // register_thread
+        //
+        // Register the calling thread if it is not already.  Returns NULL if out of memory, or on a
+        // mark worker: a collection never stops those, and one waits on them all.
+        //
+        Thread *register_thread();
+
+        //
+        // registered_thread
+        //
+        // Returns the calling thread's registration, registering it if needed.
+        //
+        inline Thread *registered_thread() {
+            Thread *thread = current_thread();
+            return thread ? thread : register_thread();
+        }
+
+        //
+        // unregister_thread
+        //
+        // Remove the calling thread's registration, returning its cached blocks.
+        //
+        void unregister_thread();
+
+        //
+        // allocate_subzone
+        //
+        // Returns fresh zero filled memory for a subzone, adding a region if needed.
+        //
+        Subzone *allocate_subzone();
+
+        //
+        // Heap growth
+        //
+        // Subzones and regions are added with locks held, so will_grow is told afterwards, by the
+        // allocating thread once it holds none.  AUTO_LOG_REGIONS logs growth and purging as it happens.
+        //
+        inline void report_growth() {
+            if (__builtin_expect(__atomic_load_n(&_pending_growth, __ATOMIC_RELAXED) != 0, 0)) deliver_growth();
+        }
+        void deliver_growth();
+        void log_regions(const char *event, const void *address, usword_t size);
+
+        //
+        // purge_decayed
+        //
+        // Return to the system the pages of subzones and freed large blocks idle for the purge decay.
+        // Returns when something decays next, or 0 if nothing is idle.
+        //
+        uint64_t purge_decayed();
+
+        //
+        // subzone_for
+        //
+        // Returns the subzone containing address, or NULL if it does not lie in one.  Lock free.
+        //
+        inline Subzone *subzone_for(const void *address) const { return _page_map.subzone_for(address); }
+
+        //
+        // large_for
+        //
+        // Returns the descriptor of the large block starting at address, or NULL.  Lock free.
+        //
+        inline Large *large_for(const void *address) const {
+            Large *large = _page_map.large_containing(address);
+            return large && large->address() == address ? large : NULL;
+        }
+
+        //
+        // large_containing
+        //
+        // Returns the descriptor of the large block containing address, or NULL.  Lock free.
+        //
+        inline Large *large_containing(const void *address) const { return _page_map.large_containing(address); }
+
+        inline const PageMap &page_map() const { return _page_map; }
+
+        //
+        // block_start
+        //
+        // Returns the start of the live block containing address, or NULL.  Lock free.
+        //
+        void *block_start(const void *address) const;
+
+        //
+        // in_heap
+        //
+        // Quick check whether address may lie in a block.
+        //
+        inline bool in_heap(const void *address) const { return (usword_t)address - heap_min() < heap_max() - heap_min(); }
+
+        //
+        // write_barrier
+        //
+        // Dirty the cards covering [address, address + size) if they lie in a block.  Returns false,
+        // doing nothing, if address is not in a block.
+        //
+        bool write_barrier(const void *address, usword_t size);
+
+        //
+        // set_write_barrier
+        //
+        // Store value at address and dirty the card when address lies in a block.  Returns false,
+        // without storing, if it does not.
+        //
+        bool set_write_barrier(const void *address, const void *value);
+
+        //
+        // publish
+        //
+        // Make global any of the calling thread's local blocks that value reaches.  Called before value
+        // is stored where other threads or the global collector may find it.
+        //
+        inline void publish(const void *value) {
+            if (!in_heap(value)) return;
+            Thread *thread = current_thread();
+            if (thread) thread->publish(value);
+        }
+
+        //
+        // block_allocate
+        //
+        // Allocate a block of at least size bytes with the given layout.  Small blocks without a
+        // reference count allocated by a registered thread start out local to it.  Returns NULL if out
+        // of memory.
+        //
+        void *block_allocate(usword_t size, auto_memory_type_t layout, bool initial_refcount_to_one, bool clear);
+
+        //
+        // batch_allocate
+        //
+        // Allocate up to n blocks of the same size and layout into results, returning the number allocated.
+        //
+        unsigned batch_allocate(usword_t size, auto_memory_type_t layout, bool initial_refcount_to_one, bool clear, void **results, unsigned n);
+
+        //
+        // block_deallocate
+        //
+        // Immediately free a block.  Pointers that are not block starts are ignored.
+        //
+        void block_deallocate(void *block);
+
+        //
+        // block_size
+        //
+        // Returns the size of the block starting at address, or 0 if address is not a block start.
+        //
+        usword_t block_size(const void *address);
+
+        //
+        // block_layout
+        //
+        // Returns the layout of the block starting at address, or AUTO_TYPE_UNKNOWN.
+        //
+        auto_memory_type_t block_layout(const void *address);
+
+        //
+        // set_block_layout
+        //
+        // Change the layout of the block starting at address, if there is one.
+        //
+        void set_block_layout(const void *address, auto_memory_type_t layout);
+
+        //
+        // block_retain
+        //
+        // Increment the reference count of the block starting at address, making it global if it is
+        // the calling thread's.  Returns the new count, or 0 if address is not a block start.
+        //
+        usword_t block_retain(void *address);
+
+        //
+        // block_release
+        //
+        // Decrement the reference count of the block starting at address, unless already 0.  Returns
+        // the new count.
+        //
+        usword_t block_release(void *address);
+
+        //
+        // block_retain_count
+        //
+        // Returns the reference count of the block starting at address.
+        //
+        usword_t block_retain_count(const void *address);
+
+        //
+        // statistics
+        //
+        // Summarize blocks and memory in use.
+        //
+        void statistics(malloc_statistics_t &stats);
+
+        //
+        // collection_statistics
+        //
+        // Fill in the collector part of the public statistics, as far as stats.version reaches.
+        //
+        void collection_statistics(auto_statistics_t &stats);
+
+        //
+        // good_size
+        //
+        // The size a block allocated for size bytes actually has.
+        //
+        static usword_t good_size(usword_t size);
+
+        //
+        // check
+        //
+        // Verify the allocator's bookkeeping, reporting the first inconsistency to stderr.  Returns
+        // false if there was one.
+        //
+        bool check();
+
+        //
+        // print
+        //
+        // Describe the zone on stderr, per size class if verbose.
+        //
+        void print(bool verbose);
+
+        //
+        // force_lock, force_unlock
+        //
+        // Take every lock of the zone, waiting for a collection in progress to finish, so that its
+        // state is stable for a fork or an enumeration, and release them.
+        //
+        void force_lock();
+        void force_unlock();
+
+        //
+        // Roots
+        //
+        void add_root(void *root, void *value);
+        void remove_root(void *root);
+        void add_datasegment(void *address, usword_t size);
+        void remove_datasegment(void *address, usword_t size);
+
+        //
+        // root_write_barrier
+        //
+        // Store value at an address that may be a global.  Stores into the heap take the write barrier,
+        // and stores into a registered data segment or root publish the value; those are found without
+        // a lock.  Any other address, the calling thread's stack included, is not scanned as a root and
+        // is simply stored to.
+        //
+        void root_write_barrier(void *address, void *value);
+
+        //
+        // Collection control
+        //
+        inline auto_collection_control_t *control() { return &_control; }
+        inline void disable_collector() { __atomic_add_fetch(&_collector_disable_count, 1, __ATOMIC_SEQ_CST); }
+        inline void reenable_collector() { __atomic_sub_fetch(&_collector_disable_count, 1, __ATOMIC_SEQ_CST); }
+        inline bool is_enabled() const { return __atomic_load_n(&_collector_disable_count, __ATOMIC_RELAXED) == 0; }
+        inline bool is_collecting() const { return __atomic_load_n(&_is_collecting, __ATOMIC_RELAXED); }
+
+        //
+        // collect
+        //
+        // Run a collection in the calling thread.  Returns immediately if one is already running, or
+        // with AUTO_COLLECT_IF_NEEDED if the pacer does not think one is due and no resource tracker
+        // asks for one.
+        //
+        void collect(auto_collection_mode_t mode);
+
+        //
+        // Resource trackers
+        //
+        // Registered should_collect blocks are polled by conditional collections that memory use alone
+        // would not start, at most once per pacing interval.  They are called with the trackers mutex
+        // held and must not register or unregister trackers.
+        //
+        void register_resource_tracker(const char *description, boolean_t (^should_collect)(void));
+        void unregister_resource_tracker(const char *description);
+        bool resource_tracker_wants_collection();
+
+        //
+        // collect_local
+        //
+        // Run a thread local collection of the calling thread's local blocks.
+        //
+        void collect_local();
+
+        //
+        // reap_local_blocks
+        //
+        // Free all of the calling thread's local blocks, which the caller knows to be unreachable.
+        //
+        void reap_local_blocks();
+
+        //
+        // request_collection
+        //
+        // Ask the background collector thread for a collection, starting it if needed.  A coalescing
+        // request is satisfied by a collection already running or requested.  If given, the completion
+        // block is submitted to queue once the collection satisfying the request finishes.
+        //
+        void request_collection(auto_collection_mode_t mode, bool coalesce, dispatch_queue_t queue, dispatch_block_t completion);
+
+        //
+        // Compaction
+        //
+        // compact() runs a full collection and then moves live blocks out of sparse subzones, or with
+        // AUTO_ZONE_COMPACT_ANALYZE only reports what it would move.  request_compaction() has the
+        // collector thread do it, once no collection was requested for a while if the options say
+        // AUTO_ZONE_COMPACT_IF_IDLE.  Observers are called after blocks moved; the compactor rekeys them
+        // with the observers lock held.
+        //
+        void compact(auto_zone_compact_options_t options);
+        void request_compaction(auto_zone_compact_options_t options, dispatch_queue_t queue, dispatch_block_t completion);
+        inline void disable_compaction() { __atomic_store_n(&_compaction_disabled, true, __ATOMIC_RELAXED); }
+        inline bool is_compaction_disabled() const { return __atomic_load_n(&_compaction_disabled, __ATOMIC_RELAXED); }
+        void set_compaction_observer(void *block, dispatch_block_t observer);
+        void forget_dying_observers(bool generational);
+        inline void lock_compaction_observers() { spin_lock(&_observers_lock); }
+        inline void unlock_compaction_observers() { spin_unlock(&_observers_lock); }
+        void relocate_compaction_observers(Compactor &compactor);
+
+        //
+        // visit_heap
+        //
+        // Finish sweeping and walk the heap with the world stopped, reporting to visitor.  Holds the
+        // collection mutex throughout, so no collection runs meanwhile.
+        //
+        void visit_heap(HeapVisitor &visitor);
+
+        //
+        // enumerate_references
+        //
+        // Report the words referring to referent: those in the heap and the roots, through the reverse
+        // reference index, rebuilt first if a collection ran since it was built, and those of the
+        // calling thread's stack in [stack_top, stack_bottom).
+        //
+        void enumerate_references(void *referent, auto_reference_recorder_t callback, void *stack_top, void *stack_bottom, void *context);
+
+        //
+        // Concurrent marking
+        //
+        inline bool is_marking() const { return __atomic_load_n(&_marking, __ATOMIC_RELAXED); }
+        inline void set_marking(bool marking) { __atomic_store_n(&_marking, marking, __ATOMIC_RELAXED); }
+        void release_deferred_large();
+
+        //
+        // Finalization
+        //
+        // While a collection's finalizers run, storing one of its garbage blocks into a block that
+        // survives resurrects it.
+        //
+        inline bool is_finalizing() const { return __atomic_load_n(&_finalizing, __ATOMIC_RELAXED); }
+        inline void set_finalizing(bool finalizing, bool generational) {
+            _finalizing_generational = generational;
+            __atomic_store_n(&_finalizing, finalizing, __ATOMIC_RELEASE);
+        }
+        inline usword_t resurrected_blocks() const { return __atomic_load_n(&_resurrected_blocks, __ATOMIC_RELAXED); }
+
+        //
+        // Exhaustive collection candidates
+        //
+        // From the first pause of an exhaustive collection until it ends, blocks whose last retain goes
+        // away, and blocks a finalizer unlinks from a word of a surviving block that was scanned, are
+        // noted for the next pass to reconsider.  Blocks retained or resurrected meanwhile count as
+        // reached more than once, so no pass condemns them, and so do the surviving blocks a resurrected
+        // block refers to, since no marking scanned it.  Noting begins with the world stopped.
+        //
+        inline bool is_noting_candidates() const { return __atomic_load_n(&_noting_candidates, __ATOMIC_RELAXED); }
+        inline void begin_noting_candidates() { __atomic_store_n(&_noting_candidates, true, __ATOMIC_RELAXED); }
+        void end_noting_candidates();
+        void note_candidate(const void *block);
+        void note_shared(const void *address);
+        bool take_candidates(VMArray<void *> &candidates);
+        inline usword_t resurrected_bytes() const { return __atomic_load_n(&_resurrected_bytes, __ATOMIC_RELAXED); }
+
+        //
+        // Lazy sweeping
+        //
+        // A collection frees its subzone garbage lazily.  While determining the garbage it bumps the
+        // sweep epoch, leaving every subzone pending; blocks allocated or published in a pending
+        // subzone are marked so they do not look like garbage.  Once finalization is over, admins
+        // sweep pending subzones as they need blocks and the collector thread sweeps the rest in the
+        // background.  Sweeping finishes before the next collection clears the marks.
+        //
+        inline usword_t sweep_epoch() const { return __atomic_load_n(&_sweep_epoch, __ATOMIC_ACQUIRE); }
+        inline bool is_sweep_pending(Subzone *subzone) const { return subzone->swept_epoch() != sweep_epoch(); }
+        inline bool allocates_marked(Subzone *subzone) const { return is_marking() || is_sweep_pending(subzone); }
+        inline bool is_sweeping_enabled() const { return __atomic_load_n(&_sweeping_enabled, __ATOMIC_ACQUIRE); }
+        inline bool sweep_generational() const { return _sweep_generational; }
+
+        //
+        // needs_sweep
+        //
+        // Whether the subzone's garbage may be swept now.  A thread stopped between the two tests
+        // may resume after the next collection began: begin_sweep disables sweeping before it
+        // makes subzones pending, so pending is tested first.
+        //
+        inline bool needs_sweep(Subzone *subzone) const { return is_sweep_pending(subzone) && is_sweeping_enabled(); }
+
+        //
+        // begin_sweep
+        //
+        // Make every subzone pending.  Called with the world stopped, once the marks are final.
+        //
+        void begin_sweep(bool generational);
+
+        //
+        // enable_sweeping
+        //
+        // Let pending subzones be swept, now that blocks and bytes of garbage are final.
+        //
+        void enable_sweeping(usword_t blocks, usword_t bytes);
+
+        //
+        // note_swept
+        //
+        // Account for garbage freed by sweeping.
+        //
+        void note_swept(usword_t blocks, usword_t bytes);
+
+        //
+        // sweep_some
+        //
+        // Sweep one pending subzone, returning false once none are left.
+        //
+        bool sweep_some();
+
+        //
+        // finish_sweeping
+        //
+        // Sweep every pending subzone.
+        //
+        void finish_sweeping();
+
+        //
+        // make_global
+        //
+        // Publish a local block, marking it if its subzone is pending so that sweeping spares it.
+        //
+        inline void make_global(Subzone *subzone, usword_t index) {
+            if (is_sweep_pending(subzone)) {
+                subzone->test_set_mark(index);
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+            }
+            subzone->set_global(index);
+        }
+
+        //
+        // start_mark_workers
+        //
+        // Start helper threads so that marking runs on up to count threads.  Only grows the pool.
+        //
+        void start_mark_workers(usword_t count);
+
+        //
+        // run_mark_workers
+        //
+        // Run job(context, index) on the calling thread as worker 0 and on every helper, returning when
+        // all are done.  The collector runs its current phase, marking or finalizing, this way; heap
+        // scans outside collections may too, with the collection mutex held.
+        //
+        void run_mark_workers(mark_job_t job, void *context);
+        void run_mark_workers(Collector *collector);
+        inline usword_t mark_worker_count() const { return _mark_worker_count; }
+
+        //
+        // Collector access.  Valid while the world is stopped, or under the corresponding locks.
+        //
+        void lock_for_collection();
+        void unlock_for_collection();
+        inline usword_t heap_min() const { return __atomic_load_n(&_heap_min, __ATOMIC_RELAXED); }
+        inline usword_t heap_max() const { return __atomic_load_n(&_heap_max, __ATOMIC_RELAXED); }
+        inline Thread *registered_threads() const { return _registered_threads; }
+        inline Region *region_list() const { return __atomic_load_n(&_region_list, __ATOMIC_ACQUIRE); }
+        inline Large *large_list() const { return _large_list; }
+        inline RootTable &roots() { return _roots; }
+
+        inline WeakTable &weak_table() { return _weak_table; }
+        inline RetainTable &retain_table() { return _retain_table; }
+        inline AssociationTable &associations() { return _associations; }
+        inline LayoutCache &layout_cache() { return _layout_cache; }
+
+        //
+        // Weak locations in blocks
+        //
+        // note_weak_location() flags the block containing a location about to be registered, so that
+        // block_deallocate() erases registrations only from blocks that may hold some.
+        //
+        void note_weak_location(const void *location);
+        bool holds_weak_locations(const void *block);
+
+        //
+        // is_dying
+        //
+        // Whether the block containing address is garbage of the collection that just determined
+        // its garbage.  Only meaningful between the end of marking and the start of the next
+        // collection.
+        //
+        bool is_dying(const void *address, bool generational);
+
+        //
+        // set_finalized
+        //
+        // Mark a block as having been finalized.
+        //
+        void set_finalized(void *block);
+
+        //
+        // is_finalized
+        //
+        // Whether the block starting at address has been finalized, or is not to be.
+        //
+        bool is_finalized(const void *address);
+
+        //
+        // resurrect
+        //
+        // Keep a block dying in the last collection, and the dying blocks it reaches, from being
+        // reclaimed.  Called when a finalizer makes garbage reachable again.
+        //
+        void resurrect(void *block, bool generational);
+
+        //
+        // deallocate_large
+        //
+        // Free the large block starting at address, if there is one.
+        //
+        void deallocate_large(void *address);
+    };
+
+};
+
+#endif // __AUTO_ZONE_CORE__
@@ -26,160 +26,390 @@
 #define AUTO_USE_NEW_WEAK_CALLBACK
 
 #include "auto_zone.h"
+#include "AutoIntrospection.h"
+#include "AutoRecorder.h"
+#include "AutoSnapshot.h"
+#include "AutoTrace.h"
+#include "AutoZone.h"
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+using namespace Auto;
+
+static auto_zone_t *gc_zone = NULL;     // the first zone created
+
+
+//
+// record_allocation
+//
+// Record the blocks just allocated, if the zone is being recorded.
+//
+static inline void record_allocation(Zone *zone, void **blocks, unsigned count, size_t size, auto_memory_type_t type, boolean_t retained, boolean_t clear) {
+    if (!is_recording(zone)) return;
+    unsigned flags = (retained ? recording_retained : 0) | (clear ? recording_cleared : 0);
+    for (unsigned i = 0; i < count; i++) if (blocks[i]) record_allocate(blocks[i], size, type, flags);
+}
+
+//
+// malloc zone entry points
+//
+// Memory allocated through the malloc interface is unscanned and starts retained, so it behaves
+// like ordinary malloc memory until released.
+//
+
+static size_t auto_malloc_size(malloc_zone_t *zone, const void *ptr) {
+    return Zone::zone(zone)->block_size(ptr);
+}
+
+static void *auto_malloc(malloc_zone_t *zone, size_t size) {
+    Zone *azone = Zone::zone(zone);
+    void *ptr = azone->block_allocate(size, AUTO_MEMORY_UNSCANNED, true, false);
+    record_allocation(azone, &ptr, 1, size, AUTO_MEMORY_UNSCANNED, true, false);
+    return ptr;
+}
+
+static void *auto_calloc(malloc_zone_t *zone, size_t num_items, size_t size) {
+    size_t total = num_items * size;
+    if (size && total / size != num_items) return NULL;
+    Zone *azone = Zone::zone(zone);
+    void *ptr = azone->block_allocate(total, AUTO_MEMORY_UNSCANNED, true, true);
+    record_allocation(azone, &ptr, 1, total, AUTO_MEMORY_UNSCANNED, true, true);
+    return ptr;
+}
+
+static void *auto_valloc(malloc_zone_t *zone, size_t size) {
+    // large blocks are page aligned.
+    Zone *azone = Zone::zone(zone);
+    size = size > maximum_small_size ? size : maximum_small_size + 1;
+    void *ptr = azone->block_allocate(size, AUTO_MEMORY_UNSCANNED, true, true);
+    record_allocation(azone, &ptr, 1, size, AUTO_MEMORY_UNSCANNED, true, true);
+    return ptr;
+}
+
+static void auto_free(malloc_zone_t *zone, void *ptr) {
+    if (!ptr) return;
+    Zone *azone = Zone::zone(zone);
+    if (is_recording(azone)) record_block(recording_free, ptr);
+    azone->block_deallocate(ptr);
+}
+
+static void *auto_realloc(malloc_zone_t *zone, void *ptr, size_t size) {
+    Zone *azone = Zone::zone(zone);
+    if (!ptr) return auto_malloc(zone, size);
+    usword_t old_size = azone->block_size(ptr);
+    if (!old_size) return NULL;
+    if (size <= old_size && size > old_size / 2) return ptr;
+    auto_memory_type_t layout = azone->block_layout(ptr);
+    void *new_ptr = azone->block_allocate(size, layout, true, false);
+    if (!new_ptr) return NULL;
+    record_allocation(azone, &new_ptr, 1, size, layout, true, false);
+    memmove(new_ptr, ptr, old_size < size ? old_size : size);
+    auto_free(zone, ptr);
+    return new_ptr;
+}
+
+static unsigned auto_batch_malloc(malloc_zone_t *zone, size_t size, void **results, unsigned num_requested) {
+    Zone *azone = Zone::zone(zone);
+    unsigned count = azone->batch_allocate(size, AUTO_MEMORY_UNSCANNED, true, false, results, num_requested);
+    record_allocation(azone, results, count, size, AUTO_MEMORY_UNSCANNED, true, false);
+    return count;
+}
+
+static void auto_batch_free(malloc_zone_t *zone, void **to_be_freed, unsigned num) {
+    for (unsigned i = 0; i < num; i++) auto_free(zone, to_be_freed[i]);
+}
+
+static void auto_destroy(malloc_zone_t *zone) {
+    // collected zones live for the life of the process.
+}
+
+
+//
+// malloc introspection
+//
+
+static size_t auto_good_size(malloc_zone_t *zone, size_t size) {
+    return Zone::good_size(size);
+}
+
+static boolean_t auto_check(malloc_zone_t *zone) {
+    return Zone::zone(zone)->check();
+}
+
+static void auto_print(malloc_zone_t *zone, boolean_t verbose) {
+    Zone::zone(zone)->print(verbose);
+}
+
+static void auto_log(malloc_zone_t *zone, void *address) {
+    // the zone keeps no per address log.
+}
+
+static void auto_force_lock(malloc_zone_t *zone) {
+    Zone::zone(zone)->force_lock();
+}
+
+static void auto_force_unlock(malloc_zone_t *zone) {
+    Zone::zone(zone)->force_unlock();
+}
+
+static void auto_malloc_statistics(malloc_zone_t *zone, malloc_statistics_t *stats) {
+    Zone::zone(zone)->statistics(*stats);
+}
+
+static malloc_introspection_t auto_introspection = {
+    enumerate_zone, auto_good_size, auto_check, auto_print, auto_log, auto_force_lock, auto_force_unlock, auto_malloc_statistics,
+};
+
+
+static void write_trace_file(void) {
+    int fd = open(getenv("AUTO_TRACE_FILE"), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    write_trace(fd);
+    close(fd);
+}
+
+
+static int record_file = -1;
+
+static void write_record_file(void) {
+    stop_recording();
+    close(record_file);
+}
+
 
 auto_zone_t *auto_zone_create(const char *name) {
-    abort();
+    Zone *azone = Zone::create(name);
+    if (!azone) return NULL;
+    auto_zone_t *zone = azone->basic_zone();
+    zone->size = auto_malloc_size;
+    zone->malloc = auto_malloc;
+    zone->calloc = auto_calloc;
+    zone->valloc = auto_valloc;
+    zone->free = auto_free;
+    zone->realloc = auto_realloc;
+    zone->destroy = auto_destroy;
+    zone->batch_malloc = auto_batch_malloc;
+    zone->batch_free = auto_batch_free;
+    zone->introspect = &auto_introspection;
+    zone->version = 4;
+    // AUTO_TRACE_FILE traces from the first zone's creation and writes the trace at exit; likewise
+    // AUTO_RECORD_FILE records the zone's operations.
+    if (__sync_bool_compare_and_swap(&gc_zone, (auto_zone_t *)NULL, zone)) {
+        if (getenv("AUTO_TRACE_FILE")) {
+            set_tracing(true);
+            atexit(write_trace_file);
+        }
+        const char *record_path = getenv("AUTO_RECORD_FILE");
+        if (record_path && (record_file = open(record_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+            if (start_recording(azone, record_file)) atexit(write_record_file);
+            else close(record_file);
+        }
+    }
+    return zone;
 }
 
 
 struct malloc_introspection_t auto_zone_introspection() {
-    abort();
+    return auto_introspection;
+}
+
+
+__attribute__((noinline)) static void log_reference(auto_zone_t *zone, uint32_t event, void *ptr, usword_t count) {
+    if (__auto_reference_logger) __auto_reference_logger(event, ptr, count);
+    trace(event == AUTO_RETAIN_EVENT ? trace_retain : trace_release, 0, (usword_t)ptr, count);
+    if (is_recording(Zone::zone(zone))) record_block(event == AUTO_RETAIN_EVENT ? recording_retain : recording_release, ptr);
 }
 
 
 void auto_zone_retain(auto_zone_t *zone, void *ptr) {
-    abort();
+    usword_t count = Zone::zone(zone)->block_retain(ptr);
+    // one branch while neither the logger, tracing nor recording is on.
+    if (__builtin_expect((__auto_reference_logger != NULL) | trace_enabled | recording_enabled, 0)) log_reference(zone, AUTO_RETAIN_EVENT, ptr, count);
 }
 
 
 unsigned int auto_zone_release(auto_zone_t *zone, void *ptr) {
-    abort();
+    usword_t count = Zone::zone(zone)->block_release(ptr);
+    if (__builtin_expect((__auto_reference_logger != NULL) | trace_enabled | recording_enabled, 0)) log_reference(zone, AUTO_RELEASE_EVENT, ptr, count);
+    return (unsigned int)count;
 }
 
 
 unsigned int auto_zone_retain_count(auto_zone_t *zone, const void *ptr) {
-    abort();
+    return (unsigned int)Zone::zone(zone)->block_retain_count(ptr);
 }
 
 
 const void *auto_zone_base_pointer(auto_zone_t *zone, const void *ptr) {
-    abort();
+    return Zone::zone(zone)->block_start(ptr);
 }
 
 
 boolean_t auto_zone_is_valid_pointer(auto_zone_t *zone, const void *ptr) {
-    abort();
+    return ptr && Zone::zone(zone)->block_start(ptr) == ptr;
 }
 
 
 size_t auto_zone_size(auto_zone_t *zone, const void *ptr) {
-    abort();
+    return Zone::zone(zone)->block_size(ptr);
 }
 
 
 boolean_t auto_zone_set_write_barrier(auto_zone_t *zone, const void *dest, const void *new_value) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    boolean_t stored = azone->set_write_barrier(dest, new_value);
+    if (stored && is_recording(azone)) record_store(azone, dest, new_value);
+    return stored;
 }
 
 
 boolean_t auto_zone_atomicCompareAndSwap(auto_zone_t *zone, void *existingValue, void *newValue, void *volatile *location, boolean_t isGlobal, boolean_t issueBarrier) {
-    abort();
+    // the swap is always a full barrier.
+    if (!__sync_bool_compare_and_swap(location, existingValue, newValue)) return false;
+    Zone *azone = Zone::zone(zone);
+    if (is_recording(azone)) record_store(azone, (const void *)location, newValue);
+    if (!azone->in_heap(newValue)) return true;
+    if (isGlobal) azone->publish(newValue);
+    else azone->write_barrier((const void *)location, sizeof(void *));
+    return true;
 }
 
 
 boolean_t auto_zone_atomicCompareAndSwapPtr(auto_zone_t *zone, void *existingValue, void *newValue, void *volatile *location, boolean_t issueBarrier) {
-    abort();
+    return auto_zone_atomicCompareAndSwap(zone, existingValue, newValue, location, false, issueBarrier);
 }
 
 
 void *auto_zone_write_barrier_memmove(auto_zone_t *zone, void *dst, const void *src, size_t size) {
-    abort();
+    memmove(dst, src, size);
+    if (!size) return dst;
+    Zone *azone = Zone::zone(zone);
+    azone->write_barrier(dst, size);
+    if (is_recording(azone)) record_copy(azone, dst, size);
+    return dst;
 }
 
 
 void *auto_zone_strong_read_barrier(auto_zone_t *zone, void **source) {
-    abort();
+    return *source;
 }
 
 
 void auto_zone_statistics(auto_zone_t *zone, auto_statistics_t *stats) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    if (stats->version != 1 && stats->version != 2) return;
+    azone->statistics(stats->malloc_statistics);
+    azone->collection_statistics(*stats);
 }
 
 
 auto_collection_control_t *auto_collection_parameters(auto_zone_t *zone) {
-    abort();
+    return Zone::zone(zone)->control();
 }
 
 
 void auto_collector_disable(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->disable_collector();
 }
 
 
 void auto_collector_reenable(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->reenable_collector();
 }
 
 
 boolean_t auto_zone_is_enabled(auto_zone_t *zone) {
-    abort();
+    return Zone::zone(zone)->is_enabled();
 }
 
 
 boolean_t auto_zone_is_collecting(auto_zone_t *zone) {
-    abort();
+    return Zone::zone(zone)->is_collecting();
 }
 
 
 void auto_collect(auto_zone_t *zone, auto_collection_mode_t mode, void *collection_context) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    if (is_recording(azone)) record_mode(recording_collect, mode);
+    if (mode & AUTO_COLLECT_SYNCHRONOUS) azone->collect(mode);
+    else azone->request_collection(mode, false, NULL, NULL);
 }
 
 
 void auto_collect_multithreaded(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->start_mark_workers(~(usword_t)0);
 }
 
 
 void auto_zone_collect(auto_zone_t *zone, auto_zone_options_t options) {
-    abort();
+    if (is_recording(Zone::zone(zone))) record_mode(recording_zone_collect, options);
+    if (options & AUTO_ZONE_COLLECT_LOCAL_COLLECTION) Zone::zone(zone)->collect_local();
+
+    // global modes 1-4 correspond to the auto_collection_mode_t kinds 0-3.
+    usword_t global = options & AUTO_ZONE_COLLECT_GLOBAL_COLLECTION_MODE_MASK;
+    if (global == AUTO_ZONE_COLLECT_NO_OPTIONS || global > AUTO_ZONE_COLLECT_GLOBAL_MODE_MAX) return;
+    Zone::zone(zone)->request_collection((auto_collection_mode_t)(global - 1), (options & AUTO_ZONE_COLLECT_COALESCE) != 0, NULL, NULL);
 }
 
 
 void auto_zone_collect_and_notify(auto_zone_t *zone, auto_zone_options_t options, dispatch_queue_t callback_queue, dispatch_block_t completion_callback) {
-    abort();
+    if (is_recording(Zone::zone(zone))) record_mode(recording_zone_collect, options);
+    if (options & AUTO_ZONE_COLLECT_LOCAL_COLLECTION) Zone::zone(zone)->collect_local();
+
+    usword_t global = options & AUTO_ZONE_COLLECT_GLOBAL_COLLECTION_MODE_MASK;
+    if (global == AUTO_ZONE_COLLECT_NO_OPTIONS || global > AUTO_ZONE_COLLECT_GLOBAL_MODE_MAX) {
+        // nothing to wait for.
+        if (completion_callback) dispatch_async(callback_queue, completion_callback);
+        return;
+    }
+    Zone::zone(zone)->request_collection((auto_collection_mode_t)(global - 1), (options & AUTO_ZONE_COLLECT_COALESCE) != 0, callback_queue, completion_callback);
 }
 
 
 void auto_zone_compact(auto_zone_t *zone, auto_zone_compact_options_t options, dispatch_queue_t callback_queue, dispatch_block_t completion_callback) {
-    abort();
+    Zone::zone(zone)->request_compaction(options, callback_queue, completion_callback);
 }
 
 
 void auto_zone_disable_compaction(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->disable_compaction();
 }
 
 
 void auto_zone_register_resource_tracker(auto_zone_t *zone, const char *description, boolean_t (^should_collect)(void)) {
-    abort();
+    Zone::zone(zone)->register_resource_tracker(description, should_collect);
 }
 
 
 void auto_zone_unregister_resource_tracker(auto_zone_t *zone, const char *description) {
-    abort();
+    Zone::zone(zone)->unregister_resource_tracker(description);
 }
 
 
 void auto_zone_reap_all_local_blocks(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->reap_local_blocks();
 }
 
 
 auto_memory_type_t auto_zone_get_layout_type(auto_zone_t *zone, void *ptr) {
-    abort();
+    return Zone::zone(zone)->block_layout(ptr);
 }
 
 
 void* auto_zone_allocate_object(auto_zone_t *zone, size_t size, auto_memory_type_t type, boolean_t initial_refcount_to_one, boolean_t clear) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    void *ptr = azone->block_allocate(size, type, initial_refcount_to_one, clear);
+    record_allocation(azone, &ptr, 1, size, type, initial_refcount_to_one, clear);
+    return ptr;
 }
 
 
 unsigned auto_zone_batch_allocate(auto_zone_t *zone, size_t size, auto_memory_type_t type, boolean_t initial_refcount_to_one, boolean_t clear, void **results, unsigned num_requested) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    unsigned count = azone->batch_allocate(size, type, initial_refcount_to_one, clear, results, num_requested);
+    record_allocation(azone, results, count, size, type, initial_refcount_to_one, clear);
+    return count;
 }
 
 
@@ -189,82 +419,95 @@ void *auto_zone_create_copy(auto_zone_t *zone, void *ptr) {
 
 
 void auto_zone_register_thread(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->register_thread();
 }
 
 
 void auto_zone_unregister_thread(auto_zone_t *zone) {
-    abort();
+    Zone::zone(zone)->unregister_thread();
 }
 
 
 void auto_zone_assert_thread_registered(auto_zone_t *zone) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    if (!azone->current_thread()) {
+        fprintf(stderr, "auto_zone_assert_thread_registered: thread %p is not registered with zone %s\n", (void *)pthread_self(), azone->name());
+    }
 }
 
 
 void auto_zone_register_datasegment(auto_zone_t *zone, void *address, size_t size) {
-    abort();
+    Zone::zone(zone)->add_datasegment(address, size);
 }
 
 
 void auto_zone_unregister_datasegment(auto_zone_t *zone, void *address, size_t size) {
-    abort();
+    Zone::zone(zone)->remove_datasegment(address, size);
 }
 
 
 void auto_assign_weak_reference(auto_zone_t *zone, const void *value, const void **location, auto_weak_callback_block_t *block) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    azone->weak_table().assign(azone, value, location, block);
+    if (is_recording(azone)) record_weak(azone, location, value);
 }
 
 
 void* auto_read_weak_reference(auto_zone_t *zone, void **referrer) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    return azone->weak_table().read(azone, referrer);
 }
 
 
 void auto_zone_set_compaction_observer(auto_zone_t *zone, void *block, void (^observer) (void)) {
-    abort();
+    Zone::zone(zone)->set_compaction_observer(block, observer);
 }
 
 
 void auto_zone_add_root(auto_zone_t *zone, void *address_of_root_ptr, void *value) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    azone->add_root(address_of_root_ptr, value);
+    if (is_recording(azone)) record_root(recording_root_add, azone, address_of_root_ptr, value);
 }
 
 
 void auto_zone_remove_root(auto_zone_t *zone, void *address_of_root_ptr) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    azone->remove_root(address_of_root_ptr);
+    if (is_recording(azone)) record_root(recording_root_remove, azone, address_of_root_ptr, NULL);
 }
 
 
 void auto_zone_root_write_barrier(auto_zone_t *zone, void *address_of_possible_root_ptr, void *value) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    azone->root_write_barrier(address_of_possible_root_ptr, value);
+    if (is_recording(azone)) record_root(recording_root_store, azone, address_of_possible_root_ptr, value);
 }
 
 
 void auto_zone_set_associative_ref(auto_zone_t *zone, void *object, void *key, void *value) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    azone->associations().set(azone, object, key, value);
 }
 
 
 void *auto_zone_get_associative_ref(auto_zone_t *zone, void *object,  void *key) {
-    abort();
+    return Zone::zone(zone)->associations().get(object, key);
 }
 
 
 void auto_zone_erase_associative_refs(auto_zone_t *zone, void *object) {
-    abort();
+    Zone::zone(zone)->associations().erase(object);
 }
 
 
 size_t auto_zone_get_associative_hash(auto_zone_t *zone, void *object) {
-    abort();
+    return Zone::zone(zone)->associations().hash(object);
 }
 
 
 void auto_zone_enumerate_associative_refs(auto_zone_t *zone, void *key, boolean_t (^block) (void *object, void *value)) {
-    abort();
+    Zone::zone(zone)->associations().enumerate(key, block);
 }
 
 
@@ -289,12 +532,14 @@ void auto_zone_enumerate_uncollected(auto_zone_t *zone, auto_zone_collection_che
 
 
 boolean_t auto_zone_is_finalized(auto_zone_t *zone, const void *ptr) {
-    abort();
+    return Zone::zone(zone)->is_finalized(ptr);
 }
 
 
 void auto_zone_set_nofinalize(auto_zone_t *zone, void *ptr) {
-    abort();
+    // a block taken as already finalized is never handed to batch_invalidate.
+    Zone *azone = Zone::zone(zone);
+    if (azone->block_size(ptr)) azone->set_finalized(ptr);
 }
 
 
@@ -304,7 +549,10 @@ void auto_zone_set_unscanned(auto_zone_t *zone, void *ptr) {
 
 
 void auto_zone_set_scan_exactly(auto_zone_t *zone, void *ptr) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    auto_memory_type_t layout = azone->block_layout(ptr);
+    // scanned memory becomes all pointers; objects are scanned all pointers past their layout maps.
+    if (layout != AUTO_TYPE_UNKNOWN && !(layout & AUTO_UNSCANNED)) azone->set_block_layout(ptr, layout | AUTO_POINTERS_ONLY);
 }
 
 
@@ -319,43 +567,188 @@ void (*__auto_reference_logger)(uint32_t eventtype, void *ptr, uintptr_t data);
 void auto_enumerate_references(auto_zone_t *zone, void *referent, 
                                auto_reference_recorder_t callback, 
                                void *stack_bottom, void *ctx) {
-    abort();
+    // the stack above this frame is the caller's.
+    Zone::zone(zone)->enumerate_references(referent, callback, __builtin_frame_address(0), stack_bottom, ctx);
 }
 
 
 void **auto_weak_find_first_referrer(auto_zone_t *zone, void **location, unsigned long count) {
-    abort();
+    return Zone::zone(zone)->weak_table().find_first_referrer(location, count);
 }
 
 
 auto_zone_t *auto_zone(void) {
-    return 0;
+    return gc_zone;
+}
+
+
+void auto_trace_set_enabled(boolean_t enabled) {
+    set_tracing(enabled);
+}
+
+
+boolean_t auto_trace_write(int fd) {
+    return write_trace(fd);
+}
+
+
+boolean_t auto_zone_write_snapshot(auto_zone_t *zone, int fd) {
+    return write_snapshot(Zone::zone(zone), fd);
+}
+
+
+boolean_t auto_zone_start_recording(auto_zone_t *zone, int fd) {
+    return start_recording(Zone::zone(zone), fd);
+}
+
+
+void auto_zone_stop_recording(void) {
+    stop_recording();
+}
+
+
+//
+// Dumps
+//
+// auto_zone_dump() reports through the same heap walk as auto_zone_visit(), its blocks kept in the
+// context the walk passes back.
+//
+struct DumpContext {
+    auto_zone_stack_dump stack_dump;
+    auto_zone_register_dump register_dump;
+    auto_zone_node_dump thread_local_node_dump;
+    auto_zone_root_dump root_dump;
+    auto_zone_node_dump global_node_dump;
+    auto_zone_weak_dump weak_dump;
+};
+
+
+static void dump_thread(Thread *thread, auto_address_range_t stack, auto_address_range_t registers, void *context) {
+    DumpContext *dump = (DumpContext *)context;
+    if (dump->stack_dump) dump->stack_dump(stack.begin, (usword_t)stack.end - (usword_t)stack.begin);
+    if (dump->register_dump && registers.begin) dump->register_dump(registers.begin, (usword_t)registers.end - (usword_t)registers.begin);
+}
+
+
+static void dump_nodes(const auto_node_info_t *nodes, usword_t count, void *context) {
+    DumpContext *dump = (DumpContext *)context;
+    for (usword_t i = 0; i < count; i++) {
+        auto_zone_node_dump node_dump = nodes[i].is_thread_local ? dump->thread_local_node_dump : dump->global_node_dump;
+        if (node_dump) node_dump(nodes[i].address, nodes[i].size, nodes[i].type, nodes[i].refcount);
+    }
+}
+
+
+static void dump_root(const void **root, void *context) {
+    ((DumpContext *)context)->root_dump(root);
+}
+
+
+static void dump_weak(const void *referent, const void **location, auto_weak_callback_block_t *block, void *context) {
+    ((DumpContext *)context)->weak_dump(location, referent);
 }
 
 
 void auto_zone_dump(auto_zone_t *zone,
                     auto_zone_stack_dump stack_dump,
                     auto_zone_register_dump register_dump,
-                    auto_zone_node_dump thread_local_node_dump, // unsupported
+                    auto_zone_node_dump thread_local_node_dump,
                     auto_zone_root_dump root_dump,
                     auto_zone_node_dump global_node_dump,
                     auto_zone_weak_dump weak_dump) {
-    abort();
+    DumpContext context = { stack_dump, register_dump, thread_local_node_dump, root_dump, global_node_dump, weak_dump };
+    HeapVisitor visitor = {
+        &context,
+        (stack_dump || register_dump) ? dump_thread : NULL,
+        (thread_local_node_dump || global_node_dump) ? dump_nodes : NULL,
+        root_dump ? dump_root : NULL,
+        NULL,
+        weak_dump ? dump_weak : NULL,
+        NULL,
+    };
+    Zone::zone(zone)->visit_heap(visitor);
+}
+
+
+//
+// Visits
+//
+static void visit_thread(Thread *thread, auto_address_range_t stack, auto_address_range_t registers, void *context) {
+    ((auto_zone_visitor_t *)context)->visit_thread(thread->pthread(), stack, registers);
+}
+
+
+static void visit_nodes(const auto_node_info_t *nodes, usword_t count, void *context) {
+    auto_zone_visitor_t *visitor = (auto_zone_visitor_t *)context;
+    // visitors built against an older header end before visit_nodes.
+    if (visitor->version >= offsetof(auto_zone_visitor_t, visit_nodes) + sizeof(visitor->visit_nodes) && visitor->visit_nodes) {
+        visitor->visit_nodes(nodes, count);
+        return;
+    }
+    for (usword_t i = 0; i < count; i++) visitor->visit_node(nodes[i].address, nodes[i].size, nodes[i].type, nodes[i].refcount, nodes[i].is_thread_local);
+}
+
+
+static void visit_root(const void **root, void *context) {
+    ((auto_zone_visitor_t *)context)->visit_root(root);
+}
+
+
+static void visit_weak(const void *referent, const void **location, auto_weak_callback_block_t *block, void *context) {
+    ((auto_zone_visitor_t *)context)->visit_weak(referent, (void *const *)location, block);
+}
+
+
+static void visit_association(const void *object, const void *key, void *value, void *context) {
+    ((auto_zone_visitor_t *)context)->visit_association(object, key, value);
 }
 
 
 void auto_zone_visit(auto_zone_t *zone, auto_zone_visitor_t *visitor) {
-    abort();
+    bool batched = visitor->version >= offsetof(auto_zone_visitor_t, visit_nodes) + sizeof(visitor->visit_nodes) && visitor->visit_nodes;
+    HeapVisitor heap_visitor = {
+        visitor,
+        visitor->visit_thread ? visit_thread : NULL,
+        (batched || visitor->visit_node) ? visit_nodes : NULL,
+        visitor->visit_root ? visit_root : NULL,
+        NULL,
+        visitor->visit_weak ? visit_weak : NULL,
+        visitor->visit_association ? visit_association : NULL,
+    };
+    Zone::zone(zone)->visit_heap(heap_visitor);
 }
 
 
 auto_probe_results_t auto_zone_probe_unlocked(auto_zone_t *zone, void *address) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    if (!address || azone->block_start(address) != address) return auto_is_not_auto;
+    Subzone *subzone = azone->subzone_for(address);
+    return auto_is_auto | (subzone && subzone->is_local(subzone->block_index(address)) ? auto_is_local : 0);
+}
+
+
+struct ScanExactContext {
+    void *base;
+    void (^callback)(void *base, unsigned long byte_offset, void *candidate);
+};
+
+
+static void scan_exact_reference(usword_t offset, void *value, void *block, void *context) {
+    ScanExactContext *scan = (ScanExactContext *)context;
+    scan->callback(scan->base, offset, value);
 }
 
 
 void auto_zone_scan_exact(auto_zone_t *zone, void *address, void (^callback)(void *base, unsigned long byte_offset, void *candidate)) {
-    abort();
+    Zone *azone = Zone::zone(zone);
+    usword_t size = azone->block_size(address);
+    auto_memory_type_t layout = azone->block_layout(address);
+    if (!size || (layout & AUTO_UNSCANNED)) return;
+
+    // the same compiled layouts the collector scans with.
+    const CompiledLayout *compiled = is_exactly_scanned(layout) ? azone->layout_cache().layout_for(azone, address) : NULL;
+    ScanExactContext context = { address, callback };
+    HeapWalker::scan_references(azone, address, displace(address, size), compiled, scan_exact_reference, &context);
 }
 
 
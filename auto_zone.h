@@ -65,7 +65,7 @@ typedef struct {
 } auto_collection_durations_t;
 typedef struct {
     malloc_statistics_t malloc_statistics;
-    uint32_t            version;            // set to 1 before calling
+    uint32_t            version;            // set to 1, or to 2 for the fields from exhaustive_passes on, before calling
     size_t              num_collections[2];
     boolean_t           last_collection_was_generational;
     size_t              bytes_in_use_after_last_collection[2];
@@ -77,6 +77,9 @@ typedef struct {
     size_t              thread_collections_total;
     size_t              thread_blocks_recovered_total;
     size_t              thread_bytes_recovered_total;
+    // version 2
+    size_t              exhaustive_passes;  // collections the last exhaustive collection ran
+    auto_date_t         exhaustive_pass_durations[8];   // total_duration of each of them
 } auto_statistics_t;
 AUTO_EXPORT void auto_zone_statistics(auto_zone_t *zone, auto_statistics_t *stats);
 enum {
@@ -123,6 +126,11 @@ typedef struct {
     size_t          collection_threshold;
     size_t          full_vs_gen_frequency;
     const char*     (*name_for_object) (auto_zone_t *zone, void *object);
+    boolean_t       parallel_finalization;      // batch_invalidate may be called from several threads at once
+    auto_date_t     purge_decay;                // microseconds free pages stay committed before being returned to the system
+    size_t          heap_growth_percent;        // growth over the live data that makes AUTO_COLLECT_IF_NEEDED collect
+    size_t          collection_cpu_percent;     // share of time collections should take; the heap grows further to keep it
+    boolean_t       disable_concurrent_marking; // trace the heap with the world stopped, in one pause
 } auto_collection_control_t;
 AUTO_EXPORT auto_collection_control_t *auto_collection_parameters(auto_zone_t *zone);
 AUTO_EXPORT void auto_collector_disable(auto_zone_t *zone);
@@ -254,6 +262,11 @@ AUTO_EXPORT void auto_enumerate_references(auto_zone_t *zone, void *referent,
                                       void *stack_bottom, void *ctx);
 AUTO_EXPORT void **auto_weak_find_first_referrer(auto_zone_t *zone, void **location, unsigned long count);
 AUTO_EXPORT auto_zone_t *auto_zone(void);
+AUTO_EXPORT boolean_t auto_zone_write_snapshot(auto_zone_t *zone, int fd);   // compact binary heap snapshot; see tools/auto_snapshot.cpp
+AUTO_EXPORT void auto_trace_set_enabled(boolean_t enabled);   // record collector events in per-thread ring buffers; AUTO_TRACE_FILE enables at startup
+AUTO_EXPORT boolean_t auto_trace_write(int fd);                 // drain recorded events to fd as Chrome trace event JSON
+AUTO_EXPORT boolean_t auto_zone_start_recording(auto_zone_t *zone, int fd);   // record zone operations to fd for replay; see tools/auto_replay.cpp
+AUTO_EXPORT void auto_zone_stop_recording(void);               // write out what was recorded; AUTO_RECORD_FILE records from startup to exit
 #ifdef __BLOCKS__
 typedef void (^auto_zone_stack_dump)(const void *base, unsigned long byte_size);
 typedef void (^auto_zone_register_dump)(const void *base, unsigned long byte_size);
@@ -263,7 +276,7 @@ typedef void (^auto_zone_weak_dump)(const void **address, const void *item);
 AUTO_EXPORT void auto_zone_dump(auto_zone_t *zone,
             auto_zone_stack_dump stack_dump,
             auto_zone_register_dump register_dump,
-            auto_zone_node_dump thread_local_node_dump, // unsupported
+            auto_zone_node_dump thread_local_node_dump,
             auto_zone_root_dump root_dump,
             auto_zone_node_dump global_node_dump,
             auto_zone_weak_dump weak_dump);
@@ -271,6 +284,13 @@ typedef struct {
     void *begin;
     void *end;
 } auto_address_range_t;
+typedef struct {
+    const void *address;
+    size_t size;
+    auto_memory_type_t type;
+    uint32_t refcount;
+    boolean_t is_thread_local;
+} auto_node_info_t;
 typedef struct {
     uint32_t version;                    // sizeof(auto_zone_visitor_t)
     void (^visit_thread)(pthread_t thread, auto_address_range_t stack_range, auto_address_range_t registers);
@@ -278,6 +298,7 @@ typedef struct {
     void (^visit_root)(const void **address);
     void (^visit_weak)(const void *value, void *const*location, auto_weak_callback_block_t *callback);
     void (^visit_association)(const void *object, const void *key, const void *value);
+    void (^visit_nodes)(const auto_node_info_t *nodes, size_t count);   // if set, nodes come in batches instead of through visit_node
 } auto_zone_visitor_t;
 AUTO_EXPORT void auto_zone_visit(auto_zone_t *zone, auto_zone_visitor_t *visitor);
 enum {
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    test_exhaustive_survivors.cpp
+    An exhaustive collection keeps a released block that an unscanned survivor still refers to
+
+    Build and run with the other tests:
+
+        make -C tests check
+
+    A finalizer releases a block whose only other reference is in a surviving block no pass of the
+    exhaustive collection scanned: one the finalizer resurrects, or one it allocates.  Neither is
+    stored into through a barrier, so no card records the reference either.
+ */
+
+#include <auto_zone.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    tag_resurrect = 1,                                      // word 1 of a finalized block: what to do
+    tag_allocate = 2,
+    disguise = 0x5a5a5a5a,
+};
+
+static auto_zone_t *zone;
+static void *root;
+static void **keeper;                                       // the rooted block the finalizers store into
+static uintptr_t disguised_released[2];                     // no collection sees the released blocks here
+static const void *weak_released[2];
+
+static void *released(int i) { return (void *)(disguised_released[i] ^ disguise); }
+
+static void finalize(void *block, void *) {
+    void **words = (void **)block;
+    if (words[1] == (void *)tag_resurrect) {
+        auto_zone_set_write_barrier(zone, &keeper[0], block);
+        auto_zone_release(zone, released(0));
+    } else if (words[1] == (void *)tag_allocate) {
+        void **fresh = (void **)auto_zone_allocate_object(zone, 32, AUTO_MEMORY_SCANNED, false, true);
+        fresh[0] = released(1);
+        auto_zone_set_write_barrier(zone, &keeper[1], fresh);
+        auto_zone_release(zone, released(1));
+    }
+}
+
+static void invalidate(auto_zone_t *, auto_zone_foreach_object_t foreach, auto_zone_cursor_t cursor, size_t) {
+    foreach(cursor, finalize, NULL);
+}
+
+// each released block is retained, and the block to be resurrected refers to the first from birth.
+// It is of another size than the allocated block, whose subzone the next pass scans whole.
+__attribute__((noinline)) static void allocate() {
+    keeper = (void **)auto_zone_allocate_object(zone, 2 * sizeof(void *), AUTO_MEMORY_SCANNED, false, true);
+    auto_zone_add_root(zone, &root, keeper);
+    for (int i = 0; i < 2; i++) {
+        void *block = auto_zone_allocate_object(zone, 32, AUTO_MEMORY_SCANNED, true, true);
+        auto_assign_weak_reference(zone, block, &weak_released[i], NULL);
+        disguised_released[i] = (uintptr_t)block ^ disguise;
+    }
+    void **resurrecting = (void **)auto_zone_allocate_object(zone, 64, AUTO_OBJECT_SCANNED, true, true);
+    resurrecting[0] = released(0);
+    resurrecting[1] = (void *)tag_resurrect;
+    void **allocating = (void **)auto_zone_allocate_object(zone, 32, AUTO_OBJECT_SCANNED, true, true);
+    allocating[1] = (void *)tag_allocate;
+    auto_zone_release(zone, resurrecting);
+    auto_zone_release(zone, allocating);
+}
+
+__attribute__((noinline)) static void scrub() { char buffer[16384]; memset(buffer, 0, sizeof(buffer)); __asm__ volatile("" : : "r"(buffer) : "memory"); }
+
+int main() {
+    zone = auto_zone_create("test_exhaustive_survivors");
+    auto_zone_register_thread(zone);
+    auto_collection_parameters(zone)->batch_invalidate = invalidate;
+    allocate();
+    scrub();
+
+    auto_collect(zone, AUTO_COLLECT_EXHAUSTIVE_COLLECTION | AUTO_COLLECT_SYNCHRONOUS, NULL);
+    if (!keeper[0] || !keeper[1]) {
+        printf("FAIL: the finalizers did not run\n");
+        return 1;
+    }
+    static const char *holders[2] = { "resurrected", "allocated" };
+    for (int i = 0; i < 2; i++) {
+        if (auto_read_weak_reference(zone, (void **)&weak_released[i]) != released(i)) {
+            printf("FAIL: the block kept by the %s block was collected\n", holders[i]);
+            return 1;
+        }
+    }
+    printf("ok\n");
+    return 0;
+}
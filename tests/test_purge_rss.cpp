@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    test_purge_rss.cpp
+    Freed memory leaves the resident set once purge_decay has passed
+
+    Build and run with the other tests:
+
+        make -C tests check
+ */
+
+#include <auto_zone.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+    small_size = 1024,
+    small_count = 64 * 1024,                                // 64MB of small blocks
+    large_size = 1024 * 1024,
+    large_count = 32,                                       // 32MB of large blocks
+    decay = 100 * 1000,                                     // microseconds
+};
+
+// hosts without Mach read /proc/self/statm.
+static size_t resident_size() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+    return info.resident_size;
+#else
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    unsigned long size, resident;
+    int fields = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    return fields == 2 ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+// the blocks are retained, so none is thread local, and only this unscanned array knows them.
+static void **allocate_all(auto_zone_t *zone) {
+    void **blocks = (void **)calloc(small_count + large_count, sizeof(void *));
+    for (int i = 0; i < small_count; i++) {
+        blocks[i] = auto_zone_allocate_object(zone, small_size, AUTO_MEMORY_UNSCANNED, true, false);
+        memset(blocks[i], 0xa5, small_size);
+    }
+    for (int i = 0; i < large_count; i++) {
+        blocks[small_count + i] = auto_zone_allocate_object(zone, large_size, AUTO_MEMORY_UNSCANNED, true, false);
+        memset(blocks[small_count + i], 0xa5, large_size);
+    }
+    return blocks;
+}
+
+int main() {
+    auto_zone_t *zone = auto_zone_create("test_purge_rss");
+    auto_zone_register_thread(zone);
+    auto_collection_parameters(zone)->purge_decay = decay;
+
+    size_t baseline = resident_size();
+    void **blocks = allocate_all(zone);
+    size_t peak = resident_size();
+    size_t allocated = (size_t)small_count * small_size + (size_t)large_count * large_size;
+    if (peak < baseline + allocated / 2) {
+        printf("FAIL: resident size grew by %zu bytes for %zu allocated\n", peak - baseline, allocated);
+        return 1;
+    }
+
+    for (int i = 0; i < small_count + large_count; i++) auto_zone_release(zone, blocks[i]);
+    free(blocks);
+    auto_collect(zone, AUTO_COLLECT_FULL_COLLECTION | AUTO_COLLECT_SYNCHRONOUS, NULL);
+
+    // the collector thread purges once the decay passes; give it a few.
+    size_t current = peak;
+    for (int i = 0; i < 50 && current > baseline + allocated / 4; i++) {
+        usleep(decay);
+        current = resident_size();
+    }
+    printf("resident: baseline %zu, peak %zu, after purge %zu\n", baseline, peak, current);
+    if (current > baseline + allocated / 4) {
+        printf("FAIL: %zu of %zu freed bytes still resident\n", current - baseline, allocated);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    test_retain_overflow.cpp
+    Reference counts past the side byte's capacity move to the retain table and back
+
+    Build and run with the other tests:
+
+        make -C tests check
+ */
+
+#include <auto_zone.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    inline_maximum = 254,                                   // largest count a side byte holds
+    peak = 1000,
+    thread_count = 8,
+    thread_rounds = 200,
+    thread_depth = 300,                                     // retains per round; crosses the side byte's limit
+    disguise = 0x5a5a5a5a,
+};
+
+static auto_zone_t *zone;
+static uintptr_t disguised_block;                           // no collection sees the block here
+static const void *weak_block;
+
+static void *block() { return (void *)(disguised_block ^ disguise); }
+
+static int check_count(unsigned expected, const char *when) {
+    unsigned count = auto_zone_retain_count(zone, block());
+    if (count == expected) return 0;
+    printf("FAIL: retain count %u %s, expected %u\n", count, when, expected);
+    return 1;
+}
+
+__attribute__((noinline)) static void allocate() {
+    void *b = auto_zone_allocate_object(zone, 32, AUTO_MEMORY_SCANNED, true, true);
+    auto_assign_weak_reference(zone, b, &weak_block, NULL);
+    disguised_block = (uintptr_t)b ^ disguise;
+}
+
+__attribute__((noinline)) static void scrub() { char buffer[16384]; memset(buffer, 0, sizeof(buffer)); __asm__ volatile("" : : "r"(buffer) : "memory"); }
+
+static void *contend(void *) {
+    auto_zone_register_thread(zone);
+    for (int round = 0; round < thread_rounds; round++) {
+        for (int i = 0; i < thread_depth; i++) auto_zone_retain(zone, block());
+        for (int i = 0; i < thread_depth; i++) auto_zone_release(zone, block());
+    }
+    auto_zone_unregister_thread(zone);
+    return NULL;
+}
+
+int main() {
+    zone = auto_zone_create("test_retain_overflow");
+    auto_zone_register_thread(zone);
+    allocate();
+    scrub();
+
+    // one retain at a time up past the side byte, checking either side of the limit.
+    if (check_count(1, "after allocation")) return 1;
+    for (unsigned count = 2; count <= peak; count++) {
+        auto_zone_retain(zone, block());
+        if ((count >= inline_maximum - 1 && count <= inline_maximum + 2) || count == peak) {
+            if (check_count(count, "retaining")) return 1;
+        }
+    }
+
+    // a collection leaves the retained block alone, whichever table holds its count.
+    auto_collect(zone, AUTO_COLLECT_FULL_COLLECTION | AUTO_COLLECT_SYNCHRONOUS, NULL);
+    if (check_count(peak, "after a collection")) return 1;
+
+    // threads crossing the limit together lose no counts.
+    pthread_t threads[thread_count];
+    for (int i = 0; i < thread_count; i++) pthread_create(&threads[i], NULL, contend, NULL);
+    for (int i = 0; i < thread_count; i++) pthread_join(threads[i], NULL);
+    if (check_count(peak, "after contended retains and releases")) return 1;
+
+    for (unsigned count = peak - 1; count < peak; count--) {
+        auto_zone_release(zone, block());
+        if ((count >= inline_maximum - 1 && count <= inline_maximum + 2) || count == 0) {
+            if (check_count(count, "releasing")) return 1;
+        }
+    }
+    auto_zone_release(zone, block());
+    if (check_count(0, "after releasing a zero count")) return 1;
+
+    // back in the side byte at zero, the block is garbage.
+    scrub();
+    auto_collect(zone, AUTO_COLLECT_FULL_COLLECTION | AUTO_COLLECT_SYNCHRONOUS, NULL);
+    if (auto_read_weak_reference(zone, (void **)&weak_block)) {
+        printf("FAIL: block survived a collection after its count reached zero\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    test_scan_filters.cpp
+    The vector candidate filters keep exactly the words the scalar filter keeps
+
+    Build and run with the other tests:
+
+        make -C tests check
+
+    Compiles the scanning kernel in, since its filters are internal to the library.
+ */
+
+#include "AutoScan.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace Auto;
+
+enum {
+    rounds = 2000,
+    maximum_words = 3 * scan_batch_words + 7,               // the vector tails see every remainder
+};
+
+static const char *filter_names[candidate_filter_count] = { "words", "sse2", "avx2" };
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t random_next() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dull;
+}
+
+// mostly random words, with some on and around the range's edges, and some with only one half
+// of the word in range, which the 32 bit compares of SSE2 must not be fooled by.
+static uintptr_t random_word(uintptr_t min, uintptr_t span) {
+    uint64_t r = random_next();
+    switch (r & 7) {
+    case 0: return min + (uintptr_t)(r >> 8) % span;
+    case 1: return min - 1;
+    case 2: return min;
+    case 3: return min + span - 1;
+    case 4: return min + span;
+    case 5: return (min & ~(uintptr_t)0xffffffff) | (uintptr_t)(r >> 32);
+    case 6: return (min & 0xffffffff) | ((uintptr_t)r << 32);
+    default: return (uintptr_t)random_next();
+    }
+}
+
+int main() {
+    std::vector<void *> words(maximum_words);
+    std::vector<void **> expected(maximum_words), survivors(maximum_words);
+    candidate_filter_t scalar = candidate_filter(candidate_filter_words);
+    unsigned checked[candidate_filter_count] = { 0 };
+
+    for (int round = 0; round < rounds; round++) {
+        // heap sized ranges anywhere, including those straddling the sign bit and the top of memory.
+        uintptr_t min = (uintptr_t)random_next();
+        uintptr_t span = ((uintptr_t)1 << (20 + random_next() % 24)) + (uintptr_t)(random_next() & 0xffff);
+        if (round % 4 == 0) min = (uintptr_t)INT64_MAX - span / 2;
+        if (round % 4 == 1) min = (uintptr_t)0 - span / 2;
+        uintptr_t count = round < maximum_words ? round : (uintptr_t)(random_next() % maximum_words);
+        for (uintptr_t i = 0; i < count; i++) words[i] = (void *)random_word(min, span);
+        uintptr_t expected_count = scalar(&words[0], count, min, span, &expected[0]);
+
+        for (uintptr_t kind = candidate_filter_words + 1; kind < candidate_filter_count; kind++) {
+            candidate_filter_t filter = candidate_filter(kind);
+            if (!filter) continue;
+            uintptr_t found = filter(&words[0], count, min, span, &survivors[0]);
+            if (found != expected_count || memcmp(&survivors[0], &expected[0], found * sizeof(void **))) {
+                printf("FAIL: %s kept %lu of %lu words, the scalar filter %lu (min %#lx span %#lx)\n",
+                       filter_names[kind], (unsigned long)found, (unsigned long)count, (unsigned long)expected_count,
+                       (unsigned long)min, (unsigned long)span);
+                return 1;
+            }
+            checked[kind]++;
+        }
+    }
+
+    for (uintptr_t kind = candidate_filter_words + 1; kind < candidate_filter_count; kind++) {
+        if (checked[kind]) printf("%s: %u rounds\n", filter_names[kind], checked[kind]);
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,528 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    auto_replay.cpp
+    Replays recordings of zone operations written through AUTO_RECORD_FILE or
+    auto_zone_start_recording(), for benchmarking the collector on real workloads
+
+    Builds against the library, on any host it builds on, or against malloc on any host with a C++11
+    compiler, to check a recording or compare with:
+
+        make -C tools auto_replay auto_replay_malloc
+
+    usage: auto_replay [-n] [-q] recording
+
+    Replays the recorded operations in the order they happened, on one thread, then reports their
+    throughput, the collector's pauses, the peak resident set size and the zone's statistics.  The
+    recorded program's liveness stands in for its stack: every block the recording allocated is kept
+    retained until the recording has it die or freed, and then released to the collector.  So
+    thread-local collection is not reproduced; every block is global.  Pauses come from the
+    collector's event trace, which costs the replay a little; -n turns it off.  -q leaves out the
+    statistics.  Replayed on malloc, blocks are freed as they die, and there are no pauses.
+ */
+
+#include "../AutoRecorder.h"
+#include "replay_allocator.h"
+
+#include <algorithm>
+#include <deque>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace Auto;
+
+enum {
+    pause_drain_interval = 1 << 13,                         // operations between trace drains; each traces at most one
+                                                            // retain or release, well within a thread's trace buffer
+};
+
+//
+// Operation
+//
+// A decoded record.  Addresses are as recorded; a value is a block and an offset in it.  A copy's
+// pointers are copy_count entries of Recording::copies from first_copy.
+//
+struct Operation {
+    uint64_t    sequence;
+    uint8_t     tag;
+    uint64_t    address;
+    uint64_t    offset;                                     // into address, or a size, mode or new address
+    uint64_t    size;
+    uint64_t    value;
+    uint64_t    value_offset;
+    int32_t     type;
+    uint32_t    flags;
+    size_t      first_copy;
+    size_t      copy_count;
+};
+
+struct CopiedPointer {
+    uint64_t    offset;                                     // from the first word copied
+    uint64_t    value;
+    uint64_t    value_offset;
+};
+
+struct Recording {
+    std::vector<Operation>      operations;
+    std::vector<CopiedPointer>  copies;
+    size_t                      threads;
+    size_t                      chunks;
+};
+
+struct Chunk {
+    uint64_t        thread;
+    uint64_t        index;
+    const uint8_t   *bytes;
+    uint64_t        length;
+
+    bool operator<(const Chunk &other) const { return thread != other.thread ? thread < other.thread : index < other.index; }
+};
+
+
+static bool by_sequence(const Operation &a, const Operation &b) { return a.sequence < b.sequence; }
+
+
+//
+// ChunkReader
+//
+// Decodes the records of a chunk, exiting on a malformed one.
+//
+class ChunkReader {
+    const uint8_t   *_p;
+    const uint8_t   *_limit;
+    uint64_t        _sequence;
+    uint64_t        _address;
+
+  public:
+    ChunkReader(const uint8_t *p, const uint8_t *limit) : _p(p), _limit(limit), _sequence(0), _address(0) {}
+
+    bool done() const { return _p == _limit; }
+
+    uint64_t get() {
+        uint64_t value;
+        _p = get_varint(_p, _limit, value);
+        if (!_p) {
+            fprintf(stderr, "auto_replay: record is cut short\n");
+            exit(1);
+        }
+        return value;
+    }
+
+    uint64_t get_address() { return _address += unzigzag(get()); }
+
+    int get_tag() { return *_p++; }
+
+    uint64_t get_sequence() { return _sequence += get(); }
+
+    void get_value(uint64_t &block, uint64_t &offset) {
+        block = get_address();
+        offset = get();
+    }
+};
+
+
+static void read_chunk(const Chunk &chunk, Recording &recording) {
+    ChunkReader reader(chunk.bytes, chunk.bytes + chunk.length);
+    while (!reader.done()) {
+        Operation op;
+        memset(&op, 0, sizeof(op));
+        op.tag = reader.get_tag();
+        op.sequence = reader.get_sequence();
+        switch (op.tag) {
+        case recording_allocate:
+            op.address = reader.get_address();
+            op.size = reader.get();
+            op.type = (int32_t)unzigzag(reader.get());
+            op.flags = (uint32_t)reader.get();
+            break;
+        case recording_free:
+        case recording_retain:
+        case recording_release:
+        case recording_death:
+        case recording_root_remove:
+            op.address = reader.get_address();
+            break;
+        case recording_store:
+        case recording_weak:
+            op.address = reader.get_address();
+            op.offset = reader.get();
+            reader.get_value(op.value, op.value_offset);
+            break;
+        case recording_copy:
+            op.address = reader.get_address();
+            op.offset = reader.get();
+            op.size = reader.get();
+            op.copy_count = reader.get();
+            op.first_copy = recording.copies.size();
+            for (size_t i = 0; i < op.copy_count; i++) {
+                CopiedPointer copied;
+                copied.offset = reader.get();
+                reader.get_value(copied.value, copied.value_offset);
+                recording.copies.push_back(copied);
+            }
+            break;
+        case recording_root_add:
+        case recording_root_store:
+            op.address = reader.get_address();
+            reader.get_value(op.value, op.value_offset);
+            break;
+        case recording_collect:
+        case recording_zone_collect:
+            op.offset = reader.get();
+            break;
+        case recording_move:
+            op.address = reader.get_address();
+            op.offset = reader.get_address();
+            break;
+        default:
+            fprintf(stderr, "auto_replay: unknown record tag %d\n", op.tag);
+            exit(1);
+        }
+        recording.operations.push_back(op);
+    }
+}
+
+
+static void read_recording(const uint8_t *bytes, size_t size, Recording &recording) {
+    const uint8_t *limit = bytes + size;
+    if (size < sizeof(recording_magic) || memcmp(bytes, recording_magic, sizeof(recording_magic))) {
+        fprintf(stderr, "auto_replay: not a recording\n");
+        exit(1);
+    }
+    uint64_t version, pointer_size;
+    const uint8_t *p = get_varint(bytes + sizeof(recording_magic), limit, version);
+    if (p) p = get_varint(p, limit, pointer_size);
+    if (!p || version != recording_version || pointer_size != sizeof(void *)) {
+        fprintf(stderr, "auto_replay: recording is of an unsupported version or pointer size\n");
+        exit(1);
+    }
+
+    std::vector<Chunk> chunks;
+    while (p < limit) {
+        Chunk chunk;
+        if ((p = get_varint(p, limit, chunk.thread)) && (p = get_varint(p, limit, chunk.index)))
+            p = get_varint(p, limit, chunk.length);
+        if (!p || chunk.length > (uint64_t)(limit - p)) {
+            fprintf(stderr, "auto_replay: recording is cut short\n");
+            exit(1);
+        }
+        chunk.bytes = p;
+        p += chunk.length;
+        chunks.push_back(chunk);
+    }
+
+    // a chunk written twice was cut short the first time.
+    std::stable_sort(chunks.begin(), chunks.end());
+    recording.threads = recording.chunks = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (i + 1 < chunks.size() && !(chunks[i] < chunks[i + 1]) && !(chunks[i + 1] < chunks[i])) {
+            if (chunks[i].length > chunks[i + 1].length) chunks[i + 1] = chunks[i];
+            continue;
+        }
+        recording.chunks++;
+        if (!i || chunks[i - 1].thread != chunks[i].thread) recording.threads++;
+        read_chunk(chunks[i], recording);
+    }
+    std::stable_sort(recording.operations.begin(), recording.operations.end(), by_sequence);
+}
+
+
+//
+// PauseCollector
+//
+// Collects the lengths of the collector's pauses from its event trace, drained to a temporary file
+// now and then.  A pause may begin in one drain and end in the next.
+//
+class PauseCollector {
+    FILE                                    *_file;
+    std::unordered_map<unsigned, double>    _begun;         // begin times by thread
+    std::vector<double>                     _pauses;        // microseconds
+
+  public:
+    PauseCollector() : _file(tmpfile()) {
+        if (!_file) perror("auto_replay: tmpfile");
+    }
+
+    ~PauseCollector() { if (_file) fclose(_file); }
+
+    bool enabled() const { return _file != NULL; }
+
+    void drain() {
+        if (!_file) return;
+        rewind(_file);
+        if (ftruncate(fileno(_file), 0) || !Replay::write_trace(fileno(_file))) return;
+        rewind(_file);
+        char line[1024];
+        while (fgets(line, sizeof(line), _file)) {
+            if (!strstr(line, "\"name\":\"pause\"")) continue;
+            const char *phase = strstr(line, "\"ph\":\""), *ts = strstr(line, "\"ts\":"), *tid = strstr(line, "\"tid\":");
+            if (!phase || !ts || !tid) continue;
+            double time = strtod(ts + 5, NULL);
+            unsigned thread = (unsigned)strtoul(tid + 6, NULL, 10);
+            if (phase[6] == 'B') {
+                _begun[thread] = time;
+            } else if (phase[6] == 'E' && _begun.count(thread)) {
+                _pauses.push_back(time - _begun[thread]);
+                _begun.erase(thread);
+            }
+        }
+    }
+
+    std::vector<double> &pauses() { return _pauses; }
+};
+
+
+//
+// Replayer
+//
+// Performs a recording's operations on the allocator.  Operations on blocks the replay does not
+// know, ones that were allocated before the recording began, are skipped.
+//
+class Replayer {
+    const Recording                         &_recording;
+    std::unordered_map<uint64_t, void *>    _blocks;        // recorded address to replayed block
+    std::unordered_map<uint64_t, void **>   _slots;         // recorded address outside the heap to a slot standing for it
+    std::deque<void *>                      _slot_storage;
+    std::vector<uint8_t>                    _copy_buffer;
+    size_t                                  _skipped;
+
+    void *block(uint64_t address) {
+        std::unordered_map<uint64_t, void *>::iterator i = _blocks.find(address);
+        return i == _blocks.end() ? NULL : i->second;
+    }
+
+    void **slot(uint64_t address) {
+        void **&slot = _slots[address];
+        if (!slot) {
+            _slot_storage.push_back(NULL);
+            slot = &_slot_storage.back();
+        }
+        return slot;
+    }
+
+    // a value for block and offset, false if the block is unknown.
+    bool value(uint64_t address, uint64_t offset, void *&result) {
+        if (!address) {
+            result = NULL;
+            return true;
+        }
+        void *replayed = block(address);
+        result = replayed ? (uint8_t *)replayed + offset : NULL;
+        return replayed != NULL;
+    }
+
+  public:
+    Replayer(const Recording &recording) : _recording(recording), _skipped(0) {}
+
+    size_t skipped() const { return _skipped; }
+
+    size_t live_blocks() const { return _blocks.size(); }
+
+    void replay(const Operation &op) {
+        void *target = NULL, *pointer = NULL;
+        switch (op.tag) {
+        case recording_allocate:
+            target = Replay::allocate(op.size, op.type, true, (op.flags & recording_cleared) != 0);
+            if (!target) {
+                fprintf(stderr, "auto_replay: allocation of %" PRIu64 " bytes failed\n", op.size);
+                exit(1);
+            }
+            // the extra retain the recording's liveness holds.
+            if (op.flags & recording_retained) Replay::retain(target);
+            _blocks[op.address] = target;
+            return;
+        case recording_free:
+            if (!(target = block(op.address))) break;
+            _blocks.erase(op.address);
+            Replay::free_block(target);
+            return;
+        case recording_retain:
+            if (!(target = block(op.address))) break;
+            Replay::retain(target);
+            return;
+        case recording_release:
+            if (!(target = block(op.address))) break;
+            Replay::release(target);
+            return;
+        case recording_death:
+            if (!(target = block(op.address))) break;
+            _blocks.erase(op.address);
+            Replay::drop(target);
+            return;
+        case recording_store:
+            if (!(target = block(op.address)) || !value(op.value, op.value_offset, pointer)) break;
+            Replay::store((void **)((uint8_t *)target + op.offset), pointer);
+            return;
+        case recording_copy: {
+            if (!(target = block(op.address))) break;
+            _copy_buffer.assign(op.size, 0);
+            for (size_t i = 0; i < op.copy_count; i++) {
+                const CopiedPointer &copied = _recording.copies[op.first_copy + i];
+                if (value(copied.value, copied.value_offset, pointer) && copied.offset + sizeof(void *) <= op.size)
+                    memcpy(&_copy_buffer[copied.offset], &pointer, sizeof(void *));
+            }
+            if (op.size) Replay::copy((uint8_t *)target + op.offset, _copy_buffer.data(), op.size);
+            return;
+        }
+        case recording_weak: {
+            if (!value(op.value, op.value_offset, pointer)) break;
+            void **location;
+            if (op.address) {
+                if (!(target = block(op.address))) break;
+                location = (void **)((uint8_t *)target + op.offset);
+            } else {
+                location = slot(op.offset);
+            }
+            Replay::assign_weak(location, pointer);
+            return;
+        }
+        case recording_root_add:
+            if (!value(op.value, op.value_offset, pointer)) break;
+            Replay::add_root(slot(op.address), pointer);
+            return;
+        case recording_root_remove:
+            Replay::remove_root(slot(op.address));
+            return;
+        case recording_root_store:
+            if (!value(op.value, op.value_offset, pointer)) break;
+            Replay::store_root(slot(op.address), pointer);
+            return;
+        case recording_collect:
+            Replay::collect(op.offset);
+            return;
+        case recording_zone_collect:
+            Replay::zone_collect(op.offset);
+            return;
+        case recording_move:
+            if (!(target = block(op.address))) break;
+            _blocks.erase(op.address);
+            _blocks[op.offset] = target;
+            return;
+        }
+        _skipped++;
+    }
+};
+
+
+static double seconds_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+// ru_maxrss is in bytes on Darwin and in kilobytes elsewhere.
+static long peak_rss_kilobytes(const struct rusage &usage) {
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+
+static double percentile(const std::vector<double> &sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+
+int main(int argc, char **argv) {
+    bool trace_pauses = true, quiet = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "-n")) trace_pauses = false;
+        else if (!strcmp(argv[arg], "-q")) quiet = true;
+        else break;
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "usage: auto_replay [-n] [-q] recording\n");
+        return 2;
+    }
+
+    FILE *file = fopen(argv[arg], "rb");
+    if (!file) {
+        perror(argv[arg]);
+        return 1;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[1 << 16];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0; ) bytes.insert(bytes.end(), buffer, buffer + n);
+    fclose(file);
+
+    Recording recording;
+    read_recording(bytes.data(), bytes.size(), recording);
+    std::vector<uint8_t>().swap(bytes);
+    printf("recording %s: %zu operations from %zu threads in %zu chunks\n", argv[arg], recording.operations.size(), recording.threads, recording.chunks);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long loaded_rss = peak_rss_kilobytes(usage);
+
+    PauseCollector pauses;
+    trace_pauses = trace_pauses && pauses.enabled();
+    if (!Replay::create_allocator(trace_pauses)) {
+        fprintf(stderr, "auto_replay: could not set up %s\n", Replay::allocator_name());
+        return 1;
+    }
+
+    Replayer replayer(recording);
+    double elapsed = 0, start = seconds_now();
+    for (size_t i = 0; i < recording.operations.size(); i++) {
+        replayer.replay(recording.operations[i]);
+        if (trace_pauses && (i + 1) % pause_drain_interval == 0) {
+            // draining is not the replay's time.
+            double now = seconds_now();
+            elapsed += now - start;
+            pauses.drain();
+            start = seconds_now();
+        }
+    }
+    elapsed += seconds_now() - start;
+    if (trace_pauses) pauses.drain();
+
+    size_t count = recording.operations.size();
+    printf("  replayed         %zu operations on %s in %.3f s, %.0f operations/s\n", count, Replay::allocator_name(), elapsed, elapsed > 0 ? count / elapsed : 0);
+    printf("  skipped          %zu operations on blocks allocated before recording\n", replayer.skipped());
+    printf("  live blocks      %zu at the end\n", replayer.live_blocks());
+
+    if (trace_pauses) {
+        std::vector<double> &sorted = pauses.pauses();
+        std::sort(sorted.begin(), sorted.end());
+        printf("  pauses           %zu, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n", sorted.size(),
+               percentile(sorted, 0.50), percentile(sorted, 0.90), percentile(sorted, 0.99), sorted.empty() ? 0 : sorted.back());
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  peak RSS         %ld KB, %ld KB of it the recording loaded\n", peak_rss_kilobytes(usage), loaded_rss);
+
+    if (quiet) return 0;
+    printf("\n%s statistics\n", Replay::allocator_name());
+    Replay::print_statistics();
+    return 0;
+}
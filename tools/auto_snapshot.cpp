@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    auto_snapshot.cpp
+    Offline reader for heap snapshots written by auto_zone_write_snapshot()
+
+    Builds on its own, on any host with a C++11 compiler:
+
+        c++ -O2 -o auto_snapshot tools/auto_snapshot.cpp
+
+    usage: auto_snapshot [-v] [-t count] snapshot
+
+    Prints what the snapshot holds, the node types taking the most memory and how much of the heap
+    nothing reaches any more.  -v also prints every record.  -t sets how many types to list.
+ */
+
+#include "../AutoSnapshot.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace Auto;
+
+struct Node {
+    uint64_t    address;
+    uint64_t    size;
+    uint32_t    type;
+    uint64_t    refcount;
+    uint64_t    flags;
+    size_t      first_reference;                            // into Snapshot::references
+    size_t      reference_count;
+};
+
+struct Association {
+    uint64_t    object;
+    uint64_t    key;
+    uint64_t    value;
+};
+
+struct Snapshot {
+    std::vector<Node>           nodes;
+    std::vector<uint64_t>       references;                 // blocks the nodes refer to
+    std::vector<uint64_t>       root_blocks;                // blocks stacks, registers and data segments refer to
+    std::vector<uint64_t>       root_values;                // values of explicit roots
+    std::vector<Association>    associations;
+    size_t                      threads;
+    size_t                      datasegments;
+    size_t                      datasegment_bytes;
+    size_t                      weak_references;
+
+    Snapshot() : threads(0), datasegments(0), datasegment_bytes(0), weak_references(0) {}
+};
+
+
+//
+// Reader
+//
+// Decodes records from a snapshot held in memory, exiting on a malformed one.
+//
+class Reader {
+    const uint8_t   *_p;
+    const uint8_t   *_limit;
+
+  public:
+    Reader(const uint8_t *p, const uint8_t *limit) : _p(p), _limit(limit) {}
+
+    uint64_t get() {
+        uint64_t value;
+        _p = get_varint(_p, _limit, value);
+        if (!_p) {
+            fprintf(stderr, "auto_snapshot: snapshot is cut short\n");
+            exit(1);
+        }
+        return value;
+    }
+
+    int get_tag() {
+        if (_p == _limit) {
+            fprintf(stderr, "auto_snapshot: snapshot has no end record\n");
+            exit(1);
+        }
+        return *_p++;
+    }
+};
+
+
+static void read_root_references(Reader &reader, Snapshot &snapshot, bool verbose) {
+    uint64_t count = reader.get(), block = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        block += unzigzag(reader.get());
+        snapshot.root_blocks.push_back(block);
+        if (verbose) printf("    -> 0x%" PRIx64 "\n", block);
+    }
+}
+
+
+static void read_snapshot(const uint8_t *bytes, size_t size, Snapshot &snapshot, bool verbose) {
+    if (size < sizeof(snapshot_magic) || memcmp(bytes, snapshot_magic, sizeof(snapshot_magic))) {
+        fprintf(stderr, "auto_snapshot: not a heap snapshot\n");
+        exit(1);
+    }
+    Reader reader(bytes + sizeof(snapshot_magic), bytes + size);
+    uint64_t previous_node = 0;
+    for (;;) {
+        int tag = reader.get_tag();
+        switch (tag) {
+            case snapshot_end:
+                return;
+            case snapshot_header: {
+                uint64_t version = reader.get(), pointer_size = reader.get();
+                if (version != snapshot_version) {
+                    fprintf(stderr, "auto_snapshot: snapshot version %" PRIu64 ", expected %d\n", version, snapshot_version);
+                    exit(1);
+                }
+                if (verbose) printf("header version %" PRIu64 " pointer size %" PRIu64 "\n", version, pointer_size);
+                break;
+            }
+            case snapshot_thread: {
+                uint64_t begin = reader.get(), end = reader.get();
+                if (verbose) printf("thread stack 0x%" PRIx64 "-0x%" PRIx64 "\n", begin, end);
+                read_root_references(reader, snapshot, verbose);
+                snapshot.threads++;
+                break;
+            }
+            case snapshot_node: {
+                Node node;
+                node.address = previous_node += unzigzag(reader.get());
+                node.size = reader.get();
+                node.type = (uint32_t)reader.get();
+                node.refcount = reader.get();
+                node.flags = reader.get();
+                node.reference_count = reader.get();
+                node.first_reference = snapshot.references.size();
+                if (verbose) printf("node 0x%" PRIx64 " size %" PRIu64 " type 0x%x refcount %" PRIu64 "%s\n", node.address, node.size, node.type, node.refcount, (node.flags & snapshot_node_thread_local) ? " local" : "");
+                for (size_t i = 0; i < node.reference_count; i++) {
+                    uint64_t word = reader.get();
+                    uint64_t block = node.address + unzigzag(reader.get());
+                    snapshot.references.push_back(block);
+                    if (verbose) printf("    [%" PRIu64 "] -> 0x%" PRIx64 "\n", word, block);
+                }
+                snapshot.nodes.push_back(node);
+                break;
+            }
+            case snapshot_datasegment: {
+                uint64_t begin = reader.get(), end = reader.get();
+                if (verbose) printf("data segment 0x%" PRIx64 "-0x%" PRIx64 "\n", begin, end);
+                read_root_references(reader, snapshot, verbose);
+                snapshot.datasegments++;
+                snapshot.datasegment_bytes += end - begin;
+                break;
+            }
+            case snapshot_root: {
+                uint64_t address = reader.get(), value = reader.get();
+                if (verbose) printf("root 0x%" PRIx64 " = 0x%" PRIx64 "\n", address, value);
+                snapshot.root_values.push_back(value);
+                break;
+            }
+            case snapshot_weak: {
+                uint64_t location = reader.get(), referent = reader.get();
+                if (verbose) printf("weak 0x%" PRIx64 " -> 0x%" PRIx64 "\n", location, referent);
+                snapshot.weak_references++;
+                break;
+            }
+            case snapshot_association: {
+                Association association;
+                association.object = reader.get();
+                association.key = reader.get();
+                association.value = reader.get();
+                if (verbose) printf("association 0x%" PRIx64 " [0x%" PRIx64 "] = 0x%" PRIx64 "\n", association.object, association.key, association.value);
+                snapshot.associations.push_back(association);
+                break;
+            }
+            default:
+                fprintf(stderr, "auto_snapshot: unknown record %d\n", tag);
+                exit(1);
+        }
+    }
+}
+
+
+//
+// NodeIndex
+//
+// Nodes by address.  Snapshots list subzone blocks before large ones, so addresses are not sorted.
+//
+class NodeIndex {
+    std::vector<std::pair<uint64_t, size_t> > _order;
+
+  public:
+    NodeIndex(const std::vector<Node> &nodes) {
+        _order.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++) _order.push_back(std::make_pair(nodes[i].address, i));
+        std::sort(_order.begin(), _order.end());
+    }
+
+    //
+    // find
+    //
+    // The node starting at address, or -1.
+    //
+    ssize_t find(uint64_t address) const {
+        std::vector<std::pair<uint64_t, size_t> >::const_iterator i = std::lower_bound(_order.begin(), _order.end(), std::make_pair(address, (size_t)0));
+        return (i != _order.end() && i->first == address) ? (ssize_t)i->second : -1;
+    }
+};
+
+
+static void shade(uint64_t address, const NodeIndex &index, std::vector<bool> &marked, std::vector<size_t> &pending) {
+    ssize_t node = index.find(address);
+    if (node >= 0 && !marked[node]) {
+        marked[node] = true;
+        pending.push_back(node);
+    }
+}
+
+
+//
+// mark_reachable
+//
+// Mark what the roots reach, as a collection would: stacks, registers, data segments, explicit roots,
+// retained nodes, and the values associated with reached objects.
+//
+static void mark_reachable(const Snapshot &snapshot, const NodeIndex &index, std::vector<bool> &marked) {
+    std::vector<size_t> pending;
+    marked.assign(snapshot.nodes.size(), false);
+    for (size_t i = 0; i < snapshot.root_blocks.size(); i++) shade(snapshot.root_blocks[i], index, marked, pending);
+    for (size_t i = 0; i < snapshot.root_values.size(); i++) shade(snapshot.root_values[i], index, marked, pending);
+    for (size_t i = 0; i < snapshot.nodes.size(); i++) {
+        if (snapshot.nodes[i].refcount) shade(snapshot.nodes[i].address, index, marked, pending);
+    }
+    while (!pending.empty()) {
+        while (!pending.empty()) {
+            const Node &node = snapshot.nodes[pending.back()];
+            pending.pop_back();
+            for (size_t i = 0; i < node.reference_count; i++) shade(snapshot.references[node.first_reference + i], index, marked, pending);
+        }
+        // associated values live as long as their objects.
+        for (size_t i = 0; i < snapshot.associations.size(); i++) {
+            ssize_t object = index.find(snapshot.associations[i].object);
+            if (object >= 0 && marked[object]) shade(snapshot.associations[i].value, index, marked, pending);
+        }
+    }
+}
+
+
+struct TypeUsage {
+    uint32_t    type;
+    size_t      count;
+    uint64_t    bytes;
+
+    bool operator<(const TypeUsage &other) const { return bytes > other.bytes; }
+};
+
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    size_t type_limit = 10;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "-v")) verbose = true;
+        else if (!strcmp(argv[arg], "-t") && arg + 1 < argc) type_limit = strtoul(argv[++arg], NULL, 0);
+        else break;
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "usage: auto_snapshot [-v] [-t count] snapshot\n");
+        return 2;
+    }
+
+    FILE *file = fopen(argv[arg], "rb");
+    if (!file) {
+        perror(argv[arg]);
+        return 1;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[1 << 16];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0; ) bytes.insert(bytes.end(), buffer, buffer + n);
+    fclose(file);
+
+    Snapshot snapshot;
+    read_snapshot(bytes.data(), bytes.size(), snapshot, verbose);
+
+    uint64_t node_bytes = 0;
+    size_t local = 0, retained = 0;
+    std::vector<TypeUsage> types;
+    for (size_t i = 0; i < snapshot.nodes.size(); i++) {
+        const Node &node = snapshot.nodes[i];
+        node_bytes += node.size;
+        local += (node.flags & snapshot_node_thread_local) != 0;
+        retained += node.refcount != 0;
+        size_t t = 0;
+        while (t < types.size() && types[t].type != node.type) t++;
+        if (t == types.size()) {
+            TypeUsage usage = { node.type, 0, 0 };
+            types.push_back(usage);
+        }
+        types[t].count++;
+        types[t].bytes += node.size;
+    }
+
+    printf("snapshot %s: %zu bytes\n", argv[arg], bytes.size());
+    printf("  threads          %zu\n", snapshot.threads);
+    printf("  data segments    %zu (%zu bytes)\n", snapshot.datasegments, snapshot.datasegment_bytes);
+    printf("  explicit roots   %zu\n", snapshot.root_values.size());
+    printf("  nodes            %zu (%" PRIu64 " bytes), %zu thread local, %zu retained\n", snapshot.nodes.size(), node_bytes, local, retained);
+    printf("  references       %zu\n", snapshot.references.size());
+    printf("  weak references  %zu\n", snapshot.weak_references);
+    printf("  associations     %zu\n", snapshot.associations.size());
+
+    std::sort(types.begin(), types.end());
+    printf("\n%10s %12s %16s\n", "type", "nodes", "bytes");
+    for (size_t t = 0; t < types.size() && t < type_limit; t++) printf("%#10x %12zu %16" PRIu64 "\n", types[t].type, types[t].count, types[t].bytes);
+
+    NodeIndex index(snapshot.nodes);
+    std::vector<bool> marked;
+    mark_reachable(snapshot, index, marked);
+    size_t unreachable = 0;
+    uint64_t unreachable_bytes = 0;
+    for (size_t i = 0; i < snapshot.nodes.size(); i++) {
+        if (marked[i] || (snapshot.nodes[i].flags & snapshot_node_thread_local)) continue;
+        unreachable++;
+        unreachable_bytes += snapshot.nodes[i].size;
+    }
+    printf("\nunreachable global nodes: %zu (%" PRIu64 " bytes)\n", unreachable, unreachable_bytes);
+    return 0;
+}
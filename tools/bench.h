@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench.h
+    Clocks, resident size, percentiles and random numbers shared by the benchmarks in tools
+ */
+
+#ifndef __AUTO_BENCH__
+#define __AUTO_BENCH__
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Bench {
+
+    //
+    // seconds_now
+    //
+    // A monotonic clock, in seconds.
+    //
+    inline double seconds_now() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    }
+
+    //
+    // resident_size
+    //
+    // The task's resident set, in bytes, or 0 if it cannot be read.  Hosts without Mach read
+    // /proc/self/statm.
+    //
+    inline size_t resident_size() {
+#ifdef __APPLE__
+        mach_task_basic_info_data_t info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+        return info.resident_size;
+#else
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (!statm) return 0;
+        unsigned long size, resident;
+        int fields = fscanf(statm, "%lu %lu", &size, &resident);
+        fclose(statm);
+        return fields == 2 ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+    }
+
+    //
+    // percentile
+    //
+    // The value a fraction of the way through sorted, nearest rank.
+    //
+    inline double percentile(const std::vector<double> &sorted, double fraction) {
+        if (sorted.empty()) return 0;
+        return sorted[(size_t)(fraction * (sorted.size() - 1) + 0.5)];
+    }
+
+    //
+    // Random
+    //
+    // xorshift64*, so runs are repeatable and cost next to nothing beside what they measure.
+    //
+    class Random {
+        uint64_t    _state;
+
+      public:
+        Random(uint64_t seed = 1) : _state(seed ? seed : 1) {}
+
+        uint64_t next() {
+            _state ^= _state >> 12;
+            _state ^= _state << 25;
+            _state ^= _state >> 27;
+            return _state * 0x2545f4914f6cdd1dULL;
+        }
+    };
+
+};
+
+#endif // __AUTO_BENCH__
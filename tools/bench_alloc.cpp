@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_alloc.cpp
+    Allocation throughput and metadata overhead by block size
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_alloc
+
+    usage: bench_alloc [bytes]
+
+    For each block size from 16 bytes to 4KB, allocates bytes worth of blocks (32MB by default) into
+    a fresh zone and reports:
+
+        allocs/s        retained blocks, which stay global and are never collected
+        churn/s         blocks dropped at once, which thread-local collections recover
+        rounded         the block's size class
+        metadata        resident bytes beyond the blocks' rounded sizes, per block: the side data,
+                        bitmaps, cards and subzone headers, plus whatever the zone allocated besides
+ */
+
+#include "bench.h"
+#include "../auto_zone.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace Bench;
+
+enum {
+    minimum_size = 16,
+    maximum_size = 4096,
+    default_bytes = 32 * 1024 * 1024,
+};
+
+// no block stays reachable from the stack.
+__attribute__((noinline)) static double churn(auto_zone_t *zone, size_t size, size_t count) {
+    double start = seconds_now();
+    for (size_t i = 0; i < count; i++) auto_zone_allocate_object(zone, size, AUTO_MEMORY_UNSCANNED, false, false);
+    return seconds_now() - start;
+}
+
+int main(int argc, char **argv) {
+    size_t bytes = argc > 1 ? strtoull(argv[1], NULL, 0) : default_bytes;
+    if (argc > 2 || !bytes) {
+        fprintf(stderr, "usage: bench_alloc [bytes]\n");
+        return 2;
+    }
+
+    printf("%8s %8s %14s %14s %10s\n", "size", "rounded", "allocs/s", "churn/s", "metadata");
+    for (size_t size = minimum_size; size <= maximum_size; size *= 2) {
+        size_t count = bytes / size;
+        std::vector<void *> blocks(count, NULL);
+        auto_zone_t *zone = auto_zone_create("bench_alloc");
+        auto_zone_register_thread(zone);
+
+        size_t resident = resident_size();
+        double start = seconds_now();
+        for (size_t i = 0; i < count; i++) blocks[i] = auto_zone_allocate_object(zone, size, AUTO_MEMORY_UNSCANNED, true, false);
+        double elapsed = seconds_now() - start;
+        for (size_t i = 0; i < count; i++) memset(blocks[i], 0xa5, size);
+        size_t rounded = auto_zone_size(zone, blocks[0]);
+        double metadata = ((double)resident_size() - resident - (double)count * rounded) / count;
+
+        double churned = churn(zone, size, count);
+        printf("%8zu %8zu %14.0f %14.0f %10.2f\n", size, rounded, count / elapsed, count / churned, metadata);
+
+        for (size_t i = 0; i < count; i++) auto_zone_release(zone, blocks[i]);
+        auto_zone_unregister_thread(zone);
+    }
+    return 0;
+}
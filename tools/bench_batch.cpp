@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_batch.cpp
+    auto_zone_batch_allocate against as many auto_zone_allocate_object calls
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_batch
+
+    usage: bench_batch [blocks]
+
+    Allocates blocks blocks (4M by default) in batches of 8, 64 and 1024, once through one
+    auto_zone_batch_allocate call per batch and once through a loop of auto_zone_allocate_object,
+    for a few block sizes.  Blocks are cleared and retained, as CoreFoundation's are, so both paths
+    hand out global blocks; every chunk of them is freed again between timings.  Reports
+    nanoseconds per block either way and the speedup.
+ */
+
+#include "bench.h"
+#include "../auto_zone.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace Bench;
+
+enum {
+    default_blocks = 4 * 1024 * 1024,
+    chunk_blocks = 64 * 1024,                               // allocated between frees
+};
+
+static const unsigned batch_counts[] = { 8, 64, 1024 };
+static const size_t sizes[] = { 16, 64, 256 };
+
+static void free_all(auto_zone_t *zone, void **blocks, size_t count) {
+    for (size_t i = 0; i < count; i++) zone->free(zone, blocks[i]);
+}
+
+// seconds to allocate count blocks n at a time, batched or singly.
+static double allocate(auto_zone_t *zone, size_t size, unsigned n, bool batched, size_t count, void **blocks) {
+    double elapsed = 0;
+    for (size_t done = 0; done < count; ) {
+        size_t chunk = count - done < chunk_blocks ? count - done : chunk_blocks;
+        chunk -= chunk % n;
+        double start = seconds_now();
+        for (size_t i = 0; i < chunk; i += n) {
+            if (!batched) {
+                for (unsigned j = 0; j < n; j++) blocks[i + j] = auto_zone_allocate_object(zone, size, AUTO_MEMORY_SCANNED, true, true);
+            } else if (auto_zone_batch_allocate(zone, size, AUTO_MEMORY_SCANNED, true, true, blocks + i, n) != n) {
+                fprintf(stderr, "bench_batch: batch allocation failed\n");
+                exit(1);
+            }
+        }
+        elapsed += seconds_now() - start;
+        free_all(zone, blocks, chunk);
+        done += chunk;
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    size_t blocks = argc > 1 ? strtoull(argv[1], NULL, 0) : default_blocks;
+    if (argc > 2 || !blocks) {
+        fprintf(stderr, "usage: bench_batch [blocks]\n");
+        return 2;
+    }
+    auto_zone_t *zone = auto_zone_create("bench_batch");
+    auto_zone_register_thread(zone);
+    std::vector<void *> chunk(chunk_blocks);
+
+    printf("%6s %6s %14s %14s %8s\n", "n", "size", "single ns", "batch ns", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t c = 0; c < sizeof(batch_counts) / sizeof(batch_counts[0]); c++) {
+            unsigned n = batch_counts[c];
+            size_t count = blocks - blocks % n;
+            // once untimed, so that neither side pays for growing the heap.
+            allocate(zone, sizes[s], n, true, chunk_blocks, chunk.data());
+            double single = allocate(zone, sizes[s], n, false, count, chunk.data());
+            double batched = allocate(zone, sizes[s], n, true, count, chunk.data());
+            printf("%6u %6zu %14.1f %14.1f %8.2f\n", n, sizes[s], single * 1e9 / count, batched * 1e9 / count, single / batched);
+        }
+    }
+    return 0;
+}
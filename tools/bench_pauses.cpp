@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_pauses.cpp
+    Stop-the-world pause lengths under a steady allocation load, with and without concurrent marking
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_pauses
+
+    usage: bench_pauses [seconds [live nodes [mutators]]]
+
+    Keeps live nodes (256K by default) reachable from a root, and runs mutator threads (2 by
+    default) that allocate nodes and store them into random live ones, dropping the nodes stored
+    there before.  Meanwhile full collections are requested back to back.  Runs for seconds (5 by
+    default) with concurrent marking, then as long with it disabled, and reports the collections'
+    pauses, from the collector's event trace, and the mutators' allocation rate.
+ */
+
+#include "bench.h"
+#include "../auto_zone.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace Bench;
+
+enum {
+    default_seconds = 5,
+    default_live_nodes = 256 * 1024,
+    default_mutators = 2,
+    maximum_mutators = 64,
+    node_slots = 2,
+    drain_interval = 100 * 1000,                            // microseconds between trace drains
+};
+
+struct Node {
+    void    *slots[node_slots];
+};
+
+struct Load {
+    auto_zone_t     *zone;
+    Node            **live;                                 // a scanned block, the root's referent
+    size_t          live_count;
+    bool            stopping;
+    uint64_t        allocations;
+};
+
+static void *root;
+
+
+static void *mutate(void *arg) {
+    Load *load = (Load *)arg;
+    auto_zone_register_thread(load->zone);
+    Random random((uint64_t)(uintptr_t)&random);
+    uint64_t allocations = 0;
+    while (!__atomic_load_n(&load->stopping, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < 256; i++) {
+            uint64_t r = random.next();
+            Node *node = (Node *)auto_zone_allocate_object(load->zone, sizeof(Node), AUTO_MEMORY_SCANNED, false, true);
+            Node *into = load->live[r % load->live_count];
+            auto_zone_set_write_barrier(load->zone, &into->slots[(r >> 32) % node_slots], node);
+        }
+        allocations += 256;
+    }
+    __atomic_add_fetch(&load->allocations, allocations, __ATOMIC_RELAXED);
+    auto_zone_unregister_thread(load->zone);
+    return NULL;
+}
+
+
+//
+// PauseCollector
+//
+// Collects the lengths of the collector's pauses from its event trace, drained to a temporary file
+// now and then.  A pause may begin in one drain and end in the next.
+//
+class PauseCollector {
+    FILE                                    *_file;
+    std::unordered_map<unsigned, double>    _begun;         // begin times by thread
+    std::vector<double>                     _pauses;        // microseconds
+
+  public:
+    PauseCollector() : _file(tmpfile()) {}
+
+    ~PauseCollector() { if (_file) fclose(_file); }
+
+    bool enabled() const { return _file != NULL; }
+
+    void drain() {
+        rewind(_file);
+        if (ftruncate(fileno(_file), 0) || !auto_trace_write(fileno(_file))) return;
+        rewind(_file);
+        char line[1024];
+        while (fgets(line, sizeof(line), _file)) {
+            if (!strstr(line, "\"name\":\"pause\"")) continue;
+            const char *phase = strstr(line, "\"ph\":\""), *ts = strstr(line, "\"ts\":"), *tid = strstr(line, "\"tid\":");
+            if (!phase || !ts || !tid) continue;
+            double time = strtod(ts + 5, NULL);
+            unsigned thread = (unsigned)strtoul(tid + 6, NULL, 10);
+            if (phase[6] == 'B') {
+                _begun[thread] = time;
+            } else if (phase[6] == 'E' && _begun.count(thread)) {
+                _pauses.push_back(time - _begun[thread]);
+                _begun.erase(thread);
+            }
+        }
+    }
+
+    std::vector<double> take_pauses() {
+        std::vector<double> pauses;
+        pauses.swap(_pauses);
+        _begun.clear();
+        return pauses;
+    }
+};
+
+
+static void run(Load &load, unsigned mutators, double seconds, bool concurrent, PauseCollector &pauses) {
+    auto_collection_parameters(load.zone)->disable_concurrent_marking = !concurrent;
+    // what the previous run left traced is not this one's.
+    auto_collect(load.zone, AUTO_COLLECT_FULL_COLLECTION | AUTO_COLLECT_SYNCHRONOUS, NULL);
+    pauses.drain();
+    pauses.take_pauses();
+
+    load.stopping = false;
+    load.allocations = 0;
+    pthread_t threads[maximum_mutators];
+    for (unsigned i = 0; i < mutators; i++) pthread_create(&threads[i], NULL, mutate, &load);
+    double start = seconds_now(), end = start + seconds, drained = start;
+    while (seconds_now() < end) {
+        // a request while one runs starts the next as soon as it is done.
+        auto_collect(load.zone, AUTO_COLLECT_FULL_COLLECTION, NULL);
+        usleep(1000);
+        if (seconds_now() - drained >= drain_interval / 1e6) {
+            pauses.drain();
+            drained = seconds_now();
+        }
+    }
+    __atomic_store_n(&load.stopping, true, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < mutators; i++) pthread_join(threads[i], NULL);
+    double elapsed = seconds_now() - start;
+    pauses.drain();
+
+    std::vector<double> sorted = pauses.take_pauses();
+    std::sort(sorted.begin(), sorted.end());
+    printf("%-12s %8zu %10.1f %10.1f %10.1f %14.0f\n", concurrent ? "concurrent" : "stopped", sorted.size(),
+           percentile(sorted, 0.50), percentile(sorted, 0.99), sorted.empty() ? 0 : sorted.back(), load.allocations / elapsed);
+}
+
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? strtod(argv[1], NULL) : default_seconds;
+    size_t live_count = argc > 2 ? strtoull(argv[2], NULL, 0) : default_live_nodes;
+    unsigned mutators = argc > 3 ? (unsigned)strtoul(argv[3], NULL, 0) : default_mutators;
+    if (argc > 4 || seconds <= 0 || !live_count || !mutators || mutators > maximum_mutators) {
+        fprintf(stderr, "usage: bench_pauses [seconds [live nodes [mutators]]]\n");
+        return 2;
+    }
+    PauseCollector pauses;
+    if (!pauses.enabled()) {
+        perror("bench_pauses: tmpfile");
+        return 1;
+    }
+
+    Load load;
+    memset(&load, 0, sizeof(load));
+    load.zone = auto_zone_create("bench_pauses");
+    auto_zone_register_thread(load.zone);
+    load.live = (Node **)auto_zone_allocate_object(load.zone, live_count * sizeof(Node *), AUTO_MEMORY_SCANNED, false, true);
+    load.live_count = live_count;
+    auto_zone_add_root(load.zone, &root, load.live);
+    for (size_t i = 0; i < live_count; i++) {
+        Node *node = (Node *)auto_zone_allocate_object(load.zone, sizeof(Node), AUTO_MEMORY_SCANNED, false, true);
+        auto_zone_set_write_barrier(load.zone, &load.live[i], node);
+    }
+    auto_trace_set_enabled(true);
+
+    printf("%-12s %8s %10s %10s %10s %14s\n", "marking", "pauses", "p50 us", "p99 us", "max us", "allocs/s");
+    run(load, mutators, seconds, true, pauses);
+    run(load, mutators, seconds, false, pauses);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_probe.cpp
+    Address to block lookups per second, through the page map and through the lookup it replaced
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_probe
+
+    usage: bench_probe [probes]
+
+    Fills a zone with 512K small blocks of random sizes and 256 large ones, then resolves probes
+    addresses (4M by default) of three kinds to the blocks containing them:
+
+        random          anywhere between the lowest and highest block
+        interior        inside a live block, at a random offset
+        non-heap        in the benchmark's own stack, globals and malloc memory
+
+    once through auto_zone_base_pointer, which uses the page map, and once through the lookup it
+    replaced: a walk of the region list for subzones, then a probe of a hash of large block starts
+    for every page back to the largest large block, under a spin lock.  The old lookup is rebuilt
+    here from the library's inline accessors, as Zone::subzone_for and Zone::large_containing were.
+    Both must agree on every probe.
+ */
+
+#include "bench.h"
+#include "../AutoZone.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace Auto;
+using namespace Bench;
+
+enum {
+    small_blocks = 512 * 1024,
+    large_blocks = 256,
+    default_probes = 4 * 1024 * 1024,
+};
+
+static char globals[64 * 1024];
+
+//
+// OldLookup
+//
+// The lookup before the page map.  Large blocks were kept in a hash map from start address to
+// descriptor; an interior pointer was found by probing the map at every page start from its own
+// back to the size of the largest large block.
+//
+class OldLookup {
+    Zone                                        *_zone;
+    std::unordered_map<const void *, Large *>   _large_map;
+    usword_t                                    _large_max_size;
+    spin_lock_t                                 _large_lock;
+
+    Subzone *subzone_for(const void *address) const {
+        for (Region *region = _zone->region_list(); region; region = region->next()) {
+            if (region->in_range(address)) return region->is_in_subzone(address) ? Subzone::subzone(address) : NULL;
+        }
+        return NULL;
+    }
+
+    Large *large_containing(const void *address) {
+        SpinLock lock(&_large_lock);
+        usword_t page = align_down((usword_t)address, page_size);
+        for (usword_t offset = 0; offset < _large_max_size && offset <= page; offset += page_size) {
+            std::unordered_map<const void *, Large *>::const_iterator i = _large_map.find((void *)(page - offset));
+            if (i != _large_map.end()) return i->second->in_block(address) ? i->second : NULL;
+        }
+        return NULL;
+    }
+
+  public:
+    OldLookup(auto_zone_t *zone) : _zone(Zone::zone(zone)), _large_max_size(0) {
+        _large_lock.value = 0;
+        for (Large *large = _zone->large_list(); large; large = large->next()) {
+            _large_map[large->address()] = large;
+            if (large->size() > _large_max_size) _large_max_size = large->size();
+        }
+    }
+
+    const void *block_start(const void *address) {
+        Subzone *subzone = subzone_for(address);
+        if (subzone) {
+            if (!subzone->is_initialized() || !subzone->in_blocks(address)) return NULL;
+            usword_t index = subzone->block_index(address);
+            return subzone->is_allocated(index) ? subzone->block_address(index) : NULL;
+        }
+        Large *large = large_containing(address);
+        return large ? large->address() : NULL;
+    }
+};
+
+
+// probes per second and how many found a block.
+template <class Lookup> static double probe(Lookup lookup, const std::vector<const void *> &addresses, size_t &found) {
+    found = 0;
+    double start = seconds_now();
+    for (size_t i = 0; i < addresses.size(); i++) found += lookup(addresses[i]) != NULL;
+    return addresses.size() / (seconds_now() - start);
+}
+
+static auto_zone_t *probed_zone;
+static OldLookup *old_lookup;
+
+static const void *new_block_start(const void *address) { return auto_zone_base_pointer(probed_zone, address); }
+static const void *old_block_start(const void *address) { return old_lookup->block_start(address); }
+
+int main(int argc, char **argv) {
+    size_t probes = argc > 1 ? strtoull(argv[1], NULL, 0) : default_probes;
+    if (argc > 2 || !probes) {
+        fprintf(stderr, "usage: bench_probe [probes]\n");
+        return 2;
+    }
+    probed_zone = auto_zone_create("bench_probe");
+    auto_zone_register_thread(probed_zone);
+    Random random;
+
+    // retained, so every block stays for the whole run.
+    std::vector<void *> blocks;
+    uintptr_t lowest = UINTPTR_MAX, highest = 0;
+    for (size_t i = 0; i < small_blocks + large_blocks; i++) {
+        size_t size = i < small_blocks ? 16 + random.next() % 2048 : 64 * 1024 + random.next() % (1024 * 1024);
+        void *block = auto_zone_allocate_object(probed_zone, size, AUTO_MEMORY_UNSCANNED, true, false);
+        blocks.push_back(block);
+        if ((uintptr_t)block < lowest) lowest = (uintptr_t)block;
+        if ((uintptr_t)block + size > highest) highest = (uintptr_t)block + size;
+    }
+    std::vector<char> heap_memory(1024 * 1024);
+    OldLookup old(probed_zone);
+    old_lookup = &old;
+
+    const char *kinds[] = { "random", "interior", "non-heap" };
+    printf("%-10s %14s %14s %8s %10s\n", "addresses", "page map/s", "old/s", "speedup", "found");
+    for (int kind = 0; kind < 3; kind++) {
+        std::vector<const void *> addresses(probes);
+        for (size_t i = 0; i < probes; i++) {
+            uint64_t r = random.next();
+            if (kind == 0) {
+                addresses[i] = (const void *)(lowest + r % (highest - lowest));
+            } else if (kind == 1) {
+                void *block = blocks[r % blocks.size()];
+                addresses[i] = (const char *)block + (r >> 32) % auto_zone_size(probed_zone, block);
+            } else {
+                const char *places[] = { (const char *)&r, globals, heap_memory.data() };
+                size_t extents[] = { sizeof(r), sizeof(globals), heap_memory.size() };
+                int place = (int)(r % 3);
+                addresses[i] = places[place] + (r >> 32) % extents[place];
+            }
+        }
+        size_t found_new, found_old;
+        double new_rate = probe(new_block_start, addresses, found_new);
+        double old_rate = probe(old_block_start, addresses, found_old);
+        if (found_new != found_old) {
+            fprintf(stderr, "bench_probe: the lookups disagree on %s addresses, %zu against %zu\n", kinds[kind], found_new, found_old);
+            return 1;
+        }
+        printf("%-10s %14.0f %14.0f %8.2f %10zu\n", kinds[kind], new_rate, old_rate, new_rate / old_rate, found_new);
+    }
+    return 0;
+}
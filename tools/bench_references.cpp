@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_references.cpp
+    Reference queries through the reverse reference index against full heap scans
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_references
+
+    usage: bench_references [nodes [queries]]
+
+    Links nodes blocks (300K by default) into a list held by one root, collects, then asks
+    auto_enumerate_references for the referrers of queries random nodes (10K by default); the first
+    query builds the index.  Then finds the same number of referrers the way a caller without the
+    index would, with a full auto_zone_visit scan of the heap for each.  Reports the build, each
+    query and each scan, and the totals of index build plus queries against the scans.
+ */
+
+#include "bench.h"
+#include "../auto_zone.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Bench;
+
+enum {
+    default_nodes = 300 * 1000,
+    default_queries = 10 * 1000,
+    node_size = 32,
+};
+
+struct Query {
+    vm_address_t    expected;                               // the node that links to the referent
+    bool            found;
+};
+
+static auto_zone_t *zone;
+static void *root;
+static void ***nodes;                                       // unscanned, so no node is reachable from here
+static void *scan_target;
+static size_t scan_hits;
+
+static void record(auto_zone_t *, void *context, auto_reference_t reference) {
+    Query *query = (Query *)context;
+    if (reference.referrer_base == query->expected && reference.referrer_offset == sizeof(void *)) query->found = true;
+}
+
+static void scan_nodes(const auto_node_info_t *infos, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (infos[i].type & AUTO_UNSCANNED) continue;
+        void **words = (void **)infos[i].address;
+        for (size_t w = 0; w < infos[i].size / sizeof(void *); w++) scan_hits += words[w] == scan_target;
+    }
+}
+
+// each node's second word links to the one before it; only the root refers to the last.
+__attribute__((noinline)) static void build_list(size_t count) {
+    void **list = NULL;
+    for (size_t i = 0; i < count; i++) {
+        void **node = (void **)auto_zone_allocate_object(zone, node_size, AUTO_MEMORY_SCANNED, false, true);
+        node[1] = list;
+        list = node;
+        nodes[i] = node;
+    }
+    auto_zone_add_root(zone, &root, list);
+}
+
+__attribute__((noinline)) static void scrub() { char buffer[16384]; memset(buffer, 0, sizeof(buffer)); __asm__ volatile("" : : "r"(buffer) : "memory"); }
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], NULL, 0) : default_nodes;
+    size_t queries = argc > 2 ? strtoull(argv[2], NULL, 0) : default_queries;
+    if (argc > 3 || count < 2 || !queries) {
+        fprintf(stderr, "usage: bench_references [nodes [queries]]\n");
+        return 2;
+    }
+    zone = auto_zone_create("bench_references");
+    auto_zone_register_thread(zone);
+    nodes = (void ***)calloc(count, sizeof(void **));
+    auto_collector_disable(zone);
+    build_list(count);
+    scrub();
+    auto_collector_reenable(zone);
+    auto_collect(zone, AUTO_COLLECT_FULL_COLLECTION | AUTO_COLLECT_SYNCHRONOUS, NULL);
+
+    char stack_bottom;
+    Random random;
+    size_t missed = 0;
+    double build = 0, start = seconds_now();
+    for (size_t q = 0; q < queries; q++) {
+        size_t i = random.next() % (count - 1);
+        Query query = { (vm_address_t)nodes[i + 1], false };
+        auto_enumerate_references(zone, nodes[i], record, &stack_bottom, &query);
+        missed += !query.found;
+        if (q == 0) build = seconds_now() - start;
+    }
+    double indexed = seconds_now() - start;
+
+    auto_zone_visitor_t visitor = { sizeof(auto_zone_visitor_t) };
+    visitor.visit_nodes = ^(const auto_node_info_t *infos, size_t info_count) { scan_nodes(infos, info_count); };
+    start = seconds_now();
+    for (size_t q = 0; q < queries; q++) {
+        scan_target = nodes[random.next() % (count - 1)];
+        scan_hits = 0;
+        auto_zone_visit(zone, &visitor);
+        missed += scan_hits != 1;
+    }
+    double scanned = seconds_now() - start;
+
+    printf("%zu nodes, %zu queries\n", count, queries);
+    printf("index build      %10.2f ms\n", build * 1e3);
+    printf("indexed query    %10.2f us\n", (indexed - build) / (queries > 1 ? queries - 1 : 1) * 1e6);
+    printf("full scan        %10.2f ms\n", scanned / queries * 1e3);
+    printf("build + queries  %10.2f ms\n", indexed * 1e3);
+    printf("full scans       %10.2f ms   %.0fx\n", scanned * 1e3, scanned / indexed);
+    if (missed) {
+        fprintf(stderr, "bench_references: %zu referrers missed\n", missed);
+        return 1;
+    }
+    return 0;
+}
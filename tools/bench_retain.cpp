@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_retain.cpp
+    Retain and release throughput under contention, at 1 to 16 threads
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_retain
+
+    usage: bench_retain [pairs per thread]
+
+    Each thread retains and releases blocks pairs times (1M by default).  Reports the total pairs
+    per second at 1, 2, 4, 8 and 16 threads, on:
+
+        shared          one block for all threads, its count in the side byte
+        overflowed      one block for all threads, retained past the side byte into the retain
+                        table and its shard's spin lock
+        private         a block per thread, neighbours in one subzone, so side bytes share lines
+
+    Scaling past the machine's cores measures oversubscription, not the counts.
+ */
+
+#include "bench.h"
+#include "../auto_zone.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Bench;
+
+enum {
+    maximum_threads = 16,
+    default_pairs = 1000 * 1000,
+    overflowed_count = 1000,                                // past the side byte's 254
+};
+
+struct Run {
+    auto_zone_t     *zone;
+    void            *blocks[maximum_threads];               // the block each thread retains
+    size_t          pairs;
+    unsigned        waiting;                                // threads not yet at the start line
+    unsigned        next;                                   // index of the next thread's block
+    bool            started;
+};
+
+static void *retain_release(void *arg) {
+    Run *run = (Run *)arg;
+    auto_zone_register_thread(run->zone);
+    void *block = run->blocks[__atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)];
+    __atomic_sub_fetch(&run->waiting, 1, __ATOMIC_ACQ_REL);
+    while (!__atomic_load_n(&run->started, __ATOMIC_ACQUIRE)) {}
+    for (size_t i = 0; i < run->pairs; i++) {
+        auto_zone_retain(run->zone, block);
+        auto_zone_release(run->zone, block);
+    }
+    auto_zone_unregister_thread(run->zone);
+    return NULL;
+}
+
+static double measure(Run &run, unsigned count) {
+    pthread_t threads[maximum_threads];
+    run.waiting = count;
+    run.next = 0;
+    run.started = false;
+    for (unsigned i = 0; i < count; i++) pthread_create(&threads[i], NULL, retain_release, &run);
+    while (__atomic_load_n(&run.waiting, __ATOMIC_ACQUIRE)) {}
+    double start = seconds_now();
+    __atomic_store_n(&run.started, true, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < count; i++) pthread_join(threads[i], NULL);
+    return count * run.pairs / (seconds_now() - start);
+}
+
+int main(int argc, char **argv) {
+    Run run;
+    run.pairs = argc > 1 ? strtoull(argv[1], NULL, 0) : default_pairs;
+    if (argc > 2 || !run.pairs) {
+        fprintf(stderr, "usage: bench_retain [pairs per thread]\n");
+        return 2;
+    }
+    run.zone = auto_zone_create("bench_retain");
+    auto_zone_register_thread(run.zone);
+
+    void *shared = auto_zone_allocate_object(run.zone, 32, AUTO_MEMORY_UNSCANNED, true, false);
+    void *overflowed = auto_zone_allocate_object(run.zone, 32, AUTO_MEMORY_UNSCANNED, true, false);
+    for (unsigned i = 1; i < overflowed_count; i++) auto_zone_retain(run.zone, overflowed);
+    void *privates[maximum_threads];
+    for (unsigned i = 0; i < maximum_threads; i++) privates[i] = auto_zone_allocate_object(run.zone, 32, AUTO_MEMORY_UNSCANNED, true, false);
+
+    printf("%8s %14s %14s %14s\n", "threads", "shared/s", "overflowed/s", "private/s");
+    for (unsigned count = 1; count <= maximum_threads; count *= 2) {
+        double rates[3];
+        for (unsigned i = 0; i < maximum_threads; i++) run.blocks[i] = shared;
+        rates[0] = measure(run, count);
+        for (unsigned i = 0; i < maximum_threads; i++) run.blocks[i] = overflowed;
+        rates[1] = measure(run, count);
+        for (unsigned i = 0; i < maximum_threads; i++) run.blocks[i] = privates[i];
+        rates[2] = measure(run, count);
+        printf("%8u %14.0f %14.0f %14.0f\n", count, rates[0], rates[1], rates[2]);
+    }
+
+    if (auto_zone_retain_count(run.zone, shared) != 1 || auto_zone_retain_count(run.zone, overflowed) != overflowed_count) {
+        fprintf(stderr, "bench_retain: counts drifted\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_scan.cpp
+    Scanning kernel throughput on random and pointer-dense memory
+
+    Builds with the scanning kernel compiled in, since its filters are internal to the library:
+
+        make -C tools bench_scan
+
+    usage: bench_scan [bytes]
+
+    Fills bytes of memory (64MB by default) three ways and runs each candidate filter this
+    processor has over it, scan_batch_words at a time as the collector does:
+
+        random          random words, which almost never land in the heap's range
+        dense           every word in the heap's range, as in an array of pointers
+        mixed           half of the words in range at random, which defeats branch prediction
+
+    and reports GB/s scanned and the fraction of words kept for lookup.  A heap of 1GB somewhere
+    in the address space stands in for the zone's range.
+ */
+
+#include "bench.h"
+#include "../AutoScan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace Bench;
+using namespace Auto;
+
+enum {
+    default_bytes = 64 * 1024 * 1024,
+    heap_span = 1024 * 1024 * 1024,
+    heap_min = 0x10000000,
+};
+
+static const double minimum_seconds = 0.25;
+
+static const char *filter_names[candidate_filter_count] = { "words", "sse2", "avx2" };
+
+static void fill(std::vector<void *> &words, int in_range_percent, Random &random) {
+    for (size_t i = 0; i < words.size(); i++) {
+        uint64_t r = random.next();
+        if ((int)(r % 100) < in_range_percent)
+            words[i] = (void *)(heap_min + (uintptr_t)(random.next() % heap_span & ~(uint64_t)15));
+        else
+            words[i] = (void *)(uintptr_t)random.next();
+    }
+}
+
+// passes over the memory until minimum_seconds have passed; returns bytes per second.
+static double measure(candidate_filter_t filter, std::vector<void *> &words, uintptr_t &kept) {
+    void **survivors[scan_batch_words];
+    uintptr_t count = words.size(), passes = 0;
+    double start = seconds_now(), elapsed;
+    kept = 0;
+    do {
+        for (uintptr_t i = 0; i < count; i += scan_batch_words) {
+            uintptr_t batch = count - i < (uintptr_t)scan_batch_words ? count - i : (uintptr_t)scan_batch_words;
+            kept += filter(&words[i], batch, heap_min, heap_span, survivors);
+        }
+        passes++;
+    } while ((elapsed = seconds_now() - start) < minimum_seconds);
+    kept /= passes;
+    return (double)passes * count * sizeof(void *) / elapsed;
+}
+
+int main(int argc, char **argv) {
+    size_t bytes = argc > 1 ? strtoull(argv[1], NULL, 0) : default_bytes;
+    if (argc > 2 || bytes < sizeof(void *)) {
+        fprintf(stderr, "usage: bench_scan [bytes]\n");
+        return 2;
+    }
+
+    static const struct { const char *name; int in_range_percent; } kinds[] = {
+        { "random", 0 }, { "dense", 100 }, { "mixed", 50 },
+    };
+    std::vector<void *> words(bytes / sizeof(void *));
+    Random random;
+
+    printf("%8s %8s %10s %8s\n", "data", "filter", "GB/s", "kept");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        fill(words, kinds[k].in_range_percent, random);
+        for (uintptr_t kind = 0; kind < candidate_filter_count; kind++) {
+            candidate_filter_t filter = candidate_filter(kind);
+            if (!filter) continue;
+            uintptr_t kept;
+            double rate = measure(filter, words, kept);
+            printf("%8s %8s %10.2f %7.1f%%\n", kinds[k].name, filter_names[kind], rate / 1e9, 100.0 * kept / words.size());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    bench_threads.cpp
+    Allocation throughput at 1, 2, 4, 8 and 16 threads
+
+    Builds against the library, on any host it builds on:
+
+        make -C tools bench_threads
+
+    usage: bench_threads [size [allocations per thread]]
+
+    Each thread registers with one shared zone and allocates blocks of size bytes (32 by default),
+    dropping them at once, so that the thread's allocation cache and thread-local collections carry
+    the load.  Reports the total allocations per second at each thread count and its speedup over
+    one thread.  Scaling past the machine's cores measures oversubscription, not the allocator.
+ */
+
+#include "bench.h"
+#include "../auto_zone.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Bench;
+
+enum {
+    maximum_threads = 16,
+    default_size = 32,
+    default_allocations = 2 * 1000 * 1000,
+};
+
+struct Run {
+    auto_zone_t     *zone;
+    size_t          size;
+    size_t          allocations;
+    unsigned        waiting;                                // threads not yet at the start line
+    bool            started;
+};
+
+static void *allocate(void *arg) {
+    Run *run = (Run *)arg;
+    auto_zone_register_thread(run->zone);
+    __atomic_sub_fetch(&run->waiting, 1, __ATOMIC_ACQ_REL);
+    while (!__atomic_load_n(&run->started, __ATOMIC_ACQUIRE)) {}
+    for (size_t i = 0; i < run->allocations; i++) auto_zone_allocate_object(run->zone, run->size, AUTO_MEMORY_SCANNED, false, false);
+    auto_zone_unregister_thread(run->zone);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    Run run;
+    run.size = argc > 1 ? strtoull(argv[1], NULL, 0) : default_size;
+    run.allocations = argc > 2 ? strtoull(argv[2], NULL, 0) : default_allocations;
+    if (argc > 3 || !run.size || !run.allocations) {
+        fprintf(stderr, "usage: bench_threads [size [allocations per thread]]\n");
+        return 2;
+    }
+    run.zone = auto_zone_create("bench_threads");
+
+    printf("%8s %14s %8s\n", "threads", "allocs/s", "speedup");
+    double single = 0;
+    for (unsigned count = 1; count <= maximum_threads; count *= 2) {
+        pthread_t threads[maximum_threads];
+        run.waiting = count;
+        run.started = false;
+        for (unsigned i = 0; i < count; i++) pthread_create(&threads[i], NULL, allocate, &run);
+        while (__atomic_load_n(&run.waiting, __ATOMIC_ACQUIRE)) {}
+        double start = seconds_now();
+        __atomic_store_n(&run.started, true, __ATOMIC_RELEASE);
+        for (unsigned i = 0; i < count; i++) pthread_join(threads[i], NULL);
+        double rate = count * run.allocations / (seconds_now() - start);
+        if (count == 1) single = rate;
+        printf("%8u %14.0f %8.2f\n", count, rate, rate / single);
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    replay_allocator.h
+    What auto_replay needs of the allocator it replays a recording on
+ */
+
+#ifndef __AUTO_REPLAY_ALLOCATOR__
+#define __AUTO_REPLAY_ALLOCATOR__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Replay allocator
+//
+// auto_replay drives one of two implementations, chosen when it is linked:
+// replay_allocator_auto.cpp replays on libauto, and replay_allocator_malloc.cpp on malloc and free,
+// for hosts libauto does not build on.  The malloc one frees a block when the recording found it
+// garbage; it cannot collect, so retains, collection requests, weak references and roots are plain
+// stores or nothing, and it has no pauses to report.  Types and modes are the recorded auto_memory_type_t,
+// auto_collection_mode_t and auto_zone_options_t values.
+//
+namespace Replay {
+
+    const char *allocator_name();
+
+    //
+    // create_allocator
+    //
+    // Set up the allocator for the calling thread, tracing collector pauses if trace_pauses is true.
+    // Clears trace_pauses if the allocator cannot trace them.  Returns false if it could not be set up.
+    //
+    bool create_allocator(bool &trace_pauses);
+
+    void *allocate(uint64_t size, int32_t type, bool retained, bool cleared);
+    void free_block(void *block);
+    void retain(void *block);
+    void release(void *block);
+
+    //
+    // drop
+    //
+    // The recording found block garbage: give up the retain the replay held for it.
+    //
+    void drop(void *block);
+
+    void store(void **location, void *value);
+    void copy(void *destination, const void *source, size_t size);
+    void assign_weak(void **location, void *value);
+
+    void add_root(void **root, void *value);
+    void remove_root(void **root);
+    void store_root(void **root, void *value);
+
+    void collect(uint64_t mode);
+    void zone_collect(uint64_t options);
+
+    //
+    // write_trace
+    //
+    // Drain the collector events traced since the last call to fd, as Chrome trace event JSON.
+    // Returns false if nothing is traced.
+    //
+    bool write_trace(int fd);
+
+    //
+    // print_statistics
+    //
+    // Print what the allocator knows of the heap after the replay.
+    //
+    void print_statistics();
+
+};
+
+#endif // __AUTO_REPLAY_ALLOCATOR__
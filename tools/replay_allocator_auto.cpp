@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    replay_allocator_auto.cpp
+    auto_replay's allocator on libauto
+ */
+
+#include "replay_allocator.h"
+#include "../auto_zone.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace Replay {
+
+    static auto_zone_t *zone;
+
+
+    const char *allocator_name() {
+        return "libauto";
+    }
+
+
+    bool create_allocator(bool &trace_pauses) {
+        zone = auto_zone_create("auto_replay");
+        if (!zone) return false;
+        auto_zone_register_thread(zone);
+        if (trace_pauses) auto_trace_set_enabled(true);
+        return true;
+    }
+
+
+    void *allocate(uint64_t size, int32_t type, bool retained, bool cleared) {
+        return auto_zone_allocate_object(zone, size, (auto_memory_type_t)type, retained, cleared);
+    }
+
+
+    void free_block(void *block) {
+        zone->free(zone, block);
+    }
+
+
+    void retain(void *block) {
+        auto_zone_retain(zone, block);
+    }
+
+
+    void release(void *block) {
+        auto_zone_release(zone, block);
+    }
+
+
+    void drop(void *block) {
+        auto_zone_release(zone, block);
+    }
+
+
+    void store(void **location, void *value) {
+        auto_zone_set_write_barrier(zone, location, value);
+    }
+
+
+    void copy(void *destination, const void *source, size_t size) {
+        auto_zone_write_barrier_memmove(zone, destination, source, size);
+    }
+
+
+    void assign_weak(void **location, void *value) {
+        auto_assign_weak_reference(zone, value, (const void **)location, NULL);
+    }
+
+
+    void add_root(void **root, void *value) {
+        auto_zone_add_root(zone, root, value);
+    }
+
+
+    void remove_root(void **root) {
+        auto_zone_remove_root(zone, root);
+    }
+
+
+    void store_root(void **root, void *value) {
+        auto_zone_root_write_barrier(zone, root, value);
+    }
+
+
+    void collect(uint64_t mode) {
+        auto_collect(zone, (auto_collection_mode_t)mode, NULL);
+    }
+
+
+    void zone_collect(uint64_t options) {
+        auto_zone_collect(zone, (auto_zone_options_t)options);
+    }
+
+
+    bool write_trace(int fd) {
+        return auto_trace_write(fd);
+    }
+
+
+    void print_statistics() {
+        auto_statistics_t stats;
+        memset(&stats, 0, sizeof(stats));
+        stats.version = 1;
+        auto_zone_statistics(zone, &stats);
+        printf("  in use           %u blocks, %zu bytes\n", stats.malloc_statistics.blocks_in_use, stats.malloc_statistics.size_in_use);
+        printf("  allocated        %zu bytes\n", stats.malloc_statistics.size_allocated);
+        for (int kind = 0; kind < 2; kind++) {
+            printf("  %-16s %zu, total %" PRIu64 " us, scan %" PRIu64 " us, maximum %" PRIu64 " us\n", kind ? "generational" : "full",
+                   stats.num_collections[kind], stats.total[kind].total_duration, stats.total[kind].scan_duration, stats.maximum[kind].total_duration);
+        }
+        printf("  in use after     %zu bytes after the last full collection, %zu after the last generational\n",
+               stats.bytes_in_use_after_last_collection[0], stats.bytes_in_use_after_last_collection[1]);
+        printf("  thread local     %zu collections, %zu blocks, %zu bytes recovered\n",
+               stats.thread_collections_total, stats.thread_blocks_recovered_total, stats.thread_bytes_recovered_total);
+    }
+
+};
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2011 Apple Inc. All rights reserved.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_START@
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @APPLE_APACHE_LICENSE_HEADER_END@
+ */
+/*
+    replay_allocator_malloc.cpp
+    auto_replay's allocator on malloc, for hosts libauto does not build on
+ */
+
+#include "replay_allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Replay {
+
+    //
+    // Header
+    //
+    // Precedes every block, keeping its size.  Two words, so blocks stay as aligned as malloc's.
+    //
+    struct Header {
+        uint64_t    size;
+        uint64_t    unused;
+    };
+
+    static uint64_t blocks_in_use, bytes_in_use, bytes_allocated;
+
+    static inline Header *header(void *block) { return (Header *)block - 1; }
+
+
+    static void deallocate(void *block) {
+        Header *h = header(block);
+        blocks_in_use--;
+        bytes_in_use -= h->size;
+        free(h);
+    }
+
+
+    const char *allocator_name() {
+        return "malloc";
+    }
+
+
+    bool create_allocator(bool &trace_pauses) {
+        trace_pauses = false;
+        return true;
+    }
+
+
+    void *allocate(uint64_t size, int32_t type, bool retained, bool cleared) {
+        Header *h = (Header *)(cleared ? calloc(1, sizeof(Header) + size) : malloc(sizeof(Header) + size));
+        if (!h) return NULL;
+        h->size = size;
+        blocks_in_use++;
+        bytes_in_use += size;
+        bytes_allocated += size;
+        return h + 1;
+    }
+
+
+    void free_block(void *block) {
+        deallocate(block);
+    }
+
+
+    void retain(void *block) {
+    }
+
+
+    void release(void *block) {
+    }
+
+
+    void drop(void *block) {
+        deallocate(block);
+    }
+
+
+    void store(void **location, void *value) {
+        *location = value;
+    }
+
+
+    void copy(void *destination, const void *source, size_t size) {
+        memmove(destination, source, size);
+    }
+
+
+    void assign_weak(void **location, void *value) {
+        *location = value;
+    }
+
+
+    void add_root(void **root, void *value) {
+        *root = value;
+    }
+
+
+    void remove_root(void **root) {
+    }
+
+
+    void store_root(void **root, void *value) {
+        *root = value;
+    }
+
+
+    void collect(uint64_t mode) {
+    }
+
+
+    void zone_collect(uint64_t options) {
+    }
+
+
+    bool write_trace(int fd) {
+        return false;
+    }
+
+
+    void print_statistics() {
+        printf("  in use           %llu blocks, %llu bytes\n", (unsigned long long)blocks_in_use, (unsigned long long)bytes_in_use);
+        printf("  allocated        %llu bytes\n", (unsigned long long)bytes_allocated);
+    }
+
+};